@@ -11,10 +11,14 @@
 from .atom import AtomMeta, Atom, observe, set_default
 from .catom import (
     CAtom, Member, GetAttr, SetAttr, PostGetAttr, PostSetAttr,
-    DefaultValue, Validate, PostValidate, atomref, atomlist, atomclist
+    DefaultValue, Validate, PostValidate, atomref, atomlist, atomclist,
+    atomnumlist, atomnumclist, atomdict, atomcdict, atomsortedmap, atomcsortedmap
 )
 from .coerced import Coerced
+from .containerdict import ContainerDict
 from .containerlist import ContainerList
+from .containernumericlist import ContainerNumericList
+from .containersortedmap import ContainerSortedMap
 from .delegator import Delegator
 from .dict import Dict
 from .enum import Enum
@@ -22,12 +26,14 @@ from .event import Event
 from .instance import Instance, ForwardInstance
 from .intenum import IntEnum
 from .list import List
+from .numericlist import NumericList
 from .property import Property, cached_property
 from .scalars import (
     Value, ReadOnly, Constant, Callable, Bool, Int, Long, Range, Float, Bytes,
     Str, Unicode, FloatRange
 )
 from .signal import Signal
+from .sortedmap import SortedMap
 from .subclass import Subclass, ForwardSubclass
 from .tuple import Tuple
 from .typed import Typed, ForwardTyped
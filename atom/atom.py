@@ -5,11 +5,6 @@
 #
 # The full license is in the file COPYING.txt, distributed with this software.
 #------------------------------------------------------------------------------
-import sys
-if sys.version_info >= (3,):
-    import copyreg
-else:
-    import copy_reg as copyreg
 from contextlib import contextmanager
 
 from types import FunctionType
@@ -438,55 +433,3 @@ class Atom(with_metaclass(AtomMeta, CAtom)):
         old = self.set_notifications_enabled(False)
         yield
         self.set_notifications_enabled(old)
-
-    def __reduce_ex__(self, proto):
-        """ An implementation of the reduce protocol.
-
-        This method creates a reduction tuple for Atom instances. This
-        method should not be overridden by subclasses unless the author
-        fully understands the rammifications.
-
-        """
-        args = (type(self),) + self.__getnewargs__()
-        return (__newobj__, args, self.__getstate__())
-
-    def __getnewargs__(self):
-        """ Get the argument tuple to pass to __new__ on unpickling.
-
-        See the Python.org docs for more information.
-
-        """
-        return ()
-
-    def __getstate__(self):
-        """ The base implementation of the pickle getstate protocol.
-
-        This base class implementation handles the generic case where
-        the object and all of its state are pickable. This includes
-        state stored in Atom members, as well as any instance dict or
-        slot attributes. Subclasses which require further customization
-        should reimplement this method and modify the dict generated by
-        this base class method.
-
-        """
-        state = {}
-        state.update(getattr(self, '__dict__', {}))
-        slots = copyreg._slotnames(type(self))
-        if slots:
-            for name in slots:
-                state[name] = getattr(self, name)
-        for key in self.members():
-            state[key] = getattr(self, key)
-        return state
-
-    def __setstate__(self, state):
-        """ The base implementation of the pickle setstate protocol.
-
-        This base class implementation handle the generic case of
-        restoring an object using the state generated by the base
-        class __getstate__ method. Subclasses which require custom
-        behavior should reimplement this method.
-
-        """
-        for key, value in state.items():
-            setattr(self, key, value)
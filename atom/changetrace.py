@@ -0,0 +1,89 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Reader for the change traces produced by atom.catom.dump_trace.
+
+"""
+import struct
+from collections import namedtuple
+
+from .catom import dump_trace
+
+
+#: A recorded change. The atom is identified by its address and the member by
+#: its slot index. The hashes, which match the builtin hash on 64 bit
+#: platforms, are 0 unless tracing was enabled with hashes.
+TraceRecord = namedtuple(
+    'TraceRecord', 'timestamp atom member kind oldhash newhash'
+)
+
+
+#: The names of the kinds of change, indexed by their recorded value.
+KINDS = {1: 'create', 2: 'update', 3: 'delete', 4: 'event', 5: 'container'}
+
+
+MAGIC = b'ATOMTRC1'
+
+
+_HEADER = struct.Struct('<8sBQQ')
+
+
+_RECORD = struct.Struct('<QQIB')
+
+
+_HASHED_RECORD = struct.Struct('<QQIBqq')
+
+
+def load(data):
+    """ Parse a dumped trace.
+
+    Parameters
+    ----------
+    data : bytes
+        The trace as returned by dump_trace.
+
+    Returns
+    -------
+    result : tuple
+        The total number of changes recorded, which exceeds the number of
+        records when the oldest ones were overwritten, and the list of
+        TraceRecord, oldest first.
+
+    """
+    magic, flags, written, count = _HEADER.unpack_from(data)
+    if magic != MAGIC:
+        raise ValueError('not an atom change trace')
+    record = _HASHED_RECORD if flags & 1 else _RECORD
+    if len(data) != _HEADER.size + count * record.size:
+        raise ValueError('truncated atom change trace')
+    records = []
+    offset = _HEADER.size
+    for _ in range(count):
+        fields = record.unpack_from(data, offset)
+        offset += record.size
+        ts, atom, member, kind = fields[:4]
+        oldhash, newhash = fields[4:] or (0, 0)
+        records.append(
+            TraceRecord(ts, atom, member, KINDS[kind], oldhash, newhash)
+        )
+    return written, records
+
+
+def dump(path):
+    """ Write the current trace to a file.
+
+    """
+    with open(path, 'wb') as f:
+        f.write(dump_trace())
+
+
+def read(path):
+    """ Load a trace written by dump.
+
+    """
+    with open(path, 'rb') as f:
+        return load(f.read())
@@ -0,0 +1,23 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2013-2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+from .catom import Validate
+from .numericlist import NumericList
+
+
+class ContainerNumericList(NumericList):
+    """ A NumericList member which supports container notifications.
+
+    """
+    __slots__ = ()
+
+    def __init__(self, item, default=None):
+        """ Initialize a ContainerNumericList.
+
+        """
+        super(ContainerNumericList, self).__init__(item, default)
+        self.set_validate_mode(Validate.ContainerNumericList, self.item)
@@ -0,0 +1,23 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2013-2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+from .catom import Validate
+from .sortedmap import SortedMap
+
+
+class ContainerSortedMap(SortedMap):
+    """ A SortedMap member which supports container notifications.
+
+    """
+    __slots__ = ()
+
+    def __init__(self, key=None, value=None, default=None):
+        """ Initialize a ContainerSortedMap.
+
+        """
+        super(ContainerSortedMap, self).__init__(key, value, default)
+        self.set_validate_mode(Validate.ContainerSortedMap, self.validate_mode[1])
@@ -0,0 +1,38 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2013-2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+from .catom import Validate
+from .list import List
+
+
+class NumericList(List):
+    """ A List member which stores its items unboxed in native memory.
+
+    The items are stored in a contiguous array of doubles, 64 bit integers
+    or booleans, depending on the item member, and are boxed on access.
+    The list supports the buffer protocol so that its content can be read
+    without copies through memoryview or numpy.
+
+    """
+    __slots__ = ()
+
+    def __init__(self, item, default=None):
+        """ Initialize a NumericList.
+
+        Parameters
+        ----------
+        item : Member
+            A Float, Int, Range, FloatRange or Bool member used to validate
+            the items of the list.
+
+        default : list, optional
+            The default list of values. A new copy of this list will be
+            created for each atom instance.
+
+        """
+        super(NumericList, self).__init__(item, default)
+        self.set_validate_mode(Validate.NumericList, self.item)
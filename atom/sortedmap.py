@@ -0,0 +1,52 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2013-2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+from .catom import DefaultValue, Validate
+from .datastructures.api import sortedmap
+from .dict import Dict
+
+
+class SortedMap(Dict):
+    """ A value of type `sortedmap`.
+
+    The value is an atomsortedmap, a sortedmap whose keys and values are
+    validated by the key and value members when they are inserted.
+
+    """
+    __slots__ = ()
+
+    def __init__(self, key=None, value=None, default=None):
+        """ Initialize a SortedMap.
+
+        Parameters
+        ----------
+        key : Member, type, tuple of types, or None, optional
+            A member to use for validating the types of keys allowed in
+            the map. This can also be a type or a tuple of types, which
+            will be wrapped with an Instance member. If this is not
+            given, no key validation is performed.
+
+        value : Member, type, tuple of types, or None, optional
+            A member to use for validating the types of values allowed
+            in the map. This can also be a type or a tuple of types,
+            which will be wrapped with an Instance member. If this is
+            not given, no value validation is performed.
+
+        default : dict or sortedmap, optional
+            The default items of the map. A new map holding these items
+            will be created for each atom instance, ordered by the key
+            function of a sortedmap.
+
+        """
+        if isinstance(default, sortedmap):
+            super(SortedMap, self).__init__(key, value)
+            self.set_default_value_mode(DefaultValue.CallObject, default.copy)
+        else:
+            if default is not None:
+                default = dict(default)
+            super(SortedMap, self).__init__(key, value, default)
+        self.set_validate_mode(Validate.SortedMap, self.validate_mode[1])
@@ -0,0 +1,308 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <cstring>
+#include <vector>
+#include "allocpool.h"
+#include "py23compat.h"
+
+using namespace PythonHelpers;
+
+
+namespace AllocPool
+{
+
+// The slot arrays are pooled by exact slot count, the instances by size in
+// words. Larger blocks always go through the allocators.
+#define MAX_POOLED_SLOTS 64
+#define MAX_POOLED_WORDS 32
+
+
+struct Pool
+{
+    const char* name;
+    Py_ssize_t depth;
+    uint64_t reused;
+    uint64_t allocated;
+};
+
+
+enum PoolKind
+{
+    Slots,
+    Observers,
+    Instances,
+    PoolCount
+};
+
+
+static Pool pools[] = {
+    { "slots", 64, 0, 0 },
+    { "observers", 64, 0, 0 },
+    { "instances", 0, 0, 0 }
+};
+
+
+// A stack of free blocks of one size class, linked through their first word.
+struct FreeList
+{
+    void* head;
+    Py_ssize_t size;
+
+    void* pop()
+    {
+        void* block = head;
+        if( block )
+        {
+            head = *reinterpret_cast<void**>( block );
+            --size;
+        }
+        return block;
+    }
+
+    void push( void* block )
+    {
+        *reinterpret_cast<void**>( block ) = head;
+        head = block;
+        ++size;
+    }
+};
+
+
+static FreeList slot_lists[ MAX_POOLED_SLOTS + 1 ];
+
+
+static FreeList instance_lists[ MAX_POOLED_WORDS + 1 ];
+
+
+static std::vector<ObserverPool*> observer_list;
+
+
+PyObject**
+alloc_slots( uint32_t count )
+{
+    size_t size = sizeof( PyObject* ) * count;
+    void* slots = 0;
+    if( count <= MAX_POOLED_SLOTS )
+        slots = slot_lists[ count ].pop();
+    if( slots )
+        ++pools[ Slots ].reused;
+    else
+    {
+        slots = PyObject_MALLOC( size );
+        if( !slots )
+            return 0;
+        ++pools[ Slots ].allocated;
+    }
+    memset( slots, 0, size );
+    return reinterpret_cast<PyObject**>( slots );
+}
+
+
+void
+free_slots( PyObject** slots, uint32_t count )
+{
+    if( count <= MAX_POOLED_SLOTS && slot_lists[ count ].size < pools[ Slots ].depth )
+        slot_lists[ count ].push( slots );
+    else
+        PyObject_FREE( slots );
+}
+
+
+ObserverPool*
+alloc_observers()
+{
+    if( observer_list.empty() )
+    {
+        ++pools[ Observers ].allocated;
+        return new ObserverPool();
+    }
+    ++pools[ Observers ].reused;
+    ObserverPool* observers = observer_list.back();
+    observer_list.pop_back();
+    return observers;
+}
+
+
+void
+free_observers( ObserverPool* observers )
+{
+    if( static_cast<Py_ssize_t>( observer_list.size() ) < pools[ Observers ].depth )
+        observer_list.push_back( observers );
+    else
+        delete observers;
+}
+
+
+// The size class of the instances of a type, or 0 if they are not pooled.
+static size_t
+instance_words( PyTypeObject* type )
+{
+    if( type->tp_itemsize != 0 || type->tp_basicsize % sizeof( void* ) != 0 )
+        return 0;
+    size_t words = type->tp_basicsize / sizeof( void* );
+    return words <= MAX_POOLED_WORDS ? words : 0;
+}
+
+
+// Whether the instances of a type may be released to the pool. A finalized
+// instance carries a flag in its gc header, which would be inherited by
+// the next instance.
+static bool
+may_pool( PyTypeObject* type )
+{
+    if( type->tp_free != PyObject_GC_Del || type->tp_del )
+        return false;
+#if PY_VERSION_HEX >= 0x03040000
+    if( type->tp_finalize )
+        return false;
+#endif
+    return true;
+}
+
+
+PyObject*
+alloc_instance( PyTypeObject* type )
+{
+    if( type->tp_alloc == PyType_GenericAlloc )
+    {
+        size_t words = instance_words( type );
+        PyObject* object = reinterpret_cast<PyObject*>( words ? instance_lists[ words ].pop() : 0 );
+        if( object )
+        {
+            ++pools[ Instances ].reused;
+            memset( object, 0, type->tp_basicsize );
+            Py_TYPE( object ) = type;
+            if( type->tp_flags & Py_TPFLAGS_HEAPTYPE )
+                Py_INCREF( pyobject_cast( type ) );
+            _Py_NewReference( object );
+            PyObject_GC_Track( object );
+            return object;
+        }
+    }
+    ++pools[ Instances ].allocated;
+    return type->tp_alloc( type, 0 );
+}
+
+
+void
+free_instance( PyObject* object )
+{
+    PyTypeObject* type = Py_TYPE( object );
+    size_t words = instance_words( type );
+    if( words && instance_lists[ words ].size < pools[ Instances ].depth && may_pool( type ) )
+        instance_lists[ words ].push( object );
+    else
+        type->tp_free( object );
+}
+
+
+// Release the free blocks exceeding the depth of the pools.
+static void
+trim()
+{
+    for( size_t i = 0; i <= MAX_POOLED_SLOTS; ++i )
+    {
+        while( slot_lists[ i ].size > pools[ Slots ].depth )
+            PyObject_FREE( slot_lists[ i ].pop() );
+    }
+    while( static_cast<Py_ssize_t>( observer_list.size() ) > pools[ Observers ].depth )
+    {
+        delete observer_list.back();
+        observer_list.pop_back();
+    }
+    for( size_t i = 0; i <= MAX_POOLED_WORDS; ++i )
+    {
+        while( instance_lists[ i ].size > pools[ Instances ].depth )
+            PyObject_GC_Del( instance_lists[ i ].pop() );
+    }
+}
+
+
+static Py_ssize_t
+free_count( PoolKind kind )
+{
+    Py_ssize_t count = 0;
+    switch( kind )
+    {
+        case Slots:
+            for( size_t i = 0; i <= MAX_POOLED_SLOTS; ++i )
+                count += slot_lists[ i ].size;
+            break;
+        case Observers:
+            count = static_cast<Py_ssize_t>( observer_list.size() );
+            break;
+        default:
+            for( size_t i = 0; i <= MAX_POOLED_WORDS; ++i )
+                count += instance_lists[ i ].size;
+            break;
+    }
+    return count;
+}
+
+}  // namespace AllocPool
+
+
+PyObject*
+set_pool_depth( PyObject* mod, PyObject* args, PyObject* kwargs )
+{
+    using namespace AllocPool;
+    static char* kwlist[] = {
+        const_cast<char*>( "slots" ),
+        const_cast<char*>( "observers" ),
+        const_cast<char*>( "instances" ),
+        0
+    };
+    PyObject* depths[ PoolCount ] = { Py_None, Py_None, Py_None };
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|OOO:set_pool_depth", kwlist,
+            &depths[ Slots ], &depths[ Observers ], &depths[ Instances ] ) )
+        return 0;
+    Py_ssize_t values[ PoolCount ];
+    for( size_t i = 0; i < PoolCount; ++i )
+    {
+        values[ i ] = pools[ i ].depth;
+        if( depths[ i ] == Py_None )
+            continue;
+        if( !Py23Int_Check( depths[ i ] ) )
+            return py_expected_type_fail( depths[ i ], "int or None" );
+        values[ i ] = PyNumber_AsSsize_t( depths[ i ], PyExc_OverflowError );
+        if( values[ i ] == -1 && PyErr_Occurred() )
+            return 0;
+        if( values[ i ] < 0 )
+            return py_value_fail( "pool depth must be non-negative" );
+    }
+    for( size_t i = 0; i < PoolCount; ++i )
+        pools[ i ].depth = values[ i ];
+    trim();
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+pool_stats( PyObject* mod )
+{
+    using namespace AllocPool;
+    PyDictPtr result( PyDict_New() );
+    if( !result )
+        return 0;
+    for( size_t i = 0; i < PoolCount; ++i )
+    {
+        const Pool& pool = pools[ i ];
+        PyObjectPtr summary( Py_BuildValue(
+            "{s:n,s:n,s:K,s:K}",
+            "depth", pool.depth,
+            "free", free_count( static_cast<PoolKind>( i ) ),
+            "reused", static_cast<unsigned PY_LONG_LONG>( pool.reused ),
+            "allocated", static_cast<unsigned PY_LONG_LONG>( pool.allocated ) ) );
+        if( !summary )
+            return 0;
+        if( PyDict_SetItemString( result.get(), pool.name, summary.get() ) != 0 )
+            return 0;
+    }
+    return result.release();
+}
@@ -0,0 +1,55 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "inttypes.h"
+#include "observerpool.h"
+
+
+// Free lists recycling the memory released by the atoms: the slot arrays
+// and the instances are kept per size class, so that atoms created and
+// destroyed at a high rate bypass the allocators. The depth of a pool is
+// the number of free blocks kept per size class. The instance pool is
+// disabled by default.
+namespace AllocPool
+{
+
+// Allocate an array of null slots.
+PyObject**
+alloc_slots( uint32_t count );
+
+
+void
+free_slots( PyObject** slots, uint32_t count );
+
+
+ObserverPool*
+alloc_observers();
+
+
+// Release an observer pool which was cleared.
+void
+free_observers( ObserverPool* observers );
+
+
+// Allocate a tracked instance of a CAtom subtype, as tp_alloc would.
+PyObject*
+alloc_instance( PyTypeObject* type );
+
+
+// Release an untracked instance, as tp_free would.
+void
+free_instance( PyObject* object );
+
+}  // namespace AllocPool
+
+
+PyObject* set_pool_depth( PyObject* mod, PyObject* args, PyObject* kwargs );
+
+
+PyObject* pool_stats( PyObject* mod );
@@ -0,0 +1,174 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include "atomcopy.h"
+#include "atomdict.h"
+#include "atomlist.h"
+#include "atomnumlist.h"
+#include "atomsortedmap.h"
+#include "py23compat.h"
+
+using namespace PythonHelpers;
+
+
+namespace AtomCopy
+{
+
+static PyObject* deepcopy_func;
+
+
+// Whether copy.deepcopy returns the object itself.
+static bool
+is_atomic( PyObject* value )
+{
+    if( value == Py_None || PyBool_Check( value ) || PyFloat_CheckExact( value ) ||
+        PyLong_CheckExact( value ) || PyUnicode_CheckExact( value ) ||
+        PyBytes_CheckExact( value ) || PyComplex_CheckExact( value ) || PyType_Check( value ) )
+        return true;
+#if PY_MAJOR_VERSION < 3
+    if( PyInt_CheckExact( value ) )
+        return true;
+#endif
+    return false;
+}
+
+
+PyObject*
+deepcopy( PyObject* value, PyObject* memo )
+{
+    if( is_atomic( value ) )
+        return newref( value );
+    if( !deepcopy_func )
+    {
+        PyObjectPtr copy( PyImport_ImportModule( "copy" ) );
+        if( !copy )
+            return 0;
+        deepcopy_func = PyObject_GetAttrString( copy.get(), "deepcopy" );
+        if( !deepcopy_func )
+            return 0;
+    }
+    return PyObject_CallFunctionObjArgs( deepcopy_func, value, memo, 0 );
+}
+
+
+static PyObject*
+copy_list( PyObject* value, CAtom* source, CAtom* target, PyObject* memo )
+{
+    AtomList* list = atomlist_cast( value );
+    Py_ssize_t size = PyList_GET_SIZE( value );
+    PyListPtr copy( AtomCList_Check( value ) ?
+        AtomCList_New( size, target, list->validator, atomclist_cast( value )->member ) :
+        AtomList_New( size, target, list->validator ) );
+    if( !copy )
+        return 0;
+    for( Py_ssize_t i = 0; i < size; ++i )
+    {
+        // The list can only be mutated by a deep copy of one of its items.
+        if( i >= PyList_GET_SIZE( value ) )
+            return py_runtime_fail( "list changed size during copy" );
+        PyObjectPtr original( newref( PyList_GET_ITEM( value, i ) ) );
+        PyObjectPtr item( copy_value( original.get(), source, target, memo ) );
+        if( !item )
+            return 0;
+        copy.set_item( i, item );
+    }
+    return copy.release();
+}
+
+
+static PyObject*
+copy_numlist( PyObject* value, CAtom* target )
+{
+    AtomNumList* list = atomnumlist_cast( value );
+    PyObjectPtr copy( AtomNumCList_Check( value ) ?
+        AtomNumCList_New( target, list->validator, atomnumclist_cast( value )->member ) :
+        AtomNumList_New( target, list->validator ) );
+    if( !copy )
+        return 0;
+    if( AtomNumList_Extend( copy.get(), value ) < 0 )
+        return 0;
+    return copy.release();
+}
+
+
+static PyObject*
+copy_dict( PyObject* value, CAtom* source, CAtom* target, PyObject* memo )
+{
+    AtomDict* dict = atomdict_cast( value );
+    PyDictPtr copy( AtomCDict_Check( value ) ?
+        AtomCDict_New( target, dict->key_validator, dict->value_validator,
+                       atomcdict_cast( value )->member ) :
+        AtomDict_New( target, dict->key_validator, dict->value_validator ) );
+    if( !copy )
+        return 0;
+    // Hold the items, which a deep copy could remove from the dict.
+    PyListPtr items( PyDict_Items( value ) );
+    if( !items )
+        return 0;
+    Py_ssize_t size = PyList_GET_SIZE( items.get() );
+    for( Py_ssize_t i = 0; i < size; ++i )
+    {
+        PyObject* item = PyList_GET_ITEM( items.get(), i );
+        PyObjectPtr key( newref( PyTuple_GET_ITEM( item, 0 ) ) );
+        if( memo )
+        {
+            key = deepcopy( key.get(), memo );
+            if( !key )
+                return 0;
+        }
+        PyObjectPtr val( copy_value( PyTuple_GET_ITEM( item, 1 ), source, target, memo ) );
+        if( !val )
+            return 0;
+        if( !copy.set_item( key, val ) )
+            return 0;
+    }
+    return copy.release();
+}
+
+
+// The items of a sortedmap are loaded into the copy, which validates the
+// values and hence rebinds the nested containers.
+static PyObject*
+copy_sortedmap( PyObject* value, CAtom* target, PyObject* memo )
+{
+    AtomSortedMap* map = atomsortedmap_cast( value );
+    PyObjectPtr copy( AtomCSortedMap_Check( value ) ?
+        AtomCSortedMap_New( target, map->key_validator, map->value_validator,
+                            atomcsortedmap_cast( value )->member ) :
+        AtomSortedMap_New( target, map->key_validator, map->value_validator ) );
+    if( !copy )
+        return 0;
+    PyObjectPtr items( newref( value ) );
+    if( memo )
+    {
+        items = deepcopy( value, memo );
+        if( !items )
+            return 0;
+    }
+    if( AtomSortedMap_Load( copy.get(), items.get() ) < 0 )
+        return 0;
+    return copy.release();
+}
+
+
+PyObject*
+copy_value( PyObject* value, CAtom* source, CAtom* target, PyObject* memo )
+{
+    if( AtomList_Check( value ) && atomlist_cast( value )->pointer->data() == source )
+        return copy_list( value, source, target, memo );
+    if( AtomNumList_Check( value ) && atomnumlist_cast( value )->pointer->data() == source )
+        return copy_numlist( value, target );
+    if( AtomDict_Check( value ) && atomdict_cast( value )->pointer->data() == source )
+        return copy_dict( value, source, target, memo );
+    if( AtomSortedMap_Check( value ) && atomsortedmap_cast( value )->pointer->data() == source )
+        return copy_sortedmap( value, target, memo );
+    if( !memo )
+        return newref( value );
+    return deepcopy( value, memo );
+}
+
+}  // namespace AtomCopy
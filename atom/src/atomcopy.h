@@ -0,0 +1,29 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "catom.h"
+
+
+// The copies of the values stored in the slots of an atom. The containers
+// validated by a member of the copied atom are cloned into containers of
+// the same kind bound to the copy, without validating their items again.
+namespace AtomCopy
+{
+
+// Copy a value held by an atom for its copy. The value is shared when
+// memo is null, and deep copied using the memo of copy.deepcopy otherwise.
+PyObject*
+copy_value( PyObject* value, CAtom* source, CAtom* target, PyObject* memo );
+
+
+// Deep copy an object using copy.deepcopy.
+PyObject*
+deepcopy( PyObject* value, PyObject* memo );
+
+}  // namespace AtomCopy
@@ -0,0 +1,872 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include "atomdict.h"
+#include "changetrace.h"
+#include "staticstrings.h"
+#include "packagenaming.h"
+#include "py23compat.h"
+
+
+using namespace PythonHelpers;
+
+
+namespace DictMethods
+{
+
+// The method descriptors of dict, used to run the builtin implementation
+// of the methods overridden by the atomcdict to emit notifications.
+static PyObject* pop = 0;
+static PyObject* popitem = 0;
+static PyObject* clear = 0;
+
+
+static bool
+init_methods()
+{
+    pop = PyDict_GetItemString( PyDict_Type.tp_dict, "pop" );
+    if( !pop )
+    {
+// LCOV_EXCL_START
+        py_bad_internal_call( "failed to load dict 'pop' method" );
+        return false;
+// LCOV_EXCL_STOP
+    }
+    popitem = PyDict_GetItemString( PyDict_Type.tp_dict, "popitem" );
+    if( !popitem )
+    {
+// LCOV_EXCL_START
+        py_bad_internal_call( "failed to load dict 'popitem' method" );
+        return false;
+// LCOV_EXCL_STOP
+    }
+    clear = PyDict_GetItemString( PyDict_Type.tp_dict, "clear" );
+    if( !clear )
+    {
+// LCOV_EXCL_START
+        py_bad_internal_call( "failed to load dict 'clear' method" );
+        return false;
+// LCOV_EXCL_STOP
+    }
+    return true;
+}
+
+
+static PyObject*
+call( PyObject* method, PyObject* self, PyObject* args )
+{
+    Py_ssize_t size = args ? PyTuple_GET_SIZE( args ) : 0;
+    PyTuplePtr margs( PyTuple_New( size + 1 ) );
+    if( !margs )
+        return 0;  // LCOV_EXCL_LINE
+    margs.initialize( 0, newref( self ) );
+    for( Py_ssize_t i = 0; i < size; ++i )
+        margs.initialize( i + 1, newref( PyTuple_GET_ITEM( args, i ) ) );
+    return PyObject_Call( method, margs.get(), 0 );
+}
+
+}  // namespace DictMethods
+
+
+static PyObject*
+DictSubtype_New( PyTypeObject* subtype )
+{
+    PyTuplePtr args( PyTuple_New( 0 ) );
+    if( !args )
+        return 0;  // LCOV_EXCL_LINE
+    return PyDict_Type.tp_new( subtype, args.get(), 0 );
+}
+
+
+PyObject*
+AtomDict_New( CAtom* atom, Member* key_validator, Member* value_validator )
+{
+    PyObjectPtr ptr( DictSubtype_New( &AtomDict_Type ) );
+    if( !ptr )
+        return 0;
+    Py_XINCREF( pyobject_cast( key_validator ) );
+    Py_XINCREF( pyobject_cast( value_validator ) );
+    atomdict_cast( ptr.get() )->key_validator = key_validator;
+    atomdict_cast( ptr.get() )->value_validator = value_validator;
+    atomdict_cast( ptr.get() )->pointer = new CAtomPointer( atom );
+    return ptr.release();
+}
+
+
+PyObject*
+AtomCDict_New( CAtom* atom, Member* key_validator, Member* value_validator, Member* member )
+{
+    PyObjectPtr ptr( DictSubtype_New( &AtomCDict_Type ) );
+    if( !ptr )
+        return 0;
+    Py_XINCREF( pyobject_cast( key_validator ) );
+    Py_XINCREF( pyobject_cast( value_validator ) );
+    Py_XINCREF( pyobject_cast( member ) );
+    atomdict_cast( ptr.get() )->key_validator = key_validator;
+    atomdict_cast( ptr.get() )->value_validator = value_validator;
+    atomdict_cast( ptr.get() )->pointer = new CAtomPointer( atom );
+    atomcdict_cast( ptr.get() )->member = member;
+    return ptr.release();
+}
+
+
+/*-----------------------------------------------------------------------------
+| AtomDict Type
+|----------------------------------------------------------------------------*/
+namespace
+{
+
+class AtomDictHandler
+{
+
+public:
+
+    AtomDictHandler( AtomDict* dict ) :
+        m_dict( newref( pyobject_cast( dict ) ) ) {}
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        if( !value )
+            return PyDict_Type.tp_as_mapping->mp_ass_subscript(
+                m_dict.get(), key, value );
+        PyObjectPtr keyptr( validate_key( key ) );
+        if( !keyptr )
+            return -1;
+        PyObjectPtr valptr( validate_value( value ) );
+        if( !valptr )
+            return -1;
+        return PyDict_SetItem( m_dict.get(), keyptr.get(), valptr.get() );
+    }
+
+    PyObject* setdefault( PyObject* args )
+    {
+        PyObject* key;
+        PyObject* value = Py_None;
+        if( !PyArg_UnpackTuple( args, "setdefault", 1, 2, &key, &value ) )
+            return 0;
+        PyObjectPtr keyptr( validate_key( key ) );
+        if( !keyptr )
+            return 0;
+        PyObject* item = lookup( keyptr.get() );
+        if( item )
+            return newref( item );
+        if( PyErr_Occurred() )
+            return 0;
+        PyObjectPtr valptr( validate_value( value ) );
+        if( !valptr )
+            return 0;
+        if( PyDict_SetItem( m_dict.get(), keyptr.get(), valptr.get() ) < 0 )
+            return 0;
+        m_validated_key = keyptr;
+        m_validated = valptr;
+        return valptr.release();
+    }
+
+    PyObject* update( PyObject* args, PyObject* kwargs )
+    {
+        PyObject* other = 0;
+        if( !PyArg_UnpackTuple( args, "update", 0, 1, &other ) )
+            return 0;
+        PyDictPtr items( PyDict_New() );
+        if( !items )
+            return 0;  // LCOV_EXCL_LINE
+        if( other )
+        {
+            // Follow the dict.update rules: anything with keys() is a
+            // mapping, anything else a sequence of pairs.
+            int res = PyObject_HasAttrString( other, "keys" ) ?
+                PyDict_Merge( items.get(), other, 1 ) :
+                PyDict_MergeFromSeq2( items.get(), other, 1 );
+            if( res < 0 )
+                return 0;
+        }
+        if( kwargs && PyDict_Merge( items.get(), kwargs, 1 ) < 0 )
+            return 0;  // LCOV_EXCL_LINE
+        PyObjectPtr valid( validate_items( items.get() ) );
+        if( !valid )
+            return 0;
+        if( PyDict_Update( m_dict.get(), valid.get() ) < 0 )
+            return 0;  // LCOV_EXCL_LINE
+        m_validated = valid;
+        Py_RETURN_NONE;
+    }
+
+protected:
+
+    AtomDict* adict()
+    {
+        return atomdict_cast( m_dict.get() );
+    }
+
+    CAtom* atom()
+    {
+        return adict()->pointer->data();
+    }
+
+    // Return a borrowed reference to the item, or null with or without
+    // an exception set depending on whether the lookup failed.
+    PyObject* lookup( PyObject* key )
+    {
+#if PY_MAJOR_VERSION >= 3
+        return PyDict_GetItemWithError( m_dict.get(), key );
+#else
+        if( PyObject_Hash( key ) == -1 )
+            return 0;
+        return PyDict_GetItem( m_dict.get(), key );
+#endif
+    }
+
+    PyObject* validate_key( PyObject* key )
+    {
+        Member* validator = adict()->key_validator;
+        if( validator && atom() )
+            return validator->full_validate( atom(), Py_None, key );
+        return newref( key );
+    }
+
+    PyObject* validate_value( PyObject* value )
+    {
+        Member* validator = adict()->value_validator;
+        if( validator && atom() )
+            return validator->full_validate( atom(), Py_None, value );
+        return newref( value );
+    }
+
+    PyObject* validate_items( PyObject* items )
+    {
+        if( !atom() || ( !adict()->key_validator && !adict()->value_validator ) )
+            return newref( items );
+        PyDictPtr valid( PyDict_New() );
+        if( !valid )
+            return 0;  // LCOV_EXCL_LINE
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while( PyDict_Next( items, &pos, &key, &value ) )
+        {
+            PyObjectPtr keyptr( validate_key( key ) );
+            if( !keyptr )
+                return 0;
+            PyObjectPtr valptr( validate_value( value ) );
+            if( !valptr )
+                return 0;
+            if( !valid.set_item( keyptr, valptr ) )
+                return 0;
+        }
+        return valid.release();
+    }
+
+    PyObjectPtr m_dict;
+    PyObjectPtr m_validated_key;
+    PyObjectPtr m_validated;
+
+private:
+
+    AtomDictHandler();
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomDict_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    PyObjectPtr ptr( PyDict_Type.tp_new( type, args, kwargs ) );
+    if( !ptr )
+        return 0;
+    atomdict_cast( ptr.get() )->pointer = new CAtomPointer();
+    return ptr.release();
+}
+
+
+static int
+AtomDict_clear( AtomDict* self )
+{
+    Py_CLEAR( self->key_validator );
+    Py_CLEAR( self->value_validator );
+    return PyDict_Type.tp_clear( pyobject_cast( self ) );
+}
+
+
+static int
+AtomDict_traverse( AtomDict* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->key_validator );
+    Py_VISIT( self->value_validator );
+    return PyDict_Type.tp_traverse( pyobject_cast( self ), visit, arg );
+}
+
+
+static void
+AtomDict_dealloc( AtomDict* self )
+{
+    PyObject_GC_UnTrack( self );
+    delete self->pointer;
+    self->pointer = 0;
+    Py_CLEAR( self->key_validator );
+    Py_CLEAR( self->value_validator );
+    PyDict_Type.tp_dealloc( pyobject_cast( self ) );
+}
+
+
+static PyObject*
+AtomDict_setdefault( AtomDict* self, PyObject* args )
+{
+    return AtomDictHandler( self ).setdefault( args );
+}
+
+
+static PyObject*
+AtomDict_update( AtomDict* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomDictHandler( self ).update( args, kwargs );
+}
+
+
+static PyObject*
+AtomDict_reduce_ex( AtomDict* self, PyObject* proto )
+{
+    // An atomdict is pickled as a normal dict. Assigning the dict to the
+    // attribute of the reconstituted Atom creates a new atomdict with the
+    // proper owner and validators.
+    PyObjectPtr data( PyDict_Copy( pyobject_cast( self ) ) );
+    if( !data )
+        return 0;
+    PyTuplePtr res( PyTuple_New( 2 ) );
+    if( !res )
+        return 0;
+    PyTuplePtr args( PyTuple_New( 1 ) );
+    if( !args )
+        return 0;
+    args.set_item( 0, data );
+    res.set_item( 0, newref( pyobject_cast( &PyDict_Type ) ) );
+    res.set_item( 1, args );
+    return res.release();
+}
+
+
+static int
+AtomDict_ass_subscript( AtomDict* self, PyObject* key, PyObject* value )
+{
+    return AtomDictHandler( self ).setitem( key, value );
+}
+
+
+PyDoc_STRVAR( d_setdefault_doc,
+"D.setdefault(k[,d]) -> D.get(k,d), also set D[k]=d if k not in D" );
+
+PyDoc_STRVAR( d_update_doc,
+"D.update([E, ]**F) -> None.  Update D from dict/iterable E and F." );
+
+
+static PyMethodDef
+AtomDict_methods[] = {
+    { "setdefault", ( PyCFunction )AtomDict_setdefault, METH_VARARGS, d_setdefault_doc },
+    { "update", ( PyCFunction )AtomDict_update, METH_VARARGS | METH_KEYWORDS, d_update_doc },
+    { "__reduce_ex__", ( PyCFunction )AtomDict_reduce_ex, METH_O, "" },
+    { 0 }  /* sentinel */
+};
+
+
+static PyMappingMethods
+AtomDict_as_mapping = {
+    (lenfunc)0,                             /* mp_length */
+    (binaryfunc)0,                          /* mp_subscript */
+    (objobjargproc)AtomDict_ass_subscript   /* mp_ass_subscript */
+};
+
+
+PyTypeObject AtomDict_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomdict" ),         /* tp_name */
+    sizeof( AtomDict ),                     /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomDict_dealloc,           /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)&AtomDict_as_mapping,   /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)AtomDict_traverse,        /* tp_traverse */
+    (inquiry)AtomDict_clear,                /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomDict_methods,  /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    &PyDict_Type,                           /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)0,                           /* tp_alloc */
+    (newfunc)AtomDict_new,                  /* tp_new */
+    (freefunc)0,                            /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+/*-----------------------------------------------------------------------------
+| AtomCDict Type
+|----------------------------------------------------------------------------*/
+namespace PySStr
+{
+
+_STATIC_STRING( type )
+_STATIC_STRING( name )
+_STATIC_STRING( object )
+_STATIC_STRING( value )
+_STATIC_STRING( operation )
+_STATIC_STRING( key )
+_STATIC_STRING( item )
+_STATIC_STRING( items )
+_STATIC_STRING( olditem )
+_STATIC_STRING( newitem )
+_STATIC_STRING( container )
+_STATIC_STRING( __setitem__ )
+_STATIC_STRING( __delitem__ )
+_STATIC_STRING( setdefault )
+_STATIC_STRING( update )
+_STATIC_STRING( pop )
+_STATIC_STRING( popitem )
+_STATIC_STRING( clear )
+
+}  // namespace PySStr
+
+
+namespace
+{
+
+class AtomCDictHandler : public AtomDictHandler
+{
+
+public:
+
+    AtomCDictHandler( AtomCDict* dict ) :
+        AtomDictHandler( atomdict_cast( dict ) ),
+        m_obsm( false ), m_obsa( false ) {}
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        if( !observer_check() )
+            return AtomDictHandler::setitem( key, value );
+        if( !value )
+        {
+            PyObjectPtr olditem( xnewref( lookup( key ) ) );
+            if( !olditem && PyErr_Occurred() )
+                return -1;
+            if( PyDict_Type.tp_as_mapping->mp_ass_subscript( m_dict.get(), key, 0 ) < 0 )
+                return -1;
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return -1;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::__delitem__() ) )
+                return -1;
+            if( !c.set_item( PySStr::key(), key ) )
+                return -1;
+            if( !c.set_item( PySStr::item(), olditem ) )
+                return -1;
+            return post_change( c ) ? 0 : -1;
+        }
+        PyObjectPtr keyptr( validate_key( key ) );
+        if( !keyptr )
+            return -1;
+        PyObjectPtr valptr( validate_value( value ) );
+        if( !valptr )
+            return -1;
+        PyObjectPtr olditem( xnewref( lookup( keyptr.get() ) ) );
+        if( !olditem && PyErr_Occurred() )
+            return -1;
+        if( PyDict_SetItem( m_dict.get(), keyptr.get(), valptr.get() ) < 0 )
+            return -1;
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return -1;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), PySStr::__setitem__() ) )
+            return -1;
+        if( !c.set_item( PySStr::key(), keyptr ) )
+            return -1;
+        if( olditem && !c.set_item( PySStr::olditem(), olditem ) )
+            return -1;
+        if( !c.set_item( PySStr::newitem(), valptr ) )
+            return -1;
+        return post_change( c ) ? 0 : -1;
+    }
+
+    PyObject* setdefault( PyObject* args )
+    {
+        PyObjectPtr res( AtomDictHandler::setdefault( args ) );
+        if( !res )
+            return 0;
+        // The key is only recorded when the default was inserted.
+        if( m_validated_key && observer_check() )
+        {
+            if( !post_key_change( PySStr::setdefault(), m_validated_key, res ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* update( PyObject* args, PyObject* kwargs )
+    {
+        PyObjectPtr res( AtomDictHandler::update( args, kwargs ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::update() ) )
+                return 0;
+            if( !c.set_item( PySStr::items(), m_validated ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* pop( PyObject* args )
+    {
+        PyObject* key;
+        PyObject* value = 0;
+        if( !PyArg_UnpackTuple( args, "pop", 1, 2, &key, &value ) )
+            return 0;
+        int present = PyDict_Contains( m_dict.get(), key );
+        if( present < 0 )
+            return 0;
+        PyObjectPtr res( DictMethods::call( DictMethods::pop, m_dict.get(), args ) );
+        if( !res )
+            return 0;
+        if( present && observer_check() )
+        {
+            PyObjectPtr keyptr( newref( key ) );
+            if( !post_key_change( PySStr::pop(), keyptr, res ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* popitem()
+    {
+        PyObjectPtr res( DictMethods::call( DictMethods::popitem, m_dict.get(), 0 ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr key( newref( PyTuple_GET_ITEM( res.get(), 0 ) ) );
+            PyObjectPtr item( newref( PyTuple_GET_ITEM( res.get(), 1 ) ) );
+            if( !post_key_change( PySStr::popitem(), key, item ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* clear()
+    {
+        PyObjectPtr items;
+        bool obs = observer_check() && PyDict_Size( m_dict.get() ) > 0;
+        if( obs )
+        {
+            items = PyDict_Copy( m_dict.get() );
+            if( !items )
+                return 0;  // LCOV_EXCL_LINE
+        }
+        PyObjectPtr res( DictMethods::call( DictMethods::clear, m_dict.get(), 0 ) );
+        if( !res )
+            return 0;  // LCOV_EXCL_LINE
+        if( obs )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::clear() ) )
+                return 0;
+            if( !c.set_item( PySStr::items(), items ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+private:
+
+    AtomCDictHandler();
+
+    Member* member()
+    {
+        return atomcdict_cast( m_dict.get() )->member;
+    }
+
+    bool observer_check()
+    {
+        m_obsm = false;
+        m_obsa = false;
+        if( !member() || !atom() )
+            return false;
+        m_obsm = member()->has_observers();
+        m_obsa = atom()->has_observers( member()->name );
+        return m_obsm || m_obsa;
+    }
+
+    PyObject* prepare_change()
+    {
+        PyDictPtr c( PyDict_New() );
+        if( !c )
+            return 0;
+        if( !c.set_item( PySStr::type(), PySStr::container() ) )
+            return 0;
+        if( !c.set_item( PySStr::name(), member()->name ) )
+            return 0;
+        if( !c.set_item( PySStr::object(), pyobject_cast( atom() ) ) )
+            return 0;
+        if( !c.set_item( PySStr::value(), m_dict.get() ) )
+            return 0;
+        return c.release();
+    }
+
+    bool post_change( PyObjectPtr& change )
+    {
+        PyTuplePtr args( PyTuple_New( 1 ) );
+        if( !args )
+            return false;
+        args.set_item( 0, change );
+        ChangeTrace::record( ChangeTrace::Container, atom(), member() );
+        if( m_obsm )
+        {
+            if( !member()->notify( atom(), args.get(), 0 ) )
+                return false;
+        }
+        if( m_obsa )
+        {
+            if( !atom()->notify( member()->name, args.get(), 0 ) )
+                return false;
+        }
+        return true;
+    }
+
+    bool post_key_change( PyObject* operation, PyObjectPtr& key, PyObjectPtr& item )
+    {
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), operation ) )
+            return false;
+        if( !c.set_item( PySStr::key(), key ) )
+            return false;
+        if( !c.set_item( PySStr::item(), item ) )
+            return false;
+        return post_change( c );
+    }
+
+    bool m_obsm;
+    bool m_obsa;
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomCDict_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    return AtomDict_Type.tp_new( type, args, kwargs );
+}
+
+
+static int
+AtomCDict_clear( AtomCDict* self )
+{
+    Py_CLEAR( self->member );
+    return AtomDict_clear( atomdict_cast( self ) );
+}
+
+
+static int
+AtomCDict_traverse( AtomCDict* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->member );
+    return AtomDict_traverse( atomdict_cast( self ), visit, arg );
+}
+
+
+static void
+AtomCDict_dealloc( AtomCDict* self )
+{
+    PyObject_GC_UnTrack( self );
+    Py_CLEAR( self->member );
+    AtomDict_dealloc( atomdict_cast( self ) );
+}
+
+
+static PyObject*
+AtomCDict_setdefault( AtomCDict* self, PyObject* args )
+{
+    return AtomCDictHandler( self ).setdefault( args );
+}
+
+
+static PyObject*
+AtomCDict_update( AtomCDict* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomCDictHandler( self ).update( args, kwargs );
+}
+
+
+static PyObject*
+AtomCDict_pop( AtomCDict* self, PyObject* args )
+{
+    return AtomCDictHandler( self ).pop( args );
+}
+
+
+static PyObject*
+AtomCDict_popitem( AtomCDict* self )
+{
+    return AtomCDictHandler( self ).popitem();
+}
+
+
+static PyObject*
+AtomCDict_clear_items( AtomCDict* self )
+{
+    return AtomCDictHandler( self ).clear();
+}
+
+
+static int
+AtomCDict_ass_subscript( AtomCDict* self, PyObject* key, PyObject* value )
+{
+    return AtomCDictHandler( self ).setitem( key, value );
+}
+
+
+PyDoc_STRVAR( c_pop_doc,
+"D.pop(k[,d]) -> v, remove specified key and return the corresponding value.\n"
+"If key is not found, d is returned if given, otherwise KeyError is raised" );
+
+PyDoc_STRVAR( c_popitem_doc,
+"D.popitem() -> (k, v), remove and return some (key, value) pair as a\n"
+"2-tuple; but raise KeyError if D is empty." );
+
+PyDoc_STRVAR( c_clear_doc,
+"D.clear() -> None.  Remove all items from D." );
+
+
+static PyMethodDef
+AtomCDict_methods[] = {
+    { "setdefault", ( PyCFunction )AtomCDict_setdefault, METH_VARARGS, d_setdefault_doc },
+    { "update", ( PyCFunction )AtomCDict_update, METH_VARARGS | METH_KEYWORDS, d_update_doc },
+    { "pop", ( PyCFunction )AtomCDict_pop, METH_VARARGS, c_pop_doc },
+    { "popitem", ( PyCFunction )AtomCDict_popitem, METH_NOARGS, c_popitem_doc },
+    { "clear", ( PyCFunction )AtomCDict_clear_items, METH_NOARGS, c_clear_doc },
+    { 0 }  /* sentinel */
+};
+
+
+static PyMappingMethods
+AtomCDict_as_mapping = {
+    (lenfunc)0,                             /* mp_length */
+    (binaryfunc)0,                          /* mp_subscript */
+    (objobjargproc)AtomCDict_ass_subscript  /* mp_ass_subscript */
+};
+
+
+PyTypeObject AtomCDict_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomcdict" ),        /* tp_name */
+    sizeof( AtomCDict ),                    /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomCDict_dealloc,          /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)&AtomCDict_as_mapping,  /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)AtomCDict_traverse,       /* tp_traverse */
+    (inquiry)AtomCDict_clear,               /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomCDict_methods, /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    &AtomDict_Type,                         /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)0,                           /* tp_alloc */
+    (newfunc)AtomCDict_new,                 /* tp_new */
+    (freefunc)0,                            /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+int
+import_atomdict()
+{
+    if( PyType_Ready( &AtomDict_Type ) < 0 )
+        return -1;
+    if( PyType_Ready( &AtomCDict_Type ) < 0 )
+        return -1;
+    if( !DictMethods::init_methods() )
+        return -1;
+    return 0;
+}
@@ -6,6 +6,9 @@
 | The full license is in the file COPYING.txt, distributed with this software.
 |----------------------------------------------------------------------------*/
 #include "atomlist.h"
+#include "changetrace.h"
+#include "staticstrings.h"
+#include "containerbatch.h"
 #include "packagenaming.h"
 #include "py23compat.h"
 
@@ -153,6 +156,52 @@ ListSubtype_New( PyTypeObject* subtype, Py_ssize_t size )
 }
 
 
+static bool
+ListSubtype_Reserve( PyObject* list, Py_ssize_t extra )
+{
+    // Grow the item storage so that `extra` more items can be stored
+    // without reallocation. The list size itself is left unchanged.
+    PyListObject* op = reinterpret_cast<PyListObject*>( list );
+    if( extra <= op->allocated - Py_SIZE( op ) )
+        return true;
+    if( extra > PY_SSIZE_T_MAX / static_cast<Py_ssize_t>( sizeof( PyObject* ) ) - Py_SIZE( op ) )
+    {
+        PyErr_NoMemory();  // LCOV_EXCL_LINE
+        return false;  // LCOV_EXCL_LINE
+    }
+    Py_ssize_t allocated = Py_SIZE( op ) + extra;
+    PyObject** items = op->ob_item;
+    PyMem_RESIZE( items, PyObject*, allocated );
+    if( !items )
+    {
+        PyErr_NoMemory();  // LCOV_EXCL_LINE
+        return false;  // LCOV_EXCL_LINE
+    }
+    op->ob_item = items;
+    op->allocated = allocated;
+    return true;
+}
+
+
+static bool
+ListSubtype_AppendSteal( PyObject* list, PyObject* item )
+{
+    // Append a new reference to the list, using the reserved storage
+    // when available. The reference is consumed in all cases.
+    PyListObject* op = reinterpret_cast<PyListObject*>( list );
+    Py_ssize_t size = Py_SIZE( op );
+    if( size < op->allocated )
+    {
+        op->ob_item[ size ] = item;
+        Py_SIZE( op ) = size + 1;
+        return true;
+    }
+    int res = PyList_Append( list, item );
+    Py_DECREF( item );
+    return res == 0;
+}
+
+
 PyObject*
 AtomList_New( Py_ssize_t size, CAtom* atom, Member* validator )
 {
@@ -193,7 +242,7 @@ class AtomListHandler
 public:
 
     AtomListHandler( AtomList* list ) :
-        m_list( newref( pyobject_cast( list ) ) ) {}
+        m_list( newref( pyobject_cast( list ) ) ), m_extend_start( 0 ) {}
 
     PyObject* append( PyObject* value )
     {
@@ -228,19 +277,16 @@ public:
 
     PyObject* extend( PyObject* value )
     {
-        PyObjectPtr item( validate_sequence( value ) );
-        if( !item )
+        if( !extend_sequence( value ) )
             return 0;
-        return ListMethods::extend( m_list.get(), item.get() );
+        Py_RETURN_NONE;
     }
 
     PyObject* iadd( PyObject* value )
     {
-        PyObjectPtr item( validate_sequence( value ) );
-        if( !item )
+        if( !extend_sequence( value ) )
             return 0;
-        return PyList_Type.tp_as_sequence->sq_inplace_concat(
-            m_list.get(), item.get() );
+        return m_list.newref();
     }
 
     int setitem( Py_ssize_t index, PyObject* value )
@@ -323,18 +369,42 @@ protected:
         if( validator() && atom() )
         {
             // no validation needed for self[::-1] = self
-            if( m_list.get() != value )
+            NumericBuffer buffer;
+            NumericBuffer::Boxing boxing;
+            if( buffer.acquire( value ) && validator()->bulk_validate( buffer, boxing ) )
             {
-                PyListPtr templist( PySequence_List( value ) );
-                if( !templist )
+                item = box_buffer( buffer, boxing );
+                if( !item )
                     return 0;
+            }
+            else if( m_list.get() != value )
+            {
+                buffer.release();
+                PyObjectPtr seq( PySequence_Fast( value, "can only assign an iterable" ) );
+                if( !seq )
+                    return 0;
+                // A list created by PySequence_Fast is owned by the handler
+                // and can be validated in place. Otherwise the validated
+                // items are written straight into a list of the final size.
+                PyListPtr templist;
+                if( seq.get() != value )
+                    templist = seq;
+                else
+                {
+                    templist = PyList_New( PySequence_Fast_GET_SIZE( seq.get() ) );
+                    if( !templist )
+                        return 0;
+                }
                 CAtom* atm = atom();
                 Member* vd = validator();
                 Py_ssize_t size = templist.size();
                 for( Py_ssize_t i = 0; i < size; ++i )
                 {
-                    PyObject* b = templist.borrow_item( i );
-                    PyObject* val = vd->full_validate( atm, Py_None, b );
+                    // the validator may run arbitrary code, re-check the size
+                    if( i >= PySequence_Fast_GET_SIZE( seq.get() ) )
+                        return py_runtime_fail( "sequence changed size during validation" );
+                    PyObjectPtr b( newref( PySequence_Fast_GET_ITEM( seq.get(), i ) ) );
+                    PyObject* val = vd->full_validate( atm, Py_None, b.get() );
                     if( !val )
                         return 0;
                     templist.set_item( i, val );
@@ -346,8 +416,134 @@ protected:
         return item.release();
     }
 
+    bool extend_sequence( PyObject* value )
+    {
+        // no validation needed for self.extend( self )
+        if( !validator() || !atom() || m_list.get() == value )
+        {
+            PyObjectPtr res( ListMethods::extend( m_list.get(), value ) );
+            if( !res )
+                return false;
+            m_validated = newref( value );
+            return true;
+        }
+        // The items are validated straight into the reserved tail of the
+        // list. The validated items are only materialized as a separate
+        // list if an observer asks for them (see extended_items).
+        m_validated = 0;
+        m_extend_start = m_list.size();
+        CAtom* atm = atom();
+        Member* vd = validator();
+        // Numeric buffers whose items are all accepted by the validator
+        // are checked in a single pass and only boxed afterwards.
+        NumericBuffer buffer;
+        NumericBuffer::Boxing boxing;
+        if( buffer.acquire( value ) && vd->bulk_validate( buffer, boxing ) )
+        {
+            Py_ssize_t size = buffer.size();
+            if( !ListSubtype_Reserve( m_list.get(), size ) )
+                return false;
+            for( Py_ssize_t i = 0; i < size; ++i )
+            {
+                PyObject* val = buffer.box( i, boxing );
+                if( !val )
+                    return rollback_extend();
+                if( !ListSubtype_AppendSteal( m_list.get(), val ) )
+                    return rollback_extend();  // LCOV_EXCL_LINE
+            }
+            return true;
+        }
+        buffer.release();
+        PyObjectPtr seq;
+        PyObjectPtr iter;
+        Py_ssize_t hint;
+        if( PyList_CheckExact( value ) || PyTuple_CheckExact( value ) )
+        {
+            seq = newref( value );
+            hint = PySequence_Fast_GET_SIZE( value );
+        }
+        else
+        {
+            iter = PyObject_GetIter( value );
+            if( !iter )
+                return false;
+#if PY_MAJOR_VERSION >= 3
+            hint = PyObject_LengthHint( value, 0 );
+#else
+            hint = _PyObject_LengthHint( value, 0 );
+#endif
+            if( hint < 0 )
+                return false;
+        }
+        if( !ListSubtype_Reserve( m_list.get(), hint ) )
+            return false;
+        for( Py_ssize_t i = 0; ; ++i )
+        {
+            PyObjectPtr item;
+            if( seq )
+            {
+                // the validator may run arbitrary code, re-check the size
+                if( i >= PySequence_Fast_GET_SIZE( seq.get() ) )
+                    break;
+                item = newref( PySequence_Fast_GET_ITEM( seq.get(), i ) );
+            }
+            else
+            {
+                item = PyIter_Next( iter.get() );
+                if( !item )
+                {
+                    if( PyErr_Occurred() )
+                        return rollback_extend();
+                    break;
+                }
+            }
+            PyObject* val = vd->full_validate( atm, Py_None, item.get() );
+            if( !val )
+                return rollback_extend();
+            if( !ListSubtype_AppendSteal( m_list.get(), val ) )
+                return rollback_extend();  // LCOV_EXCL_LINE
+        }
+        return true;
+    }
+
+    PyObject* box_buffer( NumericBuffer& buffer, NumericBuffer::Boxing boxing )
+    {
+        Py_ssize_t size = buffer.size();
+        PyListPtr templist( PyList_New( size ) );
+        if( !templist )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* val = buffer.box( i, boxing );
+            if( !val )
+                return 0;
+            templist.set_item( i, val );
+        }
+        return templist.release();
+    }
+
+    bool rollback_extend()
+    {
+        // Remove the items appended by a failed extend while preserving
+        // the exception which caused the failure.
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch( &type, &value, &traceback );
+        PyList_SetSlice( m_list.get(), m_extend_start, PY_SSIZE_T_MAX, 0 );
+        PyErr_Restore( type, value, traceback );
+        return false;
+    }
+
+    PyObject* extended_items()
+    {
+        if( !m_validated )
+            m_validated = PyList_GetSlice(
+                m_list.get(), m_extend_start, m_list.size() );
+        return m_validated.get();
+    }
+
     PyListPtr m_list;
     PyObjectPtr m_validated;
+    Py_ssize_t m_extend_start;
 
 private:
 
@@ -575,36 +771,6 @@ PyTypeObject AtomList_Type = {
 namespace PySStr
 {
 
-class PyStringMaker
-{
-
-public:
-
-    PyStringMaker( const char* string ) : m_pystring( 0 )
-    {
-        m_pystring = Py23Str_FromString( string );
-    }
-
-    PyObject* operator()()
-    {
-        return m_pystring.get();
-    }
-
-private:
-
-    PyStringMaker();
-    PyObjectPtr m_pystring;
-};
-
-
-#define _STATIC_STRING( name )                \
-    static PyObject*                          \
-    name()                                    \
-    {                                         \
-        static PyStringMaker string( #name ); \
-        return string();                      \
-    }
-
 _STATIC_STRING( type )
 _STATIC_STRING( name )
 _STATIC_STRING( object )
@@ -632,6 +798,9 @@ _STATIC_STRING( sort )
 _STATIC_STRING( olditem )
 _STATIC_STRING( newitem )
 _STATIC_STRING( count )
+_STATIC_STRING( batch )
+_STATIC_STRING( removed )
+_STATIC_STRING( inserted )
 
 }  // namespace PySStr
 
@@ -719,7 +888,7 @@ public:
                 return 0;  // LCOV_EXCL_LINE
             if( !c.set_item( PySStr::operation(), PySStr::extend() ) )
                 return 0;
-            if( !c.set_item( PySStr::items(), m_validated ) )
+            if( !c.set_item( PySStr::items(), extended_items() ) )
                 return 0;
             if( !post_change( c ) )
                 return 0;
@@ -871,7 +1040,7 @@ public:
                 return 0;  // LCOV_EXCL_LINE
             if( !c.set_item( PySStr::operation(), PySStr::__iadd__() ) )
                 return 0;
-            if( !c.set_item( PySStr::items(), m_validated ) )
+            if( !c.set_item( PySStr::items(), extended_items() ) )
                 return 0;
             if( !post_change( c ) )
                 return 0;
@@ -973,6 +1142,50 @@ public:
         return res;
     }
 
+    bool post_batch_change( PyObject* snapshot )
+    {
+        // The items which were not touched by the batch are the same
+        // objects in the snapshot and the list, which makes the common
+        // prefix and suffix cheap to find by identity.
+        if( !observer_check() )
+            return true;
+        PyListObject* old = reinterpret_cast<PyListObject*>( snapshot );
+        PyListObject* cur = reinterpret_cast<PyListObject*>( m_list.get() );
+        Py_ssize_t oldsize = Py_SIZE( old );
+        Py_ssize_t cursize = Py_SIZE( cur );
+        Py_ssize_t limit = oldsize < cursize ? oldsize : cursize;
+        Py_ssize_t start = 0;
+        while( start < limit && old->ob_item[ start ] == cur->ob_item[ start ] )
+            ++start;
+        Py_ssize_t tail = 0;
+        while( tail < limit - start &&
+               old->ob_item[ oldsize - tail - 1 ] == cur->ob_item[ cursize - tail - 1 ] )
+            ++tail;
+        if( start + tail == oldsize && start + tail == cursize )
+            return true;
+        PyObjectPtr removed( PyList_GetSlice( snapshot, start, oldsize - tail ) );
+        if( !removed )
+            return false;  // LCOV_EXCL_LINE
+        PyObjectPtr inserted( PyList_GetSlice( m_list.get(), start, cursize - tail ) );
+        if( !inserted )
+            return false;  // LCOV_EXCL_LINE
+        PyObjectPtr index( Py23Int_FromSsize_t( start ) );
+        if( !index )
+            return false;  // LCOV_EXCL_LINE
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), PySStr::batch() ) )
+            return false;
+        if( !c.set_item( PySStr::index(), index ) )
+            return false;
+        if( !c.set_item( PySStr::removed(), removed ) )
+            return false;
+        if( !c.set_item( PySStr::inserted(), inserted ) )
+            return false;
+        return post_change( c );
+    }
+
 private:
 
     AtomCListHandler();
@@ -991,7 +1204,7 @@ private:
     {
         m_obsm = false;
         m_obsa = false;
-        if( !member() || !atom() )
+        if( !member() || !atom() || clist()->batch_depth > 0 )
             return false;
         m_obsm = member()->has_observers();
         m_obsa = atom()->has_observers( member()->name );
@@ -1020,6 +1233,7 @@ private:
         if( !args )
             return false;
         args.set_item( 0, change );
+        ChangeTrace::record( ChangeTrace::Container, atom(), member() );
         if( m_obsm )
         {
             if( !member()->notify( atom(), args.get(), 0 ) )
@@ -1077,6 +1291,7 @@ AtomCList_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
 int AtomCList_clear( AtomCList* self )
 {
     Py_CLEAR( self->member );
+    Py_CLEAR( self->batch_snapshot );
     return AtomList_clear( atomlist_cast( self )  );
 }
 
@@ -1084,6 +1299,7 @@ int AtomCList_clear( AtomCList* self )
 int AtomCList_traverse( AtomCList* self, visitproc visit, void* arg )
 {
     Py_VISIT( self->member );
+    Py_VISIT( self->batch_snapshot );
     return AtomList_traverse( atomlist_cast( self ) , visit, arg );
 }
 
@@ -1092,6 +1308,7 @@ AtomCList_dealloc( AtomCList* self )
 {
     PyObject_GC_UnTrack( self );
     Py_CLEAR( self->member );
+    Py_CLEAR( self->batch_snapshot );
     delete atomlist_cast( self )->pointer;
     atomlist_cast( self )->pointer = 0;
     Py_CLEAR( atomlist_cast( self )->validator );
@@ -1148,6 +1365,13 @@ AtomCList_sort( AtomCList* self, PyObject* args, PyObject* kwargs )
 }
 
 
+static PyObject*
+AtomCList_batch( AtomCList* self )
+{
+    return ContainerBatch_New( pyobject_cast( self ) );
+}
+
+
 static int
 AtomCList_ass_item( AtomCList* self, Py_ssize_t index, PyObject* value )
 {
@@ -1202,6 +1426,9 @@ PyDoc_STRVAR(c_reverse_doc,
 PyDoc_STRVAR(c_sort_doc,
 "L.sort(cmp=None, key=None, reverse=False) -- stable sort *IN PLACE*;\n\
 cmp(x, y) -> -1, 0, 1");
+PyDoc_STRVAR(c_batch_doc,
+"L.batch() -> context manager -- emit a single 'batch' change for all the\n"
+"modifications made in the context, instead of one change per operation.");
 
 
 static PyMethodDef
@@ -1213,6 +1440,7 @@ AtomCList_methods[] = {
     { "remove", ( PyCFunction )AtomCList_remove, METH_O, c_remove_doc },
     { "reverse", ( PyCFunction )AtomCList_reverse, METH_NOARGS, c_reverse_doc },
     { "sort", ( PyCFunction )AtomCList_sort, METH_VARARGS | METH_KEYWORDS, c_sort_doc },
+    { "batch", ( PyCFunction )AtomCList_batch, METH_NOARGS, c_batch_doc },
     { 0 }  /* sentinel */
 };
 
@@ -1304,6 +1532,40 @@ PyTypeObject AtomCList_Type = {
 };
 
 
+bool
+AtomCList_BeginBatch( PyObject* list )
+{
+    AtomCList* self = atomclist_cast( list );
+    if( self->batch_depth == 0 )
+    {
+        PyObject* snapshot = PyList_GetSlice( list, 0, PyList_GET_SIZE( list ) );
+        if( !snapshot )
+            return false;  // LCOV_EXCL_LINE
+        PyObject* old = self->batch_snapshot;
+        self->batch_snapshot = snapshot;
+        Py_XDECREF( old );
+    }
+    ++self->batch_depth;
+    return true;
+}
+
+
+bool
+AtomCList_EndBatch( PyObject* list )
+{
+    AtomCList* self = atomclist_cast( list );
+    if( self->batch_depth <= 0 )
+        return true;  // LCOV_EXCL_LINE
+    if( --self->batch_depth > 0 )
+        return true;
+    PyObjectPtr snapshot( self->batch_snapshot );
+    self->batch_snapshot = 0;
+    if( !snapshot )
+        return true;  // LCOV_EXCL_LINE
+    return AtomCListHandler( self ).post_batch_change( snapshot.get() );
+}
+
+
 int
 import_atomlist()
 {
@@ -28,6 +28,8 @@ typedef struct {
 typedef struct {
     AtomList atomlist;
     Member* member;
+    PyObject* batch_snapshot;
+    Py_ssize_t batch_depth;
 } AtomCList;
 
 
@@ -45,5 +47,18 @@ PyObject*
 AtomCList_New( Py_ssize_t size, CAtom* atom, Member* validator, Member* member );
 
 
+// Suspend the container notifications of the list until the matching
+// call to AtomCList_EndBatch. Batches may be nested.
+bool
+AtomCList_BeginBatch( PyObject* list );
+
+
+// Close a batch. When the outermost batch is closed, a single 'batch'
+// change describing the splice between the content of the list at the
+// start of the batch and its current content is emitted.
+bool
+AtomCList_EndBatch( PyObject* list );
+
+
 int
 import_atomlist();
@@ -0,0 +1,1990 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "atomnumlist.h"
+#include "changetrace.h"
+#include "containerbatch.h"
+#include "numericbuffer.h"
+#include "packagenaming.h"
+#include "py23compat.h"
+#include "staticstrings.h"
+
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wdeprecated-writable-strings"
+#endif
+
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wwrite-strings"
+#endif
+
+#if PY_MAJOR_VERSION >= 3
+#define SLICE_CAST( o ) ( o )
+#else
+#define SLICE_CAST( o ) ( reinterpret_cast<PySliceObject*>( o ) )
+#endif
+
+
+using namespace PythonHelpers;
+
+
+namespace
+{
+
+inline size_t
+format_itemsize( char format )
+{
+    return format == '?' ? 1 : 8;
+}
+
+
+inline const char*
+format_string( char format )
+{
+    switch( format )
+    {
+        case 'd':
+            return "d";
+        case 'q':
+            return "q";
+        default:
+            return "?";
+    }
+}
+
+
+PyObject*
+box_int64( int64_t value )
+{
+#if PY_MAJOR_VERSION >= 3
+    return PyLong_FromLongLong( value );
+#else
+    if( value >= LONG_MIN && value <= LONG_MAX )
+        return PyInt_FromLong( static_cast<long>( value ) );
+    return PyLong_FromLongLong( value );
+#endif
+}
+
+
+PyObject*
+box_item( char format, const char* src )
+{
+    switch( format )
+    {
+        case 'd':
+        {
+            double value;
+            memcpy( &value, src, sizeof( double ) );
+            return PyFloat_FromDouble( value );
+        }
+        case 'q':
+        {
+            int64_t value;
+            memcpy( &value, src, sizeof( int64_t ) );
+            return box_int64( value );
+        }
+        default:
+            return newref( *src ? Py_True : Py_False );
+    }
+}
+
+
+bool
+unbox_item( char format, PyObject* value, char* dst )
+{
+    switch( format )
+    {
+        case 'd':
+        {
+            double item = PyFloat_AsDouble( value );
+            if( item == -1.0 && PyErr_Occurred() )
+                return false;
+            memcpy( dst, &item, sizeof( double ) );
+            return true;
+        }
+        case 'q':
+        {
+            int64_t item = PyLong_AsLongLong( value );
+            if( item == -1 && PyErr_Occurred() )
+                return false;
+            memcpy( dst, &item, sizeof( int64_t ) );
+            return true;
+        }
+        default:
+        {
+            int item = PyObject_IsTrue( value );
+            if( item < 0 )
+                return false;
+            *dst = static_cast<char>( item );
+            return true;
+        }
+    }
+}
+
+
+PyObject*
+box_items( char format, const char* src, Py_ssize_t count )
+{
+    PyListPtr list( PyList_New( count ) );
+    if( !list )
+        return 0;
+    size_t itemsize = format_itemsize( format );
+    for( Py_ssize_t i = 0; i < count; ++i )
+    {
+        PyObject* item = box_item( format, src + i * itemsize );
+        if( !item )
+            return 0;  // LCOV_EXCL_LINE
+        list.set_item( i, item );
+    }
+    return list.release();
+}
+
+
+template<typename T> void
+sort_items( char* items, Py_ssize_t size, bool reverse )
+{
+    T* begin = reinterpret_cast<T*>( items );
+    if( reverse )
+        std::stable_sort( begin, begin + size, std::greater<T>() );
+    else
+        std::stable_sort( begin, begin + size );
+}
+
+
+template<typename T> void
+reverse_items( char* items, Py_ssize_t size )
+{
+    T* begin = reinterpret_cast<T*>( items );
+    std::reverse( begin, begin + size );
+}
+
+}  // namespace
+
+
+static PyObject*
+NumList_AsList( AtomNumList* self, Py_ssize_t low, Py_ssize_t high )
+{
+    return box_items(
+        self->format, self->items + low * format_itemsize( self->format ), high - low );
+}
+
+
+static bool
+NumList_CanResize( AtomNumList* self )
+{
+    if( self->exports > 0 )
+    {
+        PyErr_SetString(
+            PyExc_BufferError,
+            "Existing exports of data: object cannot be re-sized" );
+        return false;
+    }
+    return true;
+}
+
+
+static bool
+NumList_Resize( AtomNumList* self, Py_ssize_t newsize )
+{
+    if( newsize == self->size )
+        return true;
+    if( !NumList_CanResize( self ) )
+        return false;
+    // Over-allocate on growth like list does so that appends run in
+    // amortized constant time, and give memory back below half usage.
+    if( newsize <= self->allocated && newsize >= ( self->allocated >> 1 ) )
+    {
+        self->size = newsize;
+        return true;
+    }
+    size_t itemsize = format_itemsize( self->format );
+    Py_ssize_t allocated = newsize + ( newsize >> 3 ) + ( newsize < 9 ? 3 : 6 );
+    if( static_cast<size_t>( allocated ) > PY_SSIZE_T_MAX / itemsize )
+    {
+        PyErr_NoMemory();  // LCOV_EXCL_LINE
+        return false;  // LCOV_EXCL_LINE
+    }
+    char* items = reinterpret_cast<char*>(
+        PyMem_Realloc( self->items, allocated * itemsize ) );
+    if( !items )
+    {
+        // LCOV_EXCL_START
+        if( newsize <= self->allocated )
+        {
+            self->size = newsize;
+            return true;
+        }
+        PyErr_NoMemory();
+        return false;
+        // LCOV_EXCL_STOP
+    }
+    self->items = items;
+    self->allocated = allocated;
+    self->size = newsize;
+    return true;
+}
+
+
+static PyObject*
+NumList_Create( PyTypeObject* type, CAtom* atom, Member* validator )
+{
+    char format = AtomNumList_Format( validator );
+    if( !format )
+        return py_type_fail( "numeric list items must be validated as float, int or bool" );
+    PyObjectPtr ptr( PyType_GenericNew( type, 0, 0 ) );
+    if( !ptr )
+        return 0;
+    AtomNumList* self = atomnumlist_cast( ptr.get() );
+    Py_INCREF( pyobject_cast( validator ) );
+    self->validator = validator;
+    self->pointer = new CAtomPointer( atom );
+    self->format = format;
+    return ptr.release();
+}
+
+
+namespace
+{
+
+class AtomNumListHandler
+{
+
+public:
+
+    AtomNumListHandler( AtomNumList* list ) :
+        m_list( newref( pyobject_cast( list ) ) ) {}
+
+    PyObject* append( PyObject* value )
+    {
+        if( !validate_single( value ) )
+            return 0;
+        if( !splice( size(), size(), 1 ) )
+            return 0;
+        return newref( Py_None );
+    }
+
+    PyObject* insert( PyObject* args )
+    {
+        Py_ssize_t where;
+        PyObject* value;
+        if( !PyArg_ParseTuple( args, "nO:insert", &where, &value ) )
+            return 0;
+        if( !validate_single( value ) )
+            return 0;
+        Py_ssize_t n = size();
+        if( where < 0 )
+        {
+            where += n;
+            if( where < 0 )
+                where = 0;
+        }
+        if( where > n )
+            where = n;
+        if( !splice( where, where, 1 ) )
+            return 0;
+        m_index = where;
+        return newref( Py_None );
+    }
+
+    PyObject* extend( PyObject* value )
+    {
+        if( !validate_sequence( value ) )
+            return 0;
+        if( !splice( size(), size(), data_count() ) )
+            return 0;
+        return newref( Py_None );
+    }
+
+    PyObject* pop( PyObject* args )
+    {
+        Py_ssize_t index = -1;
+        if( !PyArg_ParseTuple( args, "|n:pop", &index ) )
+            return 0;
+        Py_ssize_t n = size();
+        if( n == 0 )
+        {
+            PyErr_SetString( PyExc_IndexError, "pop from empty list" );
+            return 0;
+        }
+        if( index < 0 )
+            index += n;
+        if( index < 0 || index >= n )
+        {
+            PyErr_SetString( PyExc_IndexError, "pop index out of range" );
+            return 0;
+        }
+        PyObjectPtr item( box( index ) );
+        if( !item )
+            return 0;  // LCOV_EXCL_LINE
+        m_data.clear();
+        if( !splice( index, index + 1, 0 ) )
+            return 0;
+        m_index = index;
+        return item.release();
+    }
+
+    PyObject* remove( PyObject* value )
+    {
+        Py_ssize_t index = find( value, 0, size() );
+        if( index == -2 )
+            return 0;
+        if( index == -1 )
+            return py_value_fail( "list.remove(x): x not in list" );
+        m_data.clear();
+        if( !splice( index, index + 1, 0 ) )
+            return 0;
+        return newref( Py_None );
+    }
+
+    PyObject* index( PyObject* args )
+    {
+        PyObject* value;
+        Py_ssize_t start = 0;
+        Py_ssize_t stop = PY_SSIZE_T_MAX;
+        if( !PyArg_ParseTuple( args, "O|nn:index", &value, &start, &stop ) )
+            return 0;
+        Py_ssize_t n = size();
+        if( start < 0 )
+        {
+            start += n;
+            if( start < 0 )
+                start = 0;
+        }
+        if( stop < 0 )
+        {
+            stop += n;
+            if( stop < 0 )
+                stop = 0;
+        }
+        Py_ssize_t index = find( value, start, stop );
+        if( index == -2 )
+            return 0;
+        if( index == -1 )
+        {
+            PyObjectPtr pyrepr( PyObject_Repr( value ) );
+            if( !pyrepr )
+                return 0;
+            PyErr_Format(
+                PyExc_ValueError, "%s is not in list", Py23Str_AS_STRING( pyrepr.get() )
+            );
+            return 0;
+        }
+        return Py23Int_FromSsize_t( index );
+    }
+
+    PyObject* count( PyObject* value )
+    {
+        Py_ssize_t count = 0;
+        for( Py_ssize_t i = 0; i < size(); ++i )
+        {
+            PyObjectPtr item( box( i ) );
+            if( !item )
+                return 0;  // LCOV_EXCL_LINE
+            int res = PyObject_RichCompareBool( item.get(), value, Py_EQ );
+            if( res < 0 )
+                return 0;
+            count += res;
+        }
+        return Py23Int_FromSsize_t( count );
+    }
+
+    PyObject* reverse()
+    {
+        if( nlist()->format == '?' )
+            reverse_items<char>( nlist()->items, size() );
+        else if( nlist()->format == 'q' )
+            reverse_items<int64_t>( nlist()->items, size() );
+        else
+            reverse_items<double>( nlist()->items, size() );
+        return newref( Py_None );
+    }
+
+    PyObject* sort( PyObject* args, PyObject* kwargs )
+    {
+#if PY_MAJOR_VERSION < 3
+        static char *kwlist[] = { "cmp", "key", "reverse", 0 };
+        PyObject* cmp = Py_None;
+#else
+        static char *kwlist[] = { "key", "reverse", 0 };
+#endif
+        PyObject* key = Py_None;
+        int rev = 0;
+#if PY_MAJOR_VERSION < 3
+        if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|OOi:sort", kwlist, &cmp, &key, &rev ) )
+            return 0;
+        if( cmp != Py_None )
+            return sort_boxed( args, kwargs );
+#else
+        if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|Oi:sort", kwlist, &key, &rev ) )
+            return 0;
+#endif
+        if( key != Py_None )
+            return sort_boxed( args, kwargs );
+        if( nlist()->format == '?' )
+            sort_items<unsigned char>( nlist()->items, size(), rev != 0 );
+        else if( nlist()->format == 'q' )
+            sort_items<int64_t>( nlist()->items, size(), rev != 0 );
+        else
+            sort_items<double>( nlist()->items, size(), rev != 0 );
+        return newref( Py_None );
+    }
+
+    PyObject* iadd( PyObject* value )
+    {
+        if( !validate_sequence( value ) )
+            return 0;
+        if( !splice( size(), size(), data_count() ) )
+            return 0;
+        return m_list.newref();
+    }
+
+    PyObject* imul( Py_ssize_t count )
+    {
+        Py_ssize_t n = size();
+        if( count <= 0 || n == 0 )
+        {
+            if( !NumList_Resize( nlist(), 0 ) )
+                return 0;
+            return m_list.newref();
+        }
+        if( n > PY_SSIZE_T_MAX / count )
+            return PyErr_NoMemory();
+        if( !NumList_Resize( nlist(), n * count ) )
+            return 0;
+        size_t nbytes = n * itemsize();
+        char* items = nlist()->items;
+        for( Py_ssize_t i = 1; i < count; ++i )
+            memcpy( items + i * nbytes, items, nbytes );
+        return m_list.newref();
+    }
+
+    PyObject* getitem( Py_ssize_t index )
+    {
+        if( index < 0 || index >= size() )
+        {
+            PyErr_SetString( PyExc_IndexError, "list index out of range" );
+            return 0;
+        }
+        return box( index );
+    }
+
+    PyObject* getitem( PyObject* key )
+    {
+        if( PyIndex_Check( key ) )
+        {
+            Py_ssize_t index = PyNumber_AsSsize_t( key, PyExc_IndexError );
+            if( index == -1 && PyErr_Occurred() )
+                return 0;
+            if( index < 0 )
+                index += size();
+            return getitem( index );
+        }
+        if( PySlice_Check( key ) )
+        {
+            Py_ssize_t start, stop, step, length;
+            if( PySlice_GetIndicesEx(
+                SLICE_CAST( key ), size(), &start, &stop, &step, &length ) < 0 )
+                return 0;
+            if( step == 1 )
+                return NumList_AsList( nlist(), start, start + length );
+            PyListPtr list( PyList_New( length ) );
+            if( !list )
+                return 0;
+            for( Py_ssize_t i = 0; i < length; ++i )
+            {
+                PyObject* item = box( start + i * step );
+                if( !item )
+                    return 0;  // LCOV_EXCL_LINE
+                list.set_item( i, item );
+            }
+            return list.release();
+        }
+        PyErr_Format(
+            PyExc_TypeError,
+            "list indices must be integers or slices, not %s",
+            Py_TYPE( key )->tp_name );
+        return 0;
+    }
+
+    int setitem( Py_ssize_t index, PyObject* value )
+    {
+        if( index < 0 || index >= size() )
+        {
+            PyErr_SetString( PyExc_IndexError, "list assignment index out of range" );
+            return -1;
+        }
+        if( !value )
+        {
+            m_data.clear();
+            return splice( index, index + 1, 0 ) ? 0 : -1;
+        }
+        if( !validate_single( value ) )
+            return -1;
+        // the validator may run arbitrary code, re-check the index
+        if( index >= size() )
+        {
+            PyErr_SetString( PyExc_IndexError, "list assignment index out of range" );
+            return -1;
+        }
+        memcpy( item_ptr( index ), &m_data[ 0 ], itemsize() );
+        return 0;
+    }
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        if( PyIndex_Check( key ) )
+        {
+            Py_ssize_t index = PyNumber_AsSsize_t( key, PyExc_IndexError );
+            if( index == -1 && PyErr_Occurred() )
+                return -1;
+            if( index < 0 )
+                index += size();
+            return setitem( index, value );
+        }
+        if( !PySlice_Check( key ) )
+        {
+            PyErr_Format(
+                PyExc_TypeError,
+                "list indices must be integers or slices, not %s",
+                Py_TYPE( key )->tp_name );
+            return -1;
+        }
+        Py_ssize_t start, stop, step, length;
+        if( PySlice_GetIndicesEx(
+            SLICE_CAST( key ), size(), &start, &stop, &step, &length ) < 0 )
+            return -1;
+        if( !value )
+            return delete_slice( start, step, length );
+        if( !validate_sequence( value ) )
+            return -1;
+        // the validators may run arbitrary code, recompute the indices
+        if( PySlice_GetIndicesEx(
+            SLICE_CAST( key ), size(), &start, &stop, &step, &length ) < 0 )
+            return -1;  // LCOV_EXCL_LINE
+        Py_ssize_t count = data_count();
+        if( step == 1 )
+            return splice( start, start + length, count ) ? 0 : -1;
+        if( count != length )
+        {
+            PyErr_Format(
+                PyExc_ValueError,
+                "attempt to assign sequence of size %zd to extended slice of size %zd",
+                count, length );
+            return -1;
+        }
+        for( Py_ssize_t i = 0; i < count; ++i )
+            memcpy( item_ptr( start + i * step ), &m_data[ i * itemsize() ], itemsize() );
+        return 0;
+    }
+
+protected:
+
+    AtomNumList* nlist()
+    {
+        return atomnumlist_cast( m_list.get() );
+    }
+
+    Member* validator()
+    {
+        return nlist()->validator;
+    }
+
+    CAtom* atom()
+    {
+        return nlist()->pointer->data();
+    }
+
+    Py_ssize_t size()
+    {
+        return nlist()->size;
+    }
+
+    size_t itemsize()
+    {
+        return format_itemsize( nlist()->format );
+    }
+
+    char* item_ptr( Py_ssize_t index )
+    {
+        return nlist()->items + index * itemsize();
+    }
+
+    PyObject* box( Py_ssize_t index )
+    {
+        return box_item( nlist()->format, item_ptr( index ) );
+    }
+
+    Py_ssize_t data_count()
+    {
+        return static_cast<Py_ssize_t>( m_data.size() / itemsize() );
+    }
+
+    // The items validated by the last operation, as Python objects.
+    PyObject* validated_item()
+    {
+        return box_item( nlist()->format, &m_data[ 0 ] );
+    }
+
+    PyObject* validated_items()
+    {
+        return box_items( nlist()->format, m_data.empty() ? 0 : &m_data[ 0 ], data_count() );
+    }
+
+    bool unbox_into( PyObject* value, size_t offset )
+    {
+        // Without an atom there is nothing to validate against, the
+        // value is only converted to the storage format.
+        if( validator() && atom() )
+        {
+            PyObjectPtr item( validator()->full_validate( atom(), Py_None, value ) );
+            if( !item )
+                return false;
+            return unbox_item( nlist()->format, item.get(), &m_data[ offset ] );
+        }
+        return unbox_item( nlist()->format, value, &m_data[ offset ] );
+    }
+
+    bool validate_single( PyObject* value )
+    {
+        m_data.resize( itemsize() );
+        return unbox_into( value, 0 );
+    }
+
+    bool validate_sequence( PyObject* value )
+    {
+        m_data.clear();
+        NumericBuffer buffer;
+        NumericBuffer::Boxing boxing = NumericBuffer::Native;
+        if( validator() && atom() && buffer.acquire( value ) &&
+            validator()->bulk_validate( buffer, boxing ) )
+            return validate_buffer( buffer, boxing );
+        buffer.release();
+        PyObjectPtr iter( PyObject_GetIter( value ) );
+        if( !iter )
+            return false;
+        size_t isize = itemsize();
+        while( true )
+        {
+            PyObjectPtr item( PyIter_Next( iter.get() ) );
+            if( !item )
+                return !PyErr_Occurred();
+            size_t offset = m_data.size();
+            m_data.resize( offset + isize );
+            if( !unbox_into( item.get(), offset ) )
+                return false;
+        }
+    }
+
+    bool validate_buffer( NumericBuffer& buffer, NumericBuffer::Boxing boxing )
+    {
+        char format = nlist()->format;
+        size_t isize = itemsize();
+        Py_ssize_t count = buffer.size();
+        m_data.resize( count * isize );
+        for( Py_ssize_t i = 0; i < count; ++i )
+        {
+            char* dst = &m_data[ i * isize ];
+            int64_t value;
+            if( format == 'd' )
+            {
+                double item = buffer.as_double( i );
+                memcpy( dst, &item, sizeof( double ) );
+            }
+            else if( boxing == NumericBuffer::Native && buffer.as_int64( i, value ) )
+            {
+                if( format == 'q' )
+                    memcpy( dst, &value, sizeof( int64_t ) );
+                else
+                    *dst = value != 0;
+            }
+            else
+            {
+                // values which need a Python conversion, such as the
+                // truncation of floats or too large unsigned integers
+                PyObjectPtr item( buffer.box( i, boxing ) );
+                if( !item || !unbox_item( format, item.get(), dst ) )
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Replace the items in [low, high) with the first count validated
+    // items.
+    bool splice( Py_ssize_t low, Py_ssize_t high, Py_ssize_t count )
+    {
+        AtomNumList* list = nlist();
+        size_t isize = itemsize();
+        Py_ssize_t size = list->size;
+        Py_ssize_t delta = count - ( high - low );
+        Py_ssize_t tail = size - high;
+        if( delta > 0 )
+        {
+            if( !NumList_Resize( list, size + delta ) )
+                return false;
+            memmove( item_ptr( high + delta ), item_ptr( high ), tail * isize );
+        }
+        else if( delta < 0 )
+        {
+            if( !NumList_CanResize( list ) )
+                return false;
+            memmove( item_ptr( high + delta ), item_ptr( high ), tail * isize );
+            NumList_Resize( list, size + delta );
+        }
+        if( count > 0 )
+            memcpy( item_ptr( low ), &m_data[ 0 ], count * isize );
+        return true;
+    }
+
+    int delete_slice( Py_ssize_t start, Py_ssize_t step, Py_ssize_t length )
+    {
+        m_data.clear();
+        if( length <= 0 )
+            return 0;
+        if( step == 1 )
+            return splice( start, start + length, 0 ) ? 0 : -1;
+        if( !NumList_CanResize( nlist() ) )
+            return -1;
+        if( step < 0 )
+        {
+            start += step * ( length - 1 );
+            step = -step;
+        }
+        size_t isize = itemsize();
+        Py_ssize_t n = size();
+        Py_ssize_t dst = start;
+        for( Py_ssize_t src = start; src < n; ++src )
+        {
+            if( src < start + step * length && ( src - start ) % step == 0 )
+                continue;
+            memmove( item_ptr( dst++ ), item_ptr( src ), isize );
+        }
+        return NumList_Resize( nlist(), n - length ) ? 0 : -1;
+    }
+
+    // Return the index of the first item equal to value in [start, stop),
+    // -1 if there is none and -2 on error.
+    Py_ssize_t find( PyObject* value, Py_ssize_t start, Py_ssize_t stop )
+    {
+        for( Py_ssize_t i = start; i < stop && i < size(); ++i )
+        {
+            PyObjectPtr item( box( i ) );
+            if( !item )
+                return -2;  // LCOV_EXCL_LINE
+            int res = PyObject_RichCompareBool( item.get(), value, Py_EQ );
+            if( res < 0 )
+                return -2;
+            if( res == 1 )
+                return i;
+        }
+        return -1;
+    }
+
+    PyObject* sort_boxed( PyObject* args, PyObject* kwargs )
+    {
+        // Sorting with a key or a comparison function needs the boxed
+        // items, the sorted objects are then stored back.
+        PyListPtr items( NumList_AsList( nlist(), 0, size() ) );
+        if( !items )
+            return 0;
+        PyObjectPtr method( PyObject_GetAttrString( items.get(), "sort" ) );
+        if( !method )
+            return 0;  // LCOV_EXCL_LINE
+        PyObjectPtr res( PyObject_Call( method.get(), args, kwargs ) );
+        if( !res )
+            return 0;
+        if( items.size() != size() )
+            return py_value_fail( "list modified during sort" );
+        for( Py_ssize_t i = 0; i < size(); ++i )
+        {
+            if( !unbox_item( nlist()->format, items.borrow_item( i ), item_ptr( i ) ) )
+                return 0;  // LCOV_EXCL_LINE
+        }
+        return res.release();
+    }
+
+    PyObjectPtr m_list;
+    std::vector<char> m_data;
+    Py_ssize_t m_index;
+
+private:
+
+    AtomNumListHandler();
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomNumList_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    static char *kwlist[] = { 0 };
+    if( !PyArg_ParseTupleAndKeywords( args, kwargs, "", kwlist ) )
+        return 0;
+    PyObjectPtr ptr( PyType_GenericNew( type, 0, 0 ) );
+    if( !ptr )
+        return 0;
+    AtomNumList* self = atomnumlist_cast( ptr.get() );
+    self->pointer = new CAtomPointer();
+    self->format = 'd';
+    return ptr.release();
+}
+
+
+static int
+AtomNumList_clear( AtomNumList* self )
+{
+    Py_CLEAR( self->validator );
+    return 0;
+}
+
+
+static int
+AtomNumList_traverse( AtomNumList* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->validator );
+    return 0;
+}
+
+
+static void
+AtomNumList_dealloc( AtomNumList* self )
+{
+    PyObject_GC_UnTrack( self );
+    delete self->pointer;
+    self->pointer = 0;
+    Py_CLEAR( self->validator );
+    PyMem_Free( self->items );
+    self->items = 0;
+    Py_TYPE( self )->tp_free( pyobject_cast( self ) );
+}
+
+
+static PyObject*
+AtomNumList_repr( AtomNumList* self )
+{
+    PyObjectPtr items( NumList_AsList( self, 0, self->size ) );
+    if( !items )
+        return 0;
+    return PyObject_Repr( items.get() );
+}
+
+
+static PyObject*
+AtomNumList_richcompare( AtomNumList* self, PyObject* other, int op )
+{
+    PyObjectPtr items( NumList_AsList( self, 0, self->size ) );
+    if( !items )
+        return 0;
+    PyObjectPtr others( newref( other ) );
+    if( AtomNumList_Check( other ) )
+    {
+        AtomNumList* o = atomnumlist_cast( other );
+        others = NumList_AsList( o, 0, o->size );
+        if( !others )
+            return 0;
+    }
+    return PyObject_RichCompare( items.get(), others.get(), op );
+}
+
+
+static PyObject*
+AtomNumList_append( AtomNumList* self, PyObject* value )
+{
+    return AtomNumListHandler( self ).append( value );
+}
+
+
+static PyObject*
+AtomNumList_insert( AtomNumList* self, PyObject* args )
+{
+    return AtomNumListHandler( self ).insert( args );
+}
+
+
+static PyObject*
+AtomNumList_extend( AtomNumList* self, PyObject* value )
+{
+    return AtomNumListHandler( self ).extend( value );
+}
+
+
+static PyObject*
+AtomNumList_pop( AtomNumList* self, PyObject* args )
+{
+    return AtomNumListHandler( self ).pop( args );
+}
+
+
+static PyObject*
+AtomNumList_remove( AtomNumList* self, PyObject* value )
+{
+    return AtomNumListHandler( self ).remove( value );
+}
+
+
+static PyObject*
+AtomNumList_index( AtomNumList* self, PyObject* args )
+{
+    return AtomNumListHandler( self ).index( args );
+}
+
+
+static PyObject*
+AtomNumList_count( AtomNumList* self, PyObject* value )
+{
+    return AtomNumListHandler( self ).count( value );
+}
+
+
+static PyObject*
+AtomNumList_reverse( AtomNumList* self )
+{
+    return AtomNumListHandler( self ).reverse();
+}
+
+
+static PyObject*
+AtomNumList_sort( AtomNumList* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomNumListHandler( self ).sort( args, kwargs );
+}
+
+
+static PyObject*
+AtomNumList_reduce_ex( AtomNumList* self, PyObject* proto )
+{
+    // Like an atomlist, an atomnumlist is pickled as a normal list and
+    // assigning it to the member on unpickling recreates the storage.
+    PyObjectPtr data( NumList_AsList( self, 0, self->size ) );
+    if( !data )
+        return 0;
+    PyTuplePtr res( PyTuple_New( 2 ) );
+    if( !res )
+        return 0;
+    PyTuplePtr args( PyTuple_New( 1 ) );
+    if( !args )
+        return 0;
+    args.set_item( 0, data );
+    res.set_item( 0, newref( pyobject_cast( &PyList_Type ) ) );
+    res.set_item( 1, args );
+    return res.release();
+}
+
+
+static PyObject*
+AtomNumList_sizeof( AtomNumList* self, PyObject* args )
+{
+    Py_ssize_t size = Py_TYPE( self )->tp_basicsize;
+    size += self->allocated * format_itemsize( self->format );
+    return Py23Int_FromSsize_t( size );
+}
+
+
+static Py_ssize_t
+AtomNumList_length( AtomNumList* self )
+{
+    return self->size;
+}
+
+
+static PyObject*
+AtomNumList_item( AtomNumList* self, Py_ssize_t index )
+{
+    return AtomNumListHandler( self ).getitem( index );
+}
+
+
+static PyObject*
+AtomNumList_concat( AtomNumList* self, PyObject* value )
+{
+    PyObjectPtr items( NumList_AsList( self, 0, self->size ) );
+    if( !items )
+        return 0;
+    return PySequence_Concat( items.get(), value );
+}
+
+
+static int
+AtomNumList_ass_item( AtomNumList* self, Py_ssize_t index, PyObject* value )
+{
+    return AtomNumListHandler( self ).setitem( index, value );
+}
+
+
+static PyObject*
+AtomNumList_inplace_concat( AtomNumList* self, PyObject* value )
+{
+    return AtomNumListHandler( self ).iadd( value );
+}
+
+
+static PyObject*
+AtomNumList_inplace_repeat( AtomNumList* self, Py_ssize_t count )
+{
+    return AtomNumListHandler( self ).imul( count );
+}
+
+
+static PyObject*
+AtomNumList_subscript( AtomNumList* self, PyObject* key )
+{
+    return AtomNumListHandler( self ).getitem( key );
+}
+
+
+static int
+AtomNumList_ass_subscript( AtomNumList* self, PyObject* key, PyObject* value )
+{
+    return AtomNumListHandler( self ).setitem( key, value );
+}
+
+
+static int
+AtomNumList_getbuffer( AtomNumList* self, Py_buffer* view, int flags )
+{
+    // The items are exported read-only since writing through the buffer
+    // would bypass the validation.
+    if( ( flags & PyBUF_WRITABLE ) == PyBUF_WRITABLE )
+    {
+        PyErr_SetString( PyExc_BufferError, "atomnumlist buffers are read-only" );
+        view->obj = 0;
+        return -1;
+    }
+    static char empty = 0;
+    view->obj = newref( pyobject_cast( self ) );
+    view->buf = self->items ? self->items : &empty;
+    view->len = self->size * format_itemsize( self->format );
+    view->readonly = 1;
+    view->itemsize = format_itemsize( self->format );
+    view->format = 0;
+    if( ( flags & PyBUF_FORMAT ) == PyBUF_FORMAT )
+        view->format = const_cast<char*>( format_string( self->format ) );
+    view->ndim = 1;
+    view->shape = 0;
+    if( ( flags & PyBUF_ND ) == PyBUF_ND )
+        view->shape = &self->size;
+    view->strides = 0;
+    if( ( flags & PyBUF_STRIDES ) == PyBUF_STRIDES )
+        view->strides = &view->itemsize;
+    view->suboffsets = 0;
+    view->internal = 0;
+    ++self->exports;
+    return 0;
+}
+
+
+static void
+AtomNumList_releasebuffer( AtomNumList* self, Py_buffer* view )
+{
+    --self->exports;
+}
+
+
+PyDoc_STRVAR( n_append_doc,
+"L.append(object) -- append object to end" );
+PyDoc_STRVAR( n_insert_doc,
+"L.insert(index, object) -- insert object before index" );
+PyDoc_STRVAR( n_extend_doc,
+"L.extend(iterable) -- extend list by appending elements from the iterable" );
+PyDoc_STRVAR( n_pop_doc,
+"L.pop([index]) -> item -- remove and return item at index (default last).\n"
+"Raises IndexError if list is empty or index is out of range." );
+PyDoc_STRVAR( n_remove_doc,
+"L.remove(value) -- remove first occurrence of value.\n"
+"Raises ValueError if the value is not present." );
+PyDoc_STRVAR( n_index_doc,
+"L.index(value, [start, [stop]]) -> integer -- return first index of value.\n"
+"Raises ValueError if the value is not present." );
+PyDoc_STRVAR( n_count_doc,
+"L.count(value) -> integer -- return number of occurrences of value" );
+PyDoc_STRVAR( n_reverse_doc,
+"L.reverse() -- reverse *IN PLACE*" );
+PyDoc_STRVAR( n_sort_doc,
+"L.sort(key=None, reverse=False) -- stable sort *IN PLACE*" );
+PyDoc_STRVAR( n_sizeof_doc,
+"L.__sizeof__() -- size of L in memory, in bytes" );
+PyDoc_STRVAR( n_batch_doc,
+"L.batch() -> context manager -- emit a single 'batch' change for all the\n"
+"modifications made in the context, instead of one change per operation." );
+
+
+static PyMethodDef
+AtomNumList_methods[] = {
+    { "append", ( PyCFunction )AtomNumList_append, METH_O, n_append_doc },
+    { "insert", ( PyCFunction )AtomNumList_insert, METH_VARARGS, n_insert_doc },
+    { "extend", ( PyCFunction )AtomNumList_extend, METH_O, n_extend_doc },
+    { "pop", ( PyCFunction )AtomNumList_pop, METH_VARARGS, n_pop_doc },
+    { "remove", ( PyCFunction )AtomNumList_remove, METH_O, n_remove_doc },
+    { "index", ( PyCFunction )AtomNumList_index, METH_VARARGS, n_index_doc },
+    { "count", ( PyCFunction )AtomNumList_count, METH_O, n_count_doc },
+    { "reverse", ( PyCFunction )AtomNumList_reverse, METH_NOARGS, n_reverse_doc },
+    { "sort", ( PyCFunction )AtomNumList_sort, METH_VARARGS | METH_KEYWORDS, n_sort_doc },
+    { "__reduce_ex__", ( PyCFunction )AtomNumList_reduce_ex, METH_O, "" },
+    { "__sizeof__", ( PyCFunction )AtomNumList_sizeof, METH_NOARGS, n_sizeof_doc },
+    { 0 }  /* sentinel */
+};
+
+
+static PySequenceMethods
+AtomNumList_as_sequence = {
+    (lenfunc)AtomNumList_length,                /* sq_length */
+    (binaryfunc)AtomNumList_concat,             /* sq_concat */
+    (ssizeargfunc)0,                            /* sq_repeat */
+    (ssizeargfunc)AtomNumList_item,             /* sq_item */
+#if PY_MAJOR_VERSION >= 3
+    (void *)0,                                  /* sq_slice */
+#else
+    (ssizessizeargfunc)0,                       /* sq_slice */
+#endif
+    (ssizeobjargproc)AtomNumList_ass_item,      /* sq_ass_item */
+#if PY_MAJOR_VERSION >= 3
+    (void *)0,                                  /* sq_ass_slice */
+#else
+    (ssizessizeobjargproc)0,                    /* sq_ass_slice */
+#endif
+    (objobjproc)0,                              /* sq_contains */
+    (binaryfunc)AtomNumList_inplace_concat,     /* sq_inplace_concat */
+    (ssizeargfunc)AtomNumList_inplace_repeat,   /* sq_inplace_repeat */
+};
+
+
+static PyMappingMethods
+AtomNumList_as_mapping = {
+    (lenfunc)AtomNumList_length,                /* mp_length */
+    (binaryfunc)AtomNumList_subscript,          /* mp_subscript */
+    (objobjargproc)AtomNumList_ass_subscript    /* mp_ass_subscript */
+};
+
+
+static PyBufferProcs
+AtomNumList_as_buffer = {
+#if PY_MAJOR_VERSION < 3
+    (readbufferproc)0,                          /* bf_getreadbuffer */
+    (writebufferproc)0,                         /* bf_getwritebuffer */
+    (segcountproc)0,                            /* bf_getsegcount */
+    (charbufferproc)0,                          /* bf_getcharbuffer */
+#endif
+    (getbufferproc)AtomNumList_getbuffer,       /* bf_getbuffer */
+    (releasebufferproc)AtomNumList_releasebuffer /* bf_releasebuffer */
+};
+
+
+#if PY_MAJOR_VERSION >= 3
+#define NUMLIST_TPFLAGS Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC
+#else
+#define NUMLIST_TPFLAGS Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC|Py_TPFLAGS_HAVE_NEWBUFFER
+#endif
+
+
+PyTypeObject AtomNumList_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomnumlist" ),      /* tp_name */
+    sizeof( AtomNumList ),                  /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomNumList_dealloc,        /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)AtomNumList_repr,             /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)&AtomNumList_as_sequence, /* tp_as_sequence */
+    (PyMappingMethods*)&AtomNumList_as_mapping,   /* tp_as_mapping */
+    (hashfunc)PyObject_HashNotImplemented,  /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)&AtomNumList_as_buffer, /* tp_as_buffer */
+    NUMLIST_TPFLAGS,                        /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)AtomNumList_traverse,     /* tp_traverse */
+    (inquiry)AtomNumList_clear,             /* tp_clear */
+    (richcmpfunc)AtomNumList_richcompare,   /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomNumList_methods, /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    0,                                      /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)PyType_GenericAlloc,         /* tp_alloc */
+    (newfunc)AtomNumList_new,               /* tp_new */
+    (freefunc)PyObject_GC_Del,              /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+/*-----------------------------------------------------------------------------
+| AtomNumCList Type
+|----------------------------------------------------------------------------*/
+namespace PySStr
+{
+
+_STATIC_STRING( type )
+_STATIC_STRING( name )
+_STATIC_STRING( object )
+_STATIC_STRING( value )
+_STATIC_STRING( operation )
+_STATIC_STRING( item )
+_STATIC_STRING( items )
+_STATIC_STRING( index )
+#if PY_MAJOR_VERSION < 3
+_STATIC_STRING( cmp )
+#endif
+_STATIC_STRING( key )
+_STATIC_STRING( reverse )
+_STATIC_STRING( container )
+_STATIC_STRING( __delitem__ )
+_STATIC_STRING( __iadd__ )
+_STATIC_STRING( __imul__ )
+_STATIC_STRING( __setitem__ )
+_STATIC_STRING( append )
+_STATIC_STRING( extend )
+_STATIC_STRING( insert )
+_STATIC_STRING( pop )
+_STATIC_STRING( remove )
+_STATIC_STRING( sort )
+_STATIC_STRING( olditem )
+_STATIC_STRING( newitem )
+_STATIC_STRING( count )
+_STATIC_STRING( batch )
+_STATIC_STRING( removed )
+_STATIC_STRING( inserted )
+
+}  // namespace PySStr
+
+
+namespace
+{
+
+// Emits the same container notifications as an atomclist.
+class AtomNumCListHandler : public AtomNumListHandler
+{
+
+public:
+
+    AtomNumCListHandler( AtomNumCList* list ) :
+        AtomNumListHandler( atomnumlist_cast( list ) ),
+        m_obsm( false ), m_obsa( false ) {}
+
+    PyObject* append( PyObject* value )
+    {
+        PyObjectPtr res( AtomNumListHandler::append( value ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr item( validated_item() );
+            if( !item )
+                return 0;  // LCOV_EXCL_LINE
+            if( !post_item_change( PySStr::append(), PySStr::item(), item ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* insert( PyObject* args )
+    {
+        PyObjectPtr res( AtomNumListHandler::insert( args ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::insert() ) )
+                return 0;
+            PyObjectPtr index( Py23Int_FromSsize_t( m_index ) );
+            if( !c.set_item( PySStr::index(), index ) )
+                return 0;
+            PyObjectPtr item( validated_item() );
+            if( !c.set_item( PySStr::item(), item ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* extend( PyObject* value )
+    {
+        PyObjectPtr res( AtomNumListHandler::extend( value ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr items( validated_items() );
+            if( !items )
+                return 0;  // LCOV_EXCL_LINE
+            if( !post_item_change( PySStr::extend(), PySStr::items(), items ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* pop( PyObject* args )
+    {
+        PyObjectPtr res( AtomNumListHandler::pop( args ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::pop() ) )
+                return 0;
+            PyObjectPtr index( Py23Int_FromSsize_t( m_index ) );
+            if( !c.set_item( PySStr::index(), index ) )
+                return 0;
+            if( !c.set_item( PySStr::item(), res ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* remove( PyObject* value )
+    {
+        PyObjectPtr res( AtomNumListHandler::remove( value ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr item( newref( value ) );
+            if( !post_item_change( PySStr::remove(), PySStr::item(), item ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* reverse()
+    {
+        PyObjectPtr res( AtomNumListHandler::reverse() );
+        if( !res )
+            return 0;  // LCOV_EXCL_LINE
+        if( observer_check() )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::reverse() ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* sort( PyObject* args, PyObject* kwargs )
+    {
+#if PY_MAJOR_VERSION < 3
+        static char *kwlist[] = { "cmp", "key", "reverse", 0 };
+#else
+        static char *kwlist[] = { "key", "reverse", 0 };
+#endif
+        PyObjectPtr res( AtomNumListHandler::sort( args, kwargs ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyDictPtr c( prepare_change() );
+            if( !c )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::operation(), PySStr::sort() ) )
+                return 0;
+            PyObject* key = Py_None;
+            int rev = 0;
+#if PY_MAJOR_VERSION < 3
+            PyObject* cmp = Py_None;
+            if( !PyArg_ParseTupleAndKeywords(
+                args, kwargs, "|OOi", kwlist, &cmp, &key, &rev ) )
+                return 0;  // LCOV_EXCL_LINE
+            if( !c.set_item( PySStr::cmp(), cmp ) )
+                return 0;
+#else
+            if( !PyArg_ParseTupleAndKeywords(
+                args, kwargs, "|Oi", kwlist, &key, &rev ) )
+                return 0;  // LCOV_EXCL_LINE
+#endif
+            if( !c.set_item( PySStr::key(), key ) )
+                return 0;
+            if( !c.set_item( PySStr::reverse(), rev ? Py_True : Py_False ) )
+                return 0;
+            if( !post_change( c ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* iadd( PyObject* value )
+    {
+        PyObjectPtr res( AtomNumListHandler::iadd( value ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr items( validated_items() );
+            if( !items )
+                return 0;  // LCOV_EXCL_LINE
+            if( !post_item_change( PySStr::__iadd__(), PySStr::items(), items ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    PyObject* imul( Py_ssize_t count )
+    {
+        PyObjectPtr res( AtomNumListHandler::imul( count ) );
+        if( !res )
+            return 0;
+        if( observer_check() )
+        {
+            PyObjectPtr pycount( Py23Int_FromSsize_t( count ) );
+            if( !pycount )
+                return 0;  // LCOV_EXCL_LINE
+            if( !post_item_change( PySStr::__imul__(), PySStr::count(), pycount ) )
+                return 0;
+        }
+        return res.release();
+    }
+
+    int setitem( Py_ssize_t index, PyObject* value )
+    {
+        PyObjectPtr olditem;
+        bool obs = observer_check();
+        if( obs )
+        {
+            olditem = AtomNumListHandler::getitem( index );
+            if( !olditem )
+                return -1;
+        }
+        int res = AtomNumListHandler::setitem( index, value );
+        if( res < 0 || !obs )
+            return res;
+        PyObjectPtr pyindex( Py23Int_FromSsize_t( index ) );
+        if( !pyindex )
+            return -1;  // LCOV_EXCL_LINE
+        return post_setitem_change( pyindex, olditem, value, false );
+    }
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        PyObjectPtr olditem;
+        bool obs = observer_check();
+        if( obs )
+        {
+            olditem = AtomNumListHandler::getitem( key );
+            if( !olditem )
+                return -1;
+        }
+        int res = AtomNumListHandler::setitem( key, value );
+        if( res < 0 || !obs )
+            return res;
+        PyObjectPtr index( newref( key ) );
+        return post_setitem_change( index, olditem, value, PySlice_Check( key ) );
+    }
+
+    bool post_batch_change( PyObject* snapshot )
+    {
+        // The snapshot holds the raw item data at the start of the batch
+        // so the untouched prefix and suffix are found by comparing bytes.
+        if( !observer_check() )
+            return true;
+        size_t itemsize = format_itemsize( nlist()->format );
+        const char* old = PyBytes_AS_STRING( snapshot );
+        const char* cur = nlist()->items;
+        Py_ssize_t oldsize = PyBytes_GET_SIZE( snapshot ) / itemsize;
+        Py_ssize_t cursize = size();
+        Py_ssize_t limit = oldsize < cursize ? oldsize : cursize;
+        Py_ssize_t start = 0;
+        while( start < limit &&
+               memcmp( old + start * itemsize, cur + start * itemsize, itemsize ) == 0 )
+            ++start;
+        Py_ssize_t tail = 0;
+        while( tail < limit - start &&
+               memcmp( old + ( oldsize - tail - 1 ) * itemsize,
+                       cur + ( cursize - tail - 1 ) * itemsize, itemsize ) == 0 )
+            ++tail;
+        if( start + tail == oldsize && start + tail == cursize )
+            return true;
+        PyObjectPtr removed( box_items(
+            nlist()->format, old + start * itemsize, oldsize - tail - start ) );
+        if( !removed )
+            return false;  // LCOV_EXCL_LINE
+        PyObjectPtr inserted( NumList_AsList( nlist(), start, cursize - tail ) );
+        if( !inserted )
+            return false;  // LCOV_EXCL_LINE
+        PyObjectPtr index( Py23Int_FromSsize_t( start ) );
+        if( !index )
+            return false;  // LCOV_EXCL_LINE
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), PySStr::batch() ) )
+            return false;
+        if( !c.set_item( PySStr::index(), index ) )
+            return false;
+        if( !c.set_item( PySStr::removed(), removed ) )
+            return false;
+        if( !c.set_item( PySStr::inserted(), inserted ) )
+            return false;
+        return post_change( c );
+    }
+
+private:
+
+    AtomNumCListHandler();
+
+    AtomNumCList* nclist()
+    {
+        return atomnumclist_cast( m_list.get() );
+    }
+
+    Member* member()
+    {
+        return nclist()->member;
+    }
+
+    bool observer_check()
+    {
+        m_obsm = false;
+        m_obsa = false;
+        if( !member() || !atom() || nclist()->batch_depth > 0 )
+            return false;
+        m_obsm = member()->has_observers();
+        m_obsa = atom()->has_observers( member()->name );
+        return m_obsm || m_obsa;
+    }
+
+    PyObject* prepare_change()
+    {
+        PyDictPtr c( PyDict_New() );
+        if( !c )
+            return 0;
+        if( !c.set_item( PySStr::type(), PySStr::container() ) )
+            return 0;
+        if( !c.set_item( PySStr::name(), member()->name ) )
+            return 0;
+        if( !c.set_item( PySStr::object(), pyobject_cast( atom() ) ) )
+            return 0;
+        if( !c.set_item( PySStr::value(), m_list.get() ) )
+            return 0;
+        return c.release();
+    }
+
+    bool post_change( PyObjectPtr& change )
+    {
+        PyTuplePtr args( PyTuple_New( 1 ) );
+        if( !args )
+            return false;
+        args.set_item( 0, change );
+        ChangeTrace::record( ChangeTrace::Container, atom(), member() );
+        if( m_obsm )
+        {
+            if( !member()->notify( atom(), args.get(), 0 ) )
+                return false;
+        }
+        if( m_obsa )
+        {
+            if( !atom()->notify( member()->name, args.get(), 0 ) )
+                return false;
+        }
+        return true;
+    }
+
+    bool post_item_change( PyObject* operation, PyObject* key, PyObjectPtr& value )
+    {
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), operation ) )
+            return false;
+        if( !c.set_item( key, value ) )
+            return false;
+        return post_change( c );
+    }
+
+    int post_setitem_change( PyObjectPtr& i, PyObjectPtr& o, PyObject* value, bool slice )
+    {
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return -1;
+        if( value )
+        {
+            if( !c.set_item( PySStr::operation(), PySStr::__setitem__() ) )
+                return -1;
+            if( !c.set_item( PySStr::olditem(), o ) )
+                return -1;
+            PyObjectPtr n( slice ? validated_items() : validated_item() );
+            if( !c.set_item( PySStr::newitem(), n ) )
+                return -1;
+        }
+        else
+        {
+            if( !c.set_item( PySStr::operation(), PySStr::__delitem__() ) )
+                return -1;
+            if( !c.set_item( PySStr::item(), o ) )
+                return -1;
+        }
+        if( !c.set_item( PySStr::index(), i ) )
+            return -1;
+        if( !post_change( c ) )
+            return -1;
+        return 0;
+    }
+
+    bool m_obsm;
+    bool m_obsa;
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomNumCList_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    return AtomNumList_Type.tp_new( type, args, kwargs );
+}
+
+
+static int
+AtomNumCList_clear( AtomNumCList* self )
+{
+    Py_CLEAR( self->member );
+    Py_CLEAR( self->batch_snapshot );
+    return AtomNumList_clear( atomnumlist_cast( self ) );
+}
+
+
+static int
+AtomNumCList_traverse( AtomNumCList* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->member );
+    return AtomNumList_traverse( atomnumlist_cast( self ), visit, arg );
+}
+
+
+static void
+AtomNumCList_dealloc( AtomNumCList* self )
+{
+    PyObject_GC_UnTrack( self );
+    Py_CLEAR( self->member );
+    Py_CLEAR( self->batch_snapshot );
+    AtomNumList_dealloc( atomnumlist_cast( self ) );
+}
+
+
+static PyObject*
+AtomNumCList_append( AtomNumCList* self, PyObject* value )
+{
+    return AtomNumCListHandler( self ).append( value );
+}
+
+
+static PyObject*
+AtomNumCList_insert( AtomNumCList* self, PyObject* args )
+{
+    return AtomNumCListHandler( self ).insert( args );
+}
+
+
+static PyObject*
+AtomNumCList_extend( AtomNumCList* self, PyObject* value )
+{
+    return AtomNumCListHandler( self ).extend( value );
+}
+
+
+static PyObject*
+AtomNumCList_pop( AtomNumCList* self, PyObject* args )
+{
+    return AtomNumCListHandler( self ).pop( args );
+}
+
+
+static PyObject*
+AtomNumCList_remove( AtomNumCList* self, PyObject* value )
+{
+    return AtomNumCListHandler( self ).remove( value );
+}
+
+
+static PyObject*
+AtomNumCList_reverse( AtomNumCList* self )
+{
+    return AtomNumCListHandler( self ).reverse();
+}
+
+
+static PyObject*
+AtomNumCList_sort( AtomNumCList* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomNumCListHandler( self ).sort( args, kwargs );
+}
+
+
+static PyObject*
+AtomNumCList_batch( AtomNumCList* self )
+{
+    return ContainerBatch_New( pyobject_cast( self ) );
+}
+
+
+static int
+AtomNumCList_ass_item( AtomNumCList* self, Py_ssize_t index, PyObject* value )
+{
+    return AtomNumCListHandler( self ).setitem( index, value );
+}
+
+
+static PyObject*
+AtomNumCList_inplace_concat( AtomNumCList* self, PyObject* value )
+{
+    return AtomNumCListHandler( self ).iadd( value );
+}
+
+
+static PyObject*
+AtomNumCList_inplace_repeat( AtomNumCList* self, Py_ssize_t count )
+{
+    return AtomNumCListHandler( self ).imul( count );
+}
+
+
+static int
+AtomNumCList_ass_subscript( AtomNumCList* self, PyObject* key, PyObject* value )
+{
+    return AtomNumCListHandler( self ).setitem( key, value );
+}
+
+
+static PyMethodDef
+AtomNumCList_methods[] = {
+    { "append", ( PyCFunction )AtomNumCList_append, METH_O, n_append_doc },
+    { "insert", ( PyCFunction )AtomNumCList_insert, METH_VARARGS, n_insert_doc },
+    { "extend", ( PyCFunction )AtomNumCList_extend, METH_O, n_extend_doc },
+    { "pop", ( PyCFunction )AtomNumCList_pop, METH_VARARGS, n_pop_doc },
+    { "remove", ( PyCFunction )AtomNumCList_remove, METH_O, n_remove_doc },
+    { "reverse", ( PyCFunction )AtomNumCList_reverse, METH_NOARGS, n_reverse_doc },
+    { "sort", ( PyCFunction )AtomNumCList_sort, METH_VARARGS | METH_KEYWORDS, n_sort_doc },
+    { "batch", ( PyCFunction )AtomNumCList_batch, METH_NOARGS, n_batch_doc },
+    { 0 }  /* sentinel */
+};
+
+
+static PySequenceMethods
+AtomNumCList_as_sequence = {
+    (lenfunc)AtomNumList_length,                /* sq_length */
+    (binaryfunc)AtomNumList_concat,             /* sq_concat */
+    (ssizeargfunc)0,                            /* sq_repeat */
+    (ssizeargfunc)AtomNumList_item,             /* sq_item */
+#if PY_MAJOR_VERSION >= 3
+    (void *)0,                                  /* sq_slice */
+#else
+    (ssizessizeargfunc)0,                       /* sq_slice */
+#endif
+    (ssizeobjargproc)AtomNumCList_ass_item,     /* sq_ass_item */
+#if PY_MAJOR_VERSION >= 3
+    (void *)0,                                  /* sq_ass_slice */
+#else
+    (ssizessizeobjargproc)0,                    /* sq_ass_slice */
+#endif
+    (objobjproc)0,                              /* sq_contains */
+    (binaryfunc)AtomNumCList_inplace_concat,    /* sq_inplace_concat */
+    (ssizeargfunc)AtomNumCList_inplace_repeat,  /* sq_inplace_repeat */
+};
+
+
+static PyMappingMethods
+AtomNumCList_as_mapping = {
+    (lenfunc)AtomNumList_length,                /* mp_length */
+    (binaryfunc)AtomNumList_subscript,          /* mp_subscript */
+    (objobjargproc)AtomNumCList_ass_subscript   /* mp_ass_subscript */
+};
+
+
+PyTypeObject AtomNumCList_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomnumclist" ),     /* tp_name */
+    sizeof( AtomNumCList ),                 /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomNumCList_dealloc,       /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)AtomNumList_repr,             /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)&AtomNumCList_as_sequence, /* tp_as_sequence */
+    (PyMappingMethods*)&AtomNumCList_as_mapping,   /* tp_as_mapping */
+    (hashfunc)PyObject_HashNotImplemented,  /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)&AtomNumList_as_buffer, /* tp_as_buffer */
+    NUMLIST_TPFLAGS,                        /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)AtomNumCList_traverse,    /* tp_traverse */
+    (inquiry)AtomNumCList_clear,            /* tp_clear */
+    (richcmpfunc)AtomNumList_richcompare,   /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomNumCList_methods, /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    &AtomNumList_Type,                      /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)0,                           /* tp_alloc */
+    (newfunc)AtomNumCList_new,              /* tp_new */
+    (freefunc)0,                            /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+char
+AtomNumList_Format( Member* validator )
+{
+    if( !validator )
+        return 0;
+    switch( validator->get_validate_mode() )
+    {
+        case Validate::Float:
+        case Validate::FloatPromote:
+        case Validate::FloatRange:
+            return 'd';
+        case Validate::Int:
+        case Validate::IntPromote:
+        case Validate::Long:
+        case Validate::LongPromote:
+        case Validate::Range:
+            return 'q';
+        case Validate::Bool:
+            return '?';
+        default:
+            return 0;
+    }
+}
+
+
+PyObject*
+AtomNumList_New( CAtom* atom, Member* validator )
+{
+    return NumList_Create( &AtomNumList_Type, atom, validator );
+}
+
+
+PyObject*
+AtomNumCList_New( CAtom* atom, Member* validator, Member* member )
+{
+    PyObjectPtr ptr( NumList_Create( &AtomNumCList_Type, atom, validator ) );
+    if( !ptr )
+        return 0;
+    Py_INCREF( pyobject_cast( member ) );
+    atomnumclist_cast( ptr.get() )->member = member;
+    return ptr.release();
+}
+
+
+int
+AtomNumList_Extend( PyObject* list, PyObject* value )
+{
+    PyObjectPtr res( AtomNumListHandler( atomnumlist_cast( list ) ).extend( value ) );
+    return res ? 0 : -1;
+}
+
+
+bool
+AtomNumCList_BeginBatch( PyObject* list )
+{
+    AtomNumCList* self = atomnumclist_cast( list );
+    if( self->batch_depth == 0 )
+    {
+        AtomNumList* nlist = atomnumlist_cast( list );
+        PyObject* snapshot = PyBytes_FromStringAndSize(
+            nlist->items, nlist->size * format_itemsize( nlist->format ) );
+        if( !snapshot )
+            return false;  // LCOV_EXCL_LINE
+        PyObject* old = self->batch_snapshot;
+        self->batch_snapshot = snapshot;
+        Py_XDECREF( old );
+    }
+    ++self->batch_depth;
+    return true;
+}
+
+
+bool
+AtomNumCList_EndBatch( PyObject* list )
+{
+    AtomNumCList* self = atomnumclist_cast( list );
+    if( self->batch_depth <= 0 )
+        return true;  // LCOV_EXCL_LINE
+    if( --self->batch_depth > 0 )
+        return true;
+    PyObjectPtr snapshot( self->batch_snapshot );
+    self->batch_snapshot = 0;
+    if( !snapshot )
+        return true;  // LCOV_EXCL_LINE
+    return AtomNumCListHandler( self ).post_batch_change( snapshot.get() );
+}
+
+
+int
+import_atomnumlist()
+{
+    if( PyType_Ready( &AtomNumList_Type ) < 0 )
+        return -1;
+    if( PyType_Ready( &AtomNumCList_Type ) < 0 )
+        return -1;
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "catom.h"
+#include "catompointer.h"
+#include "member.h"
+
+
+#define atomnumlist_cast( o ) ( reinterpret_cast<AtomNumList*>( o ) )
+#define atomnumclist_cast( o ) ( reinterpret_cast<AtomNumCList*>( o ) )
+#define AtomNumList_Check( o ) ( PyObject_TypeCheck( o, &AtomNumList_Type ) )
+#define AtomNumCList_Check( o ) ( PyObject_TypeCheck( o, &AtomNumCList_Type ) )
+
+
+// A list of numbers stored unboxed in a contiguous native array. The
+// format is the struct code of the items: 'd', 'q' or '?'.
+typedef struct {
+    PyObject_HEAD
+    char* items;
+    Py_ssize_t size;
+    Py_ssize_t allocated;
+    Py_ssize_t exports;
+    Member* validator;
+    CAtomPointer* pointer;
+    char format;
+} AtomNumList;
+
+
+typedef struct {
+    AtomNumList atomnumlist;
+    Member* member;
+    PyObject* batch_snapshot;
+    Py_ssize_t batch_depth;
+} AtomNumCList;
+
+
+extern PyTypeObject AtomNumList_Type;
+
+
+extern PyTypeObject AtomNumCList_Type;
+
+
+// Get the storage format for the values produced by an item validator,
+// or 0 if the validator does not produce floats, ints or bools.
+char
+AtomNumList_Format( Member* validator );
+
+
+PyObject*
+AtomNumList_New( CAtom* atom, Member* validator );
+
+
+PyObject*
+AtomNumCList_New( CAtom* atom, Member* validator, Member* member );
+
+
+// Validate the items of an iterable and append them to the list without
+// emitting any notification. Return -1 on error.
+int
+AtomNumList_Extend( PyObject* list, PyObject* value );
+
+
+// The numeric counterparts of AtomCList_BeginBatch and AtomCList_EndBatch.
+bool
+AtomNumCList_BeginBatch( PyObject* list );
+
+
+bool
+AtomNumCList_EndBatch( PyObject* list );
+
+
+int
+import_atomnumlist();
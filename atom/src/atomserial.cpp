@@ -0,0 +1,1115 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <climits>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "atomserial.h"
+#include "atomdict.h"
+#include "atomlist.h"
+#include "atomnumlist.h"
+#include "atomsortedmap.h"
+#include "catom.h"
+#include "member.h"
+#include "py23compat.h"
+#include <structmember.h>
+
+using namespace PythonHelpers;
+
+
+namespace AtomSerial
+{
+
+static const char magic[] = "ATOMSER";
+
+
+static const size_t magic_size = sizeof( magic ) - 1;
+
+
+static const unsigned char version = 1;
+
+
+enum Tag
+{
+    NoneTag,
+    FalseTag,
+    TrueTag,
+    IntTag,
+    BigIntTag,
+    FloatTag,
+    StrTag,
+    BytesTag,
+    ListTag,
+    TupleTag,
+    DictTag,
+    SortedMapTag,
+    NumListTag,
+    AtomTag,
+    RefTag
+};
+
+
+// The fields of the class of an atom, in member index order.
+static PyObject*
+field_names( PyTypeObject* type )
+{
+    PyObjectPtr members( PyObject_GetAttrString( pyobject_cast( type ), "__atom_members__" ) );
+    if( !members )
+        return 0;
+    if( !PyDict_CheckExact( members.get() ) )
+        return py_bad_internal_call( "atom members" );
+    Py_ssize_t count = PyDict_Size( members.get() );
+    PyTuplePtr names( PyTuple_New( count ) );
+    if( !names )
+        return 0;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while( PyDict_Next( members.get(), &pos, &key, &value ) )
+    {
+        if( !Member::TypeCheck( value ) )
+            return py_expected_type_fail( value, "Member" );
+        uint32_t index = member_cast( value )->index;
+        if( index >= count || PyTuple_GET_ITEM( names.get(), index ) )
+            return py_bad_internal_call( "atom member indices" );
+        PyTuple_SET_ITEM( names.get(), index, newref( key ) );
+    }
+    return names.release();
+}
+
+
+static PyObject* slotnames_func;
+
+
+// The names and definitions of the Python slots of the class of an atom.
+// The slots declared by the classes are member descriptors holding an
+// object, which are read without calling into Python.
+static PyObject*
+slot_definitions( PyTypeObject* type, std::vector<PyMemberDef*>& slots )
+{
+    if( slots_only( type ) )
+        return PyList_New( 0 );
+    if( !slotnames_func )
+    {
+#if PY_MAJOR_VERSION >= 3
+        PyObjectPtr copyreg( PyImport_ImportModule( "copyreg" ) );
+#else
+        PyObjectPtr copyreg( PyImport_ImportModule( "copy_reg" ) );
+#endif
+        if( !copyreg )
+            return 0;
+        slotnames_func = PyObject_GetAttrString( copyreg.get(), "_slotnames" );
+        if( !slotnames_func )
+            return 0;
+    }
+    PyObjectPtr names( PyObject_CallFunctionObjArgs( slotnames_func, pyobject_cast( type ), 0 ) );
+    if( !names )
+        return 0;
+    if( !PyList_Check( names.get() ) )
+        return py_expected_type_fail( names.get(), "list" );
+    for( Py_ssize_t i = 0; i < PyList_GET_SIZE( names.get() ); ++i )
+    {
+        PyObject* name = PyList_GET_ITEM( names.get(), i );
+        PyObject* descr = _PyType_Lookup( type, name );
+        if( !descr || Py_TYPE( descr ) != &PyMemberDescr_Type ||
+            reinterpret_cast<PyMemberDescrObject*>( descr )->d_member->type != T_OBJECT_EX )
+            return py_type_fail( "cannot serialize a slot overridden by a descriptor" );
+        slots.push_back( reinterpret_cast<PyMemberDescrObject*>( descr )->d_member );
+    }
+    return names.release();
+}
+
+
+class RecursionGuard
+{
+
+public:
+
+    RecursionGuard() : m_entered( Py_EnterRecursiveCall( const_cast<char*>( " in atom serialization" ) ) == 0 ) {}
+
+    ~RecursionGuard()
+    {
+        if( m_entered )
+            Py_LeaveRecursiveCall();
+    }
+
+    bool entered() const
+    {
+        return m_entered;
+    }
+
+private:
+
+    bool m_entered;
+};
+
+
+// The writer only reads the slots, the Python slots, the instance dicts and
+// the builtin containers, without calling into Python except to describe
+// the classes, so that the graph cannot change while it is written.
+class Writer
+{
+
+public:
+
+    bool write_header()
+    {
+        raw( magic, magic_size );
+        byte( version );
+        return true;
+    }
+
+    bool write( PyObject* value )
+    {
+        RecursionGuard guard;
+        if( !guard.entered() )
+            return false;
+        if( value == Py_None )
+            return byte( NoneTag );
+        if( PyBool_Check( value ) )
+            return byte( value == Py_True ? TrueTag : FalseTag );
+#if PY_MAJOR_VERSION < 3
+        if( PyInt_CheckExact( value ) )
+        {
+            byte( IntTag );
+            return zigzag( PyInt_AS_LONG( value ) );
+        }
+#endif
+        if( PyLong_CheckExact( value ) )
+            return write_long( value );
+        if( PyFloat_CheckExact( value ) )
+        {
+            byte( FloatTag );
+            double number = PyFloat_AS_DOUBLE( value );
+            uint64_t bits;
+            memcpy( &bits, &number, sizeof( bits ) );
+            return fixed64( bits );
+        }
+        if( PyUnicode_CheckExact( value ) )
+        {
+            byte( StrTag );
+            return write_str( value );
+        }
+        if( PyBytes_CheckExact( value ) )
+        {
+            byte( BytesTag );
+            return bytes( PyBytes_AS_STRING( value ), PyBytes_GET_SIZE( value ) );
+        }
+        if( AtomNumList_Check( value ) )
+            return write_numlist( value );
+        if( PyList_CheckExact( value ) || AtomList_Check( value ) )
+        {
+            byte( ListTag );
+            return write_items( &PyList_GET_ITEM( value, 0 ), PyList_GET_SIZE( value ) );
+        }
+        if( PyTuple_CheckExact( value ) )
+        {
+            byte( TupleTag );
+            return write_items( &PyTuple_GET_ITEM( value, 0 ), PyTuple_GET_SIZE( value ) );
+        }
+        if( PyDict_CheckExact( value ) || AtomDict_Check( value ) )
+            return write_dict( value );
+        if( Py_TYPE( value ) == SortedMap_BaseType || AtomSortedMap_Check( value ) )
+            return write_sortedmap( value );
+        if( CAtom::TypeCheck( value ) )
+            return write_atom( catom_cast( value ) );
+        // The subclasses of the builtin types are not written as their base,
+        // which would lose their type and any state they add.
+        PyErr_Format(
+            PyExc_TypeError,
+            "cannot serialize object of type '%s'",
+            Py_TYPE( value )->tp_name );
+        return false;
+    }
+
+    std::vector<char> m_buffer;
+
+private:
+
+    struct ClassInfo
+    {
+        uint64_t index;
+        uint32_t count;
+        std::vector<PyMemberDef*> slots;
+    };
+
+    bool byte( unsigned char value )
+    {
+        m_buffer.push_back( static_cast<char>( value ) );
+        return true;
+    }
+
+    void raw( const char* data, size_t size )
+    {
+        m_buffer.insert( m_buffer.end(), data, data + size );
+    }
+
+    bool varint( uint64_t value )
+    {
+        while( value >= 0x80 )
+        {
+            byte( static_cast<unsigned char>( value | 0x80 ) );
+            value >>= 7;
+        }
+        return byte( static_cast<unsigned char>( value ) );
+    }
+
+    bool zigzag( int64_t value )
+    {
+        return varint( ( static_cast<uint64_t>( value ) << 1 ) ^ static_cast<uint64_t>( value >> 63 ) );
+    }
+
+    bool fixed64( uint64_t value )
+    {
+        for( int i = 0; i < 8; ++i )
+            byte( static_cast<unsigned char>( value >> ( i * 8 ) ) );
+        return true;
+    }
+
+    bool bytes( const char* data, Py_ssize_t size )
+    {
+        varint( static_cast<uint64_t>( size ) );
+        raw( data, size );
+        return true;
+    }
+
+    bool write_str( PyObject* value )
+    {
+#if PY_VERSION_HEX >= 0x03030000
+        Py_ssize_t size;
+        const char* data = PyUnicode_AsUTF8AndSize( value, &size );
+        if( !data )
+            return false;
+        return bytes( data, size );
+#else
+        PyObjectPtr utf8( PyUnicode_AsUTF8String( value ) );
+        if( !utf8 )
+            return false;
+        return bytes( PyBytes_AS_STRING( utf8.get() ), PyBytes_GET_SIZE( utf8.get() ) );
+#endif
+    }
+
+    bool write_long( PyObject* value )
+    {
+        int overflow;
+        PY_LONG_LONG number = PyLong_AsLongLongAndOverflow( value, &overflow );
+        if( number == -1 && PyErr_Occurred() )
+            return false;
+        if( !overflow )
+        {
+            byte( IntTag );
+            return zigzag( number );
+        }
+        size_t size = _PyLong_NumBits( value ) / 8 + 1;
+        std::vector<unsigned char> data( size );
+        if( _PyLong_AsByteArray( reinterpret_cast<PyLongObject*>( value ), &data[ 0 ], size, 1, 1 ) < 0 )
+            return false;
+        byte( BigIntTag );
+        return bytes( reinterpret_cast<char*>( &data[ 0 ] ), size );
+    }
+
+    bool write_items( PyObject** items, Py_ssize_t size )
+    {
+        varint( static_cast<uint64_t>( size ) );
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            if( !write( items[ i ] ) )
+                return false;
+        }
+        return true;
+    }
+
+    bool write_dict( PyObject* value )
+    {
+        byte( DictTag );
+        varint( static_cast<uint64_t>( PyDict_Size( value ) ) );
+        PyObject* key;
+        PyObject* item;
+        Py_ssize_t pos = 0;
+        while( PyDict_Next( value, &pos, &key, &item ) )
+        {
+            if( !write( key ) || !write( item ) )
+                return false;
+        }
+        return true;
+    }
+
+    // The items are read from the storage of the map, whose version tells
+    // whether writing one of them added or removed items. The key function
+    // of a map cannot be written, and the map would be read back in the
+    // natural order of its keys.
+    bool write_sortedmap( PyObject* value )
+    {
+        if( reinterpret_cast<SortedMap*>( value )->m_keyfunc )
+        {
+            py_type_fail( "cannot serialize a sortedmap with a key function" );
+            return false;
+        }
+        SortedItems* items = reinterpret_cast<SortedMap*>( value )->m_items;
+        size_t version = items->version();
+        byte( SortedMapTag );
+        varint( static_cast<uint64_t>( items->size() ) );
+        for( size_t i = 0; i < items->chunk_count(); ++i )
+        {
+            for( size_t j = 0; j < items->chunk( i ).size(); ++j )
+            {
+                PyObjectPtr key( newref( items->chunk( i ).keys[ j ] ) );
+                PyObjectPtr item( newref( items->chunk( i ).values[ j ] ) );
+                if( !write( key.get() ) || !write( item.get() ) )
+                    return false;
+                if( items->version() != version )
+                {
+                    py_runtime_fail( "sortedmap changed size during serialization" );
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The items are written little endian, as the struct module would.
+    bool write_numlist( PyObject* value )
+    {
+        AtomNumList* list = atomnumlist_cast( value );
+        byte( NumListTag );
+        byte( static_cast<unsigned char>( list->format ) );
+        varint( static_cast<uint64_t>( list->size ) );
+        for( Py_ssize_t i = 0; i < list->size; ++i )
+        {
+            if( list->format == '?' )
+                byte( list->items[ i ] ? 1 : 0 );
+            else
+            {
+                uint64_t bits;
+                memcpy( &bits, list->items + i * sizeof( bits ), sizeof( bits ) );
+                fixed64( bits );
+            }
+        }
+        return true;
+    }
+
+    ClassInfo* write_class( PyTypeObject* type )
+    {
+        std::map<PyTypeObject*, ClassInfo>::iterator it = m_classes.find( type );
+        if( it != m_classes.end() )
+        {
+            varint( it->second.index );
+            return &it->second;
+        }
+        PyObjectPtr names( field_names( type ) );
+        if( !names )
+            return 0;
+        PyObjectPtr module( PyObject_GetAttrString( pyobject_cast( type ), "__module__" ) );
+        if( !module )
+            return 0;
+#if PY_MAJOR_VERSION >= 3
+        PyObjectPtr name( PyObject_GetAttrString( pyobject_cast( type ), "__qualname__" ) );
+#else
+        PyObjectPtr name( PyUnicode_FromString( type->tp_name ) );
+#endif
+        if( !name )
+            return 0;
+        ClassInfo info;
+        PyObjectPtr slotnames( slot_definitions( type, info.slots ) );
+        if( !slotnames )
+            return 0;
+        info.index = m_classes.size();
+        info.count = static_cast<uint32_t>( PyTuple_GET_SIZE( names.get() ) );
+        varint( info.index );
+        if( !write_name( module.get() ) || !write_name( name.get() ) )
+            return 0;
+        varint( info.count );
+        for( uint32_t i = 0; i < info.count; ++i )
+        {
+            if( !write_name( PyTuple_GET_ITEM( names.get(), i ) ) )
+                return 0;
+        }
+        varint( info.slots.size() );
+        for( size_t i = 0; i < info.slots.size(); ++i )
+        {
+            if( !write_name( PyList_GET_ITEM( slotnames.get(), i ) ) )
+                return 0;
+        }
+        return &( m_classes[ type ] = info );
+    }
+
+    bool write_name( PyObject* name )
+    {
+#if PY_MAJOR_VERSION < 3
+        if( PyString_Check( name ) )
+            return bytes( PyString_AS_STRING( name ), PyString_GET_SIZE( name ) );
+#endif
+        if( !PyUnicode_Check( name ) )
+        {
+            py_expected_type_fail( name, "str" );
+            return false;
+        }
+        return write_str( name );
+    }
+
+    bool write_atom( CAtom* atom )
+    {
+        std::map<CAtom*, uint64_t>::iterator it = m_atoms.find( atom );
+        if( it != m_atoms.end() )
+        {
+            byte( RefTag );
+            return varint( it->second );
+        }
+        uint64_t index = m_atoms.size();
+        m_atoms[ atom ] = index;
+        byte( AtomTag );
+        ClassInfo* info = write_class( Py_TYPE( atom ) );
+        if( !info )
+            return false;
+        uint32_t count = atom->get_slot_count();
+        if( info->count < count )
+            count = info->count;
+        uint32_t set = 0;
+        for( uint32_t i = 0; i < count; ++i )
+        {
+            if( atom->slots[ i ] )
+                ++set;
+        }
+        varint( set );
+        for( uint32_t i = 0; i < count; ++i )
+        {
+            if( !atom->slots[ i ] )
+                continue;
+            varint( i );
+            if( !write( atom->slots[ i ] ) )
+                return false;
+        }
+        return write_python_state( atom, *info );
+    }
+
+    // The values of the set Python slots are written by index, followed by
+    // the items of the instance dict.
+    bool write_python_state( CAtom* atom, const ClassInfo& info )
+    {
+        char* base = reinterpret_cast<char*>( atom );
+        uint32_t set = 0;
+        for( size_t i = 0; i < info.slots.size(); ++i )
+        {
+            if( *reinterpret_cast<PyObject**>( base + info.slots[ i ]->offset ) )
+                ++set;
+        }
+        varint( set );
+        for( size_t i = 0; i < info.slots.size(); ++i )
+        {
+            PyObject* value = *reinterpret_cast<PyObject**>( base + info.slots[ i ]->offset );
+            if( !value )
+                continue;
+            varint( i );
+            PyObjectPtr valueptr( newref( value ) );
+            if( !write( value ) )
+                return false;
+        }
+        PyObject** dictptr = _PyObject_GetDictPtr( pyobject_cast( atom ) );
+        if( !dictptr || !*dictptr )
+            return varint( 0 );
+        PyListPtr items( PyDict_Items( *dictptr ) );
+        if( !items )
+            return false;
+        Py_ssize_t size = PyList_GET_SIZE( items.get() );
+        varint( static_cast<uint64_t>( size ) );
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* item = PyList_GET_ITEM( items.get(), i );
+            if( !write_name( PyTuple_GET_ITEM( item, 0 ) ) ||
+                !write( PyTuple_GET_ITEM( item, 1 ) ) )
+                return false;
+        }
+        return true;
+    }
+
+    std::map<PyTypeObject*, ClassInfo> m_classes;
+    std::map<CAtom*, uint64_t> m_atoms;
+};
+
+
+class Reader
+{
+
+public:
+
+    Reader( const char* data, Py_ssize_t size, PyObject* classes ) :
+        m_data( data ), m_end( data + size ), m_classes( PyList_New( 0 ) ),
+        m_atoms( PyList_New( 0 ) ), m_resolver( classes ) {}
+
+    bool read_header()
+    {
+        if( !m_classes || !m_atoms )
+            return false;
+        const char* header = take( magic_size + 1 );
+        if( !header || memcmp( header, magic, magic_size ) != 0 )
+            return fail( "not atom data" );
+        if( static_cast<unsigned char>( header[ magic_size ] ) != version )
+            return fail( "unsupported atom data version" );
+        return true;
+    }
+
+    bool at_end() const
+    {
+        return m_data == m_end;
+    }
+
+    PyObject* read()
+    {
+        RecursionGuard guard;
+        if( !guard.entered() )
+            return 0;
+        unsigned char tag;
+        if( !byte( tag ) )
+            return 0;
+        switch( tag )
+        {
+            case NoneTag:
+                return newref( Py_None );
+            case FalseTag:
+                return newref( Py_False );
+            case TrueTag:
+                return newref( Py_True );
+            case IntTag:
+                return read_int();
+            case BigIntTag:
+                return read_bigint();
+            case FloatTag:
+            {
+                uint64_t bits;
+                if( !fixed64( bits ) )
+                    return 0;
+                double number;
+                memcpy( &number, &bits, sizeof( number ) );
+                return PyFloat_FromDouble( number );
+            }
+            case StrTag:
+                return read_str();
+            case BytesTag:
+            {
+                const char* data;
+                Py_ssize_t size;
+                if( !bytes( data, size ) )
+                    return 0;
+                return PyBytes_FromStringAndSize( data, size );
+            }
+            case ListTag:
+                return read_list();
+            case TupleTag:
+                return read_tuple();
+            case DictTag:
+                return read_dict();
+            case SortedMapTag:
+                return read_sortedmap();
+            case NumListTag:
+                return read_numlist();
+            case AtomTag:
+                return read_atom();
+            case RefTag:
+            {
+                uint64_t index;
+                if( !varint( index ) )
+                    return 0;
+                if( index >= static_cast<uint64_t>( PyList_GET_SIZE( m_atoms.get() ) ) )
+                    return fail_value( "invalid atom reference" );
+                return newref( PyList_GET_ITEM( m_atoms.get(), index ) );
+            }
+            default:
+                return fail_value( "invalid atom data tag" );
+        }
+    }
+
+private:
+
+    bool fail( const char* message )
+    {
+        py_value_fail( message );
+        return false;
+    }
+
+    PyObject* fail_value( const char* message )
+    {
+        return py_value_fail( message );
+    }
+
+    const char* take( size_t size )
+    {
+        if( static_cast<size_t>( m_end - m_data ) < size )
+        {
+            fail( "truncated atom data" );
+            return 0;
+        }
+        const char* data = m_data;
+        m_data += size;
+        return data;
+    }
+
+    bool byte( unsigned char& value )
+    {
+        const char* data = take( 1 );
+        if( !data )
+            return false;
+        value = static_cast<unsigned char>( *data );
+        return true;
+    }
+
+    bool varint( uint64_t& value )
+    {
+        value = 0;
+        for( int shift = 0; shift < 64; shift += 7 )
+        {
+            unsigned char part;
+            if( !byte( part ) )
+                return false;
+            value |= static_cast<uint64_t>( part & 0x7f ) << shift;
+            if( !( part & 0x80 ) )
+                return true;
+        }
+        return fail( "invalid atom data varint" );
+    }
+
+    // Read a count of items each taking at least one byte.
+    bool count( Py_ssize_t& size )
+    {
+        uint64_t value;
+        if( !varint( value ) )
+            return false;
+        if( value > static_cast<uint64_t>( m_end - m_data ) )
+            return fail( "truncated atom data" );
+        size = static_cast<Py_ssize_t>( value );
+        return true;
+    }
+
+    bool fixed64( uint64_t& value )
+    {
+        const char* data = take( 8 );
+        if( !data )
+            return false;
+        value = 0;
+        for( int i = 0; i < 8; ++i )
+            value |= static_cast<uint64_t>( static_cast<unsigned char>( data[ i ] ) ) << ( i * 8 );
+        return true;
+    }
+
+    bool bytes( const char*& data, Py_ssize_t& size )
+    {
+        if( !count( size ) )
+            return false;
+        data = take( size );
+        return data != 0;
+    }
+
+    PyObject* read_int()
+    {
+        uint64_t value;
+        if( !varint( value ) )
+            return 0;
+        return int_from( static_cast<int64_t>( value >> 1 ) ^ -static_cast<int64_t>( value & 1 ) );
+    }
+
+    // Create an int, which is only a long on Python 2 if it does not fit.
+    PyObject* int_from( int64_t number )
+    {
+#if PY_MAJOR_VERSION < 3
+        if( number >= LONG_MIN && number <= LONG_MAX )
+            return PyInt_FromLong( static_cast<long>( number ) );
+#endif
+        return PyLong_FromLongLong( number );
+    }
+
+    PyObject* read_bigint()
+    {
+        const char* data;
+        Py_ssize_t size;
+        if( !bytes( data, size ) )
+            return 0;
+        return _PyLong_FromByteArray( reinterpret_cast<const unsigned char*>( data ), size, 1, 1 );
+    }
+
+    PyObject* read_str()
+    {
+        const char* data;
+        Py_ssize_t size;
+        if( !bytes( data, size ) )
+            return 0;
+        return PyUnicode_DecodeUTF8( data, size, "strict" );
+    }
+
+    PyObject* read_list()
+    {
+        Py_ssize_t size;
+        if( !count( size ) )
+            return 0;
+        PyListPtr list( PyList_New( size ) );
+        if( !list )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* item = read();
+            if( !item )
+                return 0;
+            PyList_SET_ITEM( list.get(), i, item );
+        }
+        return list.release();
+    }
+
+    PyObject* read_tuple()
+    {
+        Py_ssize_t size;
+        if( !count( size ) )
+            return 0;
+        PyTuplePtr tuple( PyTuple_New( size ) );
+        if( !tuple )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* item = read();
+            if( !item )
+                return 0;
+            PyTuple_SET_ITEM( tuple.get(), i, item );
+        }
+        return tuple.release();
+    }
+
+    PyObject* read_dict()
+    {
+        Py_ssize_t size;
+        if( !count( size ) )
+            return 0;
+        PyDictPtr dict( PyDict_New() );
+        if( !dict )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObjectPtr key( read() );
+            if( !key )
+                return 0;
+            PyObjectPtr value( read() );
+            if( !value )
+                return 0;
+            if( !dict.set_item( key, value ) )
+                return 0;
+        }
+        return dict.release();
+    }
+
+    PyObject* read_sortedmap()
+    {
+        Py_ssize_t size;
+        if( !count( size ) )
+            return 0;
+        PyListPtr items( PyList_New( size ) );
+        if( !items )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObjectPtr key( read() );
+            if( !key )
+                return 0;
+            PyObjectPtr value( read() );
+            if( !value )
+                return 0;
+            PyObject* pair = PyTuple_Pack( 2, key.get(), value.get() );
+            if( !pair )
+                return 0;
+            PyList_SET_ITEM( items.get(), i, pair );
+        }
+        return PyObject_CallFunctionObjArgs( pyobject_cast( SortedMap_BaseType ), items.get(), 0 );
+    }
+
+    // The numeric lists are read back as lists, which the numeric list
+    // members validate natively.
+    PyObject* read_numlist()
+    {
+        unsigned char format;
+        if( !byte( format ) )
+            return 0;
+        Py_ssize_t size;
+        if( !count( size ) )
+            return 0;
+        if( format != 'd' && format != 'q' && format != '?' )
+            return fail_value( "invalid atom data numeric list" );
+        PyListPtr list( PyList_New( size ) );
+        if( !list )
+            return 0;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* item;
+            if( format == '?' )
+            {
+                unsigned char value;
+                if( !byte( value ) )
+                    return 0;
+                item = newref( value ? Py_True : Py_False );
+            }
+            else
+            {
+                uint64_t bits;
+                if( !fixed64( bits ) )
+                    return 0;
+                if( format == 'd' )
+                {
+                    double number;
+                    memcpy( &number, &bits, sizeof( number ) );
+                    item = PyFloat_FromDouble( number );
+                }
+                else
+                    item = int_from( static_cast<int64_t>( bits ) );
+                if( !item )
+                    return 0;
+            }
+            PyList_SET_ITEM( list.get(), i, item );
+        }
+        return list.release();
+    }
+
+    PyObject* read_name()
+    {
+#if PY_MAJOR_VERSION >= 3
+        return read_str();
+#else
+        PyObjectPtr name( read_str() );
+        if( !name )
+            return 0;
+        return PyUnicode_AsUTF8String( name.get() );
+#endif
+    }
+
+    // Find a class from its module and name, in the mapping of classes
+    // given to deserialize first.
+    PyObject* resolve( PyObject* module, PyObject* name )
+    {
+        if( m_resolver != Py_None )
+        {
+#if PY_MAJOR_VERSION >= 3
+            PyObjectPtr key( PyUnicode_FromFormat( "%U.%U", module, name ) );
+#else
+            PyObjectPtr key( PyString_FromFormat(
+                "%s.%s", PyString_AS_STRING( module ), PyString_AS_STRING( name ) ) );
+#endif
+            if( !key )
+                return 0;
+            PyObject* type = PyObject_GetItem( m_resolver, key.get() );
+            if( type || !PyErr_ExceptionMatches( PyExc_KeyError ) )
+                return type;
+            PyErr_Clear();
+        }
+        PyObjectPtr current( PyImport_Import( module ) );
+        if( !current )
+            return 0;
+        PyObjectPtr parts( PyObject_CallMethod( name, const_cast<char*>( "split" ), const_cast<char*>( "s" ), "." ) );
+        if( !parts )
+            return 0;
+        for( Py_ssize_t i = 0; i < PyList_GET_SIZE( parts.get() ); ++i )
+        {
+            current = PyObject_GetAttr( current.get(), PyList_GET_ITEM( parts.get(), i ) );
+            if( !current )
+                return 0;
+        }
+        return current.release();
+    }
+
+    // Read a class definition, resolving the member of each field or None
+    // for the fields which are no longer members of the class.
+    bool read_class()
+    {
+        PyObjectPtr module( read_name() );
+        if( !module )
+            return false;
+        PyObjectPtr name( read_name() );
+        if( !name )
+            return false;
+        PyObjectPtr type( resolve( module.get(), name.get() ) );
+        if( !type )
+            return false;
+        if( !PyType_Check( type.get() ) ||
+            !PyType_IsSubtype( pytype_cast( type.get() ), &CAtom_Type ) )
+        {
+            py_expected_type_fail( type.get(), "CAtom subclass" );
+            return false;
+        }
+        PyObjectPtr members( PyObject_GetAttrString( type.get(), "__atom_members__" ) );
+        if( !members )
+            return false;
+        if( !PyDict_CheckExact( members.get() ) )
+        {
+            py_bad_internal_call( "atom members" );
+            return false;
+        }
+        Py_ssize_t size;
+        if( !count( size ) )
+            return false;
+        PyTuplePtr fields( PyTuple_New( size ) );
+        if( !fields )
+            return false;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObjectPtr field( read_name() );
+            if( !field )
+                return false;
+            PyObject* member = PyDict_GetItem( members.get(), field.get() );
+            if( !member || !Member::TypeCheck( member ) )
+                member = Py_None;
+            PyTuple_SET_ITEM( fields.get(), i, newref( member ) );
+        }
+        if( !count( size ) )
+            return false;
+        PyTuplePtr slots( PyTuple_New( size ) );
+        if( !slots )
+            return false;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObject* slot = read_name();
+            if( !slot )
+                return false;
+            PyTuple_SET_ITEM( slots.get(), i, slot );
+        }
+        PyObjectPtr entry( PyTuple_Pack( 3, type.get(), fields.get(), slots.get() ) );
+        if( !entry )
+            return false;
+        return m_classes.append( entry );
+    }
+
+    PyObject* read_atom()
+    {
+        uint64_t index;
+        if( !varint( index ) )
+            return 0;
+        uint64_t known = static_cast<uint64_t>( PyList_GET_SIZE( m_classes.get() ) );
+        if( index == known )
+        {
+            if( !read_class() )
+                return 0;
+        }
+        else if( index > known )
+            return fail_value( "invalid atom class reference" );
+        PyObjectPtr entry( newref( PyList_GET_ITEM( m_classes.get(), index ) ) );
+        PyTypeObject* type = pytype_cast( PyTuple_GET_ITEM( entry.get(), 0 ) );
+        PyObject* fields = PyTuple_GET_ITEM( entry.get(), 1 );
+        PyObject* slots = PyTuple_GET_ITEM( entry.get(), 2 );
+        PyTuplePtr args( PyTuple_New( 0 ) );
+        if( !args )
+            return 0;
+        PyObjectPtr atomptr( type->tp_new( type, args.get(), 0 ) );
+        if( !atomptr )
+            return 0;
+        if( !CAtom::TypeCheck( atomptr.get() ) )
+            return py_expected_type_fail( atomptr.get(), "CAtom" );
+        if( !m_atoms.append( atomptr ) )
+            return 0;
+        CAtom* atom = catom_cast( atomptr.get() );
+        Py_ssize_t set;
+        if( !count( set ) )
+            return 0;
+        for( Py_ssize_t i = 0; i < set; ++i )
+        {
+            uint64_t field;
+            if( !varint( field ) )
+                return 0;
+            if( field >= static_cast<uint64_t>( PyTuple_GET_SIZE( fields ) ) )
+                return fail_value( "invalid atom field" );
+            PyObjectPtr value( read() );
+            if( !value )
+                return 0;
+            PyObject* member = PyTuple_GET_ITEM( fields, field );
+            if( member == Py_None )
+                continue;
+            if( !restore_member( atom, member_cast( member ), value.get() ) )
+                return 0;
+        }
+        if( !read_python_state( atomptr.get(), slots ) )
+            return 0;
+        return atomptr.release();
+    }
+
+    // The Python slots and the items of the instance dict are restored
+    // through setattr, as by __setstate__.
+    bool read_python_state( PyObject* atom, PyObject* slots )
+    {
+        Py_ssize_t set;
+        if( !count( set ) )
+            return false;
+        for( Py_ssize_t i = 0; i < set; ++i )
+        {
+            uint64_t slot;
+            if( !varint( slot ) )
+                return false;
+            if( slot >= static_cast<uint64_t>( PyTuple_GET_SIZE( slots ) ) )
+                return fail( "invalid atom slot" );
+            PyObjectPtr value( read() );
+            if( !value )
+                return false;
+            if( PyObject_SetAttr( atom, PyTuple_GET_ITEM( slots, slot ), value.get() ) != 0 )
+                return false;
+        }
+        Py_ssize_t size;
+        if( !count( size ) )
+            return false;
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            PyObjectPtr name( read_name() );
+            if( !name )
+                return false;
+            PyObjectPtr value( read() );
+            if( !value )
+                return false;
+            if( PyObject_SetAttr( atom, name.get(), value.get() ) != 0 )
+                return false;
+        }
+        return true;
+    }
+
+    const char* m_data;
+    const char* m_end;
+    PyListPtr m_classes;
+    PyListPtr m_atoms;
+    PyObject* m_resolver;
+};
+
+}  // namespace AtomSerial
+
+
+PyObject*
+serialize( PyObject* mod, PyObject* value )
+{
+    AtomSerial::Writer writer;
+    writer.write_header();
+    if( !writer.write( value ) )
+        return 0;
+    return PyBytes_FromStringAndSize( &writer.m_buffer[ 0 ], writer.m_buffer.size() );
+}
+
+
+PyObject*
+deserialize( PyObject* mod, PyObject* args, PyObject* kwargs )
+{
+    static char* kwlist[] = {
+        const_cast<char*>( "data" ),
+        const_cast<char*>( "classes" ),
+        0
+    };
+    PyObject* data;
+    PyObject* classes = Py_None;
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "O|O:deserialize", kwlist, &data, &classes ) )
+        return 0;
+    Py_buffer view;
+    if( PyObject_GetBuffer( data, &view, PyBUF_SIMPLE ) != 0 )
+        return 0;
+    PyObjectPtr result;
+    {
+        AtomSerial::Reader reader( reinterpret_cast<const char*>( view.buf ), view.len, classes );
+        if( reader.read_header() )
+        {
+            result = reader.read();
+            if( result && !reader.at_end() )
+                result = py_value_fail( "trailing atom data" );
+        }
+    }
+    PyBuffer_Release( &view );
+    return result.release();
+}
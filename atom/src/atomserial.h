@@ -0,0 +1,24 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+
+
+// A compact binary format for graphs of atoms. A stream starts with the
+// magic "ATOMSER" and a version byte, followed by a single tagged value.
+// Integers are zigzag varints, strs and bytes are length prefixed, and the
+// numeric lists are written as packed arrays. The first instance of a
+// class defines it with its module, name and member names, its later
+// instances refer to it by index. An atom writes the index and value of
+// each of its set slots, so that a reader skips the members its class no
+// longer has, followed by its Python slots and instance dict. An atom met
+// again is written as a reference to its index.
+PyObject* serialize( PyObject* mod, PyObject* value );
+
+
+PyObject* deserialize( PyObject* mod, PyObject* args, PyObject* kwargs );
@@ -0,0 +1,1121 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include "atomsortedmap.h"
+#include "changetrace.h"
+#include "staticstrings.h"
+#include "packagenaming.h"
+#include "py23compat.h"
+
+
+using namespace PythonHelpers;
+
+
+PyTypeObject* SortedMap_BaseType = 0;
+
+
+namespace SortedMapMethods
+{
+
+// The update method of sortedmap, used to collect the items given to the
+// validating methods with the same rules as the sortedmap.
+static PyObject* update = 0;
+
+
+static bool
+init_methods()
+{
+    update = PyDict_GetItemString( SortedMap_BaseType->tp_dict, "update" );
+    if( !update )
+    {
+// LCOV_EXCL_START
+        py_bad_internal_call( "failed to load sortedmap 'update' method" );
+        return false;
+// LCOV_EXCL_STOP
+    }
+    return true;
+}
+
+
+static PyObject*
+call( PyObject* method, PyObject* self, PyObject* args, PyObject* kwargs )
+{
+    Py_ssize_t size = args ? PyTuple_GET_SIZE( args ) : 0;
+    PyTuplePtr margs( PyTuple_New( size + 1 ) );
+    if( !margs )
+        return 0;  // LCOV_EXCL_LINE
+    margs.initialize( 0, newref( self ) );
+    for( Py_ssize_t i = 0; i < size; ++i )
+        margs.initialize( i + 1, newref( PyTuple_GET_ITEM( args, i ) ) );
+    return PyObject_Call( method, margs.get(), kwargs );
+}
+
+}  // namespace SortedMapMethods
+
+
+static PyObject*
+SortedMapSubtype_New( PyTypeObject* subtype )
+{
+    PyTuplePtr args( PyTuple_New( 0 ) );
+    if( !args )
+        return 0;  // LCOV_EXCL_LINE
+    return SortedMap_BaseType->tp_new( subtype, args.get(), 0 );
+}
+
+
+PyObject*
+AtomSortedMap_New( CAtom* atom, Member* key_validator, Member* value_validator )
+{
+    PyObjectPtr ptr( SortedMapSubtype_New( &AtomSortedMap_Type ) );
+    if( !ptr )
+        return 0;
+    Py_XINCREF( pyobject_cast( key_validator ) );
+    Py_XINCREF( pyobject_cast( value_validator ) );
+    atomsortedmap_cast( ptr.get() )->key_validator = key_validator;
+    atomsortedmap_cast( ptr.get() )->value_validator = value_validator;
+    atomsortedmap_cast( ptr.get() )->pointer = new CAtomPointer( atom );
+    return ptr.release();
+}
+
+
+PyObject*
+AtomCSortedMap_New( CAtom* atom, Member* key_validator, Member* value_validator, Member* member )
+{
+    PyObjectPtr ptr( SortedMapSubtype_New( &AtomCSortedMap_Type ) );
+    if( !ptr )
+        return 0;
+    Py_XINCREF( pyobject_cast( key_validator ) );
+    Py_XINCREF( pyobject_cast( value_validator ) );
+    Py_XINCREF( pyobject_cast( member ) );
+    atomsortedmap_cast( ptr.get() )->key_validator = key_validator;
+    atomsortedmap_cast( ptr.get() )->value_validator = value_validator;
+    atomsortedmap_cast( ptr.get() )->pointer = new CAtomPointer( atom );
+    atomcsortedmap_cast( ptr.get() )->member = member;
+    return ptr.release();
+}
+
+
+/*-----------------------------------------------------------------------------
+| AtomSortedMap Type
+|----------------------------------------------------------------------------*/
+namespace
+{
+
+class AtomSortedMapHandler
+{
+
+public:
+
+    typedef SortedMap::Items Items;
+
+    AtomSortedMapHandler( AtomSortedMap* map ) :
+        m_map( newref( pyobject_cast( map ) ) ), m_record( false ) {}
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        if( !value || PySlice_Check( key ) )
+            return SortedMap_BaseType->tp_as_mapping->mp_ass_subscript(
+                m_map.get(), key, value );
+        PyObjectPtr keyptr( validate_key( key ) );
+        if( !keyptr )
+            return -1;
+        PyObjectPtr valptr( validate_value( value ) );
+        if( !valptr )
+            return -1;
+        return map()->setitem( keyptr.get(), valptr.get() );
+    }
+
+    PyObject* update( PyObject* args, PyObject* kwargs )
+    {
+        Items batch;
+        if( !collect( args, kwargs, batch ) )
+            return 0;
+        if( !record( batch ) )
+            return 0;
+        map()->m_items->merge( batch );
+        Py_RETURN_NONE;
+    }
+
+    PyObject* merge( PyObject* args )
+    {
+        PyObject* other;
+        PyObject* policy = 0;
+        if( !PyArg_UnpackTuple( args, "merge", 1, 2, &other, &policy ) )
+            return 0;
+        Conflict conflict = { Conflict::Replace, 0, 0 };
+        if( policy && !conflict.parse( policy ) )
+            return 0;
+        if( !merge_items( other, conflict ) )
+            return 0;
+        Py_RETURN_NONE;
+    }
+
+    PyObject* inplace_or( PyObject* other )
+    {
+        Conflict conflict = { Conflict::Replace, 0, 0 };
+        if( !merge_items( other, conflict ) )
+            return 0;
+        return newref( m_map.get() );
+    }
+
+    // The map loaded from a sortedmap takes over its key function and
+    // chunksize, so that it keeps its order.
+    bool load( PyObject* items )
+    {
+        Items batch;
+        if( SortedMap_Check( items ) )
+        {
+            SortedMap* source = reinterpret_cast<SortedMap*>( items );
+            if( source != map() )
+            {
+                SortedItems empty( source->m_items->chunksize() );
+                map()->m_items->swap( empty );
+                PyObject* old = map()->m_keyfunc;
+                map()->m_keyfunc = xnewref( source->m_keyfunc );
+                Py_XDECREF( old );
+            }
+            if( !validate_items( items, batch ) )
+                return false;
+        }
+        else
+        {
+            PyTuplePtr args( PyTuple_Pack( 1, items ) );
+            if( !args || !collect( args.get(), 0, batch ) )
+                return false;
+        }
+        map()->m_items->merge( batch );
+        return true;
+    }
+
+protected:
+
+    // Checks the values produced by a callable merge policy.
+    class ValueCheck : public Conflict::Check
+    {
+
+    public:
+
+        ValueCheck( AtomSortedMapHandler* handler ) : m_handler( handler ) {}
+
+        PyObject* operator()( PyObject* value )
+        {
+            return m_handler->validate_value( value );
+        }
+
+    private:
+
+        AtomSortedMapHandler* m_handler;
+    };
+
+    SortedMap* map()
+    {
+        return reinterpret_cast<SortedMap*>( m_map.get() );
+    }
+
+    AtomSortedMap* amap()
+    {
+        return atomsortedmap_cast( m_map.get() );
+    }
+
+    CAtom* atom()
+    {
+        return amap()->pointer->data();
+    }
+
+    PyObject* validate_key( PyObject* key )
+    {
+        Member* validator = amap()->key_validator;
+        if( validator && atom() )
+            return validator->full_validate( atom(), Py_None, key );
+        return newref( key );
+    }
+
+    PyObject* validate_value( PyObject* value )
+    {
+        Member* validator = amap()->value_validator;
+        if( validator && atom() )
+            return validator->full_validate( atom(), Py_None, value );
+        return newref( value );
+    }
+
+    // Validate the items of a sortedmap into a batch sorted for this map.
+    bool validate_items( PyObject* items, Items& batch )
+    {
+        SortedItems* source = reinterpret_cast<SortedMap*>( items )->m_items;
+        if( !atom() || ( !amap()->key_validator && !amap()->value_validator ) )
+            source->flatten( batch );
+        else
+        {
+            batch.reserve( source->size() );
+            for( size_t i = 0; i < source->chunk_count(); ++i )
+            {
+                const SortedItems::Chunk& chunk = source->chunk( i );
+                for( size_t j = 0; j < chunk.size(); ++j )
+                {
+                    PyObjectPtr keyptr( validate_key( chunk.keys[ j ] ) );
+                    if( !keyptr )
+                        return false;
+                    PyObjectPtr valptr( validate_value( chunk.values[ j ] ) );
+                    if( !valptr )
+                        return false;
+                    batch.push_back( MapItem( keyptr, valptr ) );
+                }
+            }
+        }
+        if( !map()->sort_keys( batch ) )
+            return false;
+        SortedItems::sort( batch );
+        return true;
+    }
+
+    // Gather the arguments of update with the rules of the sortedmap, then
+    // validate them.
+    bool collect( PyObject* args, PyObject* kwargs, Items& batch )
+    {
+        PyObjectPtr items( PyType_GenericNew( SortedMap_BaseType, 0, 0 ) );
+        if( !items )
+            return false;  // LCOV_EXCL_LINE
+        reinterpret_cast<SortedMap*>( items.get() )->m_items = new SortedItems();
+        PyObjectPtr res( SortedMapMethods::call(
+            SortedMapMethods::update, items.get(), args, kwargs ) );
+        if( !res )
+            return false;
+        return validate_items( items.get(), batch );
+    }
+
+    bool merge_items( PyObject* other, Conflict& conflict )
+    {
+        ValueCheck check( this );
+        if( amap()->value_validator )
+            conflict.check = &check;
+        Items batch;
+        PyTuplePtr args( PyTuple_Pack( 1, other ) );
+        if( !args || !collect( args.get(), 0, batch ) )
+            return false;
+        if( !record( batch ) )
+            return false;
+        return map()->merge( batch, conflict );
+    }
+
+    // Create a plain sortedmap ordered as this map from a sorted batch.
+    PyObject* new_map( Items& items )
+    {
+        PyObject* pymap = PyType_GenericNew( SortedMap_BaseType, 0, 0 );
+        if( !pymap )
+            return 0;  // LCOV_EXCL_LINE
+        SortedMap* other = reinterpret_cast<SortedMap*>( pymap );
+        other->m_items = new SortedItems( map()->m_items->chunksize() );
+        other->m_keyfunc = xnewref( map()->m_keyfunc );
+        other->m_items->assign( items );
+        return pymap;
+    }
+
+    // Keep a copy of the validated items when they will be reported.
+    bool record( Items& batch )
+    {
+        if( !m_record || batch.empty() )
+            return true;
+        Items copy( batch );
+        m_validated = new_map( copy );
+        return m_validated;
+    }
+
+    PyObjectPtr m_map;
+    PyObjectPtr m_validated;
+    bool m_record;
+
+private:
+
+    AtomSortedMapHandler();
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomSortedMap_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    PyObjectPtr ptr( SortedMap_BaseType->tp_new( type, args, kwargs ) );
+    if( !ptr )
+        return 0;
+    atomsortedmap_cast( ptr.get() )->pointer = new CAtomPointer();
+    return ptr.release();
+}
+
+
+static int
+AtomSortedMap_clear( AtomSortedMap* self )
+{
+    Py_CLEAR( self->key_validator );
+    Py_CLEAR( self->value_validator );
+    return SortedMap_BaseType->tp_clear( pyobject_cast( self ) );
+}
+
+
+static int
+AtomSortedMap_traverse( AtomSortedMap* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->key_validator );
+    Py_VISIT( self->value_validator );
+    return SortedMap_BaseType->tp_traverse( pyobject_cast( self ), visit, arg );
+}
+
+
+static void
+AtomSortedMap_dealloc( AtomSortedMap* self )
+{
+    PyObject_GC_UnTrack( self );
+    delete self->pointer;
+    self->pointer = 0;
+    Py_CLEAR( self->key_validator );
+    Py_CLEAR( self->value_validator );
+    SortedMap_BaseType->tp_dealloc( pyobject_cast( self ) );
+}
+
+
+static PyObject*
+AtomSortedMap_update( AtomSortedMap* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomSortedMapHandler( self ).update( args, kwargs );
+}
+
+
+static PyObject*
+AtomSortedMap_merge( AtomSortedMap* self, PyObject* args )
+{
+    return AtomSortedMapHandler( self ).merge( args );
+}
+
+
+static PyObject*
+AtomSortedMap_ior( AtomSortedMap* self, PyObject* other )
+{
+    return AtomSortedMapHandler( self ).inplace_or( other );
+}
+
+
+static int
+AtomSortedMap_ass_subscript( AtomSortedMap* self, PyObject* key, PyObject* value )
+{
+    return AtomSortedMapHandler( self ).setitem( key, value );
+}
+
+
+int
+AtomSortedMap_Load( PyObject* map, PyObject* items )
+{
+    return AtomSortedMapHandler( atomsortedmap_cast( map ) ).load( items ) ? 0 : -1;
+}
+
+
+PyDoc_STRVAR( s_update_doc,
+"M.update([E, ]**F) -> None.  Update M from mapping/iterable E and F." );
+
+PyDoc_STRVAR( s_merge_doc,
+"M.merge(E[, policy]) -> None.  Merge the items of E into M, resolving the\n"
+"keys present in both according to policy." );
+
+
+static PyMethodDef
+AtomSortedMap_methods[] = {
+    { "update", ( PyCFunction )AtomSortedMap_update, METH_VARARGS | METH_KEYWORDS, s_update_doc },
+    { "merge", ( PyCFunction )AtomSortedMap_merge, METH_VARARGS, s_merge_doc },
+    { 0 }  /* sentinel */
+};
+
+
+static PyNumberMethods
+AtomSortedMap_as_number = {
+     ( binaryfunc )0,                       /* nb_add */
+     ( binaryfunc )0,                       /* nb_subtract */
+     ( binaryfunc )0,                       /* nb_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_remainder */
+     ( binaryfunc )0,                       /* nb_divmod */
+     ( ternaryfunc )0,                      /* nb_power */
+     ( unaryfunc )0,                        /* nb_negative */
+     ( unaryfunc )0,                        /* nb_positive */
+     ( unaryfunc )0,                        /* nb_absolute */
+     ( inquiry )0,                          /* nb_nonzero, or nb_bool in python3 */
+     ( unaryfunc )0,                        /* nb_invert */
+     ( binaryfunc )0,                       /* nb_lshift */
+     ( binaryfunc )0,                       /* nb_rshift */
+     ( binaryfunc )0,                       /* nb_and */
+     ( binaryfunc )0,                       /* nb_xor */
+     ( binaryfunc )0,                       /* nb_or */
+#if PY_MAJOR_VERSION < 3
+     ( coercion )0,                         /* nb_coerce */
+#endif
+     ( unaryfunc )0,                        /* nb_int */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_long */
+#else
+     ( void* )0,                            /* nb_reserved */
+#endif
+     ( unaryfunc )0,                        /* nb_float */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_oct */
+     ( unaryfunc )0,                        /* nb_hex */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_add */
+     ( binaryfunc )0,                       /* nb_inplace_subtract */
+     ( binaryfunc )0,                       /* nb_inplace_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_inplace_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_remainder */
+     ( ternaryfunc )0,                      /* nb_inplace_power */
+     ( binaryfunc )0,                       /* nb_inplace_lshift */
+     ( binaryfunc )0,                       /* nb_inplace_rshift */
+     ( binaryfunc )0,                       /* nb_inplace_and */
+     ( binaryfunc )0,                       /* nb_inplace_xor */
+     ( binaryfunc )AtomSortedMap_ior        /* nb_inplace_or */
+};
+
+
+static PyMappingMethods
+AtomSortedMap_as_mapping = {
+    (lenfunc)0,                                 /* mp_length */
+    (binaryfunc)0,                              /* mp_subscript */
+    (objobjargproc)AtomSortedMap_ass_subscript  /* mp_ass_subscript */
+};
+
+
+// The base type is the sortedmap of the datastructures extension which is
+// only known once it is imported, see import_atomsortedmap.
+PyTypeObject AtomSortedMap_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomsortedmap" ),    /* tp_name */
+    sizeof( AtomSortedMap ),                /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomSortedMap_dealloc,      /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)&AtomSortedMap_as_number,    /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)&AtomSortedMap_as_mapping,  /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+#if PY_MAJOR_VERSION < 3
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC|Py_TPFLAGS_CHECKTYPES, /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC, /* tp_flags */
+#endif
+    0,                                      /* Documentation string */
+    (traverseproc)AtomSortedMap_traverse,   /* tp_traverse */
+    (inquiry)AtomSortedMap_clear,           /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomSortedMap_methods,  /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    0,                                      /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)0,                           /* tp_alloc */
+    (newfunc)AtomSortedMap_new,             /* tp_new */
+    (freefunc)0,                            /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+/*-----------------------------------------------------------------------------
+| AtomCSortedMap Type
+|----------------------------------------------------------------------------*/
+namespace PySStr
+{
+
+_STATIC_STRING( type )
+_STATIC_STRING( name )
+_STATIC_STRING( object )
+_STATIC_STRING( value )
+_STATIC_STRING( operation )
+_STATIC_STRING( key )
+_STATIC_STRING( item )
+_STATIC_STRING( items )
+_STATIC_STRING( index )
+_STATIC_STRING( range )
+_STATIC_STRING( olditem )
+_STATIC_STRING( newitem )
+_STATIC_STRING( container )
+_STATIC_STRING( __setitem__ )
+_STATIC_STRING( __delitem__ )
+_STATIC_STRING( __ior__ )
+_STATIC_STRING( update )
+_STATIC_STRING( merge )
+_STATIC_STRING( pop )
+_STATIC_STRING( popitem )
+_STATIC_STRING( clear )
+
+}  // namespace PySStr
+
+
+namespace
+{
+
+// Changes touching one key report the key, its item and its index in the
+// map. Changes touching several keys report a sortedmap of the affected
+// items along with the (lowest, highest) range of their keys.
+class AtomCSortedMapHandler : public AtomSortedMapHandler
+{
+
+public:
+
+    AtomCSortedMapHandler( AtomCSortedMap* map ) :
+        AtomSortedMapHandler( atomsortedmap_cast( map ) ),
+        m_obsm( false ), m_obsa( false ) {}
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        if( !observer_check() )
+            return AtomSortedMapHandler::setitem( key, value );
+        if( PySlice_Check( key ) )
+            return delslice( key, value );
+        if( !value )
+            return delitem( key );
+        PyObjectPtr keyptr( validate_key( key ) );
+        if( !keyptr )
+            return -1;
+        PyObjectPtr valptr( validate_value( value ) );
+        if( !valptr )
+            return -1;
+        SortedItems::Cursor cursor;
+        int found = map()->find( keyptr.get(), cursor );
+        if( found < 0 )
+            return -1;
+        PyObjectPtr olditem;
+        if( found )
+            olditem = newref( map()->m_items->value( cursor ) );
+        size_t index = map()->m_items->position( cursor );
+        if( map()->setitem( keyptr.get(), valptr.get() ) < 0 )
+            return -1;
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return -1;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), PySStr::__setitem__() ) )
+            return -1;
+        if( !c.set_item( PySStr::key(), keyptr ) )
+            return -1;
+        if( olditem && !c.set_item( PySStr::olditem(), olditem ) )
+            return -1;
+        if( !c.set_item( PySStr::newitem(), valptr ) )
+            return -1;
+        if( !set_index( c, index ) )
+            return -1;
+        return post_change( c ) ? 0 : -1;
+    }
+
+    PyObject* update( PyObject* args, PyObject* kwargs )
+    {
+        m_record = observer_check();
+        PyObjectPtr res( AtomSortedMapHandler::update( args, kwargs ) );
+        if( !res )
+            return 0;
+        if( !post_items_change( PySStr::update() ) )
+            return 0;
+        return res.release();
+    }
+
+    PyObject* merge( PyObject* args )
+    {
+        m_record = observer_check();
+        PyObjectPtr res( AtomSortedMapHandler::merge( args ) );
+        if( !res )
+            return 0;
+        if( !post_items_change( PySStr::merge() ) )
+            return 0;
+        return res.release();
+    }
+
+    PyObject* inplace_or( PyObject* other )
+    {
+        m_record = observer_check();
+        PyObjectPtr res( AtomSortedMapHandler::inplace_or( other ) );
+        if( !res )
+            return 0;
+        if( !post_items_change( PySStr::__ior__() ) )
+            return 0;
+        return res.release();
+    }
+
+    PyObject* pop( PyObject* args )
+    {
+        PyObject* key;
+        PyObject* value = 0;
+        if( !PyArg_UnpackTuple( args, "pop", 1, 2, &key, &value ) )
+            return 0;
+        if( !observer_check() )
+            return map()->pop( key, value );
+        SortedItems::Cursor cursor;
+        int found = map()->find( key, cursor );
+        if( found < 0 )
+            return 0;
+        if( !found )
+            return value ? newref( value ) : SortedMap::lookup_fail( key );
+        size_t index = map()->m_items->position( cursor );
+        MapItem item;
+        map()->m_items->erase( cursor, item );
+        if( !post_item_change( PySStr::pop(), item, index ) )
+            return 0;
+        return newref( item.value() );
+    }
+
+    PyObject* popitem( PyObject* args )
+    {
+        Py_ssize_t index = -1;
+        if( !PyArg_ParseTuple( args, "|n:popitem", &index ) )
+            return 0;
+        if( map()->m_items->size() == 0 )
+        {
+            PyErr_SetString( PyExc_KeyError, "popitem(): sortedmap is empty" );
+            return 0;
+        }
+        if( !map()->normalize( index ) )
+            return 0;
+        MapItem item;
+        map()->m_items->erase( map()->m_items->at( index ), item );
+        if( observer_check() && !post_item_change( PySStr::popitem(), item, index ) )
+            return 0;
+        return PyTuple_Pack( 2, item.key(), item.value() );
+    }
+
+    PyObject* clear()
+    {
+        bool obs = observer_check() && map()->m_items->size() > 0;
+        // Make the map empty before letting the destructors of the old
+        // items run, as in sortedmap.clear.
+        SortedItems empty( map()->m_items->chunksize() );
+        map()->m_items->swap( empty );
+        if( obs )
+        {
+            Items none;
+            m_validated = new_map( none );
+            if( !m_validated )
+                return 0;  // LCOV_EXCL_LINE
+            reinterpret_cast<SortedMap*>( m_validated.get() )->m_items->swap( empty );
+            if( !post_items_change( PySStr::clear() ) )
+                return 0;
+        }
+        Py_RETURN_NONE;
+    }
+
+private:
+
+    AtomCSortedMapHandler();
+
+    int delitem( PyObject* key )
+    {
+        SortedItems::Cursor cursor;
+        int found = map()->find( key, cursor );
+        if( found <= 0 )
+        {
+            if( found == 0 )
+                SortedMap::lookup_fail( key );
+            return -1;
+        }
+        size_t index = map()->m_items->position( cursor );
+        MapItem item;
+        map()->m_items->erase( cursor, item );
+        return post_item_change( PySStr::__delitem__(), item, index ) ? 0 : -1;
+    }
+
+    int delslice( PyObject* slice, PyObject* value )
+    {
+        if( value )
+            return AtomSortedMapHandler::setitem( slice, value );
+        m_validated = SortedMap_BaseType->tp_as_mapping->mp_subscript(
+            m_map.get(), slice );
+        if( !m_validated )
+            return -1;
+        if( SortedMap_BaseType->tp_as_mapping->mp_ass_subscript(
+                m_map.get(), slice, 0 ) < 0 )
+            return -1;  // LCOV_EXCL_LINE
+        return post_items_change( PySStr::__delitem__() ) ? 0 : -1;
+    }
+
+    Member* member()
+    {
+        return atomcsortedmap_cast( m_map.get() )->member;
+    }
+
+    bool observer_check()
+    {
+        m_obsm = false;
+        m_obsa = false;
+        if( !member() || !atom() )
+            return false;
+        m_obsm = member()->has_observers();
+        m_obsa = atom()->has_observers( member()->name );
+        return m_obsm || m_obsa;
+    }
+
+    PyObject* prepare_change()
+    {
+        PyDictPtr c( PyDict_New() );
+        if( !c )
+            return 0;
+        if( !c.set_item( PySStr::type(), PySStr::container() ) )
+            return 0;
+        if( !c.set_item( PySStr::name(), member()->name ) )
+            return 0;
+        if( !c.set_item( PySStr::object(), pyobject_cast( atom() ) ) )
+            return 0;
+        if( !c.set_item( PySStr::value(), m_map.get() ) )
+            return 0;
+        return c.release();
+    }
+
+    bool set_index( PyDictPtr& change, size_t index )
+    {
+        PyObjectPtr pyindex( Py23Int_FromSsize_t( static_cast<Py_ssize_t>( index ) ) );
+        if( !pyindex )
+            return false;  // LCOV_EXCL_LINE
+        return change.set_item( PySStr::index(), pyindex );
+    }
+
+    bool post_change( PyObjectPtr& change )
+    {
+        PyTuplePtr args( PyTuple_New( 1 ) );
+        if( !args )
+            return false;
+        args.set_item( 0, change );
+        ChangeTrace::record( ChangeTrace::Container, atom(), member() );
+        if( m_obsm )
+        {
+            if( !member()->notify( atom(), args.get(), 0 ) )
+                return false;
+        }
+        if( m_obsa )
+        {
+            if( !atom()->notify( member()->name, args.get(), 0 ) )
+                return false;
+        }
+        return true;
+    }
+
+    bool post_item_change( PyObject* operation, MapItem& item, size_t index )
+    {
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), operation ) )
+            return false;
+        if( !c.set_item( PySStr::key(), item.key() ) )
+            return false;
+        if( !c.set_item( PySStr::item(), item.value() ) )
+            return false;
+        if( !set_index( c, index ) )
+            return false;
+        return post_change( c );
+    }
+
+    // Report the recorded items, if any, with the range of their keys.
+    bool post_items_change( PyObject* operation )
+    {
+        if( !m_validated )
+            return true;
+        SortedItems* items = reinterpret_cast<SortedMap*>( m_validated.get() )->m_items;
+        if( items->size() == 0 )
+            return true;
+        PyObjectPtr range( PyTuple_Pack( 2,
+            items->chunk( 0 ).keys.front(),
+            items->chunk( items->chunk_count() - 1 ).keys.back() ) );
+        if( !range )
+            return false;  // LCOV_EXCL_LINE
+        PyDictPtr c( prepare_change() );
+        if( !c )
+            return false;  // LCOV_EXCL_LINE
+        if( !c.set_item( PySStr::operation(), operation ) )
+            return false;
+        if( !c.set_item( PySStr::items(), m_validated ) )
+            return false;
+        if( !c.set_item( PySStr::range(), range ) )
+            return false;
+        return post_change( c );
+    }
+
+    bool m_obsm;
+    bool m_obsa;
+};
+
+}  // namespace
+
+
+static PyObject*
+AtomCSortedMap_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    return AtomSortedMap_Type.tp_new( type, args, kwargs );
+}
+
+
+static int
+AtomCSortedMap_clear( AtomCSortedMap* self )
+{
+    Py_CLEAR( self->member );
+    return AtomSortedMap_clear( atomsortedmap_cast( self ) );
+}
+
+
+static int
+AtomCSortedMap_traverse( AtomCSortedMap* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->member );
+    return AtomSortedMap_traverse( atomsortedmap_cast( self ), visit, arg );
+}
+
+
+static void
+AtomCSortedMap_dealloc( AtomCSortedMap* self )
+{
+    PyObject_GC_UnTrack( self );
+    Py_CLEAR( self->member );
+    AtomSortedMap_dealloc( atomsortedmap_cast( self ) );
+}
+
+
+static PyObject*
+AtomCSortedMap_update( AtomCSortedMap* self, PyObject* args, PyObject* kwargs )
+{
+    return AtomCSortedMapHandler( self ).update( args, kwargs );
+}
+
+
+static PyObject*
+AtomCSortedMap_merge( AtomCSortedMap* self, PyObject* args )
+{
+    return AtomCSortedMapHandler( self ).merge( args );
+}
+
+
+static PyObject*
+AtomCSortedMap_pop( AtomCSortedMap* self, PyObject* args )
+{
+    return AtomCSortedMapHandler( self ).pop( args );
+}
+
+
+static PyObject*
+AtomCSortedMap_popitem( AtomCSortedMap* self, PyObject* args )
+{
+    return AtomCSortedMapHandler( self ).popitem( args );
+}
+
+
+static PyObject*
+AtomCSortedMap_clear_items( AtomCSortedMap* self )
+{
+    return AtomCSortedMapHandler( self ).clear();
+}
+
+
+static PyObject*
+AtomCSortedMap_ior( AtomCSortedMap* self, PyObject* other )
+{
+    return AtomCSortedMapHandler( self ).inplace_or( other );
+}
+
+
+static int
+AtomCSortedMap_ass_subscript( AtomCSortedMap* self, PyObject* key, PyObject* value )
+{
+    return AtomCSortedMapHandler( self ).setitem( key, value );
+}
+
+
+PyDoc_STRVAR( c_pop_doc,
+"M.pop(k[,d]) -> v, remove specified key and return the corresponding value.\n"
+"If key is not found, d is returned if given, otherwise KeyError is raised" );
+
+PyDoc_STRVAR( c_popitem_doc,
+"M.popitem([index]) -> (k, v), remove and return the item at index (default\n"
+"last); but raise KeyError if M is empty." );
+
+PyDoc_STRVAR( c_clear_doc,
+"M.clear() -> None.  Remove all items from M." );
+
+
+static PyMethodDef
+AtomCSortedMap_methods[] = {
+    { "update", ( PyCFunction )AtomCSortedMap_update, METH_VARARGS | METH_KEYWORDS, s_update_doc },
+    { "merge", ( PyCFunction )AtomCSortedMap_merge, METH_VARARGS, s_merge_doc },
+    { "pop", ( PyCFunction )AtomCSortedMap_pop, METH_VARARGS, c_pop_doc },
+    { "popitem", ( PyCFunction )AtomCSortedMap_popitem, METH_VARARGS, c_popitem_doc },
+    { "clear", ( PyCFunction )AtomCSortedMap_clear_items, METH_NOARGS, c_clear_doc },
+    { 0 }  /* sentinel */
+};
+
+
+static PyNumberMethods
+AtomCSortedMap_as_number = {
+     ( binaryfunc )0,                       /* nb_add */
+     ( binaryfunc )0,                       /* nb_subtract */
+     ( binaryfunc )0,                       /* nb_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_remainder */
+     ( binaryfunc )0,                       /* nb_divmod */
+     ( ternaryfunc )0,                      /* nb_power */
+     ( unaryfunc )0,                        /* nb_negative */
+     ( unaryfunc )0,                        /* nb_positive */
+     ( unaryfunc )0,                        /* nb_absolute */
+     ( inquiry )0,                          /* nb_nonzero, or nb_bool in python3 */
+     ( unaryfunc )0,                        /* nb_invert */
+     ( binaryfunc )0,                       /* nb_lshift */
+     ( binaryfunc )0,                       /* nb_rshift */
+     ( binaryfunc )0,                       /* nb_and */
+     ( binaryfunc )0,                       /* nb_xor */
+     ( binaryfunc )0,                       /* nb_or */
+#if PY_MAJOR_VERSION < 3
+     ( coercion )0,                         /* nb_coerce */
+#endif
+     ( unaryfunc )0,                        /* nb_int */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_long */
+#else
+     ( void* )0,                            /* nb_reserved */
+#endif
+     ( unaryfunc )0,                        /* nb_float */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_oct */
+     ( unaryfunc )0,                        /* nb_hex */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_add */
+     ( binaryfunc )0,                       /* nb_inplace_subtract */
+     ( binaryfunc )0,                       /* nb_inplace_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_inplace_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_remainder */
+     ( ternaryfunc )0,                      /* nb_inplace_power */
+     ( binaryfunc )0,                       /* nb_inplace_lshift */
+     ( binaryfunc )0,                       /* nb_inplace_rshift */
+     ( binaryfunc )0,                       /* nb_inplace_and */
+     ( binaryfunc )0,                       /* nb_inplace_xor */
+     ( binaryfunc )AtomCSortedMap_ior       /* nb_inplace_or */
+};
+
+
+static PyMappingMethods
+AtomCSortedMap_as_mapping = {
+    (lenfunc)0,                                 /* mp_length */
+    (binaryfunc)0,                              /* mp_subscript */
+    (objobjargproc)AtomCSortedMap_ass_subscript /* mp_ass_subscript */
+};
+
+
+PyTypeObject AtomCSortedMap_Type = {
+    PyVarObject_HEAD_INIT( &PyType_Type, 0 )
+    PACKAGE_TYPENAME( "atomcsortedmap" ),   /* tp_name */
+    sizeof( AtomCSortedMap ),               /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)AtomCSortedMap_dealloc,     /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)&AtomCSortedMap_as_number,   /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)&AtomCSortedMap_as_mapping, /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+#if PY_MAJOR_VERSION < 3
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC|Py_TPFLAGS_CHECKTYPES, /* tp_flags */
+#else
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_BASETYPE|Py_TPFLAGS_HAVE_GC, /* tp_flags */
+#endif
+    0,                                      /* Documentation string */
+    (traverseproc)AtomCSortedMap_traverse,  /* tp_traverse */
+    (inquiry)AtomCSortedMap_clear,          /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)AtomCSortedMap_methods, /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    &AtomSortedMap_Type,                    /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)0,                           /* tp_alloc */
+    (newfunc)AtomCSortedMap_new,            /* tp_new */
+    (freefunc)0,                            /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+int
+import_atomsortedmap()
+{
+    PyObjectPtr mod( PyImport_ImportModule( "atom.datastructures.sortedmap" ) );
+    if( !mod )
+        return -1;
+    PyObjectPtr type( PyObject_GetAttrString( mod.get(), "sortedmap" ) );
+    if( !type )
+        return -1;
+    if( !PyType_Check( type.get() ) ||
+        pytype_cast( type.get() )->tp_basicsize != sizeof( SortedMap ) )
+    {
+        py_bad_internal_call( "incompatible atom.datastructures.sortedmap extension" );
+        return -1;
+    }
+    SortedMap_BaseType = pytype_cast( type.release() );
+    AtomSortedMap_Type.tp_base = SortedMap_BaseType;
+    if( PyType_Ready( &AtomSortedMap_Type ) < 0 )
+        return -1;
+    if( PyType_Ready( &AtomCSortedMap_Type ) < 0 )
+        return -1;
+    if( !SortedMapMethods::init_methods() )
+        return -1;
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "catom.h"
+#include "catompointer.h"
+#include "member.h"
+#include "sortedmap.h"
+
+
+#define atomsortedmap_cast( o ) ( reinterpret_cast<AtomSortedMap*>( o ) )
+#define atomcsortedmap_cast( o ) ( reinterpret_cast<AtomCSortedMap*>( o ) )
+#define AtomSortedMap_Check( o ) ( PyObject_TypeCheck( o, &AtomSortedMap_Type ) )
+#define AtomCSortedMap_Check( o ) ( PyObject_TypeCheck( o, &AtomCSortedMap_Type ) )
+
+
+// The atomsortedmap derives from the sortedmap of the datastructures
+// extension, whose layout it shares through sortedmap.h.
+typedef struct {
+    SortedMap map;
+    Member* key_validator;
+    Member* value_validator;
+    CAtomPointer* pointer;
+} AtomSortedMap;
+
+
+typedef struct {
+    AtomSortedMap atomsortedmap;
+    Member* member;
+} AtomCSortedMap;
+
+
+extern PyTypeObject AtomSortedMap_Type;
+
+
+extern PyTypeObject AtomCSortedMap_Type;
+
+
+// The sortedmap type, available once import_atomsortedmap succeeded.
+extern PyTypeObject* SortedMap_BaseType;
+
+
+#define SortedMap_Check( o ) ( PyObject_TypeCheck( o, SortedMap_BaseType ) )
+
+
+PyObject*
+AtomSortedMap_New( CAtom* atom, Member* key_validator, Member* value_validator );
+
+
+PyObject*
+AtomCSortedMap_New( CAtom* atom, Member* key_validator, Member* value_validator, Member* member );
+
+
+// Validate the items of a dict or a sortedmap into an empty atomsortedmap,
+// without emitting notifications.
+int
+AtomSortedMap_Load( PyObject* map, PyObject* items );
+
+
+int
+import_atomsortedmap();
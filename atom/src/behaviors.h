@@ -131,7 +131,12 @@ enum Mode
     Tuple,
     List,
     ContainerList,
+    NumericList,
+    ContainerNumericList,
     Dict,
+    ContainerDict,
+    SortedMap,
+    ContainerSortedMap,
     Instance,
     Typed,
     Subclass,
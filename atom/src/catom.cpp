@@ -14,9 +14,14 @@
 #endif
 
 #include <map>
+#include <vector>
+#include "allocpool.h"
+#include "atomcopy.h"
 #include "atomref.h"
 #include "catom.h"
 #include "globalstatic.h"
+#include "member.h"
+#include "memberstats.h"
 #include "methodwrapper.h"
 #include "packagenaming.h"
 #include "utils.h"
@@ -29,36 +34,90 @@ using namespace PythonHelpers;
 static PyObject* atom_members;
 
 
+bool
+slots_only( PyTypeObject* type )
+{
+    if( type->tp_dictoffset != 0 )
+        return false;
+    Py_ssize_t size = CAtom_Type.tp_basicsize;
+    if( type->tp_weaklistoffset != 0 )
+        size += sizeof( PyObject* );
+    return type->tp_basicsize == size;
+}
+
+
 static PyObject*
-CAtom_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+atom_members_of( PyTypeObject* type )
 {
     PyDictPtr membersptr( PyObject_GetAttr( pyobject_cast( type ), atom_members ) );
     if( !membersptr )
         return 0;
     if( !membersptr.check_exact() )
         return py_bad_internal_call( "atom members" );
-    PyObjectPtr selfptr( PyType_GenericNew( type, args, kwargs ) );
+    return membersptr.release();
+}
+
+
+// Create an atom with the given number of slots, without calling __init__.
+static PyObject*
+new_atom( PyTypeObject* type, Py_ssize_t count )
+{
+    if( count > static_cast<Py_ssize_t>( MAX_MEMBER_COUNT ) )
+        return py_type_fail( "too many members" );
+    PyObjectPtr selfptr( AllocPool::alloc_instance( type ) );
     if( !selfptr )
         return 0;
     CAtom* atom = catom_cast( selfptr.get() );
-    uint32_t count = static_cast<uint32_t>( membersptr.size() );
     if( count > 0 )
     {
-        if( count > MAX_MEMBER_COUNT )
-            return py_type_fail( "too many members" );
-        size_t size = sizeof( PyObject* ) * count;
-        void* slots = PyObject_MALLOC( size );
-        if( !slots )
+        atom->slots = AllocPool::alloc_slots( static_cast<uint32_t>( count ) );
+        if( !atom->slots )
             return PyErr_NoMemory();  // LCOV_EXCL_LINE
-        memset( slots, 0, size );
-        atom->slots = reinterpret_cast<PyObject**>( slots );
-        atom->set_slot_count( count );
+        atom->set_slot_count( static_cast<uint32_t>( count ) );
     }
     atom->set_notifications_enabled( true );
     return selfptr.release();
 }
 
 
+static PyObject*
+CAtom_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    PyDictPtr membersptr( atom_members_of( type ) );
+    if( !membersptr )
+        return 0;
+    return new_atom( type, membersptr.size() );
+}
+
+
+// The member bound to a field name, looked up as setattr would, or null if
+// the field should be set through setattr: when it is not a member, when
+// the class customizes setattr or when the member overrides __set__.
+static PyObject*
+field_member( PyTypeObject* type, PyObject* name )
+{
+    if( type->tp_setattro != PyObject_GenericSetAttr )
+        return 0;
+    PyObject* member = _PyType_Lookup( type, name );
+    if( !member || !Member::TypeCheck( member ) )
+        return 0;
+    if( Py_TYPE( member )->tp_descr_set != Member_Type.tp_descr_set )
+        return 0;
+    return newref( member );
+}
+
+
+// Set a field of an atom being created, through its member when it has
+// one and through setattr otherwise.
+static bool
+set_field( CAtom* atom, PyObject* name, PyObject* member, PyObject* value )
+{
+    if( member )
+        return member_cast( member )->setattr( atom, value ) == 0;
+    return PyObject_SetAttr( pyobject_cast( atom ), name, value ) == 0;
+}
+
+
 static int
 CAtom_init( CAtom* self, PyObject* args, PyObject* kwargs )
 {
@@ -69,14 +128,17 @@ CAtom_init( CAtom* self, PyObject* args, PyObject* kwargs )
     }
     if( kwargs )
     {
-        PyObjectPtr selfptr( newref( pyobject_cast( self ) ) );
+        PyTypeObject* type = Py_TYPE( self );
         PyObject* key;
         PyObject* value;
         Py_ssize_t pos = 0;
         while( PyDict_Next( kwargs, &pos, &key, &value ) )
         {
-            if( !selfptr.setattr( key, value ) )
-                return -1;  // LCOV_EXCL_LINE
+            PyObjectPtr keyptr( newref( key ) );
+            PyObjectPtr valueptr( newref( value ) );
+            PyObjectPtr member( field_member( type, key ) );
+            if( !set_field( self, keyptr.get(), member.get(), valueptr.get() ) )
+                return -1;
         }
     }
     return 0;
@@ -116,10 +178,11 @@ CAtom_dealloc( CAtom* self )
     PyObject_GC_UnTrack( self );
     CAtom_clear( self );
     if( self->slots )
-        PyObject_FREE( self->slots );
-    delete self->observers;
+        AllocPool::free_slots( self->slots, self->get_slot_count() );
+    if( self->observers )
+        AllocPool::free_observers( self->observers );
     self->observers = 0;
-    Py_TYPE(self)->tp_free( pyobject_cast( self ) );
+    AllocPool::free_instance( pyobject_cast( self ) );
 }
 
 
@@ -332,6 +395,689 @@ CAtom_sizeof( CAtom* self, PyObject* args )
 }
 
 
+static PyObject*
+CAtom_from_rows( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    static char* kwlist[] = { "rows", "fields", "notify", 0 };
+    PyObject* rows;
+    PyObject* fields;
+    PyObject* pynotify = Py_True;
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "OO|O:from_rows", kwlist, &rows, &fields, &pynotify ) )
+        return 0;
+    int notify = PyObject_IsTrue( pynotify );
+    if( notify < 0 )
+        return 0;
+    PyDictPtr membersptr( atom_members_of( type ) );
+    if( !membersptr )
+        return 0;
+    PyObjectPtr namesptr( PySequence_Tuple( fields ) );
+    if( !namesptr )
+        return 0;
+    Py_ssize_t count = PyTuple_GET_SIZE( namesptr.get() );
+    PyObject** names = &PyTuple_GET_ITEM( namesptr.get(), 0 );
+    std::vector<PyObjectPtr> members( count );
+    for( Py_ssize_t i = 0; i < count; ++i )
+    {
+        if( !Py23Str_Check( names[ i ] ) )
+            return py_expected_type_fail( names[ i ], "str" );
+        members[ i ] = field_member( type, names[ i ] );
+    }
+    PyObjectPtr iterptr( PyObject_GetIter( rows ) );
+    if( !iterptr )
+        return 0;
+    PyListPtr result( PyList_New( 0 ) );
+    if( !result )
+        return 0;
+    PyObjectPtr item;
+    while( ( item = PyIter_Next( iterptr.get() ) ) )
+    {
+        PyObjectPtr rowptr( PySequence_Fast( item.get(), "rows must be sequences" ) );
+        if( !rowptr )
+            return 0;
+        PyObjectPtr atomptr( new_atom( type, membersptr.size() ) );
+        if( !atomptr )
+            return 0;
+        CAtom* atom = catom_cast( atomptr.get() );
+        atom->set_notifications_enabled( notify != 0 );
+        for( Py_ssize_t i = 0; i < count; ++i )
+        {
+            // Setting a field may run arbitrary code mutating a list row.
+            if( PySequence_Fast_GET_SIZE( rowptr.get() ) != count )
+            {
+                return py_value_fail(
+                    "the rows must hold as many values as there are fields" );
+            }
+            PyObjectPtr value( newref( PySequence_Fast_GET_ITEM( rowptr.get(), i ) ) );
+            if( !set_field( atom, names[ i ], members[ i ].get(), value.get() ) )
+                return 0;
+        }
+        atom->set_notifications_enabled( true );
+        if( !result.append( atomptr ) )
+            return 0;
+    }
+    if( PyErr_Occurred() )
+        return 0;
+    return result.release();
+}
+
+
+static PyObject*
+CAtom_from_dicts( PyTypeObject* type, PyObject* args, PyObject* kwargs )
+{
+    static char* kwlist[] = { "dicts", "notify", 0 };
+    PyObject* dicts;
+    PyObject* pynotify = Py_True;
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "O|O:from_dicts", kwlist, &dicts, &pynotify ) )
+        return 0;
+    int notify = PyObject_IsTrue( pynotify );
+    if( notify < 0 )
+        return 0;
+    PyDictPtr membersptr( atom_members_of( type ) );
+    if( !membersptr )
+        return 0;
+    PyObjectPtr iterptr( PyObject_GetIter( dicts ) );
+    if( !iterptr )
+        return 0;
+    PyListPtr result( PyList_New( 0 ) );
+    if( !result )
+        return 0;
+    PyObjectPtr item;
+    while( ( item = PyIter_Next( iterptr.get() ) ) )
+    {
+        if( !PyDict_Check( item.get() ) )
+            return py_expected_type_fail( item.get(), "dict" );
+        PyObjectPtr atomptr( new_atom( type, membersptr.size() ) );
+        if( !atomptr )
+            return 0;
+        CAtom* atom = catom_cast( atomptr.get() );
+        atom->set_notifications_enabled( notify != 0 );
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while( PyDict_Next( item.get(), &pos, &key, &value ) )
+        {
+            if( !Py23Str_Check( key ) )
+                return py_expected_type_fail( key, "str" );
+            PyObjectPtr keyptr( newref( key ) );
+            PyObjectPtr valueptr( newref( value ) );
+            PyObjectPtr member( field_member( type, key ) );
+            if( !set_field( atom, keyptr.get(), member.get(), valueptr.get() ) )
+                return 0;
+        }
+        atom->set_notifications_enabled( true );
+        if( !result.append( atomptr ) )
+            return 0;
+    }
+    if( PyErr_Occurred() )
+        return 0;
+    return result.release();
+}
+
+
+// The pickle support. The state of an atom is a tuple holding the names
+// of the members in slot order, an int masking the set slots, the values
+// of the set slots and, when it is not empty, a dict of the attributes
+// stored outside of the slots. The names tuple is cached on the class, so that a
+// pickle stream holds it once per class, and lets a state be restored by
+// name when the members of the class changed.
+static PyObject* state_names_str;
+
+
+static PyObject* getstate_str;
+
+
+static PyObject* setstate_str;
+
+
+static PyObject* getnewargs_str;
+
+
+static PyObject* dict_str;
+
+
+static PyObject* newobj_func;
+
+
+static PyObject* slotnames_func;
+
+
+// The CAtom implementations, recognized to skip calling them.
+static PyObject* default_getstate;
+
+
+static PyObject* default_setstate;
+
+
+static PyObject* default_getnewargs;
+
+
+static PyObject* default_reduce_ex;
+
+
+static PyObject* default_reduce;
+
+
+static PyObject* reduce_ex_str;
+
+
+static PyObject* reduce_str;
+
+
+// Whether restoring a state trusts its values and skips their validation.
+static bool trusted_state = false;
+
+
+static PyObject*
+state_names( PyTypeObject* type, PyObject* members )
+{
+    Py_ssize_t count = PyDict_Size( members );
+    PyObject* cached = PyDict_GetItem( type->tp_dict, state_names_str );
+    if( cached && PyTuple_CheckExact( cached ) && PyTuple_GET_SIZE( cached ) == count )
+        return newref( cached );
+    PyTuplePtr names( PyTuple_New( count ) );
+    if( !names )
+        return 0;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while( PyDict_Next( members, &pos, &key, &value ) )
+    {
+        if( !Member::TypeCheck( value ) )
+            return py_expected_type_fail( value, "Member" );
+        uint32_t index = member_cast( value )->index;
+        if( index >= count || PyTuple_GET_ITEM( names.get(), index ) )
+            return py_bad_internal_call( "atom member indices" );
+        PyTuple_SET_ITEM( names.get(), index, newref( key ) );
+    }
+    if( PyObject_SetAttr( pyobject_cast( type ), state_names_str, names.get() ) != 0 )
+        PyErr_Clear();
+    return names.release();
+}
+
+
+// The attributes of an atom stored in its instance dict or Python slots.
+static PyObject*
+python_state( CAtom* self, bool missing_ok )
+{
+    PyDictPtr state( PyDict_New() );
+    if( !state )
+        return 0;
+    PyTypeObject* type = Py_TYPE( self );
+    if( slots_only( type ) )
+        return state.release();
+    if( type->tp_dictoffset != 0 )
+    {
+        PyObjectPtr dict( PyObject_GetAttr( pyobject_cast( self ), dict_str ) );
+        if( !dict )
+            return 0;
+        if( PyDict_Update( state.get(), dict.get() ) != 0 )
+            return 0;
+    }
+    PyObjectPtr slots( PyObject_CallFunctionObjArgs( slotnames_func, type, 0 ) );
+    if( !slots )
+        return 0;
+    PyObjectPtr iter( PyObject_GetIter( slots.get() ) );
+    if( !iter )
+        return 0;
+    PyObjectPtr name;
+    while( ( name = PyIter_Next( iter.get() ) ) )
+    {
+        PyObjectPtr value( PyObject_GetAttr( pyobject_cast( self ), name.get() ) );
+        if( !value )
+        {
+            if( !missing_ok || !PyErr_ExceptionMatches( PyExc_AttributeError ) )
+                return 0;
+            PyErr_Clear();
+            continue;
+        }
+        if( !state.set_item( name, value ) )
+            return 0;
+    }
+    if( PyErr_Occurred() )
+        return 0;
+    return state.release();
+}
+
+
+static PyObject*
+compact_state( CAtom* self )
+{
+    PyTypeObject* type = Py_TYPE( self );
+    PyDictPtr members( atom_members_of( type ) );
+    if( !members )
+        return 0;
+    PyObjectPtr names( state_names( type, members.get() ) );
+    if( !names )
+        return 0;
+    uint32_t count = self->get_slot_count();
+    if( PyTuple_GET_SIZE( names.get() ) < count )
+        count = static_cast<uint32_t>( PyTuple_GET_SIZE( names.get() ) );
+    Py_ssize_t set = 0;
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        if( self->slots[ i ] )
+            ++set;
+    }
+    std::vector<unsigned char> bits( count / 8 + 1, 0 );
+    PyTuplePtr values( PyTuple_New( set ) );
+    if( !values )
+        return 0;
+    for( uint32_t i = 0, j = 0; i < count && j < set; ++i )
+    {
+        if( !self->slots[ i ] )
+            continue;
+        bits[ i / 8 ] |= static_cast<unsigned char>( 1 << ( i % 8 ) );
+        PyTuple_SET_ITEM( values.get(), j++, newref( self->slots[ i ] ) );
+    }
+    PyObjectPtr mask( _PyLong_FromByteArray( &bits[ 0 ], bits.size(), 1, 0 ) );
+    if( !mask )
+        return 0;
+    PyDictPtr extra( python_state( self, true ) );
+    if( !extra )
+        return 0;
+    if( extra.size() == 0 )
+        return PyTuple_Pack( 3, names.get(), mask.get(), values.get() );
+    return PyTuple_Pack( 4, names.get(), mask.get(), values.get(), extra.get() );
+}
+
+
+// Whether the validation of a member builds the stored value, which must
+// then happen even for a trusted state.
+static bool
+builds_value( Member* member )
+{
+    switch( member->get_validate_mode() )
+    {
+        case Validate::List:
+        case Validate::ContainerList:
+        case Validate::NumericList:
+        case Validate::ContainerNumericList:
+        case Validate::Dict:
+        case Validate::ContainerDict:
+        case Validate::SortedMap:
+        case Validate::ContainerSortedMap:
+        case Validate::Delegate:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+bool
+restore_member( CAtom* atom, Member* member, PyObject* value )
+{
+    if( member->index >= atom->get_slot_count() )
+    {
+        py_bad_internal_call( "atom member index" );
+        return false;
+    }
+    PyObjectPtr valueptr( newref( value ) );
+    if( trusted_state )
+    {
+        if( builds_value( member ) )
+        {
+            valueptr = member->full_validate( atom, Py_None, valueptr.get() );
+            if( !valueptr )
+                return false;
+        }
+        atom->set_slot( member->index, valueptr.get() );
+        return true;
+    }
+    switch( member->get_setattr_mode() )
+    {
+        case SetAttr::Slot:
+        case SetAttr::ReadOnly:
+        case SetAttr::Delegate:
+            return member->setattr( atom, valueptr.get() ) == 0;
+        default:
+            atom->set_slot( member->index, valueptr.get() );
+            return true;
+    }
+}
+
+
+static bool
+restore_compact( CAtom* self, PyObject* state )
+{
+    Py_ssize_t size = PyTuple_GET_SIZE( state );
+    PyObject* names = PyTuple_GET_ITEM( state, 0 );
+    PyObject* mask = PyTuple_GET_ITEM( state, 1 );
+    PyObject* values = PyTuple_GET_ITEM( state, 2 );
+    PyObject* extra = size > 3 ? PyTuple_GET_ITEM( state, 3 ) : 0;
+    if( !PyTuple_Check( names ) || !( Py23Int_Check( mask ) || PyLong_Check( mask ) ) ||
+        !PyTuple_Check( values ) || ( extra && !PyDict_Check( extra ) ) )
+    {
+        py_type_fail( "invalid atom state" );
+        return false;
+    }
+    Py_ssize_t count = PyTuple_GET_SIZE( names );
+    PyObjectPtr maskptr( PyNumber_Long( mask ) );
+    if( !maskptr )
+        return false;
+    std::vector<unsigned char> bits( count / 8 + 1, 0 );
+    if( _PyLong_AsByteArray( reinterpret_cast<PyLongObject*>( maskptr.get() ),
+                             &bits[ 0 ], bits.size(), 1, 0 ) != 0 ||
+        bits[ count / 8 ] >> ( count % 8 ) != 0 )
+    {
+        PyErr_Clear();
+        py_value_fail( "invalid atom state" );
+        return false;
+    }
+    PyTypeObject* type = Py_TYPE( self );
+    PyDictPtr members( atom_members_of( type ) );
+    if( !members )
+        return false;
+    Py_ssize_t set = 0;
+    for( Py_ssize_t i = 0; i < count; ++i )
+    {
+        if( bits[ i / 8 ] & ( 1 << ( i % 8 ) ) )
+            ++set;
+    }
+    if( set != PyTuple_GET_SIZE( values ) )
+    {
+        py_value_fail( "invalid atom state" );
+        return false;
+    }
+    PyObjectPtr stateptr( newref( state ) );
+    for( Py_ssize_t i = 0, j = 0; i < count; ++i )
+    {
+        if( !( bits[ i / 8 ] & ( 1 << ( i % 8 ) ) ) )
+            continue;
+        PyObject* name = PyTuple_GET_ITEM( names, i );
+        PyObject* value = PyTuple_GET_ITEM( values, j++ );
+        PyObjectPtr member( xnewref( PyDict_GetItem( members.get(), name ) ) );
+        if( member && Member::TypeCheck( member.get() ) )
+        {
+            if( !restore_member( self, member_cast( member.get() ), value ) )
+                return false;
+        }
+        else if( PyObject_SetAttr( pyobject_cast( self ), name, value ) != 0 )
+            return false;
+    }
+    if( extra )
+    {
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while( PyDict_Next( extra, &pos, &key, &value ) )
+        {
+            PyObjectPtr keyptr( newref( key ) );
+            PyObjectPtr valueptr( newref( value ) );
+            if( PyObject_SetAttr( pyobject_cast( self ), key, value ) != 0 )
+                return false;
+        }
+    }
+    return true;
+}
+
+
+static PyObject*
+CAtom_getstate( CAtom* self )
+{
+    PyDictPtr state( python_state( self, false ) );
+    if( !state )
+        return 0;
+    PyDictPtr members( atom_members_of( Py_TYPE( self ) ) );
+    if( !members )
+        return 0;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while( PyDict_Next( members.get(), &pos, &key, &value ) )
+    {
+        PyObjectPtr keyptr( newref( key ) );
+        PyObjectPtr attr( PyObject_GetAttr( pyobject_cast( self ), key ) );
+        if( !attr )
+            return 0;
+        if( !state.set_item( keyptr, attr ) )
+            return 0;
+    }
+    return state.release();
+}
+
+
+static PyObject*
+CAtom_setstate( CAtom* self, PyObject* state )
+{
+    if( PyDict_Check( state ) )
+    {
+        PyObjectPtr stateptr( newref( state ) );
+        PyObject* key;
+        PyObject* value;
+        Py_ssize_t pos = 0;
+        while( PyDict_Next( state, &pos, &key, &value ) )
+        {
+            PyObjectPtr keyptr( newref( key ) );
+            PyObjectPtr valueptr( newref( value ) );
+            if( PyObject_SetAttr( pyobject_cast( self ), key, value ) != 0 )
+                return 0;
+        }
+        Py_RETURN_NONE;
+    }
+    if( !PyTuple_Check( state ) || PyTuple_GET_SIZE( state ) < 3 || PyTuple_GET_SIZE( state ) > 4 )
+        return py_expected_type_fail( state, "dict or atom state tuple" );
+    if( !restore_compact( self, state ) )
+        return 0;
+    Py_RETURN_NONE;
+}
+
+
+static PyObject*
+CAtom_getnewargs( CAtom* self )
+{
+    return PyTuple_New( 0 );
+}
+
+
+static PyObject*
+CAtom_reduce_ex( CAtom* self, PyObject* proto )
+{
+    PyTypeObject* type = Py_TYPE( self );
+    PyObjectPtr newargs;
+    if( _PyType_Lookup( type, getnewargs_str ) == default_getnewargs )
+        newargs = PyTuple_New( 0 );
+    else
+        newargs = PyObject_CallMethodObjArgs( pyobject_cast( self ), getnewargs_str, 0 );
+    if( !newargs )
+        return 0;
+    if( !PyTuple_Check( newargs.get() ) )
+        return py_expected_type_fail( newargs.get(), "tuple" );
+    Py_ssize_t count = PyTuple_GET_SIZE( newargs.get() );
+    PyTuplePtr args( PyTuple_New( count + 1 ) );
+    if( !args )
+        return 0;
+    PyTuple_SET_ITEM( args.get(), 0, newref( pyobject_cast( type ) ) );
+    for( Py_ssize_t i = 0; i < count; ++i )
+        PyTuple_SET_ITEM( args.get(), i + 1, newref( PyTuple_GET_ITEM( newargs.get(), i ) ) );
+    // The compact state is only understood by the default __setstate__,
+    // and subclasses customizing __getstate__ expect it to return a dict.
+    PyObjectPtr state;
+    if( _PyType_Lookup( type, getstate_str ) == default_getstate &&
+        _PyType_Lookup( type, setstate_str ) == default_setstate )
+        state = compact_state( self );
+    else
+        state = PyObject_CallMethodObjArgs( pyobject_cast( self ), getstate_str, 0 );
+    if( !state )
+        return 0;
+    return PyTuple_Pack( 3, newobj_func, args.get(), state.get() );
+}
+
+
+// Whether the pickling of a type was customized, in which case the copies
+// of its instances are made from its reduction, as copy.copy would.
+static bool
+custom_reduction( PyTypeObject* type )
+{
+    return _PyType_Lookup( type, reduce_ex_str ) != default_reduce_ex ||
+        _PyType_Lookup( type, reduce_str ) != default_reduce ||
+        _PyType_Lookup( type, getstate_str ) != default_getstate ||
+        _PyType_Lookup( type, setstate_str ) != default_setstate ||
+        _PyType_Lookup( type, getnewargs_str ) != default_getnewargs;
+}
+
+
+static bool
+memoize( CAtom* self, PyObject* copy, PyObject* memo )
+{
+    PyObjectPtr key( PyLong_FromVoidPtr( self ) );
+    if( !key )
+        return false;
+    return PyObject_SetItem( memo, key.get(), copy ) == 0;
+}
+
+
+static PyObject*
+copy_arg( PyObject* value, PyObject* memo )
+{
+    return memo ? AtomCopy::deepcopy( value, memo ) : newref( value );
+}
+
+
+static PyObject*
+reconstruct( CAtom* self, PyObject* memo )
+{
+#if PY_MAJOR_VERSION >= 3
+    PyObjectPtr rv( PyObject_CallMethod( pyobject_cast( self ), "__reduce_ex__", "i", 4 ) );
+#else
+    PyObjectPtr rv( PyObject_CallMethod( pyobject_cast( self ), "__reduce_ex__", "i", 2 ) );
+#endif
+    if( !rv )
+        return 0;
+    if( Py23Str_Check( rv.get() ) )
+        return newref( pyobject_cast( self ) );
+    if( !PyTuple_Check( rv.get() ) || PyTuple_GET_SIZE( rv.get() ) < 2 ||
+        PyTuple_GET_SIZE( rv.get() ) > 5 || !PyTuple_Check( PyTuple_GET_ITEM( rv.get(), 1 ) ) )
+        return py_type_fail( "invalid reduction of an atom" );
+    Py_ssize_t size = PyTuple_GET_SIZE( rv.get() );
+    PyObjectPtr args( copy_arg( PyTuple_GET_ITEM( rv.get(), 1 ), memo ) );
+    if( !args )
+        return 0;
+    PyObjectPtr copy( PyObject_Call( PyTuple_GET_ITEM( rv.get(), 0 ), args.get(), 0 ) );
+    if( !copy )
+        return 0;
+    if( memo && !memoize( self, copy.get(), memo ) )
+        return 0;
+    if( size > 2 && PyTuple_GET_ITEM( rv.get(), 2 ) != Py_None )
+    {
+        PyObjectPtr state( copy_arg( PyTuple_GET_ITEM( rv.get(), 2 ), memo ) );
+        if( !state )
+            return 0;
+        PyObjectPtr res( PyObject_CallMethodObjArgs( copy.get(), setstate_str, state.get(), 0 ) );
+        if( !res )
+            return 0;
+    }
+    if( size > 3 && PyTuple_GET_ITEM( rv.get(), 3 ) != Py_None )
+    {
+        PyObjectPtr iter( PyObject_GetIter( PyTuple_GET_ITEM( rv.get(), 3 ) ) );
+        if( !iter )
+            return 0;
+        PyObjectPtr item;
+        while( ( item = PyIter_Next( iter.get() ) ) )
+        {
+            item = copy_arg( item.get(), memo );
+            if( !item )
+                return 0;
+            PyObjectPtr res( PyObject_CallMethod( copy.get(), "append", "O", item.get() ) );
+            if( !res )
+                return 0;
+        }
+        if( PyErr_Occurred() )
+            return 0;
+    }
+    if( size > 4 && PyTuple_GET_ITEM( rv.get(), 4 ) != Py_None )
+    {
+        PyObjectPtr iter( PyObject_GetIter( PyTuple_GET_ITEM( rv.get(), 4 ) ) );
+        if( !iter )
+            return 0;
+        PyObjectPtr item;
+        while( ( item = PyIter_Next( iter.get() ) ) )
+        {
+            item = copy_arg( item.get(), memo );
+            if( !item )
+                return 0;
+            if( !PyTuple_Check( item.get() ) || PyTuple_GET_SIZE( item.get() ) != 2 )
+                return py_expected_type_fail( item.get(), "2-tuple" );
+            if( PyObject_SetItem( copy.get(), PyTuple_GET_ITEM( item.get(), 0 ),
+                                  PyTuple_GET_ITEM( item.get(), 1 ) ) != 0 )
+                return 0;
+        }
+        if( PyErr_Occurred() )
+            return 0;
+    }
+    return copy.release();
+}
+
+
+// Copy an atom, deeply if memo is not null. The slots are copied directly,
+// without validation or notification, the containers being cloned for the
+// copy. The attributes stored outside of the slots are set afterwards.
+static PyObject*
+copy_atom( CAtom* self, PyObject* memo )
+{
+    PyTypeObject* type = Py_TYPE( self );
+    if( custom_reduction( type ) )
+        return reconstruct( self, memo );
+    uint32_t count = self->get_slot_count();
+    PyObjectPtr copyptr( new_atom( type, count ) );
+    if( !copyptr )
+        return 0;
+    if( memo && !memoize( self, copyptr.get(), memo ) )
+        return 0;
+    CAtom* copy = catom_cast( copyptr.get() );
+    // The slots are read again after each copy, which may run Python code
+    // modifying the atom.
+    for( uint32_t i = 0; i < count && i < self->get_slot_count(); ++i )
+    {
+        PyObjectPtr original( self->get_slot( i ) );
+        if( !original )
+            continue;
+        PyObjectPtr value( AtomCopy::copy_value( original.get(), self, copy, memo ) );
+        if( !value )
+            return 0;
+        copy->set_slot( i, value.get() );
+    }
+    PyDictPtr extra( python_state( self, true ) );
+    if( !extra )
+        return 0;
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while( PyDict_Next( extra.get(), &pos, &key, &value ) )
+    {
+        PyObjectPtr valueptr( copy_arg( value, memo ) );
+        if( !valueptr )
+            return 0;
+        if( PyObject_SetAttr( copyptr.get(), key, valueptr.get() ) != 0 )
+            return 0;
+    }
+    return copyptr.release();
+}
+
+
+static PyObject*
+CAtom_copy( CAtom* self )
+{
+    return copy_atom( self, 0 );
+}
+
+
+static PyObject*
+CAtom_deepcopy( CAtom* self, PyObject* memo )
+{
+    if( memo == Py_None )
+    {
+        PyDictPtr memoptr( PyDict_New() );
+        if( !memoptr )
+            return 0;
+        return copy_atom( self, memoptr.get() );
+    }
+    return copy_atom( self, memo );
+}
+
+
 static PyMethodDef
 CAtom_methods[] = {
     { "notifications_enabled", ( PyCFunction )CAtom_notifications_enabled, METH_NOARGS,
@@ -352,8 +1098,30 @@ CAtom_methods[] = {
       "Call the registered observers for a given topic with positional and keyword arguments." },
     { "freeze", ( PyCFunction )CAtom_freeze, METH_NOARGS,
       "Freeze the atom to prevent further modifications to its attributes." },
+    { "__getstate__", ( PyCFunction )CAtom_getstate, METH_NOARGS,
+      "__getstate__() -> dict of the members, instance dict and slot attributes of the "
+      "atom. Subclasses may extend the dict, in which case it is used for pickling." },
+    { "__setstate__", ( PyCFunction )CAtom_setstate, METH_O,
+      "__setstate__(state) -> restore a state returned by __getstate__ or the compact "
+      "state pickled by default" },
+    { "__getnewargs__", ( PyCFunction )CAtom_getnewargs, METH_NOARGS,
+      "__getnewargs__() -> arguments passed to __new__ on unpickling" },
+    { "__reduce_ex__", ( PyCFunction )CAtom_reduce_ex, METH_O,
+      "__reduce_ex__(protocol) -> reduction of the atom, pickling the values of the set "
+      "slots unless __getstate__ or __setstate__ is overridden" },
+    { "__copy__", ( PyCFunction )CAtom_copy, METH_NOARGS,
+      "__copy__() -> shallow copy of the atom, sharing the values of its slots but "
+      "not the containers bound to it" },
+    { "__deepcopy__", ( PyCFunction )CAtom_deepcopy, METH_O,
+      "__deepcopy__(memo) -> deep copy of the atom" },
     { "__sizeof__", ( PyCFunction )CAtom_sizeof, METH_NOARGS,
       "__sizeof__() -> size of object in memory, in bytes" },
+    { "from_rows", ( PyCFunction )CAtom_from_rows, METH_CLASS | METH_VARARGS | METH_KEYWORDS,
+      "from_rows(rows, fields, notify=True) -> list of atoms whose fields are set from "
+      "each sequence of values, without calling __init__" },
+    { "from_dicts", ( PyCFunction )CAtom_from_dicts, METH_CLASS | METH_VARARGS | METH_KEYWORDS,
+      "from_dicts(dicts, notify=True) -> list of atoms whose fields are set from each "
+      "dict, without calling __init__" },
     { 0 } // sentinel
 };
 
@@ -424,10 +1192,64 @@ import_catom()
     atom_members = Py23Str_FromString( "__atom_members__" );
     if( !atom_members )
         return -1;
+    state_names_str = Py23Str_FromString( "__atom_state_names__" );
+    if( !state_names_str )
+        return -1;
+    getstate_str = Py23Str_FromString( "__getstate__" );
+    if( !getstate_str )
+        return -1;
+    setstate_str = Py23Str_FromString( "__setstate__" );
+    if( !setstate_str )
+        return -1;
+    getnewargs_str = Py23Str_FromString( "__getnewargs__" );
+    if( !getnewargs_str )
+        return -1;
+    dict_str = Py23Str_FromString( "__dict__" );
+    if( !dict_str )
+        return -1;
+    reduce_ex_str = Py23Str_FromString( "__reduce_ex__" );
+    if( !reduce_ex_str )
+        return -1;
+    reduce_str = Py23Str_FromString( "__reduce__" );
+    if( !reduce_str )
+        return -1;
+    default_getstate = PyDict_GetItem( CAtom_Type.tp_dict, getstate_str );
+    default_setstate = PyDict_GetItem( CAtom_Type.tp_dict, setstate_str );
+    default_getnewargs = PyDict_GetItem( CAtom_Type.tp_dict, getnewargs_str );
+    default_reduce_ex = PyDict_GetItem( CAtom_Type.tp_dict, reduce_ex_str );
+    default_reduce = _PyType_Lookup( &CAtom_Type, reduce_str );
+    if( !default_getstate || !default_setstate || !default_getnewargs ||
+        !default_reduce_ex || !default_reduce )
+        return -1;
+#if PY_MAJOR_VERSION >= 3
+    PyObjectPtr copyreg( PyImport_ImportModule( "copyreg" ) );
+#else
+    PyObjectPtr copyreg( PyImport_ImportModule( "copy_reg" ) );
+#endif
+    if( !copyreg )
+        return -1;
+    newobj_func = PyObject_GetAttrString( copyreg.get(), "__newobj__" );
+    if( !newobj_func )
+        return -1;
+    slotnames_func = PyObject_GetAttrString( copyreg.get(), "_slotnames" );
+    if( !slotnames_func )
+        return -1;
     return 0;
 }
 
 
+PyObject*
+set_trusted_unpickling( PyObject* mod, PyObject* arg )
+{
+    int trusted = PyObject_IsTrue( arg );
+    if( trusted < 0 )
+        return 0;
+    bool old = trusted_state;
+    trusted_state = trusted != 0;
+    return py_bool( old );
+}
+
+
 static PyObject*
 wrap_callback( PyObject* callback )
 {
@@ -445,7 +1267,7 @@ CAtom::observe( PyObject* topic, PyObject* callback )
     if( !callbackptr )
         return false;
     if( !observers )
-        observers = new ObserverPool();
+        observers = AllocPool::alloc_observers();
     observers->add( topicptr, callbackptr );
     return true;
 }
@@ -492,6 +1314,11 @@ CAtom::notify( PyObject* topic, PyObject* args, PyObject* kwargs )
         PyObjectPtr topicptr( newref( topic ) );
         PyObjectPtr argsptr( newref( args ) );
         PyObjectPtr kwargsptr( xnewref( kwargs ) );
+        if( MemberStats::flags )
+        {
+            MemberStats::Round round( this, topic );
+            return observers->notify( topicptr, argsptr, kwargsptr );
+        }
         if( !observers->notify( topicptr, argsptr, kwargsptr ) )
             return false;
     }
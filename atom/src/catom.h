@@ -155,3 +155,23 @@ struct CAtom
 
 int
 import_catom();
+
+
+// Whether the instances of a type hold no other object than the slots and
+// observers of the atom, i.e. it declares no Python slots or instance dict.
+bool
+slots_only( PyTypeObject* type );
+
+
+struct Member;
+
+
+// Restore the value of a member of an unpickled or deserialized atom. The
+// members storing the value they are set to go through setattr, which
+// validates it and notifies the change, unless unpickling is trusted. The
+// others, such as cached properties, have their slot written directly.
+bool
+restore_member( CAtom* atom, Member* member, PyObject* value );
+
+
+PyObject* set_trusted_unpickling( PyObject* mod, PyObject* arg );
@@ -14,8 +14,16 @@
 #include "signalconnector.h"
 #include "atomref.h"
 #include "atomlist.h"
+#include "atomnumlist.h"
+#include "atomdict.h"
+#include "atomsortedmap.h"
+#include "containerbatch.h"
 #include "enumtypes.h"
 #include "propertyhelper.h"
+#include "allocpool.h"
+#include "atomserial.h"
+#include "memberstats.h"
+#include "changetrace.h"
 #include "py23compat.h"
 
 using namespace PythonHelpers;
@@ -25,6 +33,48 @@ static PyMethodDef
 catom_methods[] = {
     { "reset_property", ( PyCFunction )reset_property, METH_VARARGS,
       "Reset a Property member. For internal use only!" },
+    { "enable_stats", ( PyCFunction )enable_stats, METH_VARARGS | METH_KEYWORDS,
+      "enable_stats(timing=False, observers=False) -> start counting the operations of "
+      "the members, accumulate their duration if timing is true and the latency of "
+      "each observer if observers is true" },
+    { "disable_stats", ( PyCFunction )disable_stats, METH_NOARGS,
+      "disable_stats() -> stop counting the operations of the members" },
+    { "reset_stats", ( PyCFunction )reset_stats, METH_NOARGS,
+      "reset_stats() -> discard the recorded counters" },
+    { "stats", ( PyCFunction )stats, METH_NOARGS,
+      "stats() -> dict mapping (class, member name) to the recorded counters" },
+    { "observer_stats", ( PyCFunction )observer_stats, METH_NOARGS,
+      "observer_stats() -> dict mapping (observer name, topic) to the count, total, "
+      "median, 99th percentile and maximum latency of the calls" },
+    { "set_slow_notification_hook", ( PyCFunction )set_slow_notification_hook, METH_VARARGS,
+      "set_slow_notification_hook(hook, budget_ns=0) -> call hook(atom, topic, elapsed_ns, "
+      "observers) after each notification round exceeding the budget, or remove the "
+      "hook if it is None" },
+    { "enable_trace", ( PyCFunction )enable_trace, METH_VARARGS | METH_KEYWORDS,
+      "enable_trace(capacity=65536, hashes=False) -> record the changes notified by the "
+      "atoms in a ring buffer holding the last capacity records, hashing the old and new "
+      "values if hashes is true" },
+    { "disable_trace", ( PyCFunction )disable_trace, METH_NOARGS,
+      "disable_trace() -> stop recording the changes, keeping the records" },
+    { "dump_trace", ( PyCFunction )dump_trace, METH_NOARGS,
+      "dump_trace() -> bytes holding the recorded changes, oldest first" },
+    { "set_pool_depth", ( PyCFunction )set_pool_depth, METH_VARARGS | METH_KEYWORDS,
+      "set_pool_depth(slots=None, observers=None, instances=None) -> set the number of "
+      "free blocks kept per size class by the pools recycling the slot arrays, observer "
+      "pools and instances of the atoms, leaving the depths given as None unchanged" },
+    { "pool_stats", ( PyCFunction )pool_stats, METH_NOARGS,
+      "pool_stats() -> dict mapping each pool to its depth, number of free blocks and "
+      "number of blocks reused and allocated" },
+    { "set_trusted_unpickling", ( PyCFunction )set_trusted_unpickling, METH_O,
+      "set_trusted_unpickling(enabled) -> write the values of the unpickled atoms directly "
+      "to their slots, without validating or notifying them, if enabled is true and "
+      "return the previous setting" },
+    { "serialize", ( PyCFunction )serialize, METH_O,
+      "serialize(value) -> bytes encoding the value, the atoms it holds and the values "
+      "of the members they set, in the binary format read by deserialize" },
+    { "deserialize", ( PyCFunction )deserialize, METH_VARARGS | METH_KEYWORDS,
+      "deserialize(data, classes=None) -> value encoded by serialize, the classes of the "
+      "atoms being looked up by qualified name in classes first and imported otherwise" },
     { 0 } // Sentinel
 };
 
@@ -68,8 +118,14 @@ MOD_INIT(catom)
         INITERROR;
     if( import_atomlist() < 0 )
         INITERROR;
-    //if( import_atomdict() < 0 )
-    //    INITERROR;
+    if( import_atomnumlist() < 0 )
+        INITERROR;
+    if( import_containerbatch() < 0 )
+        INITERROR;
+    if( import_atomdict() < 0 )
+        INITERROR;
+    if( import_atomsortedmap() < 0 )
+        INITERROR;
     if( import_enumtypes() < 0 )
         INITERROR;
 
@@ -78,7 +134,12 @@ MOD_INIT(catom)
     Py_INCREF( &AtomRef_Type );
     Py_INCREF( &AtomList_Type );
     Py_INCREF( &AtomCList_Type );
-    //Py_INCREF( &AtomDict_Type );
+    Py_INCREF( &AtomNumList_Type );
+    Py_INCREF( &AtomNumCList_Type );
+    Py_INCREF( &AtomDict_Type );
+    Py_INCREF( &AtomCDict_Type );
+    Py_INCREF( &AtomSortedMap_Type );
+    Py_INCREF( &AtomCSortedMap_Type );
     Py_INCREF( PyGetAttr );
     Py_INCREF( PySetAttr );
     Py_INCREF( PyDelAttr );
@@ -92,7 +153,12 @@ MOD_INIT(catom)
     PyModule_AddObject( mod, "atomref", pyobject_cast( &AtomRef_Type ) );
     PyModule_AddObject( mod, "atomlist", pyobject_cast( &AtomList_Type ) );
     PyModule_AddObject( mod, "atomclist", pyobject_cast( &AtomCList_Type ) );
-    //PyModule_AddObject( mod, "atomdict", pyobject_cast( &AtomDict_Type ) );
+    PyModule_AddObject( mod, "atomnumlist", pyobject_cast( &AtomNumList_Type ) );
+    PyModule_AddObject( mod, "atomnumclist", pyobject_cast( &AtomNumCList_Type ) );
+    PyModule_AddObject( mod, "atomdict", pyobject_cast( &AtomDict_Type ) );
+    PyModule_AddObject( mod, "atomcdict", pyobject_cast( &AtomCDict_Type ) );
+    PyModule_AddObject( mod, "atomsortedmap", pyobject_cast( &AtomSortedMap_Type ) );
+    PyModule_AddObject( mod, "atomcsortedmap", pyobject_cast( &AtomCSortedMap_Type ) );
     PyModule_AddObject( mod, "GetAttr", PyGetAttr );
     PyModule_AddObject( mod, "SetAttr", PySetAttr );
     PyModule_AddObject( mod, "DelAttr", PyDelAttr );
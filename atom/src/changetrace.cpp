@@ -0,0 +1,171 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <cstring>
+#include <new>
+#include "changetrace.h"
+#include "memberstats.h"
+
+using namespace PythonHelpers;
+
+
+namespace ChangeTrace
+{
+
+Record* buffer = 0;
+
+
+// The records are kept once tracing is disabled, so that they can still be
+// dumped. The capacity is a power of two.
+static Record* storage = 0;
+
+
+static uint64_t capacity = 0;
+
+
+// The number of records written since tracing was enabled, which may
+// exceed the capacity.
+static uint64_t written = 0;
+
+
+static bool hashes = false;
+
+
+static const char magic[] = "ATOMTRC1";
+
+
+static const size_t header_size = 8 + 1 + 8 + 8;
+
+
+static const size_t record_size = 8 + 8 + 4 + 1;
+
+
+static const size_t hashes_size = 8 + 8;
+
+
+static uint64_t
+value_hash( PyObject* value )
+{
+    if( !value )
+        return 0;
+    PY_LONG_LONG hash = PyObject_Hash( value );
+    if( hash == -1 && PyErr_Occurred() )
+    {
+        // Unhashable values are identified by their address instead.
+        PyErr_Clear();
+        return static_cast<uint64_t>( reinterpret_cast<size_t>( value ) );
+    }
+    return static_cast<uint64_t>( hash );
+}
+
+
+void
+record_change( Kind kind, CAtom* atom, Member* member, PyObject* oldvalue, PyObject* newvalue )
+{
+    uint64_t oldhash = 0;
+    uint64_t newhash = 0;
+    if( hashes )
+    {
+        oldhash = value_hash( oldvalue );
+        newhash = value_hash( newvalue );
+        // Hashing may run arbitrary code, which may disable tracing.
+        if( !buffer )
+            return;
+    }
+    Record& record = buffer[ written & ( capacity - 1 ) ];
+    record.timestamp = MemberStats::now();
+    record.atom = static_cast<uint64_t>( reinterpret_cast<size_t>( atom ) );
+    record.oldhash = oldhash;
+    record.newhash = newhash;
+    record.member = member->index;
+    record.kind = static_cast<uint8_t>( kind );
+    ++written;
+}
+
+
+// The dump is written in little-endian order whatever the platform.
+static unsigned char*
+pack( uint64_t value, size_t size, unsigned char* out )
+{
+    for( size_t i = 0; i < size; ++i, value >>= 8 )
+        out[ i ] = static_cast<unsigned char>( value & 0xff );
+    return out + size;
+}
+
+}  // namespace ChangeTrace
+
+
+PyObject*
+enable_trace( PyObject* mod, PyObject* args, PyObject* kwargs )
+{
+    static char* kwlist[] = {
+        const_cast<char*>( "capacity" ), const_cast<char*>( "hashes" ), 0
+    };
+    Py_ssize_t size = 65536;
+    PyObject* pyhashes = Py_False;
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|nO:enable_trace", kwlist, &size, &pyhashes ) )
+        return 0;
+    if( size <= 0 )
+        return py_value_fail( "trace capacity must be positive" );
+    int hashes = PyObject_IsTrue( pyhashes );
+    if( hashes < 0 )
+        return 0;
+    uint64_t capacity = 1;
+    while( capacity < static_cast<uint64_t>( size ) )
+        capacity *= 2;
+    ChangeTrace::Record* storage = new ( std::nothrow ) ChangeTrace::Record[ capacity ];
+    if( !storage )
+        return PyErr_NoMemory();
+    delete[] ChangeTrace::storage;
+    ChangeTrace::storage = storage;
+    ChangeTrace::capacity = capacity;
+    ChangeTrace::written = 0;
+    ChangeTrace::hashes = hashes != 0;
+    ChangeTrace::buffer = storage;
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+disable_trace( PyObject* mod )
+{
+    ChangeTrace::buffer = 0;
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+dump_trace( PyObject* mod )
+{
+    using namespace ChangeTrace;
+    uint64_t count = written < capacity ? written : capacity;
+    size_t size = record_size + ( hashes ? hashes_size : 0 );
+    PyObjectPtr result( PyBytes_FromStringAndSize(
+        0, static_cast<Py_ssize_t>( header_size + count * size ) ) );
+    if( !result )
+        return 0;
+    unsigned char* out = reinterpret_cast<unsigned char*>( PyBytes_AS_STRING( result.get() ) );
+    memcpy( out, magic, 8 );
+    out = pack( hashes ? 1 : 0, 1, out + 8 );
+    out = pack( written, 8, out );
+    out = pack( count, 8, out );
+    for( uint64_t i = written - count; i < written; ++i )
+    {
+        const Record& record = storage[ i & ( capacity - 1 ) ];
+        out = pack( record.timestamp, 8, out );
+        out = pack( record.atom, 8, out );
+        out = pack( record.member, 4, out );
+        out = pack( record.kind, 1, out );
+        if( hashes )
+        {
+            out = pack( record.oldhash, 8, out );
+            out = pack( record.newhash, 8, out );
+        }
+    }
+    return result.release();
+}
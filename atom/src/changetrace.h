@@ -0,0 +1,69 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "inttypes.h"
+#include "catom.h"
+#include "member.h"
+
+
+// A fixed size ring buffer recording the changes notified by the atoms of
+// the process. The notification paths only test whether the buffer exists
+// while tracing is disabled. The GIL makes the buffer single writer, so
+// that no lock is needed.
+namespace ChangeTrace
+{
+
+enum Kind
+{
+    Create = 1,
+    Update,
+    Delete,
+    Event,
+    Container
+};
+
+
+struct Record
+{
+    uint64_t timestamp;
+    uint64_t atom;
+    uint64_t oldhash;
+    uint64_t newhash;
+    uint32_t member;
+    uint8_t kind;
+};
+
+
+// The records, or null while tracing is disabled.
+extern Record* buffer;
+
+
+void
+record_change( Kind kind, CAtom* atom, Member* member, PyObject* oldvalue, PyObject* newvalue );
+
+
+// Record a change. The values are only hashed when requested, a null
+// value being recorded as 0.
+inline void
+record( Kind kind, CAtom* atom, Member* member, PyObject* oldvalue = 0, PyObject* newvalue = 0 )
+{
+    if( buffer )
+        record_change( kind, atom, member, oldvalue, newvalue );
+}
+
+}  // namespace ChangeTrace
+
+
+PyObject* enable_trace( PyObject* mod, PyObject* args, PyObject* kwargs );
+
+
+PyObject* disable_trace( PyObject* mod );
+
+
+PyObject* dump_trace( PyObject* mod );
@@ -0,0 +1,185 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include "containerbatch.h"
+#include "atomlist.h"
+#include "atomnumlist.h"
+#include "packagenaming.h"
+
+
+using namespace PythonHelpers;
+
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* list;
+    bool active;
+} ContainerBatch;
+
+
+static bool
+ContainerBatch_Begin( PyObject* list )
+{
+    if( AtomCList_Check( list ) )
+        return AtomCList_BeginBatch( list );
+    return AtomNumCList_BeginBatch( list );
+}
+
+
+static bool
+ContainerBatch_End( PyObject* list )
+{
+    if( AtomCList_Check( list ) )
+        return AtomCList_EndBatch( list );
+    return AtomNumCList_EndBatch( list );
+}
+
+
+static int
+ContainerBatch_clear( ContainerBatch* self )
+{
+    Py_CLEAR( self->list );
+    return 0;
+}
+
+
+static int
+ContainerBatch_traverse( ContainerBatch* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->list );
+    return 0;
+}
+
+
+static void
+ContainerBatch_dealloc( ContainerBatch* self )
+{
+    PyObject_GC_UnTrack( self );
+    // A batch which is never exited must not leave the list silenced.
+    if( self->active && self->list )
+    {
+        self->active = false;
+        if( !ContainerBatch_End( self->list ) )
+            PyErr_WriteUnraisable( pyobject_cast( self ) );  // LCOV_EXCL_LINE
+    }
+    ContainerBatch_clear( self );
+    Py_TYPE( self )->tp_free( pyobject_cast( self ) );
+}
+
+
+static PyObject*
+ContainerBatch_enter( ContainerBatch* self )
+{
+    if( self->active )
+        return py_runtime_fail( "the batch is already active" );
+    if( !self->list )
+        return py_runtime_fail( "the batch has no list" );  // LCOV_EXCL_LINE
+    if( !ContainerBatch_Begin( self->list ) )
+        return 0;  // LCOV_EXCL_LINE
+    self->active = true;
+    return newref( self->list );
+}
+
+
+static PyObject*
+ContainerBatch_exit( ContainerBatch* self, PyObject* args )
+{
+    if( !self->active )
+        return py_runtime_fail( "the batch is not active" );
+    self->active = false;
+    if( !ContainerBatch_End( self->list ) )
+        return 0;
+    Py_RETURN_FALSE;
+}
+
+
+static PyMethodDef
+ContainerBatch_methods[] = {
+    { "__enter__", ( PyCFunction )ContainerBatch_enter, METH_NOARGS,
+      "Suspend the notifications of the list and return the list." },
+    { "__exit__", ( PyCFunction )ContainerBatch_exit, METH_VARARGS,
+      "Resume the notifications of the list and emit the batched change." },
+    { 0 } // sentinel
+};
+
+
+PyTypeObject ContainerBatch_Type = {
+    PyVarObject_HEAD_INIT( NULL, 0 )
+    PACKAGE_TYPENAME( "containerbatch" ),   /* tp_name */
+    sizeof( ContainerBatch ),               /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)ContainerBatch_dealloc,     /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)0,                   /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)0,                        /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,  /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)ContainerBatch_traverse,  /* tp_traverse */
+    (inquiry)ContainerBatch_clear,          /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)0,                         /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)ContainerBatch_methods, /* tp_methods */
+    (struct PyMemberDef*)0,                 /* tp_members */
+    0,                                      /* tp_getset */
+    0,                                      /* tp_base */
+    0,                                      /* tp_dict */
+    (descrgetfunc)0,                        /* tp_descr_get */
+    (descrsetfunc)0,                        /* tp_descr_set */
+    0,                                      /* tp_dictoffset */
+    (initproc)0,                            /* tp_init */
+    (allocfunc)PyType_GenericAlloc,         /* tp_alloc */
+    (newfunc)0,                             /* tp_new */
+    (freefunc)PyObject_GC_Del,              /* tp_free */
+    (inquiry)0,                             /* tp_is_gc */
+    0,                                      /* tp_bases */
+    0,                                      /* tp_mro */
+    0,                                      /* tp_cache */
+    0,                                      /* tp_subclasses */
+    0,                                      /* tp_weaklist */
+    (destructor)0                           /* tp_del */
+};
+
+
+PyObject*
+ContainerBatch_New( PyObject* list )
+{
+    PyObject* pybatch = PyType_GenericAlloc( &ContainerBatch_Type, 0 );
+    if( !pybatch )
+        return 0;
+    ContainerBatch* batch = reinterpret_cast<ContainerBatch*>( pybatch );
+    batch->list = newref( list );
+    batch->active = false;
+    return pybatch;
+}
+
+
+int
+import_containerbatch()
+{
+    if( PyType_Ready( &ContainerBatch_Type ) < 0 )
+        return -1;
+    return 0;
+}
@@ -0,0 +1,18 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+
+
+// Create the context manager returned by the 'batch' method of the
+// container lists. The list must be an atomclist or an atomnumclist.
+PyObject*
+ContainerBatch_New( PyObject* list );
+
+
+int import_containerbatch();
@@ -6,6 +6,7 @@
 | The full license is in the file COPYING.txt, distributed with this software.
 |----------------------------------------------------------------------------*/
 #include "member.h"
+#include "memberstats.h"
 #include "py23compat.h"
 
 
@@ -206,5 +207,10 @@ Member::default_value( CAtom* atom )
 {
     if( get_default_value_mode() >= sizeof( handlers ) )
         return no_op_handler( this, atom );  // LCOV_EXCL_LINE
+    if( MemberStats::flags & MemberStats::Counting )
+    {
+        MemberStats::Scope scope( MemberStats::DefaultValue, atom, name );
+        return handlers[ get_default_value_mode() ]( this, atom );
+    }
     return handlers[ get_default_value_mode() ]( this, atom );
 }
@@ -7,6 +7,7 @@
 |----------------------------------------------------------------------------*/
 #include "member.h"
 #include "memberchange.h"
+#include "changetrace.h"
 #include "py23compat.h"
 
 
@@ -79,6 +80,7 @@ slot_handler( Member* member, CAtom* atom )
     atom->set_slot( member->index, 0 );
     if( atom->get_notifications_enabled() )
     {
+        ChangeTrace::record( ChangeTrace::Delete, atom, member, valueptr.get() );
         PyObjectPtr argsptr;
         if( member->has_observers() )
         {
@@ -219,7 +219,12 @@ int import_enumtypes()
         add_long( dict_ptr, expand_enum( Tuple ) );
         add_long( dict_ptr, expand_enum( List ) );
         add_long( dict_ptr, expand_enum( ContainerList ) );
+        add_long( dict_ptr, expand_enum( NumericList ) );
+        add_long( dict_ptr, expand_enum( ContainerNumericList ) );
         add_long( dict_ptr, expand_enum( Dict ) );
+        add_long( dict_ptr, expand_enum( ContainerDict ) );
+        add_long( dict_ptr, expand_enum( SortedMap ) );
+        add_long( dict_ptr, expand_enum( ContainerSortedMap ) );
         add_long( dict_ptr, expand_enum( Instance ) );
         add_long( dict_ptr, expand_enum( Typed ) );
         add_long( dict_ptr, expand_enum( Subclass ) );
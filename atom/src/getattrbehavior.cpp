@@ -7,7 +7,9 @@
 |----------------------------------------------------------------------------*/
 #include "eventbinder.h"
 #include "member.h"
+#include "memberstats.h"
 #include "memberchange.h"
+#include "changetrace.h"
 #include "signalconnector.h"
 #include "py23compat.h"
 
@@ -101,6 +103,7 @@ slot_handler( Member* member, CAtom* atom )
     atom->set_slot( member->index, value.get() );
     if( atom->get_notifications_enabled() )
     {
+        ChangeTrace::record( ChangeTrace::Create, atom, member, 0, value.get() );
         PyObjectPtr argsptr;
         if( member->has_observers() )
         {
@@ -305,5 +308,10 @@ Member::getattr( CAtom* atom )
 {
     if( get_getattr_mode() >= sizeof( handlers ) )
         return no_op_handler( this, atom );  // LCOV_EXCL_LINE
+    if( MemberStats::flags & MemberStats::Counting )
+    {
+        MemberStats::Scope scope( MemberStats::GetAttr, atom, name );
+        return handlers[ get_getattr_mode() ]( this, atom );
+    }
     return handlers[ get_getattr_mode() ]( this, atom );
 }
@@ -14,6 +14,7 @@
 #endif
 
 #include "member.h"
+#include "memberstats.h"
 #include "enumtypes.h"
 #include "packagenaming.h"
 #include "py23compat.h"
@@ -1052,33 +1053,46 @@ Member::has_observer( PyObject* observer )
 }
 
 
+static bool
+notify_observers( Member* member, CAtom* atom, PyObject* args, PyObject* kwargs )
+{
+    ModifyGuard<Member> guard( *member );
+    PyObjectPtr argsptr( newref( args ) );
+    PyObjectPtr kwargsptr( xnewref( kwargs ) );
+    PyObjectPtr objectptr( newref( pyobject_cast( atom ) ) );
+    PyObjectPtr callable;
+    std::vector<PyObjectPtr>::iterator it;
+    std::vector<PyObjectPtr>::iterator end = member->static_observers->end();
+    for( it = member->static_observers->begin(); it != end; ++it )
+    {
+        if( Py23Str_CheckExact( it->get() ) )
+        {
+            callable = objectptr.getattr( *it );
+            if( !callable )
+                return false;
+        }
+        else
+        {
+            callable = *it;
+        }
+        if( !MemberStats::call_observer( callable, argsptr, kwargsptr ) )
+            return false;
+    }
+    return true;
+}
+
+
 bool
 Member::notify( CAtom* atom, PyObject* args, PyObject* kwargs )
 {
     if( static_observers && atom->get_notifications_enabled() )
     {
-        ModifyGuard<Member> guard( *this );
-        PyObjectPtr argsptr( newref( args ) );
-        PyObjectPtr kwargsptr( xnewref( kwargs ) );
-        PyObjectPtr objectptr( newref( pyobject_cast( atom ) ) );
-        PyObjectPtr callable;
-        std::vector<PyObjectPtr>::iterator it;
-        std::vector<PyObjectPtr>::iterator end = static_observers->end();
-        for( it = static_observers->begin(); it != end; ++it )
+        if( MemberStats::flags )
         {
-            if( Py23Str_CheckExact( it->get() ) )
-            {
-                callable = objectptr.getattr( *it );
-                if( !callable )
-                    return false;
-            }
-            else
-            {
-                callable = *it;
-            }
-            if( !callable( argsptr, kwargsptr ) )
-                return false;
+            MemberStats::Round round( atom, name );
+            return notify_observers( this, atom, args, kwargs );
         }
+        return notify_observers( this, atom, args, kwargs );
     }
     return true;
 }
@@ -13,6 +13,7 @@
 #include "behaviors.h"
 #include "catom.h"
 #include "modifyguard.h"
+#include "numericbuffer.h"
 
 #ifndef UINT64_C
 #define UINT64_C( c ) ( c ## ULL )
@@ -152,6 +153,11 @@ struct Member
 
     PyObject* full_validate( CAtom* atom, PyObject* oldvalue, PyObject* newvalue );
 
+    // Validate all the items of a numeric buffer at once. This returns
+    // false when the items must go through full_validate one by one
+    // instead, which is also the case when any item would be rejected.
+    bool bulk_validate( NumericBuffer& buffer, NumericBuffer::Boxing& boxing );
+
     bool has_observers()
     {
         return static_observers && static_observers->size() > 0;
@@ -0,0 +1,524 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "memberstats.h"
+#include "globalstatic.h"
+#include "py23compat.h"
+
+using namespace PythonHelpers;
+
+
+namespace MemberStats
+{
+
+unsigned flags = 0;
+
+
+uint64_t observer_calls = 0;
+
+
+struct Entry
+{
+    uint64_t counts[ CounterCount ];
+    uint64_t times[ CounterCount ];
+    uint64_t observer_calls;
+};
+
+
+// The entries are keyed by the identity of the class and of the name, and
+// hold a reference to both so that the identities cannot be reused. Equal
+// names held by distinct objects are merged when reported.
+typedef std::map<std::pair<PyObject*, PyObject*>, Entry> EntryMap;
+
+
+GLOBAL_STATIC( EntryMap, entries )
+
+
+// Durations are counted in buckets of 8 per power of two, which bounds the
+// error of the reported percentiles to 12.5% while covering 64 bit values.
+static const size_t bucket_count = 62 * 8;
+
+
+struct Histogram
+{
+    uint64_t buckets[ bucket_count ];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+};
+
+
+// The histograms are keyed by the qualified name of the observer and the
+// topic it observes.
+typedef std::map<std::pair<std::string, std::string>, Histogram> HistogramMap;
+
+
+GLOBAL_STATIC( HistogramMap, histograms )
+
+
+// The qualified names of the observers, keyed by the function underlying a
+// bound method since a new method object is created for each call. The
+// keys hold a reference.
+typedef std::map<PyObject*, std::string> NameMap;
+
+
+GLOBAL_STATIC( NameMap, observer_names )
+
+
+static Round* current_round = 0;
+
+
+static PyObject* slow_hook = 0;
+
+
+static uint64_t slow_budget = 0;
+
+
+static bool in_slow_hook = false;
+
+
+static const char* names[ CounterCount ] = {
+    "getattr",
+    "setattr",
+    "validate",
+    "default_value",
+    "notify"
+};
+
+
+static const char* time_names[ CounterCount ] = {
+    "getattr_ns",
+    "setattr_ns",
+    "validate_ns",
+    "default_value_ns",
+    "notify_ns"
+};
+
+
+uint64_t
+now()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    if( !frequency.QuadPart )
+        QueryPerformanceFrequency( &frequency );
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter( &counter );
+    return static_cast<uint64_t>(
+        counter.QuadPart / frequency.QuadPart * 1000000000 +
+        counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart );
+#else
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return static_cast<uint64_t>( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+void
+record( Counter counter, PyObject* type, PyObject* name, uint64_t calls, uint64_t elapsed )
+{
+    EntryMap* map = entries();
+    if( !map )
+        return;  // LCOV_EXCL_LINE
+    std::pair<PyObject*, PyObject*> key( type, name );
+    EntryMap::iterator it = map->lower_bound( key );
+    if( it == map->end() || it->first != key )
+    {
+        Entry entry = { { 0 }, { 0 }, 0 };
+        it = map->insert( it, std::make_pair( key, entry ) );
+        Py_INCREF( type );
+        Py_INCREF( name );
+    }
+    ++it->second.counts[ counter ];
+    it->second.times[ counter ] += elapsed;
+    it->second.observer_calls += calls;
+}
+
+
+static size_t
+bucket_index( uint64_t value )
+{
+    if( value < 8 )
+        return static_cast<size_t>( value );
+    size_t exponent = 0;
+    for( size_t shift = 32; shift; shift /= 2 )
+    {
+        if( value >> ( exponent + shift ) )
+            exponent += shift;
+    }
+    return ( exponent - 2 ) * 8 + static_cast<size_t>( ( value >> ( exponent - 3 ) ) & 7 );
+}
+
+
+// The largest duration counted in a bucket.
+static uint64_t
+bucket_limit( size_t index )
+{
+    if( index < 8 )
+        return index;
+    size_t exponent = index / 8 + 2;
+    uint64_t next = static_cast<uint64_t>( 9 + index % 8 ) << ( exponent - 3 );
+    return next - 1;
+}
+
+
+static uint64_t
+percentile( const Histogram& histogram, uint64_t percent )
+{
+    uint64_t rank = ( histogram.count * percent + 99 ) / 100;
+    uint64_t seen = 0;
+    for( size_t i = 0; i < bucket_count; ++i )
+    {
+        seen += histogram.buckets[ i ];
+        if( seen >= std::max<uint64_t>( rank, 1 ) )
+            return std::min( bucket_limit( i ), histogram.max );
+    }
+    return histogram.max;  // LCOV_EXCL_LINE
+}
+
+
+static std::string
+str_value( PyObject* str )
+{
+    const char* data = Py23Str_Check( str ) ? Py23Str_AS_STRING( str ) : 0;
+    if( !data )
+    {
+        PyErr_Clear();
+        return Py_TYPE( str )->tp_name;
+    }
+    return data;
+}
+
+
+// Compute the module and qualified name of an observer. The lookups must
+// not be done while an exception is pending, and never fail.
+static const std::string&
+observer_name( PyObject* callable )
+{
+    static std::string unknown( "<unknown>" );
+    NameMap* names = observer_names();
+    if( !names )
+        return unknown;  // LCOV_EXCL_LINE
+    PyObject* target = PyMethod_Check( callable ) ? PyMethod_GET_FUNCTION( callable ) : callable;
+    NameMap::iterator it = names->find( target );
+    if( it != names->end() )
+        return it->second;
+    PyObjectPtr pyname( PyObject_GetAttrString( target, "__qualname__" ) );
+    if( !pyname )
+    {
+        PyErr_Clear();
+        pyname = PyObject_GetAttrString( target, "__name__" );
+    }
+    std::string name;
+    if( pyname )
+        name = str_value( pyname.get() );
+    else
+    {
+        PyErr_Clear();
+        name = Py_TYPE( target )->tp_name;
+    }
+    PyObjectPtr pymodule( PyObject_GetAttrString( target, "__module__" ) );
+    if( pymodule && Py23Str_Check( pymodule.get() ) )
+        name = str_value( pymodule.get() ) + "." + name;
+    PyErr_Clear();
+    Py_INCREF( target );
+    return names->insert( std::make_pair( target, name ) ).first->second;
+}
+
+
+static void
+record_observer( const std::string& name, PyObject* topic, uint64_t elapsed )
+{
+    HistogramMap* map = histograms();
+    if( !map )
+        return;  // LCOV_EXCL_LINE
+    std::pair<std::string, std::string> key( name, str_value( topic ) );
+    HistogramMap::iterator it = map->find( key );
+    if( it == map->end() )
+    {
+        Histogram histogram;
+        std::memset( &histogram, 0, sizeof( Histogram ) );
+        it = map->insert( std::make_pair( key, histogram ) ).first;
+    }
+    Histogram& histogram = it->second;
+    ++histogram.buckets[ bucket_index( elapsed ) ];
+    ++histogram.count;
+    histogram.total += elapsed;
+    histogram.max = std::max( histogram.max, elapsed );
+}
+
+
+Round::Round( CAtom* atom, PyObject* topic ) :
+    m_scope( Notify, atom, topic ),
+    m_atom( atom ),
+    m_topic( topic ),
+    m_parent( current_round ),
+    m_start( flags & SlowRounds ? now() : 0 )
+{
+    current_round = this;
+}
+
+
+Round::~Round()
+{
+    current_round = m_parent;
+    if( m_start && slow_hook && !in_slow_hook )
+    {
+        uint64_t elapsed = now() - m_start;
+        if( elapsed > slow_budget )
+            report( elapsed );
+    }
+    for( size_t i = 0; i < m_observers.size(); ++i )
+        Py_DECREF( m_observers[ i ].first );
+}
+
+
+bool
+Round::call( PyObjectPtr& callable, PyObjectPtr& args, PyObjectPtr& kwargs )
+{
+    Round* round = current_round;
+    if( !round )
+        return callable( args, kwargs );
+    const std::string* name = 0;
+    if( flags & ObserverTiming )
+        name = &observer_name( callable.get() );
+    uint64_t start = now();
+    bool ok = callable( args, kwargs );
+    uint64_t elapsed = now() - start;
+    if( name )
+        record_observer( *name, round->m_topic, elapsed );
+    if( round->m_start )
+        round->m_observers.push_back( std::make_pair( newref( callable.get() ), elapsed ) );
+    return ok;
+}
+
+
+// Call the slow notification hook with the atom, the topic, the duration of
+// the round and the duration of each observer. An error raised by the hook
+// is reported as unraisable, and the error of the round is preserved.
+void
+Round::report( uint64_t elapsed )
+{
+    PyObject* type;
+    PyObject* value;
+    PyObject* traceback;
+    PyErr_Fetch( &type, &value, &traceback );
+    in_slow_hook = true;
+    PyObjectPtr hook( newref( slow_hook ) );
+    PyObjectPtr observers( PyList_New( 0 ) );
+    bool ok = observers;
+    for( size_t i = 0; ok && i < m_observers.size(); ++i )
+    {
+        PyObjectPtr pyname( Py23Str_FromString( observer_name( m_observers[ i ].first ).c_str() ) );
+        PyObjectPtr pyelapsed( PyLong_FromUnsignedLongLong( m_observers[ i ].second ) );
+        PyObjectPtr pair( pyname && pyelapsed ?
+            PyTuple_Pack( 2, pyname.get(), pyelapsed.get() ) : 0 );
+        ok = pair && PyList_Append( observers.get(), pair.get() ) == 0;
+    }
+    PyObjectPtr pyelapsed( ok ? PyLong_FromUnsignedLongLong( elapsed ) : 0 );
+    PyObjectPtr result( pyelapsed ? PyObject_CallFunctionObjArgs( hook.get(),
+        pyobject_cast( m_atom ), m_topic, pyelapsed.get(), observers.get(), NULL ) : 0 );
+    if( !result )
+        PyErr_WriteUnraisable( hook.get() );
+    in_slow_hook = false;
+    PyErr_Restore( type, value, traceback );
+}
+
+
+static bool
+add_to( PyObject* dict, const char* name, uint64_t value )
+{
+    PyObjectPtr pyname( Py23Str_FromString( name ) );
+    if( !pyname )
+        return false;
+    PyObjectPtr pyvalue( PyLong_FromUnsignedLongLong( value ) );
+    if( !pyvalue )
+        return false;
+    PyObject* current = PyDict_GetItem( dict, pyname.get() );
+    if( current )
+    {
+        pyvalue = PyNumber_Add( current, pyvalue.get() );
+        if( !pyvalue )
+            return false;
+    }
+    return PyDict_SetItem( dict, pyname.get(), pyvalue.get() ) == 0;
+}
+
+}  // namespace MemberStats
+
+
+PyObject*
+enable_stats( PyObject* mod, PyObject* args, PyObject* kwargs )
+{
+    static char* kwlist[] = {
+        const_cast<char*>( "timing" ), const_cast<char*>( "observers" ), 0
+    };
+    PyObject* timing = Py_False;
+    PyObject* observers = Py_False;
+    if( !PyArg_ParseTupleAndKeywords(
+            args, kwargs, "|OO:enable_stats", kwlist, &timing, &observers ) )
+        return 0;
+    int timed = PyObject_IsTrue( timing );
+    if( timed < 0 )
+        return 0;
+    int histograms = PyObject_IsTrue( observers );
+    if( histograms < 0 )
+        return 0;
+    unsigned flags = MemberStats::flags & MemberStats::SlowRounds;
+    flags |= MemberStats::Counting;
+    if( timed )
+        flags |= MemberStats::Timing;
+    if( histograms )
+        flags |= MemberStats::ObserverTiming;
+    MemberStats::flags = flags;
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+disable_stats( PyObject* mod )
+{
+    MemberStats::flags &= MemberStats::SlowRounds;
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+reset_stats( PyObject* mod )
+{
+    MemberStats::EntryMap* map = MemberStats::entries();
+    if( !map )
+        Py_RETURN_NONE;  // LCOV_EXCL_LINE
+    MemberStats::HistogramMap* histograms = MemberStats::histograms();
+    if( histograms )
+        histograms->clear();
+    // Releasing the classes may run arbitrary code, so empty the maps first.
+    MemberStats::EntryMap old;
+    old.swap( *map );
+    MemberStats::NameMap old_names;
+    MemberStats::NameMap* names = MemberStats::observer_names();
+    if( names )
+        old_names.swap( *names );
+    MemberStats::EntryMap::iterator it;
+    for( it = old.begin(); it != old.end(); ++it )
+    {
+        Py_DECREF( it->first.first );
+        Py_DECREF( it->first.second );
+    }
+    MemberStats::NameMap::iterator name_it;
+    for( name_it = old_names.begin(); name_it != old_names.end(); ++name_it )
+        Py_DECREF( name_it->first );
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+stats( PyObject* mod )
+{
+    PyObjectPtr result( PyDict_New() );
+    if( !result )
+        return 0;
+    MemberStats::EntryMap* map = MemberStats::entries();
+    if( !map )
+        return result.release();  // LCOV_EXCL_LINE
+    MemberStats::EntryMap::iterator it;
+    for( it = map->begin(); it != map->end(); ++it )
+    {
+        PyObjectPtr key( PyTuple_Pack( 2, it->first.first, it->first.second ) );
+        if( !key )
+            return 0;
+        PyObjectPtr counters( xnewref( PyDict_GetItem( result.get(), key.get() ) ) );
+        if( !counters )
+        {
+            counters = PyDict_New();
+            if( !counters )
+                return 0;
+            if( PyDict_SetItem( result.get(), key.get(), counters.get() ) != 0 )
+                return 0;
+        }
+        const MemberStats::Entry& entry = it->second;
+        for( int i = 0; i < MemberStats::CounterCount; ++i )
+        {
+            if( !MemberStats::add_to( counters.get(), MemberStats::names[ i ], entry.counts[ i ] ) )
+                return 0;
+            if( !MemberStats::add_to( counters.get(), MemberStats::time_names[ i ], entry.times[ i ] ) )
+                return 0;
+        }
+        if( !MemberStats::add_to( counters.get(), "observer_calls", entry.observer_calls ) )
+            return 0;
+    }
+    return result.release();
+}
+
+
+PyObject*
+observer_stats( PyObject* mod )
+{
+    PyObjectPtr result( PyDict_New() );
+    if( !result )
+        return 0;
+    MemberStats::HistogramMap* map = MemberStats::histograms();
+    if( !map )
+        return result.release();  // LCOV_EXCL_LINE
+    MemberStats::HistogramMap::iterator it;
+    for( it = map->begin(); it != map->end(); ++it )
+    {
+        const MemberStats::Histogram& histogram = it->second;
+        PyObjectPtr key( Py_BuildValue(
+            "(ss)", it->first.first.c_str(), it->first.second.c_str() ) );
+        if( !key )
+            return 0;
+        PyObjectPtr summary( Py_BuildValue( "{sKsKsKsKsK}",
+            "count", histogram.count,
+            "total_ns", histogram.total,
+            "p50_ns", MemberStats::percentile( histogram, 50 ),
+            "p99_ns", MemberStats::percentile( histogram, 99 ),
+            "max_ns", histogram.max ) );
+        if( !summary )
+            return 0;
+        if( PyDict_SetItem( result.get(), key.get(), summary.get() ) != 0 )
+            return 0;
+    }
+    return result.release();
+}
+
+
+PyObject*
+set_slow_notification_hook( PyObject* mod, PyObject* args )
+{
+    PyObject* hook;
+    unsigned PY_LONG_LONG budget = 0;
+    if( !PyArg_ParseTuple( args, "O|K:set_slow_notification_hook", &hook, &budget ) )
+        return 0;
+    if( hook != Py_None && !PyCallable_Check( hook ) )
+        return py_expected_type_fail( hook, "callable" );
+    PyObject* old = MemberStats::slow_hook;
+    if( hook == Py_None )
+    {
+        MemberStats::slow_hook = 0;
+        MemberStats::flags &= ~static_cast<unsigned>( MemberStats::SlowRounds );
+    }
+    else
+    {
+        MemberStats::slow_hook = newref( hook );
+        MemberStats::slow_budget = budget;
+        MemberStats::flags |= MemberStats::SlowRounds;
+    }
+    Py_XDECREF( old );
+    Py_RETURN_NONE;
+}
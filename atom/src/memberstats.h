@@ -0,0 +1,161 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include <vector>
+#include "pythonhelpers.h"
+#include "inttypes.h"
+#include "catom.h"
+
+
+// Opt-in counters of the work done by each member, recorded per class and
+// member name, and latency histograms of the observers. The hot paths only
+// test the flags while everything is disabled.
+namespace MemberStats
+{
+
+enum Counter
+{
+    GetAttr,
+    SetAttr,
+    Validate,
+    DefaultValue,
+    Notify,
+    CounterCount
+};
+
+
+enum Flag
+{
+    Counting = 0x1,
+    Timing = 0x2,
+    ObserverTiming = 0x4,
+    SlowRounds = 0x8
+};
+
+
+extern unsigned flags;
+
+
+// The number of observers called since the innermost recorded operation
+// started. It is bumped unconditionally by the notification loops, which
+// is cheaper than testing the flags.
+extern uint64_t observer_calls;
+
+
+// A monotonic clock in nanoseconds.
+uint64_t
+now();
+
+
+void
+record( Counter counter, PyObject* type, PyObject* name, uint64_t calls, uint64_t elapsed );
+
+
+// Record an operation when going out of scope. The observers called by a
+// nested operation are only attributed to the nested one, while the time
+// of a nested operation is included in the time of the enclosing one.
+class Scope
+{
+
+public:
+
+    Scope( Counter counter, CAtom* atom, PyObject* name ) :
+        m_counter( counter ),
+        m_type( pyobject_cast( Py_TYPE( pyobject_cast( atom ) ) ) ),
+        m_name( name ),
+        m_calls( observer_calls ),
+        m_start( flags & Timing ? now() : 0 ),
+        m_active( ( flags & Counting ) != 0 )
+    {
+        observer_calls = 0;
+    }
+
+    ~Scope()
+    {
+        uint64_t elapsed = m_start ? now() - m_start : 0;
+        if( m_active )
+            record( m_counter, m_type, m_name, observer_calls, elapsed );
+        observer_calls = m_calls;
+    }
+
+private:
+
+    Scope( const Scope& );
+
+    Scope& operator=( const Scope& );
+
+    Counter m_counter;
+    PyObject* m_type;
+    PyObject* m_name;
+    uint64_t m_calls;
+    uint64_t m_start;
+    bool m_active;
+};
+
+
+// A notification round, dispatching a topic to the static observers of a
+// member or to the dynamic observers of an atom. The observers it calls
+// are timed when the observer histograms are enabled, and the round is
+// reported to the slow notification hook when it exceeds the budget.
+class Round
+{
+
+public:
+
+    Round( CAtom* atom, PyObject* topic );
+
+    ~Round();
+
+    // Time a call to an observer made by the innermost round.
+    static bool call( PyObjectPtr& callable, PyObjectPtr& args, PyObjectPtr& kwargs );
+
+private:
+
+    Round( const Round& );
+
+    Round& operator=( const Round& );
+
+    void report( uint64_t elapsed );
+
+    Scope m_scope;
+    CAtom* m_atom;
+    PyObject* m_topic;
+    Round* m_parent;
+    uint64_t m_start;
+    std::vector<std::pair<PyObject*, uint64_t> > m_observers;
+};
+
+
+inline bool
+call_observer( PyObjectPtr& callable, PyObjectPtr& args, PyObjectPtr& kwargs )
+{
+    ++observer_calls;
+    if( flags & ( ObserverTiming | SlowRounds ) )
+        return Round::call( callable, args, kwargs );
+    return callable( args, kwargs );
+}
+
+}  // namespace MemberStats
+
+
+PyObject* enable_stats( PyObject* mod, PyObject* args, PyObject* kwargs );
+
+
+PyObject* disable_stats( PyObject* mod );
+
+
+PyObject* reset_stats( PyObject* mod );
+
+
+PyObject* stats( PyObject* mod );
+
+
+PyObject* observer_stats( PyObject* mod );
+
+
+PyObject* set_slow_notification_hook( PyObject* mod, PyObject* args );
@@ -0,0 +1,315 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#include <limits>
+#include "numericbuffer.h"
+
+
+using namespace PythonHelpers;
+
+
+namespace
+{
+
+#if PY_MAJOR_VERSION >= 3
+
+bool
+native_byte_order( char code )
+{
+    const uint16_t probe = 1;
+    bool little = *reinterpret_cast<const char*>( &probe ) == 1;
+    switch( code )
+    {
+        case '@':
+        case '=':
+            return true;
+        case '<':
+            return little;
+        case '>':
+        case '!':
+            return !little;
+        default:
+            return false;
+    }
+}
+
+
+NumericBuffer::Kind
+format_kind( const char* format, Py_ssize_t itemsize )
+{
+    if( !format )
+        format = "B";
+    if( native_byte_order( format[ 0 ] ) )
+        ++format;
+    if( format[ 0 ] == '\0' || format[ 1 ] != '\0' )
+        return NumericBuffer::Unsupported;
+    bool integral = itemsize == 1 || itemsize == 2 || itemsize == 4 || itemsize == 8;
+    switch( format[ 0 ] )
+    {
+        case '?':
+            return itemsize == 1 ? NumericBuffer::Bool : NumericBuffer::Unsupported;
+        case 'b':
+        case 'h':
+        case 'i':
+        case 'l':
+        case 'q':
+        case 'n':
+            return integral ? NumericBuffer::Signed : NumericBuffer::Unsupported;
+        case 'B':
+        case 'H':
+        case 'I':
+        case 'L':
+        case 'Q':
+        case 'N':
+            return integral ? NumericBuffer::Unsigned : NumericBuffer::Unsupported;
+        case 'f':
+        case 'd':
+            return itemsize == 4 || itemsize == 8 ? NumericBuffer::Float : NumericBuffer::Unsupported;
+        default:
+            return NumericBuffer::Unsupported;
+    }
+}
+
+#endif
+
+
+// The checks accumulate a flag instead of returning early so that the
+// contiguous loops can be vectorized by the compiler.
+template<typename T, typename B> bool
+in_range( const char* data, Py_ssize_t stride, Py_ssize_t size, B low, B high )
+{
+    bool bad = false;
+    if( stride == static_cast<Py_ssize_t>( sizeof( T ) ) )
+    {
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            T value;
+            memcpy( &value, data + i * sizeof( T ), sizeof( T ) );
+            B item = static_cast<B>( value );
+            bad |= ( item < low ) | ( item > high );
+        }
+    }
+    else
+    {
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            T value;
+            memcpy( &value, data + i * stride, sizeof( T ) );
+            B item = static_cast<B>( value );
+            bad |= ( item < low ) | ( item > high );
+        }
+    }
+    return !bad;
+}
+
+
+template<typename B> bool
+sized_in_range( const char* data, Py_ssize_t stride, Py_ssize_t size,
+                Py_ssize_t itemsize, bool is_signed, B low, B high )
+{
+    switch( itemsize )
+    {
+        case 1:
+            return is_signed ?
+                in_range<int8_t>( data, stride, size, low, high ) :
+                in_range<uint8_t>( data, stride, size, low, high );
+        case 2:
+            return is_signed ?
+                in_range<int16_t>( data, stride, size, low, high ) :
+                in_range<uint16_t>( data, stride, size, low, high );
+        case 4:
+            return is_signed ?
+                in_range<int32_t>( data, stride, size, low, high ) :
+                in_range<uint32_t>( data, stride, size, low, high );
+        default:
+            return is_signed ?
+                in_range<int64_t>( data, stride, size, low, high ) :
+                in_range<uint64_t>( data, stride, size, low, high );
+    }
+}
+
+}  // namespace
+
+
+bool
+NumericBuffer::acquire( PyObject* object )
+{
+    release();
+    // Python 2 buffers of bytes iterate as strings, so only Python 3
+    // objects share the semantics of the item validators.
+#if PY_MAJOR_VERSION >= 3
+    if( !PyObject_CheckBuffer( object ) )
+        return false;
+    if( PyObject_GetBuffer( object, &m_view, PyBUF_FORMAT | PyBUF_STRIDES ) < 0 )
+    {
+        PyErr_Clear();
+        return false;
+    }
+    m_acquired = true;
+    if( m_view.ndim == 1 )
+        m_kind = format_kind( m_view.format, m_view.itemsize );
+    if( m_kind == Unsupported )
+    {
+        release();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+bool
+NumericBuffer::check_range( int64_t low, int64_t high ) const
+{
+    const char* data = reinterpret_cast<const char*>( m_view.buf );
+    Py_ssize_t stride = m_view.strides[ 0 ];
+    if( m_kind == Signed )
+        return sized_in_range( data, stride, size(), m_view.itemsize, true, low, high );
+    if( high < 0 )
+        return size() == 0;
+    uint64_t ulow = low < 0 ? 0 : static_cast<uint64_t>( low );
+    uint64_t uhigh = high == std::numeric_limits<int64_t>::max() ?
+        std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>( high );
+    return sized_in_range( data, stride, size(), m_view.itemsize, false, ulow, uhigh );
+}
+
+
+bool
+NumericBuffer::check_range( double low, double high ) const
+{
+    const char* data = reinterpret_cast<const char*>( m_view.buf );
+    Py_ssize_t stride = m_view.strides[ 0 ];
+    if( m_view.itemsize == 4 )
+        return in_range<float>( data, stride, size(), low, high );
+    return in_range<double>( data, stride, size(), low, high );
+}
+
+
+int64_t
+NumericBuffer::get_int64( Py_ssize_t index ) const
+{
+    switch( m_view.itemsize )
+    {
+        case 1:
+            return item<int8_t>( index );
+        case 2:
+            return item<int16_t>( index );
+        case 4:
+            return item<int32_t>( index );
+        default:
+            return item<int64_t>( index );
+    }
+}
+
+
+uint64_t
+NumericBuffer::get_uint64( Py_ssize_t index ) const
+{
+    switch( m_view.itemsize )
+    {
+        case 1:
+            return item<uint8_t>( index );
+        case 2:
+            return item<uint16_t>( index );
+        case 4:
+            return item<uint32_t>( index );
+        default:
+            return item<uint64_t>( index );
+    }
+}
+
+
+double
+NumericBuffer::get_double( Py_ssize_t index ) const
+{
+    if( m_view.itemsize == 4 )
+        return item<float>( index );
+    return item<double>( index );
+}
+
+
+double
+NumericBuffer::as_double( Py_ssize_t index ) const
+{
+    switch( m_kind )
+    {
+        case Bool:
+            return item<uint8_t>( index ) ? 1.0 : 0.0;
+        case Signed:
+            return static_cast<double>( get_int64( index ) );
+        case Unsigned:
+            return static_cast<double>( get_uint64( index ) );
+        default:
+            return get_double( index );
+    }
+}
+
+
+bool
+NumericBuffer::as_int64( Py_ssize_t index, int64_t& out ) const
+{
+    switch( m_kind )
+    {
+        case Bool:
+            out = item<uint8_t>( index ) ? 1 : 0;
+            return true;
+        case Signed:
+            out = get_int64( index );
+            return true;
+        case Unsigned:
+        {
+            uint64_t value = get_uint64( index );
+            if( value > static_cast<uint64_t>( std::numeric_limits<int64_t>::max() ) )
+                return false;
+            out = static_cast<int64_t>( value );
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+
+PyObject*
+NumericBuffer::box( Py_ssize_t index, Boxing boxing ) const
+{
+    switch( m_kind )
+    {
+        case Bool:
+        {
+            bool value = item<uint8_t>( index ) != 0;
+            if( boxing == AsFloat )
+                return PyFloat_FromDouble( value ? 1.0 : 0.0 );
+            return newref( value ? Py_True : Py_False );
+        }
+        case Signed:
+        {
+            int64_t value = get_int64( index );
+            if( boxing == AsFloat )
+                return PyFloat_FromDouble( static_cast<double>( value ) );
+            return PyLong_FromLongLong( value );
+        }
+        case Unsigned:
+        {
+            uint64_t value = get_uint64( index );
+            if( boxing == AsFloat )
+                return PyFloat_FromDouble( static_cast<double>( value ) );
+            return PyLong_FromUnsignedLongLong( value );
+        }
+        case Float:
+        {
+            double value = get_double( index );
+            if( boxing == AsInt )
+                return PyLong_FromDouble( value );
+            return PyFloat_FromDouble( value );
+        }
+        default:
+            return py_type_fail( "unsupported buffer format" );  // LCOV_EXCL_LINE
+    }
+}
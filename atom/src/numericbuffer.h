@@ -0,0 +1,110 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include <cstring>
+#include "inttypes.h"
+#include "pythonhelpers.h"
+
+
+// A read only view on a one dimensional buffer of native numbers, as
+// exposed by array.array, memoryview or numpy arrays.
+class NumericBuffer
+{
+
+public:
+
+    enum Kind
+    {
+        Unsupported,
+        Bool,
+        Signed,
+        Unsigned,
+        Float
+    };
+
+    // How the items are converted to Python objects once validated.
+    // Native produces the same objects as iterating over the buffer.
+    enum Boxing
+    {
+        Native,
+        AsFloat,
+        AsInt
+    };
+
+    NumericBuffer() : m_kind( Unsupported ), m_acquired( false ) {}
+
+    ~NumericBuffer()
+    {
+        release();
+    }
+
+    // Acquire the buffer of the object. This returns false without
+    // setting an exception if the object does not expose a 1-D buffer
+    // of native numbers.
+    bool acquire( PyObject* object );
+
+    void release()
+    {
+        if( m_acquired )
+            PyBuffer_Release( &m_view );
+        m_acquired = false;
+        m_kind = Unsupported;
+    }
+
+    Kind kind() const
+    {
+        return m_kind;
+    }
+
+    Py_ssize_t size() const
+    {
+        return m_acquired ? m_view.shape[ 0 ] : 0;
+    }
+
+    // Check that all the items lie in the closed interval [low, high].
+    // Only valid for Bool, Signed and Unsigned buffers.
+    bool check_range( int64_t low, int64_t high ) const;
+
+    // Check that all the items lie in the closed interval [low, high].
+    // Only valid for Float buffers. NaN items are always accepted.
+    bool check_range( double low, double high ) const;
+
+    // Create a new reference to the Python object for the given item.
+    PyObject* box( Py_ssize_t index, Boxing boxing ) const;
+
+    // Read an item as a double, converting integers.
+    double as_double( Py_ssize_t index ) const;
+
+    // Read an integer item. This returns false for floats and for
+    // unsigned values which do not fit in 64 bit signed integers.
+    bool as_int64( Py_ssize_t index, int64_t& out ) const;
+
+private:
+
+    template<typename T> T
+    item( Py_ssize_t index ) const
+    {
+        T value;
+        const char* data = reinterpret_cast<const char*>( m_view.buf );
+        memcpy( &value, data + index * m_view.strides[ 0 ], sizeof( T ) );
+        return value;
+    }
+
+    int64_t get_int64( Py_ssize_t index ) const;
+
+    uint64_t get_uint64( Py_ssize_t index ) const;
+
+    double get_double( Py_ssize_t index ) const;
+
+    Py_buffer m_view;
+    Kind m_kind;
+    bool m_acquired;
+
+    NumericBuffer( const NumericBuffer& other );
+    NumericBuffer& operator=( const NumericBuffer& );
+};
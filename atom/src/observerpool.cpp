@@ -6,6 +6,7 @@
 | The full license is in the file COPYING.txt, distributed with this software.
 |----------------------------------------------------------------------------*/
 #include "observerpool.h"
+#include "memberstats.h"
 
 
 namespace
@@ -219,7 +220,7 @@ ObserverPool::notify( PyObjectPtr& topic, PyObjectPtr& args, PyObjectPtr& kwargs
             {
                 if( obs_it->is_true() )
                 {
-                    if( !obs_it->operator()( args, kwargs ) )
+                    if( !MemberStats::call_observer( *obs_it, args, kwargs ) )
                         return false;
                 }
                 else
@@ -321,7 +321,7 @@ public:
         return true;
     }
 
-    bool richcompare( PyObject* other, int opid, bool clear_err=true )
+    bool richcompare( PyObject* other, int opid, bool clear_err=true ) const
     {
         // Start with Python's rich compare.
         int r = PyObject_RichCompareBool( m_pyobj, other, opid );
@@ -353,7 +353,7 @@ public:
         return false;
     }
 
-    bool richcompare( PyObjectPtr& other, int opid, bool clear_err=true )
+    bool richcompare( const PyObjectPtr& other, int opid, bool clear_err=true ) const
     {
         return richcompare( other.m_pyobj, opid, clear_err );
     }
@@ -6,6 +6,8 @@
 | The full license is in the file COPYING.txt, distributed with this software.
 |----------------------------------------------------------------------------*/
 #include "member.h"
+#include "memberstats.h"
+#include "changetrace.h"
 #include "memberchange.h"
 #include "py23compat.h"
 
@@ -122,6 +124,8 @@ slot_handler( Member* member, CAtom* atom, PyObject* value )
     }
     if( ( !valid_old || oldptr != newptr ) && atom->get_notifications_enabled() )
     {
+        ChangeTrace::record( valid_old ? ChangeTrace::Update : ChangeTrace::Create,
+                             atom, member, valid_old ? oldptr.get() : 0, newptr.get() );
         PyObjectPtr argsptr;
         if( member->has_observers() )
         {
@@ -205,6 +209,7 @@ event_handler( Member* member, CAtom* atom, PyObject* value )
         return -1;
     if( atom->get_notifications_enabled() )
     {
+        ChangeTrace::record( ChangeTrace::Event, atom, member, 0, valueptr.get() );
         PyObjectPtr argsptr;
         if( member->has_observers() )
         {
@@ -418,5 +423,10 @@ Member::setattr( CAtom* atom, PyObject* value )
 {
     if( get_setattr_mode() >= sizeof( handlers ) )
         return no_op_handler( this, atom, value );  // LCOV_EXCL_LINE
+    if( MemberStats::flags & MemberStats::Counting )
+    {
+        MemberStats::Scope scope( MemberStats::SetAttr, atom, name );
+        return handlers[ get_setattr_mode() ]( this, atom, value );
+    }
     return handlers[ get_setattr_mode() ]( this, atom, value );
 }
@@ -5,12 +5,9 @@
 |
 | The full license is in the file COPYING.txt, distributed with this software.
 |----------------------------------------------------------------------------*/
-#include <algorithm>
-#include <vector>
 #include <iostream>
 #include <sstream>
-#include "pythonhelpers.h"
-#include "py23compat.h"
+#include "sortedmap.h"
 
 #ifdef __clang__
 #pragma clang diagnostic ignored "-Wdeprecated-writable-strings"
@@ -22,305 +19,519 @@
 
 using namespace PythonHelpers;
 
-class MapItem
+
+extern PyTypeObject SortedMap_Type;
+
+
+enum ViewKind
 {
+    ViewKeys,
+    ViewValues,
+    ViewItems
+};
 
-public:
 
-    MapItem() {}
+/*-----------------------------------------------------------------------------
+| Iterator
+|----------------------------------------------------------------------------*/
+// The iterator walks the storage with a cursor over a range of positions. A
+// change of the storage version means that items were added or removed, in
+// which case the cursor may be dangling and the iteration is aborted.
+struct SortedMapIter
+{
+    PyObject_HEAD
+    SortedMap* map;
+    PyObject* result;
+    SortedItems::Cursor cursor;
+    size_t remaining;
+    size_t version;
+    ViewKind kind;
+    bool reverse;
+};
 
-    MapItem( PyObject* key, PyObject* value ) :
-        m_key( newref( key ) ), m_value( newref( value ) ) { }
 
-    MapItem( PyObjectPtr& key, PyObjectPtr& value ) :
-        m_key( key ), m_value( value ) { }
+extern PyTypeObject SortedMapIter_Type;
 
-    MapItem( PyObjectPtr& key, PyObject* value ) :
-        m_key( key ), m_value( newref( value ) ) { }
 
-    MapItem( PyObject* key, PyObjectPtr& value ) :
-        m_key( newref( key ) ), m_value( value ) { }
+static PyObject*
+SortedMapIter_New( SortedMap* map, ViewKind kind, size_t first, size_t last, bool reverse )
+{
+    SortedMapIter* it = PyObject_GC_New( SortedMapIter, &SortedMapIter_Type );
+    if( !it )
+        return 0;
+    it->map = reinterpret_cast<SortedMap*>( newref( pyobject_cast( map ) ) );
+    it->result = 0;
+    it->remaining = first < last ? last - first : 0;
+    it->version = map->m_items->version();
+    it->kind = kind;
+    it->reverse = reverse;
+    if( it->remaining )
+        it->cursor = map->m_items->at( reverse ? last - 1 : first );
+    PyObject_GC_Track( it );
+    return pyobject_cast( it );
+}
 
-    ~MapItem() { }
 
-    PyObject* key()
+static int
+SortedMapIter_traverse( SortedMapIter* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->map );
+    Py_VISIT( self->result );
+    return 0;
+}
+
+
+static void
+SortedMapIter_dealloc( SortedMapIter* self )
+{
+    PyObject_GC_UnTrack( self );
+    Py_CLEAR( self->map );
+    Py_CLEAR( self->result );
+    PyObject_GC_Del( self );
+}
+
+
+static PyObject*
+SortedMapIter_next( SortedMapIter* self )
+{
+    if( !self->remaining )
+        return 0;
+    SortedItems* items = self->map->m_items;
+    if( items->version() != self->version )
     {
-        return m_key.get();
+        self->remaining = 0;
+        return py_runtime_fail( "sortedmap changed size during iteration" );
     }
-
-    PyObject* value()
+    PyObject* key = items->key( self->cursor );
+    PyObject* value = items->value( self->cursor );
+    if( --self->remaining )
     {
-        return m_value.get();
+        if( self->reverse )
+            items->prev( self->cursor );
+        else
+            items->next( self->cursor );
     }
-
-    void update( PyObject* value )
+    if( self->kind == ViewKeys )
+        return newref( key );
+    if( self->kind == ViewValues )
+        return newref( value );
+    // Like the dict iterators, recycle the last tuple if nobody holds it.
+    PyObject* result = self->result;
+    if( result && Py_REFCNT( result ) == 1 )
     {
-        m_value = newref( value );
+        Py_INCREF( result );
+        Py_DECREF( PyTuple_GET_ITEM( result, 0 ) );
+        Py_DECREF( PyTuple_GET_ITEM( result, 1 ) );
     }
-
-    struct CmpLess
+    else
     {
-        // All three operators are needed in order to keep the
-        // MSVC debug version of std::lower_bound happy.
-        bool operator()( MapItem& first, MapItem& second )
-        {
-            if( first.m_key == second.m_key )
-                return false;
-            return first.m_key.richcompare( second.m_key, Py_LT );
-        }
+        result = PyTuple_New( 2 );
+        if( !result )
+            return 0;
+        Py_XDECREF( self->result );
+        self->result = newref( result );
+    }
+    PyTuple_SET_ITEM( result, 0, newref( key ) );
+    PyTuple_SET_ITEM( result, 1, newref( value ) );
+    return result;
+}
 
-        bool operator()( MapItem& first, PyObject* second )
-        {
-            if( first.m_key == second )
-                return false;
-            return first.m_key.richcompare( second, Py_LT );
-        }
 
-        bool operator()( PyObject* first, MapItem& second )
-        {
-            if( first == second.m_key )
-                return false;
-            PyObjectPtr temp( newref( first ) );
-            return temp.richcompare( second.m_key, Py_LT );
-        }
-    };
+static PyObject*
+SortedMapIter_length_hint( SortedMapIter* self )
+{
+    return Py23Int_FromSsize_t( self->remaining );
+}
 
-    struct CmpEq
-    {
-        bool operator()( MapItem& first, MapItem& second )
-        {
-            if( first.m_key == second.m_key )
-                return true;
-            return first.m_key.richcompare( second.m_key, Py_EQ );
-        }
 
-        bool operator()( MapItem& first, PyObject* second )
-        {
-            if( first.m_key == second )
-                return true;
-            return first.m_key.richcompare( second, Py_EQ );
-        }
+static PyMethodDef
+SortedMapIter_methods[] = {
+    { "__length_hint__", ( PyCFunction )SortedMapIter_length_hint, METH_NOARGS,
+      "Private method returning an estimate of len(list(it))." },
+    { 0 } // sentinel
+};
 
-        bool operator()( PyObject* first, MapItem& second )
-        {
-            if( first == second.m_key )
-                return true;
-            PyObjectPtr temp( newref( first ) );
-            return temp.richcompare( second.m_key, Py_EQ );
-        }
-    };
 
-private:
+PyTypeObject SortedMapIter_Type = {
+    PyVarObject_HEAD_INIT( NULL, 0 )
+    "atom.datastructures.sortedmap.sortedmapiterator", /* tp_name */
+    sizeof( SortedMapIter ),                /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)SortedMapIter_dealloc,      /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)0,                            /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)0,                  /* tp_as_sequence */
+    (PyMappingMethods*)0,                   /* tp_as_mapping */
+    (hashfunc)0,                            /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)PyObject_GenericGetAttr,  /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)SortedMapIter_traverse,   /* tp_traverse */
+    (inquiry)0,                             /* tp_clear */
+    (richcmpfunc)0,                         /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)PyObject_SelfIter,         /* tp_iter */
+    (iternextfunc)SortedMapIter_next,       /* tp_iternext */
+    (struct PyMethodDef*)SortedMapIter_methods, /* tp_methods */
+};
+
 
-    PyObjectPtr m_key;
-    PyObjectPtr m_value;
+/*-----------------------------------------------------------------------------
+| Views
+|----------------------------------------------------------------------------*/
+// The keys, values and items views are live sequences over the map: they
+// reflect its changes, can be indexed by position, and compare equal to any
+// list or tuple holding the same elements in the same order.
+struct SortedMapView
+{
+    PyObject_HEAD
+    SortedMap* map;
+    ViewKind kind;
 };
 
 
-struct SortedMap
+extern PyTypeObject SortedMapView_Type;
+
+
+static PyObject*
+SortedMapView_New( SortedMap* map, ViewKind kind )
 {
-    typedef std::vector<MapItem> Items;
+    SortedMapView* view = PyObject_GC_New( SortedMapView, &SortedMapView_Type );
+    if( !view )
+        return 0;
+    view->map = reinterpret_cast<SortedMap*>( newref( pyobject_cast( map ) ) );
+    view->kind = kind;
+    PyObject_GC_Track( view );
+    return pyobject_cast( view );
+}
 
-    PyObject_HEAD
-    Items* m_items;
 
-    PyObject* getitem( PyObject* key, PyObject* default_value = 0 )
-    {
-        Items::iterator it = std::lower_bound(
-            m_items->begin(), m_items->end(), key, MapItem::CmpLess()
-        );
-        if( it == m_items->end() )
-        {
-            if( default_value )
-                return newref( default_value );
-            return lookup_fail( key );
-        }
-        if( MapItem::CmpEq()( *it, key ) )
-            return newref( it->value() );
-        if( default_value )
-            return newref( default_value );
-        return lookup_fail( key );
-    }
+static int
+SortedMapView_traverse( SortedMapView* self, visitproc visit, void* arg )
+{
+    Py_VISIT( self->map );
+    return 0;
+}
 
-    int setitem( PyObject* key, PyObject* value )
-    {
-        Items::iterator it = std::lower_bound(
-            m_items->begin(), m_items->end(), key, MapItem::CmpLess()
-        );
-        if( it == m_items->end() )
-            m_items->push_back( MapItem( key, value ) );
-        else if( MapItem::CmpEq()( *it, key ) )
-            it->update( value );
-        else
-            m_items->insert( it, MapItem( key, value ) );
+
+static void
+SortedMapView_dealloc( SortedMapView* self )
+{
+    PyObject_GC_UnTrack( self );
+    Py_CLEAR( self->map );
+    PyObject_GC_Del( self );
+}
+
+
+static Py_ssize_t
+SortedMapView_length( SortedMapView* self )
+{
+    return static_cast<Py_ssize_t>( self->map->m_items->size() );
+}
+
+
+static PyObject*
+SortedMapView_iter( SortedMapView* self )
+{
+    return SortedMapIter_New(
+        self->map, self->kind, 0, self->map->m_items->size(), false );
+}
+
+
+static PyObject*
+SortedMapView_reversed( SortedMapView* self )
+{
+    return SortedMapIter_New(
+        self->map, self->kind, 0, self->map->m_items->size(), true );
+}
+
+
+static PyObject*
+SortedMapView_item( SortedMapView* self, Py_ssize_t index )
+{
+    if( !self->map->normalize( index ) )
         return 0;
-    }
+    SortedItems* items = self->map->m_items;
+    SortedItems::Cursor cursor = items->at( index );
+    if( self->kind == ViewKeys )
+        return newref( items->key( cursor ) );
+    if( self->kind == ViewValues )
+        return newref( items->value( cursor ) );
+    return PyTuple_Pack( 2, items->key( cursor ), items->value( cursor ) );
+}
+
 
-    int delitem( PyObject* key )
+static int
+SortedMapView_contains( SortedMapView* self, PyObject* value )
+{
+    SortedItems* items = self->map->m_items;
+    if( self->kind == ViewKeys )
+        return self->map->contains( value );
+    if( self->kind == ViewItems )
     {
-        Items::iterator it = std::lower_bound(
-            m_items->begin(), m_items->end(), key, MapItem::CmpLess()
-        );
-        if( it == m_items->end() )
-        {
-            lookup_fail( key );
-            return -1;
-        }
-        if( MapItem::CmpEq()( *it, key ) )
-        {
-            m_items->erase( it );
+        if( !PyTuple_Check( value ) || PyTuple_GET_SIZE( value ) != 2 )
             return 0;
-        }
-        lookup_fail( key );
+        SortedItems::Cursor cursor;
+        int res = self->map->find( PyTuple_GET_ITEM( value, 0 ), cursor );
+        if( res <= 0 )
+            return res;
+        PyObjectPtr found( newref( items->value( cursor ) ) );
+        return PyObject_RichCompareBool( found.get(), PyTuple_GET_ITEM( value, 1 ), Py_EQ );
+    }
+    // Iterate through an iterator so that a comparison mutating the map
+    // cannot leave us with a dangling cursor.
+    PyObjectPtr iter( SortedMapView_iter( self ) );
+    if( !iter )
         return -1;
+    PyObjectPtr item;
+    while( ( item = PyIter_Next( iter.get() ) ) )
+    {
+        int res = PyObject_RichCompareBool( item.get(), value, Py_EQ );
+        if( res != 0 )
+            return res;
     }
+    return PyErr_Occurred() ? -1 : 0;
+}
 
-    bool contains( PyObject* key )
+
+static PyObject*
+SortedMapView_richcompare( SortedMapView* self, PyObject* other, int op )
+{
+    if( ( op != Py_EQ && op != Py_NE ) ||
+        !( PyList_Check( other ) || PyTuple_Check( other ) ||
+           PyObject_TypeCheck( other, &SortedMapView_Type ) ) )
     {
-        Items::iterator it = std::lower_bound(
-            m_items->begin(), m_items->end(), key, MapItem::CmpLess()
-        );
-        if( it == m_items->end() )
-            return false;
-        return MapItem::CmpEq()( *it, key );
+        Py_INCREF( Py_NotImplemented );
+        return Py_NotImplemented;
     }
+    PyObjectPtr first( PySequence_Tuple( pyobject_cast( self ) ) );
+    if( !first )
+        return 0;
+    PyObjectPtr second( PySequence_Tuple( other ) );
+    if( !second )
+        return 0;
+    return PyObject_RichCompare( first.get(), second.get(), op );
+}
+
+
+static PyObject*
+SortedMapView_repr( SortedMapView* self )
+{
+    static const char* names[] = {
+        "sortedmap_keys(%s)", "sortedmap_values(%s)", "sortedmap_items(%s)"
+    };
+    PyObjectPtr pylist( PySequence_List( pyobject_cast( self ) ) );
+    if( !pylist )
+        return 0;
+    PyObjectPtr pyrepr( PyObject_Repr( pylist.get() ) );
+    if( !pyrepr )
+        return 0;
+    return Py23Str_FromFormat( names[ self->kind ], Py23Str_AS_STRING( pyrepr.get() ) );
+}
+
+
+static PySequenceMethods
+SortedMapView_as_sequence = {
+    ( lenfunc )SortedMapView_length,          /* sq_length */
+    0,                                        /* sq_concat */
+    0,                                        /* sq_repeat */
+    ( ssizeargfunc )SortedMapView_item,       /* sq_item */
+    0,                                        /* sq_slice */
+    0,                                        /* sq_ass_item */
+    0,                                        /* sq_ass_slice */
+    ( objobjproc )SortedMapView_contains,     /* sq_contains */
+    0,                                        /* sq_inplace_concat */
+    0,                                        /* sq_inplace_repeat */
+};
+
+
+static PyMethodDef
+SortedMapView_methods[] = {
+    { "__reversed__", ( PyCFunction )SortedMapView_reversed, METH_NOARGS,
+      "__reversed__() -> iterate over the view in reverse order" },
+    { 0 } // sentinel
+};
+
+
+PyTypeObject SortedMapView_Type = {
+    PyVarObject_HEAD_INIT( NULL, 0 )
+    "atom.datastructures.sortedmap.sortedmapview", /* tp_name */
+    sizeof( SortedMapView ),                /* tp_basicsize */
+    0,                                      /* tp_itemsize */
+    (destructor)SortedMapView_dealloc,      /* tp_dealloc */
+    (printfunc)0,                           /* tp_print */
+    (getattrfunc)0,                         /* tp_getattr */
+    (setattrfunc)0,                         /* tp_setattr */
+#if PY_VERSION_HEX >= 0x03050000
+	( PyAsyncMethods* )0,                   /* tp_as_async */
+#elif PY_VERSION_HEX >= 0x03000000
+	( void* ) 0,                            /* tp_reserved */
+#else
+	( cmpfunc )0,                           /* tp_compare */
+#endif
+    (reprfunc)SortedMapView_repr,           /* tp_repr */
+    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PySequenceMethods*)&SortedMapView_as_sequence, /* tp_as_sequence */
+    (PyMappingMethods*)0,                   /* tp_as_mapping */
+    (hashfunc)PyObject_HashNotImplemented,  /* tp_hash */
+    (ternaryfunc)0,                         /* tp_call */
+    (reprfunc)0,                            /* tp_str */
+    (getattrofunc)PyObject_GenericGetAttr,  /* tp_getattro */
+    (setattrofunc)0,                        /* tp_setattro */
+    (PyBufferProcs*)0,                      /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+    0,                                      /* Documentation string */
+    (traverseproc)SortedMapView_traverse,   /* tp_traverse */
+    (inquiry)0,                             /* tp_clear */
+    (richcmpfunc)SortedMapView_richcompare, /* tp_richcompare */
+    0,                                      /* tp_weaklistoffset */
+    (getiterfunc)SortedMapView_iter,        /* tp_iter */
+    (iternextfunc)0,                        /* tp_iternext */
+    (struct PyMethodDef*)SortedMapView_methods, /* tp_methods */
+};
 
-    PyObject* pop( PyObject* key, PyObject* default_value=0 )
+
+static bool
+collect_pair( PyObject* item, SortedMap::Items& items )
+{
+    if( PyTuple_Check( item ) && PyTuple_GET_SIZE( item ) == 2 )
     {
-        Items::iterator it = std::lower_bound(
-            m_items->begin(), m_items->end(), key, MapItem::CmpLess()
+        items.push_back(
+            MapItem( PyTuple_GET_ITEM( item, 0 ), PyTuple_GET_ITEM( item, 1 ) )
         );
-        if( it == m_items->end() )
-        {
-            if( default_value )
-                return newref( default_value );
-            return lookup_fail( key );
-        }
-        if( MapItem::CmpEq()( *it, key ) )
-        {
-            PyObject* res = newref( it->value() );
-            m_items->erase( it );
-            return res;
-        }
-        if( default_value )
-            return newref( default_value );
-        return lookup_fail( key );
+        return true;
     }
-
-    PyObject* keys()
+    if( !PySequence_Check( item ) || PySequence_Size( item ) != 2 )
     {
-        PyObject* pylist = PyList_New( m_items->size() );
-        if( !pylist )
-            return 0;
-        Py_ssize_t listidx = 0;
-        Items::iterator it;
-        Items::iterator end_it = m_items->end();
-        for( it = m_items->begin(); it != end_it; ++it )
-        {
-            PyList_SET_ITEM( pylist, listidx, newref( it->key() ) );
-            ++listidx;
-        }
-        return pylist;
+        PyErr_Clear();
+        py_expected_type_fail( item, "pairs of objects" );
+        return false;
     }
+    PyObjectPtr key( PySequence_GetItem( item, 0 ) );
+    if( !key )
+        return false;
+    PyObjectPtr value( PySequence_GetItem( item, 1 ) );
+    if( !value )
+        return false;
+    items.push_back( MapItem( key, value ) );
+    return true;
+}
+
 
-    PyObject* values()
+// Append the content of a dict, a sortedmap, a mapping (any object with a
+// keys method) or an iterable of pairs to a batch of items.
+static bool
+collect_items( PyObject* map, SortedMap::Items& items )
+{
+    if( PyDict_Check( map ) )
     {
-        PyObject* pylist = PyList_New( m_items->size() );
-        if( !pylist )
-            return 0;
-        Py_ssize_t listidx = 0;
-        Items::iterator it;
-        Items::iterator end_it = m_items->end();
-        for( it = m_items->begin(); it != end_it; ++it )
-        {
-            PyList_SET_ITEM( pylist, listidx, newref( it->value() ) );
-            ++listidx;
-        }
-        return pylist;
+        items.reserve( items.size() + PyDict_Size( map ) );
+        Py_ssize_t pos = 0;
+        PyObject* key;
+        PyObject* value;
+        while( PyDict_Next( map, &pos, &key, &value ) )
+            items.push_back( MapItem( key, value ) );
+        return true;
     }
-
-    PyObject* items()
+    if( PyObject_TypeCheck( map, &SortedMap_Type ) )
     {
-        PyObject* pylist = PyList_New( m_items->size() );
-        if( !pylist )
-            return 0;
-        Py_ssize_t listidx = 0;
-        Items::iterator it;
-        Items::iterator end_it = m_items->end();
-        for( it = m_items->begin(); it != end_it; ++it )
+        reinterpret_cast<SortedMap*>( map )->m_items->flatten( items );
+        return true;
+    }
+    PyObjectPtr keys;
+    if( PyObject_HasAttrString( map, "keys" ) )
+    {
+        keys = PyMapping_Keys( map );
+        if( !keys )
+            return false;
+    }
+    PyObjectPtr iter( PyObject_GetIter( keys ? keys.get() : map ) );
+    if( !iter )
+        return false;
+    PyObjectPtr item;
+    while( ( item = PyIter_Next( iter.get() ) ) )
+    {
+        if( keys )
         {
-            PyObject* pytuple = PyTuple_New( 2 );
-            if( !pytuple )
-                return 0;
-            PyTuple_SET_ITEM( pytuple, 0, newref( it->key() ) );
-            PyTuple_SET_ITEM( pytuple, 1, newref( it->value() ) );
-            PyList_SET_ITEM( pylist, listidx, pytuple );
-            ++listidx;
+            PyObjectPtr value( PyObject_GetItem( map, item.get() ) );
+            if( !value )
+                return false;
+            items.push_back( MapItem( item, value ) );
         }
-        return pylist;
+        else if( !collect_pair( item.get(), items ) )
+            return false;
     }
+    return !PyErr_Occurred();
+}
 
-    static PyObject* lookup_fail( PyObject* key )
-    {
-        PyObjectPtr pystr( PyObject_Str( key ) );
-        if( !pystr )
-            return 0;
-        PyObjectPtr pytuple( PyTuple_Pack( 1, key ) );
-        if (!pytuple)
-            return 0;
-        PyErr_SetObject(PyExc_KeyError, pytuple.get());
-        return 0;
-    }
-};
+
+// Collect the items of a map and compute their sort keys. The sort keys
+// of a sortedmap sharing the same key function are reused as they are.
+static bool
+collect_keyed( SortedMap* self, PyObject* map, SortedMap::Items& batch )
+{
+    size_t start = batch.size();
+    if( !collect_items( map, batch ) )
+        return false;
+    if( PyObject_TypeCheck( map, &SortedMap_Type ) &&
+        reinterpret_cast<SortedMap*>( map )->m_keyfunc == self->m_keyfunc )
+        return true;
+    return self->sort_keys( batch, start );
+}
 
 
 static PyObject*
 SortedMap_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
 {
     PyObject* map = 0;
-    static char* kwlist[] = { "map", 0 };
-    if( !PyArg_ParseTupleAndKeywords( args, kwargs, "|O:__new__", kwlist, &map ) )
+    Py_ssize_t chunksize = SortedItems::default_chunksize;
+    PyObject* keyfunc = Py_None;
+    static char* kwlist[] = { "map", "chunksize", "key", 0 };
+    if( !PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|OnO:__new__", kwlist, &map, &chunksize, &keyfunc ) )
         return 0;
+    if( chunksize < 0 )
+        return py_value_fail( "chunksize must be non-negative" );
+    if( keyfunc != Py_None && !PyCallable_Check( keyfunc ) )
+        return py_expected_type_fail( keyfunc, "callable or None" );
 
-    PyObject* self = PyType_GenericNew( type, 0, 0 );
+    PyObjectPtr self( PyType_GenericNew( type, 0, 0 ) );
     if( !self )
         return 0;
-    SortedMap* cself = reinterpret_cast<SortedMap*>( self );
-    cself->m_items = new SortedMap::Items();
+    SortedMap* cself = reinterpret_cast<SortedMap*>( self.get() );
+    cself->m_items = new SortedItems( static_cast<size_t>( chunksize ) );
+    if( keyfunc != Py_None )
+        cself->m_keyfunc = newref( keyfunc );
 
-    PyObjectPtr seq;
+    // Collect everything first and sort once, rather than paying for an
+    // insertion into the vector per item.
     if( map )
     {
-        if( PyDict_Check( map ) )
-        {
-            seq = PyObject_GetIter( PyDict_Items( map ) );
-            if( !seq )
-                return 0;
-        }
-        else
-        {
-            seq = PyObject_GetIter( map );
-            if( !seq )
-                return 0;
-        }
-    }
-
-    if( seq )
-    {
-        PyObjectPtr item;
-        while( (item = PyIter_Next( seq.get() )) )
-        {
-            if( PySequence_Length( item.get() ) != 2)
-                return py_expected_type_fail( item.get(), "pairs of objects" );
-
-            cself->setitem( PySequence_GetItem( item.get(), 0 ),
-                            PySequence_GetItem( item.get(), 1 ) );
-        }
+        SortedMap::Items items;
+        if( !collect_keyed( cself, map, items ) )
+            return 0;
+        SortedItems::sort( items );
+        cself->m_items->assign( items );
     }
 
-    return self;
+    return self.release();
 }
 
+
 // Clearing the vector may cause arbitrary side effects on item
 // decref, including calls into methods which mutate the vector.
 // To avoid segfaults, first make the vector empty, then let the
@@ -329,16 +540,18 @@ SortedMap_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
     static int
     SortedMap_clear( SortedMap* self )
     {
-        SortedMap::Items empty;
+        SortedItems empty( self->m_items->chunksize() );
         self->m_items->swap( empty );
+        Py_CLEAR( self->m_keyfunc );
         return 0;
     }
 #else
     static void
     SortedMap_clear( SortedMap* self )
     {
-        SortedMap::Items empty;
+        SortedItems empty( self->m_items->chunksize() );
         self->m_items->swap( empty );
+        Py_CLEAR( self->m_keyfunc );
     }
 #endif
 
@@ -346,13 +559,18 @@ SortedMap_new( PyTypeObject* type, PyObject* args, PyObject* kwargs )
 static int
 SortedMap_traverse( SortedMap* self, visitproc visit, void* arg )
 {
-    SortedMap::Items::iterator it;
-    SortedMap::Items::iterator end_it = self->m_items->end();
-    for( it = self->m_items->begin(); it != end_it; ++it )
+    for( size_t i = 0; i < self->m_items->chunk_count(); ++i )
     {
-        Py_VISIT( it->key() );
-        Py_VISIT( it->value() );
+        const SortedItems::Chunk& chunk = self->m_items->chunk( i );
+        for( size_t j = 0; j < chunk.size(); ++j )
+        {
+            Py_VISIT( chunk.keys[ j ] );
+            Py_VISIT( chunk.values[ j ] );
+        }
+        for( size_t j = 0; j < chunk.sortkeys.size(); ++j )
+            Py_VISIT( chunk.sortkeys[ j ] );
     }
+    Py_VISIT( self->m_keyfunc );
     return 0;
 }
 
@@ -375,19 +593,205 @@ SortedMap_length( SortedMap* self )
 }
 
 
+// Create a map with the same chunksize and key function as self, holding a
+// batch of items sorted and free of duplicates. Like the copies, the result
+// is a plain sortedmap even when self is an atomsortedmap.
+static PyObject*
+SortedMap_from_sorted( SortedMap* self, SortedMap::Items& items )
+{
+    PyObject* map = SortedMap_Type.tp_alloc( &SortedMap_Type, 0 );
+    if( !map )
+        return 0;
+    SortedMap* cmap = reinterpret_cast<SortedMap*>( map );
+    cmap->m_items = new SortedItems( self->m_items->chunksize() );
+    cmap->m_keyfunc = xnewref( self->m_keyfunc );
+    cmap->m_items->assign( items );
+    return map;
+}
+
+
+// Gather the items of the other operand of a combination as a batch sorted
+// according to the key function of self.
+static bool
+sorted_batch( SortedMap* self, PyObject* other, SortedMap::Items& batch )
+{
+    if( PyObject_TypeCheck( other, &SortedMap_Type ) &&
+        reinterpret_cast<SortedMap*>( other )->m_keyfunc == self->m_keyfunc )
+    {
+        reinterpret_cast<SortedMap*>( other )->m_items->flatten( batch );
+        return true;
+    }
+    if( !collect_keyed( self, other, batch ) )
+        return false;
+    SortedItems::sort( batch );
+    return true;
+}
+
+
+static bool
+merge_into( SortedMap* self, PyObject* other, Conflict& conflict )
+{
+    SortedMap::Items batch;
+    if( !sorted_batch( self, other, batch ) )
+        return false;
+    return self->merge( batch, conflict );
+}
+
+
+// The binary operators accept a sortedmap or a dict as right operand.
+static PyObject*
+combine_new( PyObject* first, PyObject* second, SortedItems::CombineMode mode )
+{
+    if( !PyObject_TypeCheck( first, &SortedMap_Type ) ||
+        !( PyObject_TypeCheck( second, &SortedMap_Type ) || PyDict_Check( second ) ) )
+    {
+        Py_INCREF( Py_NotImplemented );
+        return Py_NotImplemented;
+    }
+    SortedMap* self = reinterpret_cast<SortedMap*>( first );
+    SortedMap::Items left;
+    SortedMap::Items right;
+    SortedMap::Items out;
+    if( !sorted_batch( self, second, right ) )
+        return 0;
+    self->m_items->flatten( left );
+    Conflict conflict = { Conflict::Replace, 0, 0 };
+    if( !SortedItems::combine( left, right, mode, conflict, out ) )
+        return 0;
+    return SortedMap_from_sorted( self, out );
+}
+
+
+static PyObject*
+SortedMap_or( PyObject* first, PyObject* second )
+{
+    return combine_new( first, second, SortedItems::Union );
+}
+
+
+static PyObject*
+SortedMap_and( PyObject* first, PyObject* second )
+{
+    return combine_new( first, second, SortedItems::Intersection );
+}
+
+
+static PyObject*
+SortedMap_sub( PyObject* first, PyObject* second )
+{
+    return combine_new( first, second, SortedItems::Difference );
+}
+
+
+static PyObject*
+SortedMap_ior( SortedMap* self, PyObject* other )
+{
+    Conflict conflict = { Conflict::Replace, 0, 0 };
+    if( !merge_into( self, other, conflict ) )
+        return 0;
+    return newref( pyobject_cast( self ) );
+}
+
+
+static PyNumberMethods
+SortedMap_as_number = {
+     ( binaryfunc )0,                       /* nb_add */
+     ( binaryfunc )SortedMap_sub,           /* nb_subtract */
+     ( binaryfunc )0,                       /* nb_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_remainder */
+     ( binaryfunc )0,                       /* nb_divmod */
+     ( ternaryfunc )0,                      /* nb_power */
+     ( unaryfunc )0,                        /* nb_negative */
+     ( unaryfunc )0,                        /* nb_positive */
+     ( unaryfunc )0,                        /* nb_absolute */
+     ( inquiry )0,                          /* nb_nonzero, or nb_bool in python3 */
+     ( unaryfunc )0,                        /* nb_invert */
+     ( binaryfunc )0,                       /* nb_lshift */
+     ( binaryfunc )0,                       /* nb_rshift */
+     ( binaryfunc )SortedMap_and,           /* nb_and */
+     ( binaryfunc )0,                       /* nb_xor */
+     ( binaryfunc )SortedMap_or,            /* nb_or */
+#if PY_MAJOR_VERSION < 3
+     ( coercion )0,                         /* nb_coerce */
+#endif
+     ( unaryfunc )0,                        /* nb_int */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_long */
+#else
+     ( void* )0,                            /* nb_reserved */
+#endif
+     ( unaryfunc )0,                        /* nb_float */
+#if PY_MAJOR_VERSION < 3
+     ( unaryfunc )0,                        /* nb_oct */
+     ( unaryfunc )0,                        /* nb_hex */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_add */
+     ( binaryfunc )0,                       /* nb_inplace_subtract */
+     ( binaryfunc )0,                       /* nb_inplace_multiply */
+#if PY_MAJOR_VERSION < 3
+     ( binaryfunc )0,                       /* nb_inplace_divide */
+#endif
+     ( binaryfunc )0,                       /* nb_inplace_remainder */
+     ( ternaryfunc )0,                      /* nb_inplace_power */
+     ( binaryfunc )0,                       /* nb_inplace_lshift */
+     ( binaryfunc )0,                       /* nb_inplace_rshift */
+     ( binaryfunc )0,                       /* nb_inplace_and */
+     ( binaryfunc )0,                       /* nb_inplace_xor */
+     ( binaryfunc )SortedMap_ior            /* nb_inplace_or */
+};
+
+
+// Slicing a sortedmap selects the keys k such that start <= k < stop.
+static bool
+slice_range( SortedMap* self, PyObject* slice, size_t& first, size_t& last )
+{
+    PySliceObject* pyslice = reinterpret_cast<PySliceObject*>( slice );
+    if( pyslice->step != Py_None )
+    {
+        py_value_fail( "sortedmap slices do not support a step" );
+        return false;
+    }
+    return self->key_range( pyslice->start, pyslice->stop, true, false, first, last );
+}
+
+
 static PyObject*
 SortedMap_subscript( SortedMap* self, PyObject* key )
 {
-    return self->getitem( key );
+    if( !PySlice_Check( key ) )
+        return self->getitem( key );
+    size_t first, last;
+    if( !slice_range( self, key, first, last ) )
+        return 0;
+    SortedMap::Items items;
+    self->m_items->copy_range( first, last, items );
+    return SortedMap_from_sorted( self, items );
 }
 
 
 static int
 SortedMap_ass_subscript( SortedMap* self, PyObject* key, PyObject* value )
 {
-    if( !value )
-        return self->delitem( key );
-    return self->setitem( key, value );
+    if( !PySlice_Check( key ) )
+    {
+        if( !value )
+            return self->delitem( key );
+        return self->setitem( key, value );
+    }
+    if( value )
+    {
+        py_type_fail( "sortedmap slices can only be deleted" );
+        return -1;
+    }
+    size_t first, last;
+    if( !slice_range( self, key, first, last ) )
+        return -1;
+    SortedMap::Items removed;
+    self->m_items->erase_range( first, last, removed );
+    return 0;
 }
 
 
@@ -445,7 +849,7 @@ SortedMap_pop( SortedMap* self, PyObject* args )
     if( nargs == 1 )
         return self->pop( PyTuple_GET_ITEM( args, 0 ) );
     if( nargs == 2 )
-        return self->getitem( PyTuple_GET_ITEM( args, 0 ), PyTuple_GET_ITEM( args, 1 ) );
+        return self->pop( PyTuple_GET_ITEM( args, 0 ), PyTuple_GET_ITEM( args, 1 ) );
     std::ostringstream ostr;
     if( nargs > 2 )
         ostr << "pop() expected at most 2 arguments, got " << nargs;
@@ -455,6 +859,144 @@ SortedMap_pop( SortedMap* self, PyObject* args )
 }
 
 
+static PyObject*
+SortedMap_update( SortedMap* self, PyObject* args, PyObject* kwargs )
+{
+    PyObject* other = 0;
+    if( !PyArg_UnpackTuple( args, "update", 0, 1, &other ) )
+        return 0;
+    SortedMap::Items batch;
+    if( other && !collect_keyed( self, other, batch ) )
+        return 0;
+    if( kwargs && !collect_keyed( self, kwargs, batch ) )
+        return 0;
+    SortedItems::sort( batch );
+    self->m_items->merge( batch );
+    Py_RETURN_NONE;
+}
+
+
+static PyObject*
+SortedMap_merge( SortedMap* self, PyObject* args )
+{
+    PyObject* other;
+    PyObject* policy = 0;
+    if( !PyArg_UnpackTuple( args, "merge", 1, 2, &other, &policy ) )
+        return 0;
+    Conflict conflict = { Conflict::Replace, 0, 0 };
+    if( policy && !conflict.parse( policy ) )
+        return 0;
+    if( !merge_into( self, other, conflict ) )
+        return 0;
+    Py_RETURN_NONE;
+}
+
+
+static PyObject*
+SortedMap_bisect_left( SortedMap* self, PyObject* key )
+{
+    Py_ssize_t position = self->bisect_left( key );
+    if( position < 0 )
+        return 0;
+    return Py23Int_FromSsize_t( position );
+}
+
+
+static PyObject*
+SortedMap_bisect_right( SortedMap* self, PyObject* key )
+{
+    Py_ssize_t position = self->bisect_right( key );
+    if( position < 0 )
+        return 0;
+    return Py23Int_FromSsize_t( position );
+}
+
+
+static PyObject*
+SortedMap_index( SortedMap* self, PyObject* key )
+{
+    SortedItems::Cursor cursor;
+    int found = self->find( key, cursor );
+    if( found < 0 )
+        return 0;
+    if( found )
+        return Py23Int_FromSsize_t( self->m_items->position( cursor ) );
+    PyObjectPtr pyrepr( PyObject_Repr( key ) );
+    if( !pyrepr )
+        return 0;
+    PyErr_Format(
+        PyExc_ValueError, "%s is not in the sortedmap", Py23Str_AS_STRING( pyrepr.get() )
+    );
+    return 0;
+}
+
+
+static PyObject*
+SortedMap_peekitem( SortedMap* self, PyObject* args )
+{
+    Py_ssize_t index = -1;
+    if( !PyArg_ParseTuple( args, "|n:peekitem", &index ) )
+        return 0;
+    if( !self->normalize( index ) )
+        return 0;
+    SortedItems::Cursor cursor = self->m_items->at( index );
+    return PyTuple_Pack( 2, self->m_items->key( cursor ), self->m_items->value( cursor ) );
+}
+
+
+static PyObject*
+SortedMap_popitem( SortedMap* self, PyObject* args )
+{
+    Py_ssize_t index = -1;
+    if( !PyArg_ParseTuple( args, "|n:popitem", &index ) )
+        return 0;
+    if( self->m_items->size() == 0 )
+    {
+        PyErr_SetString( PyExc_KeyError, "popitem(): sortedmap is empty" );
+        return 0;
+    }
+    if( !self->normalize( index ) )
+        return 0;
+    MapItem item;
+    self->m_items->erase( self->m_items->at( index ), item );
+    return PyTuple_Pack( 2, item.key(), item.value() );
+}
+
+
+static PyObject*
+SortedMap_irange( SortedMap* self, PyObject* args, PyObject* kwargs )
+{
+    PyObject* minimum = Py_None;
+    PyObject* maximum = Py_None;
+    PyObject* inclusive = 0;
+    PyObject* reverse = Py_False;
+    static char* kwlist[] = { "minimum", "maximum", "inclusive", "reverse", 0 };
+    if( !PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|OOOO:irange", kwlist, &minimum, &maximum, &inclusive, &reverse ) )
+        return 0;
+    bool lo_inclusive = true;
+    bool hi_inclusive = true;
+    if( inclusive )
+    {
+        if( !PyTuple_Check( inclusive ) || PyTuple_GET_SIZE( inclusive ) != 2 )
+            return py_expected_type_fail( inclusive, "tuple of 2 bools" );
+        int lo = PyObject_IsTrue( PyTuple_GET_ITEM( inclusive, 0 ) );
+        int hi = PyObject_IsTrue( PyTuple_GET_ITEM( inclusive, 1 ) );
+        if( lo < 0 || hi < 0 )
+            return 0;
+        lo_inclusive = lo == 1;
+        hi_inclusive = hi == 1;
+    }
+    int reversed = PyObject_IsTrue( reverse );
+    if( reversed < 0 )
+        return 0;
+    size_t first, last;
+    if( !self->key_range( minimum, maximum, lo_inclusive, hi_inclusive, first, last ) )
+        return 0;
+    return SortedMapIter_New( self, ViewKeys, first, last, reversed == 1 );
+}
+
+
 static PyObject*
 SortedMap_clearmethod( SortedMap* self )
 {
@@ -462,7 +1004,7 @@ SortedMap_clearmethod( SortedMap* self )
     // decref, including calls into methods which mutate the vector.
     // To avoid segfaults, first make the vector empty, then let the
     // destructors run for the old items.
-    SortedMap::Items empty;
+    SortedItems empty( self->m_items->chunksize() );
     self->m_items->swap( empty );
     Py_RETURN_NONE;
 }
@@ -471,31 +1013,35 @@ SortedMap_clearmethod( SortedMap* self )
 static PyObject*
 SortedMap_keys( SortedMap* self )
 {
-    return self->keys();
+    return SortedMapView_New( self, ViewKeys );
 }
 
 
 static PyObject*
 SortedMap_values( SortedMap* self )
 {
-    return self->values();
+    return SortedMapView_New( self, ViewValues );
 }
 
 
 static PyObject*
 SortedMap_items( SortedMap* self )
 {
-    return self->items();
+    return SortedMapView_New( self, ViewItems );
 }
 
 
 static PyObject*
 SortedMap_iter( SortedMap* self )
 {
-    PyObjectPtr keys( self->keys() );
-    if( !keys )
-        return 0;
-    return PyObject_GetIter( keys.get() );
+    return SortedMapIter_New( self, ViewKeys, 0, self->m_items->size(), false );
+}
+
+
+static PyObject*
+SortedMap_reversed( SortedMap* self )
+{
+    return SortedMapIter_New( self, ViewKeys, 0, self->m_items->size(), true );
 }
 
 
@@ -503,13 +1049,12 @@ SortedMap_iter( SortedMap* self )
 static PyObject*
 SortedMap_copy( SortedMap* self )
 {
-    PyTypeObject* type = pytype_cast( Py_TYPE(self) );
-    PyObject* copy = type->tp_alloc( type, 0 );
+    PyObject* copy = SortedMap_Type.tp_alloc( &SortedMap_Type, 0 );
     if( !copy )
         return 0;
     SortedMap* ccopy = reinterpret_cast<SortedMap*>( copy );
-    ccopy->m_items = new SortedMap::Items();
-    *ccopy->m_items = *self->m_items;
+    ccopy->m_items = new SortedItems( *self->m_items );
+    ccopy->m_keyfunc = xnewref( self->m_keyfunc );
     return copy;
 }
 
@@ -519,18 +1064,20 @@ SortedMap_repr( SortedMap* self )
 {
     std::ostringstream ostr;
     ostr << "sortedmap([";
-    SortedMap::Items::iterator it;
-    SortedMap::Items::iterator end_it = self->m_items->end();
-    for( it = self->m_items->begin(); it != end_it; ++it )
+    for( size_t i = 0; i < self->m_items->chunk_count(); ++i )
     {
-        PyObjectPtr keystr( PyObject_Repr( it->key() ) );
-        if( !keystr )
-            return 0;
-        PyObjectPtr valstr( PyObject_Repr( it->value() ) );
-        if( !valstr )
-            return 0;
-        ostr << "(" << Py23Str_AS_STRING( keystr.get() ) << ", ";
-        ostr << Py23Str_AS_STRING( valstr.get() ) << "), ";
+        const SortedItems::Chunk& chunk = self->m_items->chunk( i );
+        for( size_t j = 0; j < chunk.size(); ++j )
+        {
+            PyObjectPtr keystr( PyObject_Repr( chunk.keys[ j ] ) );
+            if( !keystr )
+                return 0;
+            PyObjectPtr valstr( PyObject_Repr( chunk.values[ j ] ) );
+            if( !valstr )
+                return 0;
+            ostr << "(" << Py23Str_AS_STRING( keystr.get() ) << ", ";
+            ostr << Py23Str_AS_STRING( valstr.get() ) << "), ";
+        }
     }
     if( self->m_items->size() > 0 )
         ostr.seekp( -2, std::ios_base::cur );
@@ -542,7 +1089,10 @@ SortedMap_repr( SortedMap* self )
 static PyObject*
 SortedMap_contains_bool( SortedMap* self, PyObject* key )
 {
-    if( self->contains( key ) )
+    int found = self->contains( key );
+    if( found < 0 )
+        return 0;
+    if( found )
         Py_RETURN_TRUE;
     Py_RETURN_FALSE;
 }
@@ -552,12 +1102,232 @@ static PyObject*
 SortedMap_sizeof( SortedMap* self, PyObject* args )
 {
     Py_ssize_t size = Py_TYPE(self)->tp_basicsize;
-    size += sizeof( SortedMap::Items );
-    size += sizeof( MapItem ) * self->m_items->capacity();
+    size += self->m_items->allocated();
     return Py23Int_FromSsize_t( size );
 }
 
 
+static PyObject*
+SortedMap_reserve( SortedMap* self, PyObject* arg )
+{
+    Py_ssize_t count = PyNumber_AsSsize_t( arg, PyExc_OverflowError );
+    if( count == -1 && PyErr_Occurred() )
+        return 0;
+    if( count < 0 )
+        return py_value_fail( "reserve count must be non-negative" );
+    self->m_items->reserve( static_cast<size_t>( count ) );
+    Py_RETURN_NONE;
+}
+
+
+static PyObject*
+SortedMap_shrink_to_fit( SortedMap* self )
+{
+    self->m_items->shrink_to_fit();
+    Py_RETURN_NONE;
+}
+
+
+// Packed native keys are written as little-endian 64 bit words, so that a
+// pickle can be loaded on a machine of any byte order.
+static inline void
+pack_native( const NativeKey& native, unsigned char* out )
+{
+    uint64_t word;
+    memcpy( &word, &native, sizeof( word ) );
+    for( size_t i = 0; i < sizeof( word ); ++i, word >>= 8 )
+        out[ i ] = static_cast<unsigned char>( word & 0xff );
+}
+
+
+static inline NativeKey
+unpack_native( const unsigned char* in )
+{
+    uint64_t word = 0;
+    for( size_t i = sizeof( word ); i-- > 0; )
+        word = ( word << 8 ) | in[ i ];
+    NativeKey native;
+    memcpy( &native, &word, sizeof( word ) );
+    return native;
+}
+
+
+// The keys of a map without key function whose keys are all ints or floats
+// are pickled as a bytes object holding the packed native keys, and the
+// format code tells how to read them back. Ints are only packed on Python 3
+// where int and long are a single type.
+static const char*
+packed_format( SortedMap* self )
+{
+    if( self->m_keyfunc )
+        return 0;
+    switch( self->m_items->kind() )
+    {
+#if PY_MAJOR_VERSION >= 3
+        case IntKeys:
+            return "q";
+#endif
+        case FloatKeys:
+            return "d";
+        default:
+            return 0;
+    }
+}
+
+
+// The module level _rebuild function, looked up when the module is created.
+static PyObject* rebuild_func;
+
+
+static PyObject*
+SortedMap_reduce_ex( SortedMap* self, PyObject* proto )
+{
+    long protocol = PyLong_AsLong( proto );
+    if( protocol == -1 && PyErr_Occurred() )
+        return 0;
+    SortedItems* items = self->m_items;
+    Py_ssize_t size = static_cast<Py_ssize_t>( items->size() );
+    const char* format = packed_format( self );
+    PyObjectPtr keys( format ?
+        PyBytes_FromStringAndSize( 0, size * sizeof( NativeKey ) ) : PyTuple_New( size ) );
+    if( !keys )
+        return 0;
+    PyTuplePtr values( PyTuple_New( size ) );
+    if( !values )
+        return 0;
+    Py_ssize_t index = 0;
+    for( size_t i = 0; i < items->chunk_count(); ++i )
+    {
+        const SortedItems::Chunk& chunk = items->chunk( i );
+        for( size_t j = 0; j < chunk.size(); ++j, ++index )
+        {
+            if( format )
+            {
+                unsigned char* data = reinterpret_cast<unsigned char*>(
+                    PyBytes_AS_STRING( keys.get() ) );
+                pack_native( chunk.natives[ j ], data + index * sizeof( NativeKey ) );
+            }
+            else
+                PyTuple_SET_ITEM( keys.get(), index, newref( chunk.keys[ j ] ) );
+            values.set_item( index, newref( chunk.values[ j ] ) );
+        }
+    }
+#if PY_VERSION_HEX >= 0x03080000
+    // Protocol 5 lets the pickler hand the packed keys out of band.
+    if( format && protocol >= 5 )
+    {
+        keys = PyPickleBuffer_FromObject( keys.get() );
+        if( !keys )
+            return 0;
+    }
+#endif
+    PyObjectPtr args( Py_BuildValue(
+        "(OOnOz)",
+        keys.get(),
+        values.get(),
+        static_cast<Py_ssize_t>( items->chunksize() ),
+        self->m_keyfunc ? self->m_keyfunc : Py_None,
+        format ) );
+    if( !args )
+        return 0;
+    return PyTuple_Pack( 2, rebuild_func, args.get() );
+}
+
+
+// Rebuild a map from the sorted keys and values produced by __reduce_ex__.
+// The order of the keys is trusted, and only checked in a single pass
+// before the items are assigned to the storage as they are.
+static PyObject*
+sortedmap_rebuild( PyObject* mod, PyObject* args )
+{
+    PyObject* keys;
+    PyObject* values;
+    Py_ssize_t chunksize;
+    PyObject* keyfunc;
+    const char* format;
+    if( !PyArg_ParseTuple( args, "OO!nOz:_rebuild", &keys, &PyTuple_Type, &values,
+                           &chunksize, &keyfunc, &format ) )
+        return 0;
+    if( chunksize < 0 )
+        return py_value_fail( "chunksize must be non-negative" );
+    if( keyfunc != Py_None && !PyCallable_Check( keyfunc ) )
+        return py_expected_type_fail( keyfunc, "callable or None" );
+    Py_ssize_t size = PyTuple_GET_SIZE( values );
+
+    SortedMap::Items items;
+    items.reserve( size );
+    if( format )
+    {
+        KeyKind kind = strcmp( format, "q" ) == 0 ? IntKeys :
+            ( strcmp( format, "d" ) == 0 ? FloatKeys : NoKeys );
+        if( kind == NoKeys )
+            return py_value_fail( "unknown sortedmap key format" );
+        Py_buffer view;
+        if( PyObject_GetBuffer( keys, &view, PyBUF_SIMPLE ) < 0 )
+            return 0;
+        if( view.len != size * static_cast<Py_ssize_t>( sizeof( NativeKey ) ) )
+        {
+            PyBuffer_Release( &view );
+            return py_value_fail( "sortedmap keys and values differ in length" );
+        }
+        const unsigned char* data = reinterpret_cast<const unsigned char*>( view.buf );
+        for( Py_ssize_t i = 0; i < size; ++i )
+        {
+            NativeKey native = unpack_native( data + i * sizeof( NativeKey ) );
+            PyObjectPtr key( kind == IntKeys ?
+                PyLong_FromLongLong( native.i ) : PyFloat_FromDouble( native.d ) );
+            if( !key )
+            {
+                PyBuffer_Release( &view );
+                return 0;
+            }
+            items.push_back( MapItem( key, PyTuple_GET_ITEM( values, i ) ) );
+        }
+        PyBuffer_Release( &view );
+    }
+    else
+    {
+        if( !PyTuple_Check( keys ) )
+            return py_expected_type_fail( keys, "tuple" );
+        if( PyTuple_GET_SIZE( keys ) != size )
+            return py_value_fail( "sortedmap keys and values differ in length" );
+        for( Py_ssize_t i = 0; i < size; ++i )
+            items.push_back( MapItem(
+                PyTuple_GET_ITEM( keys, i ), PyTuple_GET_ITEM( values, i ) ) );
+    }
+
+    PyObjectPtr self( PyType_GenericNew( &SortedMap_Type, 0, 0 ) );
+    if( !self )
+        return 0;
+    SortedMap* cself = reinterpret_cast<SortedMap*>( self.get() );
+    cself->m_items = new SortedItems( static_cast<size_t>( chunksize ) );
+    if( keyfunc != Py_None )
+    {
+        cself->m_keyfunc = newref( keyfunc );
+        if( !cself->sort_keys( items ) )
+            return 0;
+    }
+    SortedItems::sort( items );
+    cself->m_items->assign( items );
+    return self.release();
+}
+
+
+static PyObject*
+SortedMap_get_key( SortedMap* self, void* context )
+{
+    return newref( self->m_keyfunc ? self->m_keyfunc : Py_None );
+}
+
+
+static PyGetSetDef
+SortedMap_getset[] = {
+    { "key", ( getter )SortedMap_get_key, 0,
+      "Get the key function ordering the map, or None." },
+    { 0 } // sentinel
+};
+
+
 static PyMethodDef
 SortedMap_methods[] = {
     { "get", ( PyCFunction )SortedMap_get, METH_VARARGS,
@@ -566,12 +1336,32 @@ SortedMap_methods[] = {
       "" },
     { "clear", ( PyCFunction)SortedMap_clearmethod, METH_NOARGS,
       "" },
+    { "update", ( PyCFunction )SortedMap_update, METH_VARARGS | METH_KEYWORDS,
+      "update([map], **kwargs) -> update the map from a mapping or an iterable of pairs" },
+    { "merge", ( PyCFunction )SortedMap_merge, METH_VARARGS,
+      "merge(other, policy='replace') -> merge a map in a single pass, resolving the "
+      "keys present in both according to policy" },
+    { "irange", ( PyCFunction )SortedMap_irange, METH_VARARGS | METH_KEYWORDS,
+      "irange(minimum=None, maximum=None, inclusive=(True, True), reverse=False) -> "
+      "iterate over the keys between minimum and maximum" },
+    { "bisect_left", ( PyCFunction )SortedMap_bisect_left, METH_O,
+      "bisect_left(key) -> position of the first key not less than key" },
+    { "bisect_right", ( PyCFunction )SortedMap_bisect_right, METH_O,
+      "bisect_right(key) -> position of the first key greater than key" },
+    { "index", ( PyCFunction )SortedMap_index, METH_O,
+      "index(key) -> position of key, raise ValueError if it is not present" },
+    { "peekitem", ( PyCFunction )SortedMap_peekitem, METH_VARARGS,
+      "peekitem(index=-1) -> the (key, value) pair at a position" },
+    { "popitem", ( PyCFunction )SortedMap_popitem, METH_VARARGS,
+      "popitem(index=-1) -> remove and return the (key, value) pair at a position" },
     { "keys", ( PyCFunction )SortedMap_keys, METH_NOARGS,
       "" },
     { "values", ( PyCFunction )SortedMap_values, METH_NOARGS,
       "" },
     { "items", ( PyCFunction )SortedMap_items, METH_NOARGS,
       "" },
+    { "__reversed__", ( PyCFunction )SortedMap_reversed, METH_NOARGS,
+      "__reversed__() -> iterate over the keys in reverse order" },
     { "copy", ( PyCFunction )SortedMap_copy, METH_NOARGS,
       "" },
     { "__contains__", ( PyCFunction )SortedMap_contains_bool, METH_O | METH_COEXIST,
@@ -580,13 +1370,19 @@ SortedMap_methods[] = {
       "" },
     { "__sizeof__", ( PyCFunction )SortedMap_sizeof, METH_NOARGS,
       "__sizeof__() -> size of object in memory, in bytes" },
+    { "reserve", ( PyCFunction )SortedMap_reserve, METH_O,
+      "reserve(count) -> preallocate the storage for count items" },
+    { "shrink_to_fit", ( PyCFunction )SortedMap_shrink_to_fit, METH_NOARGS,
+      "shrink_to_fit() -> release the unused capacity of the storage" },
+    { "__reduce_ex__", ( PyCFunction )SortedMap_reduce_ex, METH_O,
+      "" },
     { 0 } // sentinel
 };
 
 
 PyTypeObject SortedMap_Type = {
     PyVarObject_HEAD_INIT( NULL, 0 )
-    "sortedmap.sortedmap",                  /* tp_name */
+    "atom.datastructures.sortedmap.sortedmap", /* tp_name */
     sizeof( SortedMap ),                    /* tp_basicsize */
     0,                                      /* tp_itemsize */
     (destructor)SortedMap_dealloc,          /* tp_dealloc */
@@ -601,7 +1397,7 @@ PyTypeObject SortedMap_Type = {
 	( cmpfunc )0,                           /* tp_compare */
 #endif
     (reprfunc)SortedMap_repr,               /* tp_repr */
-    (PyNumberMethods*)0,                    /* tp_as_number */
+    (PyNumberMethods*)&SortedMap_as_number, /* tp_as_number */
     (PySequenceMethods*)&SortedMap_as_sequence, /* tp_as_sequence */
     (PyMappingMethods*)&SortedMap_as_mapping,   /* tp_as_mapping */
     (hashfunc)0,                            /* tp_hash */
@@ -610,7 +1406,11 @@ PyTypeObject SortedMap_Type = {
     (getattrofunc)0,                        /* tp_getattro */
     (setattrofunc)0,                        /* tp_setattro */
     (PyBufferProcs*)0,                      /* tp_as_buffer */
+#if PY_MAJOR_VERSION < 3
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_CHECKTYPES, /* tp_flags */
+#else
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /* tp_flags */
+#endif
     0,                                      /* Documentation string */
     (traverseproc)SortedMap_traverse,       /* tp_traverse */
     (inquiry)SortedMap_clear,               /* tp_clear */
@@ -620,7 +1420,7 @@ PyTypeObject SortedMap_Type = {
     (iternextfunc)0,                        /* tp_iternext */
     (struct PyMethodDef*)SortedMap_methods, /* tp_methods */
     (struct PyMemberDef*)0,                 /* tp_members */
-    0,                                      /* tp_getset */
+    SortedMap_getset,                       /* tp_getset */
     0,                                      /* tp_base */
     0,                                      /* tp_dict */
     (descrgetfunc)0,                        /* tp_descr_get */
@@ -642,6 +1442,8 @@ PyTypeObject SortedMap_Type = {
 
 static PyMethodDef
 sortedmap_methods[] = {
+    { "_rebuild", ( PyCFunction )sortedmap_rebuild, METH_VARARGS,
+      "_rebuild(keys, values, chunksize, key, format) -> rebuild a pickled map" },
     { 0 } // Sentinel
 };
 
@@ -672,6 +1474,13 @@ MOD_INIT( sortedmap )
         INITERROR;
     if( PyType_Ready( &SortedMap_Type ) )
         INITERROR;
+    if( PyType_Ready( &SortedMapView_Type ) )
+        INITERROR;
+    if( PyType_Ready( &SortedMapIter_Type ) )
+        INITERROR;
+    rebuild_func = PyObject_GetAttrString( mod, "_rebuild" );
+    if( !rebuild_func )
+        INITERROR;
     Py_INCREF( ( PyObject* )( &SortedMap_Type ) );
     PyModule_AddObject( mod, "sortedmap", ( PyObject* )( &SortedMap_Type ) );
 
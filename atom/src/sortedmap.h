@@ -0,0 +1,1760 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "pythonhelpers.h"
+#include "py23compat.h"
+#include "inttypes.h"
+
+
+// The storage of the sortedmap is shared with the atomsortedmap of the
+// catom extension, which derives from the sortedmap type at import time.
+using PythonHelpers::PyObjectPtr;
+using PythonHelpers::newref;
+using PythonHelpers::py_value_fail;
+
+
+class MapItem
+{
+
+public:
+
+    MapItem() {}
+
+    MapItem( PyObject* key, PyObject* value ) :
+        m_key( newref( key ) ), m_value( newref( value ) ) { }
+
+    MapItem( PyObjectPtr& key, PyObjectPtr& value ) :
+        m_key( key ), m_value( value ) { }
+
+    MapItem( PyObjectPtr& key, PyObject* value ) :
+        m_key( key ), m_value( newref( value ) ) { }
+
+    MapItem( PyObject* key, PyObjectPtr& value ) :
+        m_key( newref( key ) ), m_value( value ) { }
+
+    ~MapItem() { }
+
+    PyObject* key() const
+    {
+        return m_key.get();
+    }
+
+    PyObject* value() const
+    {
+        return m_value.get();
+    }
+
+    // The key by which the item is ordered: the result of the key function
+    // of the map when it has one, computed once on insertion, and the key
+    // itself otherwise.
+    PyObject* sortkey() const
+    {
+        return ordering().get();
+    }
+
+    void set_sortkey( PyObject* sortkey )
+    {
+        m_sortkey = sortkey;
+    }
+
+    bool has_sortkey() const
+    {
+        return m_sortkey;
+    }
+
+    void update( PyObject* value )
+    {
+        m_value = newref( value );
+    }
+
+    // Exchanging the references avoids the incref/decref pairs of a copy,
+    // and never runs a destructor while the map is being rearranged.
+    void swap( MapItem& other )
+    {
+        swap_value( other );
+        PyObject* key = m_key.release();
+        m_key = other.m_key.release();
+        other.m_key = key;
+        PyObject* sortkey = m_sortkey.release();
+        m_sortkey = other.m_sortkey.release();
+        other.m_sortkey = sortkey;
+    }
+
+    void swap_value( MapItem& other )
+    {
+        PyObject* value = m_value.release();
+        m_value = other.m_value.release();
+        other.m_value = value;
+    }
+
+    // Exchange the value with a reference held by the storage of a map.
+    void swap_value( PyObject*& value )
+    {
+        PyObject* old = m_value.release();
+        m_value = value;
+        value = old;
+    }
+
+    // Hand the references over to the storage of a map, which keeps the
+    // keys, values and sort keys of its items in separate arrays.
+    PyObject* release_key()
+    {
+        return m_key.release();
+    }
+
+    PyObject* release_value()
+    {
+        return m_value.release();
+    }
+
+    // The sort key must be released before the key, which stands for it
+    // when the item has no sort key.
+    PyObject* release_sortkey()
+    {
+        return m_sortkey ? m_sortkey.release() : newref( m_key.get() );
+    }
+
+    // Take over references released by the storage of a map.
+    void adopt( PyObject* key, PyObject* value, PyObject* sortkey )
+    {
+        m_key = key;
+        m_value = value;
+        m_sortkey = sortkey;
+    }
+
+    struct CmpLess
+    {
+        // All three operators are needed in order to keep the
+        // MSVC debug version of std::lower_bound happy.
+        bool operator()( const MapItem& first, const MapItem& second )
+        {
+            if( first.ordering() == second.ordering() )
+                return false;
+            return first.ordering().richcompare( second.ordering(), Py_LT );
+        }
+
+        bool operator()( const MapItem& first, PyObject* second )
+        {
+            if( first.ordering() == second )
+                return false;
+            return first.ordering().richcompare( second, Py_LT );
+        }
+
+        bool operator()( PyObject* first, const MapItem& second )
+        {
+            if( first == second.ordering() )
+                return false;
+            PyObjectPtr temp( newref( first ) );
+            return temp.richcompare( second.ordering(), Py_LT );
+        }
+
+        bool operator()( PyObject* first, PyObject* second )
+        {
+            if( first == second )
+                return false;
+            PyObjectPtr temp( newref( first ) );
+            return temp.richcompare( second, Py_LT );
+        }
+    };
+
+    struct CmpEq
+    {
+        bool operator()( const MapItem& first, const MapItem& second )
+        {
+            if( first.ordering() == second.ordering() )
+                return true;
+            return first.ordering().richcompare( second.ordering(), Py_EQ );
+        }
+
+        bool operator()( const MapItem& first, PyObject* second )
+        {
+            if( first.ordering() == second )
+                return true;
+            return first.ordering().richcompare( second, Py_EQ );
+        }
+
+        bool operator()( PyObject* first, const MapItem& second )
+        {
+            if( first == second.ordering() )
+                return true;
+            PyObjectPtr temp( newref( first ) );
+            return temp.richcompare( second.ordering(), Py_EQ );
+        }
+
+        bool operator()( PyObject* first, PyObject* second )
+        {
+            if( first == second )
+                return true;
+            PyObjectPtr temp( newref( first ) );
+            return temp.richcompare( second, Py_EQ );
+        }
+    };
+
+private:
+
+    const PyObjectPtr& ordering() const
+    {
+        return m_sortkey ? m_sortkey : m_key;
+    }
+
+    PyObjectPtr m_key;
+    PyObjectPtr m_value;
+    PyObjectPtr m_sortkey;
+};
+
+
+// When all the keys of a map are exact ints fitting in 64 bits, floats
+// (other than nan) or exact strs, the keys are compared natively instead of
+// going through PyObject_RichCompareBool. Ints and floats are additionally
+// kept unboxed in arrays parallel to the items. A key of any other kind
+// turns the map back to the general comparison until it is emptied.
+enum KeyKind
+{
+    NoKeys,
+    IntKeys,
+    FloatKeys,
+    StrKeys,
+    ObjectKeys
+};
+
+
+union NativeKey
+{
+    int64_t i;
+    double d;
+};
+
+
+inline KeyKind
+key_kind( PyObject* key, NativeKey& native )
+{
+#if PY_MAJOR_VERSION < 3
+    if( PyInt_CheckExact( key ) )
+    {
+        native.i = PyInt_AS_LONG( key );
+        return IntKeys;
+    }
+#endif
+    if( PyLong_CheckExact( key ) )
+    {
+        int overflow;
+        PY_LONG_LONG value = PyLong_AsLongLongAndOverflow( key, &overflow );
+        if( overflow )
+            return ObjectKeys;
+        native.i = static_cast<int64_t>( value );
+        return IntKeys;
+    }
+    if( PyFloat_CheckExact( key ) )
+    {
+        native.d = PyFloat_AS_DOUBLE( key );
+        return native.d == native.d ? FloatKeys : ObjectKeys;
+    }
+    if( Py23Str_CheckExact( key ) )
+        return StrKeys;
+    return ObjectKeys;
+}
+
+
+struct IntKey
+{
+    typedef int64_t type;
+
+    static int64_t get( const NativeKey& key )
+    {
+        return key.i;
+    }
+};
+
+
+struct FloatKey
+{
+    typedef double type;
+
+    static double get( const NativeKey& key )
+    {
+        return key.d;
+    }
+};
+
+
+// Locate the first native key not less than the given one in [lo, hi).
+// The loop is free of unpredictable branches, the compiler turns the
+// selection into a conditional move.
+template<typename Get> inline size_t
+native_lower_bound( const NativeKey* keys, size_t lo, size_t hi, typename Get::type key )
+{
+    size_t len = hi - lo;
+    if( !len )
+        return lo;
+    const NativeKey* base = keys + lo;
+    while( len > 1 )
+    {
+        size_t half = len / 2;
+        base = Get::get( base[ half ] ) < key ? base + half : base;
+        len -= half;
+    }
+    return ( base - keys ) + ( Get::get( *base ) < key ? 1 : 0 );
+}
+
+
+static inline int
+str_compare( PyObject* first, PyObject* second )
+{
+#if PY_MAJOR_VERSION >= 3
+    return PyUnicode_Compare( first, second );
+#else
+    Py_ssize_t len1 = PyString_GET_SIZE( first );
+    Py_ssize_t len2 = PyString_GET_SIZE( second );
+    int res = memcmp( PyString_AS_STRING( first ), PyString_AS_STRING( second ),
+                      static_cast<size_t>( std::min( len1, len2 ) ) );
+    if( res )
+        return res;
+    return len1 < len2 ? -1 : ( len1 > len2 ? 1 : 0 );
+#endif
+}
+
+
+struct StrLess
+{
+    bool operator()( const MapItem& first, const MapItem& second )
+    {
+        return operator()( first.sortkey(), second.sortkey() );
+    }
+
+    bool operator()( const MapItem& first, PyObject* second )
+    {
+        return operator()( first.sortkey(), second );
+    }
+
+    bool operator()( PyObject* first, const MapItem& second )
+    {
+        return operator()( first, second.sortkey() );
+    }
+
+    bool operator()( PyObject* first, PyObject* second )
+    {
+        return first != second && str_compare( first, second ) < 0;
+    }
+};
+
+
+struct StrEq
+{
+    bool operator()( const MapItem& first, const MapItem& second )
+    {
+        return first.sortkey() == second.sortkey() ||
+            str_compare( first.sortkey(), second.sortkey() ) == 0;
+    }
+};
+
+
+// How a union resolves the value of a key present on both sides.
+struct Conflict
+{
+    enum Policy
+    {
+        Replace,
+        Keep,
+        Error,
+        Call
+    };
+
+    // A check applied to the values returned by a callable policy, used
+    // by the atomsortedmap to validate them. It returns a new reference.
+    struct Check
+    {
+        virtual ~Check() {}
+        virtual PyObject* operator()( PyObject* value ) = 0;
+    };
+
+    Policy policy;
+    PyObject* callable;
+    Check* check;
+
+    // Parse the policy argument given to merge.
+    bool parse( PyObject* pypolicy )
+    {
+        if( PyCallable_Check( pypolicy ) )
+        {
+            policy = Call;
+            callable = pypolicy;
+            return true;
+        }
+        if( Py23Str_Check( pypolicy ) )
+        {
+            const char* name = Py23Str_AS_STRING( pypolicy );
+            if( !name )
+                return false;
+            if( strcmp( name, "replace" ) == 0 )
+                policy = Replace;
+            else if( strcmp( name, "keep" ) == 0 )
+                policy = Keep;
+            else if( strcmp( name, "error" ) == 0 )
+                policy = Error;
+            else
+                name = 0;
+            if( name )
+                return true;
+        }
+        py_value_fail( "merge policy must be 'replace', 'keep', 'error' or a callable" );
+        return false;
+    }
+
+    // Store the resolved value in the left item.
+    bool resolve( MapItem& left, MapItem& right )
+    {
+        switch( policy )
+        {
+            case Replace:
+                left.swap_value( right );
+                return true;
+            case Keep:
+                return true;
+            case Error:
+            {
+                PyObjectPtr pytuple( PyTuple_Pack( 1, left.key() ) );
+                if( pytuple )
+                    PyErr_SetObject( PyExc_KeyError, pytuple.get() );
+                return false;
+            }
+            default:
+            {
+                PyObjectPtr value( PyObject_CallFunctionObjArgs(
+                    callable, left.key(), left.value(), right.value(), NULL ) );
+                if( !value )
+                    return false;
+                if( check )
+                {
+                    value = ( *check )( value.get() );
+                    if( !value )
+                        return false;
+                }
+                left.update( value.get() );
+                return true;
+            }
+        }
+    }
+};
+
+
+// The items of a sortedmap are kept sorted in a list of chunks. The chunks
+// hold at most `chunksize` items and are split in halves when they overflow,
+// so that an insertion or a deletion only shifts the items of one chunk. A
+// map which fits in a single chunk (or whose chunksize is 0) is a plain
+// sorted array. The last key of each chunk is mirrored in a contiguous array
+// which is bisected first to locate the chunk holding a key.
+class SortedItems
+{
+
+public:
+
+    typedef std::vector<MapItem> Items;
+
+    static const size_t default_chunksize = 512;
+
+    // The arrays of a chunk whose capacity exceeds this many items are
+    // shrunk once they are less than a quarter full.
+    static const size_t shrink_threshold = 64;
+
+    struct Cursor
+    {
+        size_t chunk;
+        size_t index;
+    };
+
+    // The keys and values of a chunk are stored in separate arrays, so that
+    // a binary search only walks the keys. The sort keys are only stored
+    // when the map has a key function, and the unboxed keys only for int
+    // and float keys. The arrays own a reference to their objects.
+    struct Chunk
+    {
+        Chunk() {}
+
+        Chunk( const Chunk& other ) :
+            keys( other.keys ), values( other.values ),
+            sortkeys( other.sortkeys ), natives( other.natives )
+        {
+            for( size_t i = 0; i < keys.size(); ++i )
+            {
+                Py_INCREF( keys[ i ] );
+                Py_INCREF( values[ i ] );
+            }
+            for( size_t i = 0; i < sortkeys.size(); ++i )
+                Py_INCREF( sortkeys[ i ] );
+        }
+
+        ~Chunk()
+        {
+            for( size_t i = 0; i < keys.size(); ++i )
+            {
+                Py_DECREF( keys[ i ] );
+                Py_DECREF( values[ i ] );
+            }
+            for( size_t i = 0; i < sortkeys.size(); ++i )
+                Py_DECREF( sortkeys[ i ] );
+        }
+
+        size_t size() const
+        {
+            return keys.size();
+        }
+
+        // The keys by which the items are ordered.
+        const std::vector<PyObject*>& ordering() const
+        {
+            return sortkeys.empty() ? keys : sortkeys;
+        }
+
+        PyObject* sortkey( size_t index ) const
+        {
+            return ordering()[ index ];
+        }
+
+        // Take over the references of an item, leaving it empty.
+        void insert( size_t index, MapItem& item, bool keyed )
+        {
+            if( keyed )
+                sortkeys.insert( sortkeys.begin() + index, item.release_sortkey() );
+            keys.insert( keys.begin() + index, item.release_key() );
+            values.insert( values.begin() + index, item.release_value() );
+        }
+
+        // Hand the references of an item over to an empty item, without
+        // removing it from the arrays.
+        void take( size_t index, MapItem& item )
+        {
+            item.adopt( keys[ index ], values[ index ],
+                        sortkeys.empty() ? 0 : sortkeys[ index ] );
+        }
+
+        // Drop the items in [first, last) from the arrays, once their
+        // references were handed over.
+        void remove( size_t first, size_t last )
+        {
+            keys.erase( keys.begin() + first, keys.begin() + last );
+            values.erase( values.begin() + first, values.begin() + last );
+            if( !sortkeys.empty() )
+                sortkeys.erase( sortkeys.begin() + first, sortkeys.begin() + last );
+            if( !natives.empty() )
+                natives.erase( natives.begin() + first, natives.begin() + last );
+        }
+
+        // Append the items in [first, last) to another chunk, along with
+        // their references.
+        void move_to( Chunk& other, size_t first, size_t last )
+        {
+            other.keys.insert( other.keys.end(), keys.begin() + first, keys.begin() + last );
+            other.values.insert(
+                other.values.end(), values.begin() + first, values.begin() + last );
+            if( !sortkeys.empty() )
+                other.sortkeys.insert(
+                    other.sortkeys.end(), sortkeys.begin() + first, sortkeys.begin() + last );
+            if( !natives.empty() )
+                other.natives.insert(
+                    other.natives.end(), natives.begin() + first, natives.begin() + last );
+        }
+
+        // Drop the items following the first `count` ones, once their
+        // references were handed over.
+        void truncate( size_t count )
+        {
+            remove( count, size() );
+        }
+
+        void reserve( size_t count )
+        {
+            keys.reserve( count );
+            values.reserve( count );
+            if( !sortkeys.empty() )
+                sortkeys.reserve( count );
+            if( !natives.empty() )
+                natives.reserve( count );
+        }
+
+        size_t capacity() const
+        {
+            return keys.capacity();
+        }
+
+        void shrink()
+        {
+            shrink_vector( keys );
+            shrink_vector( values );
+            shrink_vector( sortkeys );
+            shrink_vector( natives );
+        }
+
+        size_t allocated() const
+        {
+            return sizeof( Chunk ) +
+                ( keys.capacity() + values.capacity() + sortkeys.capacity() ) *
+                sizeof( PyObject* ) + natives.capacity() * sizeof( NativeKey );
+        }
+
+        std::vector<PyObject*> keys;
+        std::vector<PyObject*> values;
+        std::vector<PyObject*> sortkeys;
+        std::vector<NativeKey> natives;
+
+    private:
+
+        Chunk& operator=( const Chunk& );
+    };
+
+    SortedItems( size_t chunksize = default_chunksize ) :
+        m_fresh( 0 ), m_size( 0 ), m_chunksize( chunksize ), m_version( 0 ),
+        m_reserved( 0 ), m_kind( NoKeys ), m_keyed( false ) {}
+
+    SortedItems( const SortedItems& other ) :
+        m_native_maxes( other.m_native_maxes ), m_fresh( 0 ),
+        m_size( other.m_size ), m_chunksize( other.m_chunksize ),
+        m_version( 0 ), m_reserved( 0 ), m_kind( other.m_kind ),
+        m_keyed( other.m_keyed )
+    {
+        m_chunks.reserve( other.m_chunks.size() );
+        for( size_t i = 0; i < other.m_chunks.size(); ++i )
+            m_chunks.push_back( new Chunk( *other.m_chunks[ i ] ) );
+        refresh_maxes();
+    }
+
+    ~SortedItems()
+    {
+        for( size_t i = 0; i < m_chunks.size(); ++i )
+            delete m_chunks[ i ];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    size_t chunksize() const
+    {
+        return m_chunksize;
+    }
+
+    // The version changes whenever items are added or removed, which lets
+    // the iterators detect that their cursor became invalid.
+    size_t version() const
+    {
+        return m_version;
+    }
+
+    size_t chunk_count() const
+    {
+        return m_chunks.size();
+    }
+
+    const Chunk& chunk( size_t index ) const
+    {
+        return *m_chunks[ index ];
+    }
+
+    PyObject* key( const Cursor& cursor ) const
+    {
+        return m_chunks[ cursor.chunk ]->keys[ cursor.index ];
+    }
+
+    PyObject* value( const Cursor& cursor ) const
+    {
+        return m_chunks[ cursor.chunk ]->values[ cursor.index ];
+    }
+
+    // Replace the value at the cursor. The old value is released once the
+    // new one is in place.
+    void set_value( const Cursor& cursor, PyObject* value )
+    {
+        PyObject*& slot = m_chunks[ cursor.chunk ]->values[ cursor.index ];
+        PyObject* old = slot;
+        slot = newref( value );
+        Py_DECREF( old );
+    }
+
+    KeyKind kind() const
+    {
+        return m_kind;
+    }
+
+    // The memory held by the storage itself, excluding the referenced keys
+    // and values.
+    size_t allocated() const
+    {
+        size_t size = sizeof( SortedItems );
+        size += m_chunks.capacity() * sizeof( Chunk* );
+        size += m_maxes.capacity() * sizeof( PyObject* );
+        size += m_native_maxes.capacity() * sizeof( NativeKey );
+        size += m_offsets.capacity() * sizeof( size_t );
+        for( size_t i = 0; i < m_chunks.size(); ++i )
+            size += m_chunks[ i ]->allocated();
+        return size;
+    }
+
+    void swap( SortedItems& other )
+    {
+        m_chunks.swap( other.m_chunks );
+        m_maxes.swap( other.m_maxes );
+        m_native_maxes.swap( other.m_native_maxes );
+        m_offsets.swap( other.m_offsets );
+        std::swap( m_fresh, other.m_fresh );
+        std::swap( m_size, other.m_size );
+        std::swap( m_chunksize, other.m_chunksize );
+        std::swap( m_reserved, other.m_reserved );
+        std::swap( m_kind, other.m_kind );
+        std::swap( m_keyed, other.m_keyed );
+        ++m_version;
+        ++other.m_version;
+    }
+
+    // Preallocate the storage for the map to grow to `count` items without
+    // reallocating. The chunks of a map larger than the chunksize are
+    // created on demand, only their index is preallocated. The reserved
+    // capacity is kept by the automatic shrinking.
+    void reserve( size_t count )
+    {
+        size_t chunks = 1;
+        if( m_chunksize && count > m_chunksize )
+            chunks = count / std::max<size_t>( m_chunksize / 2, 1 ) + 1;
+        m_chunks.reserve( chunks );
+        m_maxes.reserve( chunks );
+        m_native_maxes.reserve( chunks );
+        m_offsets.reserve( chunks );
+        m_reserved = m_chunksize ? std::min( count, m_chunksize + 1 ) : count;
+        if( m_chunks.size() == 1 )
+            m_chunks[ 0 ]->reserve( m_reserved );
+    }
+
+    // Release the unused capacity of the storage, including a reservation.
+    void shrink_to_fit()
+    {
+        m_reserved = 0;
+        for( size_t i = 0; i < m_chunks.size(); ++i )
+            m_chunks[ i ]->shrink();
+        shrink_index();
+    }
+
+    // Locate the first item whose key is not less than the given key. The
+    // cursor may point one past the end of the last chunk.
+    Cursor lower_bound( PyObject* key )
+    {
+        return lower_bound( Probe( key ) );
+    }
+
+    // The position of an item is its rank in the whole map. Positions are
+    // mapped to cursors through the number of items preceding each chunk,
+    // which is recomputed lazily from the first chunk modified since it was
+    // last needed.
+    Cursor at( size_t position )
+    {
+        update_offsets( m_chunks.size() );
+        size_t chunk = std::upper_bound(
+            m_offsets.begin(), m_offsets.end(), position
+        ) - m_offsets.begin() - 1;
+        Cursor cursor = { chunk, position - m_offsets[ chunk ] };
+        return cursor;
+    }
+
+    size_t position( const Cursor& cursor )
+    {
+        if( m_chunks.empty() )
+            return 0;
+        update_offsets( cursor.chunk + 1 );
+        return m_offsets[ cursor.chunk ] + cursor.index;
+    }
+
+    // Advance a cursor to the next item, possibly in the next chunk.
+    void next( Cursor& cursor )
+    {
+        if( ++cursor.index >= m_chunks[ cursor.chunk ]->size() &&
+            cursor.chunk + 1 < m_chunks.size() )
+        {
+            ++cursor.chunk;
+            cursor.index = 0;
+        }
+    }
+
+    // Move a cursor back to the previous item, which must exist.
+    void prev( Cursor& cursor )
+    {
+        if( cursor.index == 0 )
+            cursor.index = m_chunks[ --cursor.chunk ]->size();
+        --cursor.index;
+    }
+
+    bool find( PyObject* key, Cursor& cursor )
+    {
+        Probe probe( key );
+        cursor = lower_bound( probe );
+        if( m_chunks.empty() )
+            return false;
+        Chunk& chunk = *m_chunks[ cursor.chunk ];
+        return cursor.index < chunk.size() &&
+            equal( chunk, cursor.index, probe );
+    }
+
+    // Insert an item at the cursor by taking over the references of the
+    // given item, which is left empty.
+    void insert( const Cursor& cursor, MapItem& item )
+    {
+        NativeKey native;
+        KeyKind kind = key_kind( item.sortkey(), native );
+        if( m_chunks.empty() )
+        {
+            m_chunks.push_back( new Chunk() );
+            m_maxes.push_back( 0 );
+            m_native_maxes.push_back( native );
+            m_kind = kind;
+            m_keyed = item.has_sortkey();
+        }
+        else if( kind != m_kind )
+            demote();
+        Chunk& chunk = *m_chunks[ cursor.chunk ];
+        chunk.insert( cursor.index, item, m_keyed );
+        if( has_natives() )
+            chunk.natives.insert( chunk.natives.begin() + cursor.index, native );
+        if( chunk.capacity() < m_reserved )
+            chunk.reserve( m_reserved );
+        ++m_size;
+        ++m_version;
+        touch( cursor.chunk );
+        if( !split( cursor.chunk ) )
+            set_max( cursor.chunk );
+    }
+
+    // Remove the item at the cursor, handing it over to the given item so
+    // that the caller releases it once the storage is consistent again.
+    void erase( const Cursor& cursor, MapItem& item )
+    {
+        Chunk& chunk = *m_chunks[ cursor.chunk ];
+        chunk.take( cursor.index, item );
+        chunk.remove( cursor.index, cursor.index + 1 );
+        --m_size;
+        ++m_version;
+        touch( cursor.chunk );
+        if( chunk.size() == 0 )
+        {
+            delete m_chunks[ cursor.chunk ];
+            m_chunks.erase( m_chunks.begin() + cursor.chunk );
+            m_maxes.erase( m_maxes.begin() + cursor.chunk );
+            m_native_maxes.erase( m_native_maxes.begin() + cursor.chunk );
+            if( m_chunks.empty() )
+                m_kind = NoKeys;
+            return;
+        }
+        set_max( cursor.chunk );
+        if( m_chunks.size() > 1 && chunk.size() < m_chunksize / 4 )
+            join( cursor.chunk );
+        else
+            compact( chunk );
+    }
+
+    // Replace the content by a batch of items sorted and free of duplicates.
+    // The references of the items are taken over.
+    void assign( Items& batch )
+    {
+        SortedItems empty( m_chunksize );
+        std::swap( empty.m_reserved, m_reserved );
+        swap( empty );
+        if( batch.empty() )
+            return;
+        Chunk* chunk = new Chunk();
+        m_kind = batch_kind( batch, chunk->natives );
+        m_keyed = batch[ 0 ].has_sortkey();
+        chunk->keys.reserve( std::max( batch.size(), m_reserved ) );
+        chunk->values.reserve( chunk->keys.capacity() );
+        if( m_keyed )
+            chunk->sortkeys.reserve( chunk->keys.capacity() );
+        for( size_t i = 0; i < batch.size(); ++i )
+            chunk->insert( i, batch[ i ], m_keyed );
+        batch.clear();
+        m_chunks.push_back( chunk );
+        m_maxes.push_back( 0 );
+        m_native_maxes.push_back( NativeKey() );
+        m_size = chunk->size();
+        if( !split( 0 ) )
+            set_max( 0 );
+    }
+
+    // Merge a batch of items, sorted and free of duplicates. The batch is
+    // dispatched over the chunks, and each item is located with a binary
+    // search starting after the previous one, so that only O(m log n)
+    // comparisons are performed. The existing items of a chunk are then
+    // shifted at most once, from the back. Replaced values end up in the
+    // batch and are released by the caller once the storage is consistent.
+    void merge( Items& batch )
+    {
+        if( batch.empty() )
+            return;
+        if( m_chunks.empty() )
+        {
+            assign( batch );
+            return;
+        }
+        std::vector<NativeKey> natives;
+        if( batch_kind( batch, natives ) != m_kind )
+            demote();
+        size_t chunk = 0;
+        size_t first = 0;
+        size_t last_chunk = m_chunks.size() - 1;
+        while( first < batch.size() )
+        {
+            chunk = bisect_maxes( probe( batch, natives, first ), chunk, last_chunk );
+            size_t last = batch.size();
+            if( chunk < last_chunk )
+            {
+                last = first + 1;
+                while( last < batch.size() &&
+                       !max_less( chunk, probe( batch, natives, last ) ) )
+                    ++last;
+            }
+            merge_chunk( chunk, batch, natives, first, last );
+            first = last;
+        }
+        for( size_t i = m_chunks.size(); i-- > 0; )
+            split( i );
+        refresh_maxes();
+        touch( 0 );
+    }
+
+    // Remove the items in the range of positions [first, last), handing
+    // them over to the given vector so that the caller releases them once
+    // the storage is consistent again.
+    void erase_range( size_t first, size_t last, Items& removed )
+    {
+        if( first >= last )
+            return;
+        Cursor cursor = at( first );
+        size_t index = cursor.index;
+        size_t chunk = cursor.chunk;
+        size_t count = last - first;
+        removed.reserve( removed.size() + count );
+        m_size -= count;
+        ++m_version;
+        touch( chunk );
+        while( count )
+        {
+            Chunk& current = *m_chunks[ chunk ];
+            size_t end = std::min( current.size(), index + count );
+            for( size_t i = index; i < end; ++i )
+            {
+                removed.push_back( MapItem() );
+                current.take( i, removed.back() );
+            }
+            current.remove( index, end );
+            count -= end - index;
+            index = 0;
+            if( current.size() == 0 )
+            {
+                delete m_chunks[ chunk ];
+                m_chunks.erase( m_chunks.begin() + chunk );
+                m_maxes.erase( m_maxes.begin() + chunk );
+                m_native_maxes.erase( m_native_maxes.begin() + chunk );
+            }
+            else
+                set_max( chunk++ );
+        }
+        if( m_chunks.empty() )
+        {
+            m_kind = NoKeys;
+            return;
+        }
+        // Only the chunks at both ends of the range may have become sparse.
+        for( size_t i = std::min( cursor.chunk + 1, m_chunks.size() ); i-- > cursor.chunk; )
+        {
+            if( m_chunks.size() > 1 && m_chunks[ i ]->size() < m_chunksize / 4 )
+                join( i );
+            else
+                compact( *m_chunks[ i ] );
+        }
+        if( m_chunks.capacity() > shrink_threshold &&
+            m_chunks.size() < m_chunks.capacity() / 4 )
+            shrink_index();
+    }
+
+    enum CombineMode
+    {
+        Union,
+        Intersection,
+        Difference
+    };
+
+    // Copy the items in the range of positions [first, last), in order.
+    void copy_range( size_t first, size_t last, Items& out )
+    {
+        if( first >= last )
+            return;
+        out.reserve( out.size() + last - first );
+        Cursor cursor = at( first );
+        for( size_t i = first; i < last; ++i, next( cursor ) )
+        {
+            Chunk& chunk = *m_chunks[ cursor.chunk ];
+            out.push_back( MapItem( chunk.keys[ cursor.index ], chunk.values[ cursor.index ] ) );
+            if( m_keyed )
+                out.back().set_sortkey( newref( chunk.sortkeys[ cursor.index ] ) );
+        }
+    }
+
+    // Copy all the items, in order.
+    void flatten( Items& out )
+    {
+        copy_range( 0, m_size, out );
+    }
+
+    // Combine two batches of items, sorted and free of duplicates, in a
+    // single pass over both. A key present on both sides keeps the key
+    // object of the left batch, and a union resolves its value through the
+    // conflict policy. The items are moved out of the batches.
+    static bool combine( Items& left, Items& right, CombineMode mode,
+                         Conflict& conflict, Items& out )
+    {
+        std::vector<NativeKey> lnatives;
+        std::vector<NativeKey> rnatives;
+        KeyKind kind = batch_kind( left, lnatives );
+        if( batch_kind( right, rnatives ) == kind )
+        {
+            switch( kind )
+            {
+                case IntKeys:
+                    return walk( NativeOrder<IntKey>( lnatives, rnatives ),
+                                 left, right, mode, conflict, out );
+                case FloatKeys:
+                    return walk( NativeOrder<FloatKey>( lnatives, rnatives ),
+                                 left, right, mode, conflict, out );
+                case StrKeys:
+                    return walk( ItemOrder<StrLess, StrEq>( left, right ),
+                                 left, right, mode, conflict, out );
+                default:
+                    break;
+            }
+        }
+        return walk( ItemOrder<MapItem::CmpLess, MapItem::CmpEq>( left, right ),
+                     left, right, mode, conflict, out );
+    }
+
+    // Sort a batch of items in place and collapse runs of equal keys,
+    // keeping the first key object and the last value, as a dict would.
+    // The sort is stable so that the order of the duplicates is the order
+    // of the input, and an input which is already strictly ascending is
+    // left untouched.
+    static void sort( Items& items )
+    {
+        std::vector<NativeKey> natives;
+        switch( batch_kind( items, natives ) )
+        {
+            case IntKeys:
+                sort_native<IntKey>( items, natives );
+                break;
+            case FloatKeys:
+                sort_native<FloatKey>( items, natives );
+                break;
+            case StrKeys:
+                sort_objects( items, StrLess(), StrEq() );
+                break;
+            default:
+                sort_objects( items, MapItem::CmpLess(), MapItem::CmpEq() );
+                break;
+        }
+    }
+
+private:
+
+    // A key to look for, along with its kind and native value.
+    struct Probe
+    {
+        explicit Probe( PyObject* key ) : key( key )
+        {
+            kind = key_kind( key, native );
+        }
+
+        Probe( PyObject* key, KeyKind kind, const NativeKey& native ) :
+            key( key ), kind( kind ), native( native ) {}
+
+        PyObject* key;
+        KeyKind kind;
+        NativeKey native;
+    };
+
+    bool has_natives() const
+    {
+        return m_kind == IntKeys || m_kind == FloatKeys;
+    }
+
+    Probe probe( Items& batch, std::vector<NativeKey>& natives, size_t index )
+    {
+        if( has_natives() )
+            return Probe( batch[ index ].sortkey(), m_kind, natives[ index ] );
+        return Probe( batch[ index ].sortkey(), m_kind, NativeKey() );
+    }
+
+    Cursor lower_bound( const Probe& probe )
+    {
+        Cursor cursor = { 0, 0 };
+        if( m_chunks.empty() )
+            return cursor;
+        if( m_chunks.size() > 1 )
+            cursor.chunk = bisect_maxes( probe, 0, m_chunks.size() - 1 );
+        cursor.index = bisect_chunk( *m_chunks[ cursor.chunk ], probe, 0 );
+        return cursor;
+    }
+
+    // Locate the first chunk in [lo, hi) whose last key is not less than
+    // the key of the probe.
+    size_t bisect_maxes( const Probe& probe, size_t lo, size_t hi )
+    {
+        if( probe.kind == m_kind )
+        {
+            switch( m_kind )
+            {
+                case IntKeys:
+                    return native_lower_bound<IntKey>(
+                        &m_native_maxes[ 0 ], lo, hi, probe.native.i );
+                case FloatKeys:
+                    return native_lower_bound<FloatKey>(
+                        &m_native_maxes[ 0 ], lo, hi, probe.native.d );
+                case StrKeys:
+                    return std::lower_bound(
+                        m_maxes.begin() + lo, m_maxes.begin() + hi, probe.key,
+                        StrLess() ) - m_maxes.begin();
+                default:
+                    break;
+            }
+        }
+        return std::lower_bound(
+            m_maxes.begin() + lo, m_maxes.begin() + hi, probe.key,
+            MapItem::CmpLess() ) - m_maxes.begin();
+    }
+
+    size_t bisect_chunk( Chunk& chunk, const Probe& probe, size_t lo )
+    {
+        const std::vector<PyObject*>& keys = chunk.ordering();
+        if( probe.kind == m_kind )
+        {
+            switch( m_kind )
+            {
+                case IntKeys:
+                    return native_lower_bound<IntKey>(
+                        &chunk.natives[ 0 ], lo, keys.size(), probe.native.i );
+                case FloatKeys:
+                    return native_lower_bound<FloatKey>(
+                        &chunk.natives[ 0 ], lo, keys.size(), probe.native.d );
+                case StrKeys:
+                    return std::lower_bound(
+                        keys.begin() + lo, keys.end(), probe.key, StrLess()
+                    ) - keys.begin();
+                default:
+                    break;
+            }
+        }
+        return std::lower_bound(
+            keys.begin() + lo, keys.end(), probe.key, MapItem::CmpLess()
+        ) - keys.begin();
+    }
+
+    bool equal( Chunk& chunk, size_t index, const Probe& probe )
+    {
+        PyObject* key = chunk.sortkey( index );
+        if( key == probe.key )
+            return true;
+        if( probe.kind == m_kind )
+        {
+            switch( m_kind )
+            {
+                case IntKeys:
+                    return chunk.natives[ index ].i == probe.native.i;
+                case FloatKeys:
+                    return chunk.natives[ index ].d == probe.native.d;
+                case StrKeys:
+                    return str_compare( key, probe.key ) == 0;
+                default:
+                    break;
+            }
+        }
+        return MapItem::CmpEq()( key, probe.key );
+    }
+
+    // Whether the last key of a chunk is less than the key of the probe.
+    bool max_less( size_t chunk, const Probe& probe )
+    {
+        if( probe.kind == m_kind )
+        {
+            switch( m_kind )
+            {
+                case IntKeys:
+                    return m_native_maxes[ chunk ].i < probe.native.i;
+                case FloatKeys:
+                    return m_native_maxes[ chunk ].d < probe.native.d;
+                case StrKeys:
+                    return StrLess()( m_maxes[ chunk ], probe.key );
+                default:
+                    break;
+            }
+        }
+        return MapItem::CmpLess()( m_maxes[ chunk ], probe.key );
+    }
+
+    // Compute the common kind of the keys of a batch, filling the native
+    // keys when they are ints or floats.
+    static KeyKind batch_kind( Items& batch, std::vector<NativeKey>& natives )
+    {
+        if( batch.empty() )
+            return NoKeys;
+        natives.resize( batch.size() );
+        KeyKind kind = key_kind( batch[ 0 ].sortkey(), natives[ 0 ] );
+        for( size_t i = 1; i < batch.size() && kind != ObjectKeys; ++i )
+        {
+            if( key_kind( batch[ i ].sortkey(), natives[ i ] ) != kind )
+                kind = ObjectKeys;
+        }
+        if( kind != IntKeys && kind != FloatKeys )
+            std::vector<NativeKey>().swap( natives );
+        return kind;
+    }
+
+    // Orderings of the items of two batches, as used by combine.
+    template<typename Get>
+    struct NativeOrder
+    {
+        NativeOrder( std::vector<NativeKey>& left, std::vector<NativeKey>& right ) :
+            left( left ), right( right ) {}
+
+        bool less( size_t i, size_t j )
+        {
+            return Get::get( left[ i ] ) < Get::get( right[ j ] );
+        }
+
+        bool equal( size_t i, size_t j )
+        {
+            return Get::get( left[ i ] ) == Get::get( right[ j ] );
+        }
+
+        std::vector<NativeKey>& left;
+        std::vector<NativeKey>& right;
+    };
+
+    template<typename Less, typename Eq>
+    struct ItemOrder
+    {
+        ItemOrder( Items& left, Items& right ) : left( left ), right( right ) {}
+
+        bool less( size_t i, size_t j )
+        {
+            return Less()( left[ i ], right[ j ] );
+        }
+
+        bool equal( size_t i, size_t j )
+        {
+            return Eq()( left[ i ], right[ j ] );
+        }
+
+        Items& left;
+        Items& right;
+    };
+
+    static void move_item( MapItem& item, Items& out )
+    {
+        out.push_back( MapItem() );
+        out.back().swap( item );
+    }
+
+    template<typename Order>
+    static bool walk( Order order, Items& left, Items& right, CombineMode mode,
+                      Conflict& conflict, Items& out )
+    {
+        out.reserve( mode == Union ? left.size() + right.size() : left.size() );
+        size_t i = 0;
+        size_t j = 0;
+        while( i < left.size() && j < right.size() )
+        {
+            if( order.less( i, j ) )
+            {
+                if( mode != Intersection )
+                    move_item( left[ i ], out );
+                ++i;
+            }
+            else if( order.equal( i, j ) )
+            {
+                if( mode == Union && !conflict.resolve( left[ i ], right[ j ] ) )
+                    return false;
+                if( mode != Difference )
+                    move_item( left[ i ], out );
+                ++i;
+                ++j;
+            }
+            else
+            {
+                if( mode == Union )
+                    move_item( right[ j ], out );
+                ++j;
+            }
+        }
+        if( mode != Intersection )
+        {
+            for( ; i < left.size(); ++i )
+                move_item( left[ i ], out );
+        }
+        if( mode == Union )
+        {
+            for( ; j < right.size(); ++j )
+                move_item( right[ j ], out );
+        }
+        return true;
+    }
+
+    template<typename Get>
+    static void sort_native( Items& items, std::vector<NativeKey>& natives )
+    {
+        typedef std::pair<typename Get::type, size_t> Entry;
+        size_t count = items.size();
+        size_t i = 1;
+        while( i < count && Get::get( natives[ i - 1 ] ) < Get::get( natives[ i ] ) )
+            ++i;
+        if( i >= count )
+            return;
+        // Ties are broken by position, which makes the sort stable.
+        std::vector<Entry> order( count );
+        for( i = 0; i < count; ++i )
+            order[ i ] = Entry( Get::get( natives[ i ] ), i );
+        std::sort( order.begin(), order.end() );
+        Items sorted;
+        sorted.reserve( count );
+        for( i = 0; i < count; ++i )
+        {
+            MapItem& item = items[ order[ i ].second ];
+            if( i > 0 && order[ i ].first == order[ i - 1 ].first )
+                sorted.back().swap_value( item );
+            else
+            {
+                sorted.push_back( MapItem() );
+                sorted.back().swap( item );
+            }
+        }
+        items.swap( sorted );
+    }
+
+    template<typename Less, typename Eq>
+    static void sort_objects( Items& items, Less less, Eq eq )
+    {
+        size_t count = items.size();
+        size_t i = 1;
+        while( i < count && less( items[ i - 1 ], items[ i ] ) )
+            ++i;
+        if( i >= count )
+            return;
+        std::stable_sort( items.begin(), items.end(), less );
+        size_t last = 0;
+        for( i = 1; i < count; ++i )
+        {
+            if( eq( items[ last ], items[ i ] ) )
+                items[ last ].swap_value( items[ i ] );
+            else if( ++last != i )
+                items[ last ].swap( items[ i ] );
+        }
+        items.resize( last + 1 );
+    }
+
+    template<typename T>
+    static void shift( std::vector<T>& array, size_t first, size_t last, size_t offset )
+    {
+        std::copy_backward( array.begin() + first, array.begin() + last,
+                            array.begin() + last + offset );
+    }
+
+    void merge_chunk( size_t index, Items& batch, std::vector<NativeKey>& natives,
+                      size_t first, size_t last )
+    {
+        Chunk& chunk = *m_chunks[ index ];
+        std::vector<std::pair<size_t, size_t> > inserts;
+        size_t lo = 0;
+        for( size_t i = first; i < last; ++i )
+        {
+            Probe p( probe( batch, natives, i ) );
+            size_t pos = bisect_chunk( chunk, p, lo );
+            if( pos < chunk.size() && equal( chunk, pos, p ) )
+            {
+                batch[ i ].swap_value( chunk.values[ pos ] );
+                lo = pos + 1;
+            }
+            else
+            {
+                inserts.push_back( std::make_pair( pos, i ) );
+                lo = pos;
+            }
+        }
+        if( inserts.empty() )
+            return;
+        bool native = has_natives();
+        size_t end = chunk.size();
+        size_t count = end + inserts.size();
+        chunk.keys.resize( count );
+        chunk.values.resize( count );
+        if( m_keyed )
+            chunk.sortkeys.resize( count );
+        if( native )
+            chunk.natives.resize( count );
+        for( size_t j = inserts.size(); j-- > 0; )
+        {
+            size_t pos = inserts[ j ].first;
+            MapItem& item = batch[ inserts[ j ].second ];
+            shift( chunk.keys, pos, end, j + 1 );
+            shift( chunk.values, pos, end, j + 1 );
+            if( m_keyed )
+            {
+                shift( chunk.sortkeys, pos, end, j + 1 );
+                chunk.sortkeys[ pos + j ] = item.release_sortkey();
+            }
+            chunk.keys[ pos + j ] = item.release_key();
+            chunk.values[ pos + j ] = item.release_value();
+            if( native )
+            {
+                shift( chunk.natives, pos, end, j + 1 );
+                chunk.natives[ pos + j ] = natives[ inserts[ j ].second ];
+            }
+            end = pos;
+        }
+        m_size += inserts.size();
+        ++m_version;
+    }
+
+    // Split an overflowing chunk into pieces about half full, so that the
+    // following insertions do not immediately split them again.
+    bool split( size_t index )
+    {
+        Chunk& chunk = *m_chunks[ index ];
+        if( !m_chunksize || chunk.size() <= m_chunksize )
+            return false;
+        size_t size = chunk.size();
+        size_t pieces = std::max<size_t>( size / std::max<size_t>( m_chunksize / 2, 1 ), 2 );
+        std::vector<Chunk*> created;
+        for( size_t j = 1; j < pieces; ++j )
+        {
+            size_t begin = size * j / pieces;
+            size_t end = size * ( j + 1 ) / pieces;
+            Chunk* piece = new Chunk();
+            chunk.move_to( *piece, begin, end );
+            created.push_back( piece );
+        }
+        chunk.truncate( size / pieces );
+        compact( chunk );
+        m_chunks.insert( m_chunks.begin() + index + 1, created.begin(), created.end() );
+        touch( index );
+        m_maxes.insert( m_maxes.begin() + index + 1, created.size(), 0 );
+        m_native_maxes.insert(
+            m_native_maxes.begin() + index + 1, created.size(), NativeKey() );
+        for( size_t j = index; j < index + pieces; ++j )
+            set_max( j );
+        return true;
+    }
+
+    // Join a chunk which became sparse with one of its neighbours.
+    void join( size_t index )
+    {
+        size_t left = index + 1 < m_chunks.size() ? index : index - 1;
+        Chunk& chunk = *m_chunks[ left ];
+        Chunk& next = *m_chunks[ left + 1 ];
+        next.move_to( chunk, 0, next.size() );
+        next.truncate( 0 );
+        delete m_chunks[ left + 1 ];
+        m_chunks.erase( m_chunks.begin() + left + 1 );
+        touch( left );
+        m_maxes.erase( m_maxes.begin() + left + 1 );
+        m_native_maxes.erase( m_native_maxes.begin() + left + 1 );
+        if( !split( left ) )
+            set_max( left );
+    }
+
+    // Release the capacity of a chunk left mostly unused by deletions,
+    // unless it was reserved. Shrinking only below a quarter of the
+    // capacity keeps the amortized cost of the reallocations constant.
+    void compact( Chunk& chunk )
+    {
+        size_t capacity = chunk.capacity();
+        size_t floor = m_reserved > shrink_threshold ? m_reserved : shrink_threshold;
+        if( capacity > floor && chunk.size() < capacity / 4 )
+            chunk.shrink();
+    }
+
+    void shrink_index()
+    {
+        shrink_vector( m_chunks );
+        shrink_vector( m_maxes );
+        shrink_vector( m_native_maxes );
+        m_offsets.resize( m_chunks.size() );
+        shrink_vector( m_offsets );
+    }
+
+    template<typename T>
+    static void shrink_vector( std::vector<T>& array )
+    {
+        if( array.capacity() > array.size() )
+            std::vector<T>( array ).swap( array );
+    }
+
+    // Switch to the general comparison and release the native keys.
+    void demote()
+    {
+        if( m_kind == ObjectKeys )
+            return;
+        m_kind = ObjectKeys;
+        for( size_t i = 0; i < m_chunks.size(); ++i )
+            std::vector<NativeKey>().swap( m_chunks[ i ]->natives );
+    }
+
+    void set_max( size_t index )
+    {
+        Chunk& chunk = *m_chunks[ index ];
+        m_maxes[ index ] = chunk.sortkey( chunk.size() - 1 );
+        if( has_natives() )
+            m_native_maxes[ index ] = chunk.natives.back();
+    }
+
+    // Invalidate the offsets following a modified chunk.
+    void touch( size_t index )
+    {
+        m_fresh = std::min( m_fresh, index );
+    }
+
+    // Make the offsets of the first `count` chunks valid.
+    void update_offsets( size_t count )
+    {
+        m_offsets.resize( m_chunks.size() );
+        if( m_fresh >= count )
+            return;
+        size_t i = m_fresh;
+        size_t total = i ? m_offsets[ i - 1 ] + m_chunks[ i - 1 ]->size() : 0;
+        for( ; i < count; ++i )
+        {
+            m_offsets[ i ] = total;
+            total += m_chunks[ i ]->size();
+        }
+        m_fresh = count;
+    }
+
+    void refresh_maxes()
+    {
+        m_maxes.resize( m_chunks.size() );
+        m_native_maxes.resize( m_chunks.size() );
+        for( size_t i = 0; i < m_chunks.size(); ++i )
+            set_max( i );
+    }
+
+    SortedItems& operator=( const SortedItems& );
+
+    std::vector<Chunk*> m_chunks;
+    std::vector<PyObject*> m_maxes;
+    std::vector<NativeKey> m_native_maxes;
+    std::vector<size_t> m_offsets;
+    size_t m_fresh;
+    size_t m_size;
+    size_t m_chunksize;
+    size_t m_version;
+    size_t m_reserved;
+    KeyKind m_kind;
+    bool m_keyed;
+};
+
+
+struct SortedMap
+{
+    typedef SortedItems::Items Items;
+
+    PyObject_HEAD
+    SortedItems* m_items;
+    PyObject* m_keyfunc;
+
+    // Compute the key by which a key is ordered in the map.
+    bool sort_key( PyObject* key, PyObjectPtr& sortkey )
+    {
+        if( !m_keyfunc )
+        {
+            sortkey = newref( key );
+            return true;
+        }
+        sortkey = PyObject_CallFunctionObjArgs( m_keyfunc, key, NULL );
+        return sortkey;
+    }
+
+    // Look up the cursor of a key, returning -1 on error, 1 if the key is
+    // found and 0 otherwise.
+    int find( PyObject* key, SortedItems::Cursor& cursor )
+    {
+        PyObjectPtr sortkey;
+        if( !sort_key( key, sortkey ) )
+            return -1;
+        return m_items->find( sortkey.get(), cursor ) ? 1 : 0;
+    }
+
+    PyObject* getitem( PyObject* key, PyObject* default_value = 0 )
+    {
+        SortedItems::Cursor cursor;
+        int found = find( key, cursor );
+        if( found < 0 )
+            return 0;
+        if( found )
+            return newref( m_items->value( cursor ) );
+        if( default_value )
+            return newref( default_value );
+        return lookup_fail( key );
+    }
+
+    int setitem( PyObject* key, PyObject* value )
+    {
+        PyObjectPtr sortkey;
+        if( !sort_key( key, sortkey ) )
+            return -1;
+        SortedItems::Cursor cursor;
+        if( m_items->find( sortkey.get(), cursor ) )
+        {
+            m_items->set_value( cursor, value );
+            return 0;
+        }
+        MapItem item( key, value );
+        if( m_keyfunc )
+            item.set_sortkey( sortkey.release() );
+        m_items->insert( cursor, item );
+        return 0;
+    }
+
+    int delitem( PyObject* key )
+    {
+        SortedItems::Cursor cursor;
+        int found = find( key, cursor );
+        if( found <= 0 )
+        {
+            if( found == 0 )
+                lookup_fail( key );
+            return -1;
+        }
+        MapItem item;
+        m_items->erase( cursor, item );
+        return 0;
+    }
+
+    int contains( PyObject* key )
+    {
+        SortedItems::Cursor cursor;
+        return find( key, cursor );
+    }
+
+    PyObject* pop( PyObject* key, PyObject* default_value=0 )
+    {
+        SortedItems::Cursor cursor;
+        int found = find( key, cursor );
+        if( found < 0 )
+            return 0;
+        if( found )
+        {
+            MapItem item;
+            m_items->erase( cursor, item );
+            return newref( item.value() );
+        }
+        if( default_value )
+            return newref( default_value );
+        return lookup_fail( key );
+    }
+
+    // Compute the sort keys of a batch of items from position start on,
+    // or drop those they carry from another map when the map has no key
+    // function.
+    bool sort_keys( Items& batch, size_t start = 0 )
+    {
+        for( size_t i = start; i < batch.size(); ++i )
+        {
+            if( !m_keyfunc )
+            {
+                batch[ i ].set_sortkey( 0 );
+                continue;
+            }
+            PyObject* sortkey = PyObject_CallFunctionObjArgs(
+                m_keyfunc, batch[ i ].key(), NULL );
+            if( !sortkey )
+                return false;
+            batch[ i ].set_sortkey( sortkey );
+        }
+        return true;
+    }
+
+    // Merge a sorted batch of items, resolving the keys which are already
+    // in the map through the conflict policy.
+    bool merge( Items& batch, Conflict& conflict )
+    {
+        Items left;
+        Items out;
+        m_items->flatten( left );
+        if( !SortedItems::combine( left, batch, SortedItems::Union, conflict, out ) )
+            return false;
+        m_items->assign( out );
+        return true;
+    }
+
+    // The positions return -1 on error.
+    Py_ssize_t bisect_left( PyObject* key )
+    {
+        PyObjectPtr sortkey;
+        if( !sort_key( key, sortkey ) )
+            return -1;
+        return m_items->position( m_items->lower_bound( sortkey.get() ) );
+    }
+
+    Py_ssize_t bisect_right( PyObject* key )
+    {
+        SortedItems::Cursor cursor;
+        int found = find( key, cursor );
+        if( found < 0 )
+            return -1;
+        return m_items->position( cursor ) + found;
+    }
+
+    // Resolve a pair of keys to a range of positions. A None bound leaves
+    // the range open on that side.
+    bool key_range( PyObject* lo, PyObject* hi, bool lo_inclusive, bool hi_inclusive,
+                    size_t& first, size_t& last )
+    {
+        Py_ssize_t lo_pos = 0;
+        Py_ssize_t hi_pos = static_cast<Py_ssize_t>( m_items->size() );
+        if( lo != Py_None )
+            lo_pos = lo_inclusive ? bisect_left( lo ) : bisect_right( lo );
+        if( lo_pos < 0 )
+            return false;
+        if( hi != Py_None )
+            hi_pos = hi_inclusive ? bisect_right( hi ) : bisect_left( hi );
+        if( hi_pos < 0 )
+            return false;
+        first = static_cast<size_t>( lo_pos );
+        last = std::max( first, static_cast<size_t>( hi_pos ) );
+        return true;
+    }
+
+    // Resolve a possibly negative position, setting an IndexError when it
+    // is out of range.
+    bool normalize( Py_ssize_t& index )
+    {
+        Py_ssize_t size = static_cast<Py_ssize_t>( m_items->size() );
+        if( index < 0 )
+            index += size;
+        if( index < 0 || index >= size )
+        {
+            PyErr_SetString( PyExc_IndexError, "sortedmap index out of range" );
+            return false;
+        }
+        return true;
+    }
+
+    static PyObject* lookup_fail( PyObject* key )
+    {
+        PyObjectPtr pystr( PyObject_Str( key ) );
+        if( !pystr )
+            return 0;
+        PyObjectPtr pytuple( PyTuple_Pack( 1, key ) );
+        if (!pytuple)
+            return 0;
+        PyErr_SetObject(PyExc_KeyError, pytuple.get());
+        return 0;
+    }
+};
@@ -0,0 +1,48 @@
+/*-----------------------------------------------------------------------------
+| Copyright (c) 2013-2019, Nucleic Development Team.
+|
+| Distributed under the terms of the Modified BSD License.
+|
+| The full license is in the file COPYING.txt, distributed with this software.
+|----------------------------------------------------------------------------*/
+#pragma once
+#include "pythonhelpers.h"
+#include "py23compat.h"
+
+
+namespace PySStr
+{
+
+class PyStringMaker
+{
+
+public:
+
+    PyStringMaker( const char* string ) : m_pystring( 0 )
+    {
+        m_pystring = Py23Str_FromString( string );
+    }
+
+    PyObject* operator()()
+    {
+        return m_pystring.get();
+    }
+
+private:
+
+    PyStringMaker();
+    PythonHelpers::PyObjectPtr m_pystring;
+};
+
+}  // namespace PySStr
+
+
+// Define a function returning a lazily created static Python string
+// whose value is the name of the function.
+#define _STATIC_STRING( name )                \
+    static PyObject*                          \
+    name()                                    \
+    {                                         \
+        static PyStringMaker string( #name ); \
+        return string();                      \
+    }
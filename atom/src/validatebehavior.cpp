@@ -9,7 +9,11 @@
 #include <iostream>
 #include <sstream>
 #include "member.h"
+#include "memberstats.h"
 #include "atomlist.h"
+#include "atomnumlist.h"
+#include "atomdict.h"
+#include "atomsortedmap.h"
 #include "py23compat.h"
 
 
@@ -58,7 +62,19 @@ Member::check_context( Validate::Mode mode, PyObject* context )
                 return false;
             }
             break;
+        case Validate::NumericList:
+        case Validate::ContainerNumericList:
+            if( !Member::TypeCheck( context ) ||
+                !AtomNumList_Format( member_cast( context ) ) )
+            {
+                py_expected_type_fail( context, "Float, Int, Range, FloatRange or Bool member" );
+                return false;
+            }
+            break;
         case Validate::Dict:
+        case Validate::ContainerDict:
+        case Validate::SortedMap:
+        case Validate::ContainerSortedMap:
         {
             if( !PyTuple_Check( context ) )
             {
@@ -532,88 +548,226 @@ container_list_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObjec
 }
 
 
+class AtomNumListFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* validator )
+    {
+        return AtomNumList_New( atom, validator );
+    }
+};
+
+
+class AtomNumCListFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* validator )
+    {
+        return AtomNumCList_New( atom, validator, member );
+    }
+};
+
+
+template<typename ListFactory> PyObject*
+common_numeric_list_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    // Numeric buffers are accepted besides lists so that arrays can be
+    // assigned without being converted to a list first.
+    if( !PyList_Check( newvalue ) && !PyObject_CheckBuffer( newvalue ) )
+        return validate_type_fail( member, atom, newvalue, "list" );
+    Member* validator = member_cast( member->validate_context );
+    PyObjectPtr listptr( ListFactory()( member, atom, validator ) );
+    if( !listptr )
+        return 0;
+    if( AtomNumList_Extend( listptr.get(), newvalue ) < 0 )
+        return 0;
+    return listptr.release();
+}
+
+
+static PyObject*
+numeric_list_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    return common_numeric_list_handler<AtomNumListFactory>( member, atom, oldvalue, newvalue );
+}
+
+
 static PyObject*
-validate_dict_key_value( Member* keymember, Member* valmember, CAtom* atom, PyObject* dict )
+container_numeric_list_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    return common_numeric_list_handler<AtomNumCListFactory>( member, atom, oldvalue, newvalue );
+}
+
+
+static bool
+validate_dict_key_value( Member* keymember, Member* valmember, CAtom* atom, PyObject* dict, PyDictPtr& newptr )
 {
     PyObject* key;
     PyObject* value;
     Py_ssize_t pos = 0;
-    PyDictPtr newptr( PyDict_New() );
-    if( !newptr )
-        return 0;
     while( PyDict_Next( dict, &pos, &key, &value ) )
     {
         PyObjectPtr keyptr( keymember->full_validate( atom, Py_None, key ) );
         if( !keyptr )
-            return 0;
+            return false;
         PyObjectPtr valptr( valmember->full_validate( atom, Py_None, value ) );
         if( !valptr )
-            return 0;
+            return false;
         if( !newptr.set_item( keyptr, valptr ) )
-            return 0;
+            return false;
     }
-    return newptr.release();
+    return true;
 }
 
 
-static PyObject*
-validate_dict_value( Member* valmember, CAtom* atom, PyObject* dict )
+static bool
+validate_dict_value( Member* valmember, CAtom* atom, PyObject* dict, PyDictPtr& newptr )
 {
     PyObject* key;
     PyObject* value;
     Py_ssize_t pos = 0;
-    PyDictPtr newptr( PyDict_New() );
-    if( !newptr )
-        return 0;
     while( PyDict_Next( dict, &pos, &key, &value ) )
     {
         PyObjectPtr keyptr( newref( key ) );
         PyObjectPtr valptr( valmember->full_validate( atom, Py_None, value ) );
         if( !valptr )
-            return 0;
+            return false;
         if( !newptr.set_item( keyptr, valptr ) )
-            return 0;
+            return false;
     }
-    return newptr.release();
+    return true;
 }
 
 
-static PyObject*
-validate_dict_key( Member* keymember, CAtom* atom, PyObject* dict )
+static bool
+validate_dict_key( Member* keymember, CAtom* atom, PyObject* dict, PyDictPtr& newptr )
 {
     PyObject* key;
     PyObject* value;
     Py_ssize_t pos = 0;
-    PyDictPtr newptr( PyDict_New() );
-    if( !newptr )
-        return 0;
     while( PyDict_Next( dict, &pos, &key, &value ) )
     {
         PyObjectPtr keyptr( keymember->full_validate( atom, Py_None, key ) );
         if( !keyptr )
-            return 0;
+            return false;
         PyObjectPtr valptr( newref( value ) );
         if( !newptr.set_item( keyptr, valptr ) )
-            return 0;
+            return false;
     }
+    return true;
+}
+
+
+template<typename DictFactory> PyObject*
+common_dict_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    if( !PyDict_Check( newvalue ) )
+        return validate_type_fail( member, atom, newvalue, "dict" );
+    PyObject* k = PyTuple_GET_ITEM( member->validate_context, 0 );
+    PyObject* v = PyTuple_GET_ITEM( member->validate_context, 1 );
+    Member* keymember = k != Py_None ? member_cast( k ) : 0;
+    Member* valmember = v != Py_None ? member_cast( v ) : 0;
+    PyDictPtr newptr( DictFactory()( member, atom, keymember, valmember ) );
+    if( !newptr )
+        return 0;
+    bool ok;
+    if( keymember && valmember )
+        ok = validate_dict_key_value( keymember, valmember, atom, newvalue, newptr );
+    else if( valmember )
+        ok = validate_dict_value( valmember, atom, newvalue, newptr );
+    else if( keymember )
+        ok = validate_dict_key( keymember, atom, newvalue, newptr );
+    else
+        ok = PyDict_Update( newptr.get(), newvalue ) == 0;
+    if( !ok )
+        return 0;
     return newptr.release();
 }
 
 
+class AtomDictFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* keymember, Member* valmember )
+    {
+        return AtomDict_New( atom, keymember, valmember );
+    }
+};
+
+
+class AtomCDictFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* keymember, Member* valmember )
+    {
+        return AtomCDict_New( atom, keymember, valmember, member );
+    }
+};
+
+
 static PyObject*
 dict_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
 {
-    if( !PyDict_Check( newvalue ) )
-        return validate_type_fail( member, atom, newvalue, "dict" );
+    return common_dict_handler<AtomDictFactory>( member, atom, oldvalue, newvalue );
+}
+
+
+static PyObject*
+container_dict_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    return common_dict_handler<AtomCDictFactory>( member, atom, oldvalue, newvalue );
+}
+
+
+template<typename SortedMapFactory> PyObject*
+common_sortedmap_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    if( !PyDict_Check( newvalue ) && !SortedMap_Check( newvalue ) )
+        return validate_type_fail( member, atom, newvalue, "sortedmap" );
     PyObject* k = PyTuple_GET_ITEM( member->validate_context, 0 );
     PyObject* v = PyTuple_GET_ITEM( member->validate_context, 1 );
-    if( k != Py_None && v != Py_None )
-        return validate_dict_key_value( member_cast( k ), member_cast( v ), atom, newvalue );
-    if( v != Py_None )
-        return validate_dict_value( member_cast( v ), atom, newvalue );
-    if( k != Py_None )
-        return validate_dict_key( member_cast( k ), atom, newvalue );
-    return PyDict_Copy( newvalue );
+    Member* keymember = k != Py_None ? member_cast( k ) : 0;
+    Member* valmember = v != Py_None ? member_cast( v ) : 0;
+    PyObjectPtr newptr( SortedMapFactory()( member, atom, keymember, valmember ) );
+    if( !newptr )
+        return 0;
+    if( AtomSortedMap_Load( newptr.get(), newvalue ) < 0 )
+        return 0;
+    return newptr.release();
+}
+
+
+class AtomSortedMapFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* keymember, Member* valmember )
+    {
+        return AtomSortedMap_New( atom, keymember, valmember );
+    }
+};
+
+
+class AtomCSortedMapFactory
+{
+public:
+    PyObject* operator()( Member* member, CAtom* atom, Member* keymember, Member* valmember )
+    {
+        return AtomCSortedMap_New( atom, keymember, valmember, member );
+    }
+};
+
+
+static PyObject*
+sortedmap_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    return common_sortedmap_handler<AtomSortedMapFactory>( member, atom, oldvalue, newvalue );
+}
+
+
+static PyObject*
+container_sortedmap_handler( Member* member, CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
+{
+    return common_sortedmap_handler<AtomCSortedMapFactory>( member, atom, oldvalue, newvalue );
 }
 
 
@@ -865,7 +1019,12 @@ handlers[] = {
     tuple_handler,
     list_handler,
     container_list_handler,
+    numeric_list_handler,
+    container_numeric_list_handler,
     dict_handler,
+    container_dict_handler,
+    sortedmap_handler,
+    container_sortedmap_handler,
     instance_handler,
     typed_handler,
     subclass_handler,
@@ -886,5 +1045,100 @@ Member::validate( CAtom* atom, PyObject* oldvalue, PyObject* newvalue )
 {
     if( get_validate_mode() >= sizeof( handlers ) )
         return no_op_handler( this, atom, oldvalue, newvalue );  // LCOV_EXCL_LINE
+    if( MemberStats::flags & MemberStats::Counting )
+    {
+        MemberStats::Scope scope( MemberStats::Validate, atom, name );
+        return handlers[ get_validate_mode() ]( this, atom, oldvalue, newvalue );
+    }
     return handlers[ get_validate_mode() ]( this, atom, oldvalue, newvalue );
 }
+
+
+#if PY_MAJOR_VERSION >= 3
+
+// Extract a range bound as a 64 bit integer, using the given default for
+// None. Return false if the bound does not fit.
+static bool
+int64_bound( PyObject* bound, int64_t none, int64_t& out )
+{
+    if( bound == Py_None )
+    {
+        out = none;
+        return true;
+    }
+    int overflow;
+    PY_LONG_LONG value = PyLong_AsLongLongAndOverflow( bound, &overflow );
+    if( overflow || ( value == -1 && PyErr_Occurred() ) )
+    {
+        PyErr_Clear();
+        return false;
+    }
+    out = static_cast<int64_t>( value );
+    return true;
+}
+
+#endif
+
+
+static double
+double_bound( PyObject* bound, double none )
+{
+    return bound == Py_None ? none : PyFloat_AS_DOUBLE( bound );
+}
+
+
+bool
+Member::bulk_validate( NumericBuffer& buffer, NumericBuffer::Boxing& boxing )
+{
+    if( get_post_validate_mode() != PostValidate::NoOp )
+        return false;
+    NumericBuffer::Kind kind = buffer.kind();
+    bool is_float = kind == NumericBuffer::Float;
+    boxing = NumericBuffer::Native;
+    switch( get_validate_mode() )
+    {
+        case Validate::Bool:
+            return kind == NumericBuffer::Bool;
+        case Validate::Float:
+            return is_float;
+        case Validate::FloatPromote:
+            if( !is_float )
+                boxing = NumericBuffer::AsFloat;
+            return kind != NumericBuffer::Unsupported;
+        case Validate::FloatRange:
+        {
+            if( !is_float )
+                return false;
+            double inf = std::numeric_limits<double>::infinity();
+            return buffer.check_range(
+                double_bound( PyTuple_GET_ITEM( validate_context, 0 ), -inf ),
+                double_bound( PyTuple_GET_ITEM( validate_context, 1 ), inf )
+            );
+        }
+#if PY_MAJOR_VERSION >= 3
+        case Validate::Int:
+        case Validate::Long:
+            return !is_float && kind != NumericBuffer::Unsupported;
+        case Validate::IntPromote:
+        case Validate::LongPromote:
+            if( is_float )
+                boxing = NumericBuffer::AsInt;
+            return kind != NumericBuffer::Unsupported;
+        case Validate::Range:
+        {
+            if( is_float || kind == NumericBuffer::Unsupported )
+                return false;
+            int64_t low;
+            int64_t high;
+            if( !int64_bound( PyTuple_GET_ITEM( validate_context, 0 ),
+                              std::numeric_limits<int64_t>::min(), low ) ||
+                !int64_bound( PyTuple_GET_ITEM( validate_context, 1 ),
+                              std::numeric_limits<int64_t>::max(), high ) )
+                return false;
+            return buffer.check_range( low, high );
+        }
+#endif
+        default:
+            return false;
+    }
+}
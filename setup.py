@@ -17,10 +17,18 @@ ext_modules = [
     Extension(
         'atom.catom',
         [
+            'atom/src/allocpool.cpp',
+            'atom/src/atomcopy.cpp',
+            'atom/src/atomdict.cpp',
             'atom/src/atomlist.cpp',
+            'atom/src/atomnumlist.cpp',
             'atom/src/atomref.cpp',
+            'atom/src/atomserial.cpp',
+            'atom/src/atomsortedmap.cpp',
             'atom/src/catom.cpp',
             'atom/src/catommodule.cpp',
+            'atom/src/changetrace.cpp',
+            'atom/src/containerbatch.cpp',
             'atom/src/defaultvaluebehavior.cpp',
             'atom/src/delattrbehavior.cpp',
             'atom/src/enumtypes.cpp',
@@ -28,7 +36,9 @@ ext_modules = [
             'atom/src/getattrbehavior.cpp',
             'atom/src/member.cpp',
             'atom/src/memberchange.cpp',
+            'atom/src/memberstats.cpp',
             'atom/src/methodwrapper.cpp',
+            'atom/src/numericbuffer.cpp',
             'atom/src/observerpool.cpp',
             'atom/src/postgetattrbehavior.cpp',
             'atom/src/postsetattrbehavior.cpp',
@@ -8,7 +8,10 @@
 """Test the sortedmap that acts like an ordered dictionary.
 
 """
+import copy
 import gc
+import pickle
+import sys
 import weakref
 
 import pytest
@@ -47,6 +50,184 @@ def test_sortedmap_init():
     assert 'pairs' in excinfo.exconly()
 
 
+def test_sortedmap_bulk_init():
+    """Test building a sortedmap from unsorted data containing duplicates.
+
+    """
+    pairs = [(k % 37, k) for k in range(200, 0, -1)]
+    smap = sortedmap(pairs)
+    assert smap.items() == sorted(dict(pairs).items())
+
+    # The first key object and the last value are kept
+    smap = sortedmap([(1, 'a'), (1.0, 'b'), (0, 'c')])
+    assert smap.items() == [(0, 'c'), (1, 'b')]
+    assert type(smap.keys()[1]) is int
+
+    smap = sortedmap(sortedmap({3: 4, 1: 2}))
+    assert smap.items() == [(1, 2), (3, 4)]
+    smap = sortedmap([[2, 3], [1, 2]])
+    assert smap.items() == [(1, 2), (2, 3)]
+
+
+def test_update(smap):
+    """Test updating a sortedmap.
+
+    """
+    smap.update({'b': 5, 'aa': 4, 'z': 0})
+    assert smap.items() == [('a', 1), ('aa', 4), ('b', 5), ('c', 3), ('z', 0)]
+    smap.update([('0', 1), ('c', 1), ('0', 2)], d=6)
+    assert smap.items() == [('0', 2), ('a', 1), ('aa', 4), ('b', 5), ('c', 1),
+                            ('d', 6), ('z', 0)]
+    smap.update()
+    assert len(smap) == 7
+
+    ref = {}
+    smap = sortedmap()
+    for i in range(10):
+        batch = [((k * 7 + i) % 53, (i, k)) for k in range(i * 5)]
+        ref.update(batch)
+        smap.update(batch)
+        assert smap.items() == sorted(ref.items())
+
+    with pytest.raises(TypeError):
+        smap.update(1)
+    with pytest.raises(TypeError):
+        smap.update({}, {})
+
+
+@pytest.mark.parametrize('chunksize', [0, 1, 4, 16])
+def test_chunked_storage(chunksize):
+    """Test inserting and removing items in a map spanning several chunks.
+
+    """
+    keys = [(i * 7919) % 1000 for i in range(1000)]
+    smap = sortedmap(chunksize=chunksize)
+    for k in keys:
+        smap[k] = -k
+    assert smap.keys() == list(range(1000))
+    assert all(smap[k] == -k for k in keys)
+    for k in keys[::2]:
+        del smap[k]
+    assert smap.keys() == sorted(keys[1::2])
+    smap.update((k, k) for k in range(0, 1000, 3))
+    ref = dict((k, -k) for k in keys[1::2])
+    ref.update((k, k) for k in range(0, 1000, 3))
+    assert smap.items() == sorted(ref.items())
+    assert smap.copy().items() == smap.items()
+    for k in list(ref):
+        assert smap.pop(k) == ref[k]
+    assert len(smap) == 0
+
+    smap = sortedmap([(k, k) for k in keys], chunksize=chunksize)
+    assert smap.keys() == list(range(1000))
+
+    with pytest.raises(ValueError):
+        sortedmap(chunksize=-1)
+
+
+@pytest.mark.parametrize('keys', [list(range(-50, 50)),
+                                  [i / 4. for i in range(100)],
+                                  [str(i) for i in range(100)]])
+def test_native_keys(keys):
+    """Test maps whose keys are all ints, floats or strs, and their fallback
+    when a key of another kind is inserted.
+
+    """
+    shuffled = keys[1::2] + keys[::2]
+    smap = sortedmap([(k, i) for i, k in enumerate(shuffled)], chunksize=8)
+    assert smap.keys() == sorted(keys)
+    for i, k in enumerate(shuffled):
+        assert smap[k] == i
+    smap.update((k, -1) for k in keys[::3])
+    assert all(smap[k] == -1 for k in keys[::3])
+    if not isinstance(keys[0], str):
+        # Equal keys of another type are found through the general path
+        assert smap[type(keys[0])(keys[0])] == smap[keys[0]]
+        assert float(keys[1]) in smap
+
+    smap[None] = 1
+    assert smap[None] == 1
+    del smap[None]
+    assert smap.keys() == sorted(keys)
+    assert all(k in smap for k in keys)
+
+    # Emptying the map allows to use native keys again
+    for k in keys:
+        del smap[k]
+    smap.update([(2 ** 70, 1), (1, 2)])
+    assert smap.keys() == [1, 2 ** 70]
+    assert smap[2 ** 70] == 1
+
+    # nan is only ever found by identity
+    nan = float('nan')
+    smap = sortedmap({nan: 1})
+    assert smap[nan] == 1
+
+
+@pytest.mark.parametrize('chunksize', [0, 4])
+def test_positional_access(chunksize):
+    """Test bisecting and accessing the items of a sortedmap by position.
+
+    """
+    smap = sortedmap([(k, -k) for k in range(0, 40, 2)], chunksize=chunksize)
+    assert smap.bisect_left(10) == 5
+    assert smap.bisect_right(10) == 6
+    assert smap.bisect_left(11) == smap.bisect_right(11) == 6
+    assert smap.bisect_left(-1) == 0
+    assert smap.bisect_right(100) == 20
+    assert smap.index(10) == 5
+    with pytest.raises(ValueError):
+        smap.index(11)
+
+    assert smap.peekitem(0) == (0, 0)
+    assert smap.peekitem() == (38, -38)
+    assert smap.peekitem(-2) == (36, -36)
+    with pytest.raises(IndexError):
+        smap.peekitem(20)
+
+    assert smap.popitem() == (38, -38)
+    assert smap.popitem(0) == (0, 0)
+    assert smap.popitem(5) == (12, -12)
+    assert len(smap) == 17
+    with pytest.raises(IndexError):
+        smap.popitem(-18)
+    with pytest.raises(KeyError):
+        sortedmap().popitem()
+
+
+@pytest.mark.parametrize('chunksize', [0, 4])
+def test_key_ranges(chunksize):
+    """Test iterating, slicing and deleting ranges of keys.
+
+    """
+    smap = sortedmap([(k, -k) for k in range(20)], chunksize=chunksize)
+    assert list(smap.irange(5, 8)) == [5, 6, 7, 8]
+    assert list(smap.irange(5, 8, (False, False))) == [6, 7]
+    assert list(smap.irange(5.5, 8, reverse=True)) == [8, 7, 6]
+    assert list(smap.irange(maximum=2)) == [0, 1, 2]
+    assert list(smap.irange(18)) == [18, 19]
+    assert list(smap.irange(8, 5)) == []
+    with pytest.raises(TypeError):
+        smap.irange(1, 2, True)
+
+    assert smap[5:8].items() == [(5, -5), (6, -6), (7, -7)]
+    assert smap[:2].keys() == [0, 1]
+    assert len(smap[:]) == 20
+
+    del smap[5:15]
+    assert smap.keys() == [0, 1, 2, 3, 4, 15, 16, 17, 18, 19]
+    del smap[17.5:]
+    del smap[:1]
+    assert smap.keys() == [1, 2, 3, 4, 15, 16, 17]
+    del smap[:]
+    assert len(smap) == 0
+
+    with pytest.raises(ValueError):
+        smap[1:2:3]
+    with pytest.raises(TypeError):
+        smap[1:2] = 1
+
+
 def test_traverse():
     """Test traversing on deletion.
 
@@ -119,6 +300,8 @@ def test_pop(smap):
     assert smap.pop('b', 1) == 1
     assert smap.keys() == ['a', 'c']
     assert smap.pop('d', 1) == 1
+    assert smap.pop('c', 1) == 3
+    assert 'c' not in smap
 
     with pytest.raises(KeyError):
         smap.pop('b')
@@ -148,6 +331,55 @@ def test_iter(smap):
         assert keys[i] == k
 
 
+def test_views(smap):
+    """Test the keys, values and items views.
+
+    """
+    keys, values, items = smap.keys(), smap.values(), smap.items()
+    assert len(keys) == len(values) == len(items) == 3
+    assert 'b' in keys and 'd' not in keys
+    assert 2 in values and 4 not in values
+    assert ('b', 2) in items and ('b', 3) not in items and 'b' not in items
+    assert keys[-1] == 'c' and values[0] == 1 and items[1] == ('b', 2)
+    with pytest.raises(IndexError):
+        keys[3]
+    assert list(reversed(items)) == [('c', 3), ('b', 2), ('a', 1)]
+    assert keys == ('a', 'b', 'c') and keys != ['a', 'b']
+    assert keys == smap.copy().keys()
+    assert repr(values) == 'sortedmap_values([1, 2, 3])'
+    with pytest.raises(TypeError):
+        hash(keys)
+
+    # Views are live
+    smap['d'] = 4
+    assert len(keys) == 4 and items[-1] == ('d', 4)
+
+
+def test_iterators(smap):
+    """Test iterating in both directions and the detection of mutations.
+
+    """
+    assert list(reversed(smap)) == ['c', 'b', 'a']
+    assert iter(smap).__length_hint__() == 3
+
+    it = iter(smap.items())
+    assert next(it) == ('a', 1)
+    # Replacing a value is allowed while iterating
+    smap['b'] = 5
+    assert next(it) == ('b', 5)
+    smap['e'] = 6
+    with pytest.raises(RuntimeError):
+        next(it)
+    with pytest.raises(StopIteration):
+        next(it)
+
+    it = reversed(smap.values())
+    next(it)
+    del smap['a']
+    with pytest.raises(RuntimeError):
+        next(it)
+
+
 def test_ordering_with_inhomogeneous(smap):
     """Test the ordering of the map.
 
@@ -201,6 +433,41 @@ def test_sizeof(smap):
 
     """
     smap.__sizeof__()
+    small = sortedmap({i: i for i in range(10)}, chunksize=0)
+    large = sortedmap({i: i for i in range(1000)}, chunksize=0)
+    assert large.__sizeof__() - small.__sizeof__() >= 990 * 24
+
+
+@pytest.mark.parametrize('chunksize', [0, 16])
+def test_reserve_and_shrink(chunksize):
+    """Test preallocating the storage and releasing it.
+
+    """
+    smap = sortedmap(chunksize=chunksize)
+    smap.reserve(1000)
+    for i in range(1000):
+        smap[i] = i
+    reserved = smap.__sizeof__()
+    del smap[10:]
+    if not chunksize:
+        assert smap.__sizeof__() == reserved
+    smap.shrink_to_fit()
+    assert smap.__sizeof__() < reserved
+    assert list(smap.items()) == [(i, i) for i in range(10)]
+    with pytest.raises(ValueError):
+        smap.reserve(-1)
+
+
+def test_automatic_shrink():
+    """Test that the storage shrinks after large deletions.
+
+    """
+    smap = sortedmap({str(i): i for i in range(10000)}, chunksize=0)
+    full = smap.__sizeof__()
+    for i in range(9990):
+        del smap[str(i)]
+    assert smap.__sizeof__() < full / 10
+    assert len(smap) == 10
 
 
 def test_clear(smap):
@@ -209,3 +476,139 @@ def test_clear(smap):
     """
     smap.clear()
     assert not smap
+
+
+@pytest.mark.parametrize('chunksize', [2, 512])
+def test_combining(chunksize):
+    """Test the union, intersection and difference of maps.
+
+    """
+    a = sortedmap({i: 'a' for i in range(0, 20, 2)}, chunksize=chunksize)
+    b = {i: 'b' for i in range(0, 20, 3)}
+    for other in (b, sortedmap(b)):
+        union = a | other
+        assert type(union) is sortedmap
+        assert union.keys() == sorted(set(a.keys()) | set(b))
+        assert all(union[k] == 'b' for k in b)
+        inter = a & other
+        assert inter.keys() == [0, 6, 12, 18]
+        assert inter.values() == ['a'] * 4
+        assert (a - other).keys() == [2, 4, 8, 10, 14, 16]
+    assert len(a) == 10
+
+    with pytest.raises(TypeError):
+        a | [(1, 2)]
+    with pytest.raises(TypeError):
+        {1: 2} & a
+
+    mixed = sortedmap({1: 1, 2.5: 2, 'a': 3})
+    assert (mixed | {2: 4}).keys() == [1, 2, 2.5, 'a']
+    assert (mixed & {2.5: None}).items() == [(2.5, 2)]
+
+    a |= [(1, 'c'), (2, 'c')]
+    assert a[1] == 'c' and a[2] == 'c'
+
+
+def test_merge():
+    """Test merging a map in place with the different policies.
+
+    """
+    smap = sortedmap({1: 1, 3: 3})
+    smap.merge({3: 30, 4: 40})
+    assert smap.items() == [(1, 1), (3, 30), (4, 40)]
+    smap.merge(sortedmap({1: 10, 2: 20}), 'keep')
+    assert smap.items() == [(1, 1), (2, 20), (3, 30), (4, 40)]
+    smap.merge({5: 5, 4: 4}, lambda k, old, new: old + new)
+    assert smap.items() == [(1, 1), (2, 20), (3, 30), (4, 44), (5, 5)]
+
+    with pytest.raises(KeyError):
+        smap.merge({0: 0, 2: 2}, 'error')
+    assert smap.keys() == [1, 2, 3, 4, 5]
+    with pytest.raises(ValueError):
+        smap.merge({}, 'drop')
+    with pytest.raises(ZeroDivisionError):
+        smap.merge({1: 0}, lambda k, old, new: old / new)
+    assert smap[1] == 1
+
+
+def test_key_function():
+    """Test ordering the keys through a key function.
+
+    """
+    smap = sortedmap({'B': 1, 'a': 2, 'c': 3}, key=str.lower)
+    assert smap.key is str.lower
+    assert smap.keys() == ['a', 'B', 'c']
+    smap['A'] = 4
+    assert smap.items() == [('a', 4), ('B', 1), ('c', 3)]
+    assert 'b' in smap and smap['C'] == 3
+    assert smap.bisect_left('b') == 1
+    assert list(smap.irange('A', 'b')) == ['a', 'B']
+    assert smap['A':'C'].keys() == ['a', 'B']
+    assert smap['A':'C'].key is str.lower
+    assert smap.copy().key is str.lower
+    del smap['b']
+    assert smap.keys() == ['a', 'c']
+    assert sortedmap(smap).keys() == ['a', 'c']
+    assert sortedmap().key is None
+
+    calls = []
+
+    def negate(k):
+        calls.append(k)
+        return -k
+
+    smap = sortedmap({i: i for i in range(10)}, key=negate)
+    assert smap.keys() == list(range(9, -1, -1))
+    assert len(calls) == 10
+    other = sortedmap({20: 0}, key=negate)
+    del calls[:]
+    smap.update(other)
+    assert (smap | other).keys()[0] == 20
+    assert not calls
+    smap.merge({-1: 0})
+    assert smap.keys()[-1] == -1
+
+    with pytest.raises(TypeError):
+        smap['a']
+    with pytest.raises(TypeError):
+        smap.update({'a': 1})
+    with pytest.raises(TypeError):
+        sortedmap(key=1)
+    assert len(smap) == 12
+
+
+def negate(key):
+    return -key
+
+
+@pytest.mark.parametrize('smap', [sortedmap(),
+                                  sortedmap({1: 'a', -2**40: 'b', 3: None}),
+                                  sortedmap({0.5: 1, -1.5: 2}),
+                                  sortedmap({'b': 1, 'a': 2, 2**70: 3}),
+                                  sortedmap({i: i for i in range(100)}, chunksize=8),
+                                  sortedmap({1: 2, 3: 4}, key=negate)])
+def test_pickling(smap):
+    """Test pickling and copying a map.
+
+    """
+    for proto in range(pickle.HIGHEST_PROTOCOL + 1):
+        loaded = pickle.loads(pickle.dumps(smap, proto))
+        assert type(loaded) is sortedmap
+        assert loaded.items() == smap.items()
+        assert [type(k) for k in loaded] == [type(k) for k in smap]
+        assert loaded.key is smap.key
+        loaded[0] = 0
+        assert len(loaded) == len(smap) + (0 not in smap)
+    assert copy.deepcopy(smap).items() == smap.items()
+
+
+@pytest.mark.skipif(sys.version_info < (3, 8), reason='requires pickle protocol 5')
+def test_pickling_out_of_band():
+    """Test handing the packed keys of a map out of band.
+
+    """
+    smap = sortedmap({float(i): i for i in range(1000)})
+    buffers = []
+    data = pickle.dumps(smap, 5, buffer_callback=buffers.append)
+    assert len(buffers) == 1
+    assert pickle.loads(data, buffers=buffers).items() == smap.items()
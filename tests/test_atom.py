@@ -13,11 +13,15 @@ in the test dedicated to the associated behaviors.
 The methods related to member observation are tested in test_observe.py
 
 """
+import copy
 import gc
 import pickle
+import weakref
 
 import pytest
-from atom.api import Atom, Int, Value, atomref, set_default
+from atom.api import (Atom, ContainerList, Dict, Int, List, Property, Str, Typed,
+                      Value, atomref, observe, set_default)
+from atom.catom import set_trusted_unpickling
 
 
 def test_init():
@@ -37,6 +41,39 @@ def test_init():
     a.__sizeof__()
 
 
+def test_init_binding():
+    """Test that init only bypasses setattr for the member descriptors.
+
+    """
+    class B(Atom):
+        __slots__ = ('__dict__',)
+        val = Int()
+
+    class C(B):
+        val = property(lambda self: 0, lambda self, value: None)
+
+    class D(B):
+        def __setattr__(self, name, value):
+            super(D, self).__setattr__(name, value + 1)
+
+    b = B(val=1, other=2)
+    assert (b.val, b.other) == (1, 2)
+    with pytest.raises(TypeError):
+        B(val='a')
+    assert C(val=1).val == 0
+    assert D(val=1).val == 2
+
+    class Doubled(Int):
+
+        def __set__(self, obj, value):
+            super(Doubled, self).__set__(obj, 2 * value)
+
+    class E(Atom):
+        val = Doubled()
+
+    assert E(val=2).val == 4
+
+
 def test_set_default():
     """Test changing the default value of a member.
 
@@ -161,6 +198,176 @@ def test_pickling():
     assert loaded.d == 5
 
 
+class CompactPickling(Atom):
+
+    i = Int()
+
+    v = Value()
+
+    l = ContainerList(Int())
+
+    p = Property(lambda self: 42, cached=True)
+
+
+class DictPickling(Atom):
+
+    i = Int()
+
+    def __getstate__(self):
+        state = super(DictPickling, self).__getstate__()
+        state['i'] += 1
+        return state
+
+
+def test_compact_pickling():
+    """Test pickling the set slots of an atom.
+
+    """
+    m = CompactPickling(i=1, l=[1, 2])
+    m.p
+    state = m.__reduce_ex__(2)[2]
+    assert state[0] == ('i', 'v', 'l', 'p')
+    assert state[2] == (1, m.l, 42)
+    assert CompactPickling.__atom_state_names__ is state[0]
+
+    changes = []
+    loaded = pickle.loads(pickle.dumps(m, 2))
+    assert (loaded.i, loaded.l, loaded.p) == (1, [1, 2], 42)
+    # Unset members keep their default lazily.
+    loaded.observe('v', changes.append)
+    assert loaded.v is None
+    assert changes[0]['type'] == 'create'
+    loaded.l.append(3)
+    with pytest.raises(TypeError):
+        loaded.l.append('a')
+
+    # Invalid values are rejected.
+    with pytest.raises(TypeError):
+        CompactPickling().__setstate__((state[0], state[1], ('a', [], 0)))
+    with pytest.raises(ValueError):
+        CompactPickling().__setstate__((state[0], state[1], (1,)))
+    with pytest.raises(ValueError):
+        CompactPickling().__setstate__((state[0], 1 << 4, ()))
+    with pytest.raises(ValueError):
+        CompactPickling().__setstate__((state[0], -1, ()))
+    with pytest.raises(TypeError):
+        CompactPickling().__setstate__((1, 2))
+
+    # Members are restored by name when the class changed.
+    loaded = CompactPickling()
+    loaded.__setstate__((('v', 'i'), 3, ('a', 2)))
+    assert (loaded.i, loaded.v) == (2, 'a')
+
+    # A dict state is still accepted, and used by custom __getstate__.
+    loaded = CompactPickling()
+    loaded.__setstate__({'i': 3, 'v': 4})
+    assert (loaded.i, loaded.v) == (3, 4)
+    loaded = pickle.loads(pickle.dumps(DictPickling(i=1)))
+    assert loaded.i == 2
+
+
+def test_trusted_unpickling():
+    """Test restoring the slots without validation.
+
+    """
+    m = CompactPickling()
+    names = m.__reduce_ex__(2)[2][0]
+    old = set_trusted_unpickling(True)
+    try:
+        assert old is False
+        m.observe('i', lambda change: pytest.fail('notified'))
+        m.__setstate__((names, 5, ('a', [1])))
+        assert m.i == 'a'
+        m.l.append(2)
+        with pytest.raises(TypeError):
+            m.l.append('b')
+    finally:
+        assert set_trusted_unpickling(old) is True
+
+
+class ExtraPickling(Atom):
+
+    __slots__ = ('s', 't', '__dict__')
+
+    i = Int()
+
+
+def test_pickling_extra_state():
+    """Test pickling the attributes stored outside of the slots.
+
+    """
+    m = ExtraPickling(i=1)
+    m.s = 2
+    m.x = 3
+    state = m.__reduce_ex__(2)[2]
+    assert state[3] == {'s': 2, 'x': 3}
+    loaded = pickle.loads(pickle.dumps(m))
+    assert (loaded.i, loaded.s, loaded.x) == (1, 2, 3)
+    assert not hasattr(loaded, 't')
+
+
+class CopyNode(Atom):
+
+    i = Int()
+
+    l = ContainerList(List(Int()))
+
+    d = Dict(Str(), List(Int()))
+
+    v = Value()
+
+    child = Typed(Atom)
+
+
+@pytest.mark.parametrize('deep', [False, True])
+def test_copy(deep):
+    """Test copying the slots of an atom and rebinding its containers.
+
+    """
+    m = CopyNode(i=1, l=[[1]], d={'a': [2]}, v=[3])
+    m.child = m
+    copier = copy.deepcopy if deep else copy.copy
+    c = copier(m)
+    assert type(c) is CopyNode
+    assert (c.i, c.l, c.d, c.v) == (1, [[1]], {'a': [2]}, [3])
+    assert (c.v is m.v) is not deep
+    assert c.child is (c if deep else m)
+
+    # The containers are bound to the copy.
+    changes = []
+    c.observe('l', changes.append)
+    c.l.append([4])
+    c.l[0].append(5)
+    c.d['a'].append(6)
+    assert (m.l, m.d) == ([[1]], {'a': [2]})
+    assert (c.l, c.d) == ([[1, 5], [4]], {'a': [2, 6]})
+    assert len(changes) == 1
+    with pytest.raises(TypeError):
+        c.l[0].append('a')
+
+    # Unset members stay unset.
+    assert copier(CopyNode()).__reduce_ex__(2)[2][1] == 0
+
+
+def test_copy_custom_state():
+    """Test that a customized pickling is used for copies.
+
+    """
+    c = copy.copy(DictPickling(i=1))
+    assert c.i == 2
+    memo = {}
+    c = copy.deepcopy(DictPickling(i=1), memo)
+    assert c.i == 2
+    assert c in memo.values()
+
+    w = ExtraPickling(i=1)
+    w.s = []
+    w.x = 2
+    c = copy.deepcopy(w)
+    assert (c.i, c.s, c.x) == (1, [], 2)
+    assert c.s is not w.s
+
+
 def test_freezing():
     """Test freezing an Atom instance.
 
@@ -198,3 +405,129 @@ def test_traverse_atom():
     gc.collect()
 
     assert not ref()
+
+
+def test_gc_tracking():
+    """Test that the atoms of Python classes are tracked by the gc.
+
+    An atom references its class, which may reference it in turn.
+
+    """
+    class Tracked(Atom):
+
+        i = Int()
+
+    a = Tracked(i=1)
+    assert gc.is_tracked(a)
+
+    Tracked.singleton = Tracked()
+    ref = weakref.ref(Tracked)
+    del Tracked, a
+    gc.collect()
+    assert ref() is None
+
+
+def test_allocation_pools():
+    """Test recycling the memory of the atoms.
+
+    """
+    from atom.catom import pool_stats, set_pool_depth
+
+    class Pooled(Atom):
+
+        __slots__ = ('__weakref__',)
+
+        i = Int()
+
+        v = Value()
+
+    depths = {k: v['depth'] for k, v in pool_stats().items()}
+    set_pool_depth(instances=8)
+    try:
+        a = Pooled(i=1, v=[])
+        a.observe('i', lambda change: None)
+        ref = weakref.ref(a)
+        del a
+        assert ref() is None
+        stats = pool_stats()
+        assert stats['instances']['free'] >= 1
+        assert stats['observers']['free'] >= 1
+
+        b = Pooled()
+        after = pool_stats()
+        assert after['instances']['reused'] == stats['instances']['reused'] + 1
+        assert after['slots']['reused'] == stats['slots']['reused'] + 1
+        assert b.i == 0 and b.v is None
+        assert gc.is_tracked(b)
+        assert weakref.ref(b)() is b
+        assert b.get_member('i') is Pooled.i
+
+        set_pool_depth(slots=0, observers=0, instances=0)
+        assert all(s['free'] == 0 for s in pool_stats().values())
+
+        with pytest.raises(ValueError):
+            set_pool_depth(slots=-1)
+        with pytest.raises(TypeError):
+            set_pool_depth(slots='1')
+    finally:
+        set_pool_depth(**depths)
+
+
+def test_bulk_creation():
+    """Test creating atoms from rows and dicts.
+
+    """
+    class Record(Atom):
+
+        __slots__ = ('__dict__',)
+
+        i = Int()
+
+        s = Value()
+
+        created = Int()
+
+        def __init__(self, **kwargs):
+            raise AssertionError('__init__ should not be called')
+
+        @observe('i')
+        def _count(self, change):
+            self.created += 1
+
+    records = Record.from_rows([(1, 'a'), [2, 'b']], fields=('i', 's'))
+    assert [(r.i, r.s, r.created) for r in records] == [(1, 'a', 1), (2, 'b', 1)]
+    assert all(type(r) is Record and r.notifications_enabled()
+               for r in records)
+
+    records = Record.from_rows(iter([(3, 4)]), ['i', 'extra'], notify=False)
+    assert (records[0].i, records[0].created, records[0].extra) == (3, 0, 4)
+
+    records = Record.from_dicts([{'i': 5}, {'s': 6, 'extra': 7}])
+    assert [(r.created, r.i, r.s) for r in records] == [(1, 5, None),
+                                                       (0, 0, 6)]
+    assert records[1].extra == 7
+    assert Record.from_dicts([{'i': 8}], notify=False)[0].created == 0
+
+    with pytest.raises(TypeError):
+        Record.from_rows([('a', 1)], ('i', 's'))
+    with pytest.raises(ValueError):
+        Record.from_rows([(1,)], ('i', 's'))
+    with pytest.raises(TypeError):
+        Record.from_rows([(1,)], (1,))
+
+    class Doubled(Int):
+
+        def __set__(self, obj, value):
+            super(Doubled, self).__set__(obj, 2 * value)
+
+    class Custom(Atom):
+        x = Doubled()
+
+    assert Custom.from_rows([(3,)], fields=('x',))[0].x == 6
+    assert Custom.from_dicts([{'x': 4}])[0].x == 8
+    with pytest.raises(TypeError):
+        Record.from_rows([1], ('i',))
+    with pytest.raises(TypeError):
+        Record.from_dicts([[('i', 1)]])
+    with pytest.raises(TypeError):
+        Record.from_dicts([{1: 1}])
@@ -10,9 +10,11 @@
 
 """
 import sys
+import pickle
 import pytest
 
-from atom.api import Atom, Dict, Int
+from atom.api import (Atom, ContainerDict, Dict, Int, List, atomcdict,
+                      atomdict)
 
 
 @pytest.fixture
@@ -114,3 +116,107 @@ def test_setitem(atom_dict):
         atom_dict.fullytyped[''] = 1
     with pytest.raises(TypeError):
         atom_dict.fullytyped[1] = ''
+
+
+def test_dict_types(atom_dict):
+    """Test the type of the stored dict.
+
+    """
+    atom_dict.fullytyped = {1: 2}
+    assert type(atom_dict.fullytyped) is atomdict
+    assert atom_dict.fullytyped is atom_dict.fullytyped
+    assert type(atom_dict.fullytyped.copy()) is dict
+    assert type(ContainerModel().typed) is atomcdict
+
+
+def test_setdefault(atom_dict):
+    """Test setdefault validation.
+
+    """
+    assert atom_dict.fullytyped.setdefault(1, 2) == 2
+    assert atom_dict.fullytyped.setdefault(1, 3) == 2
+    with pytest.raises(TypeError):
+        atom_dict.fullytyped.setdefault('', 1)
+    with pytest.raises(TypeError):
+        atom_dict.fullytyped.setdefault(2, '')
+    with pytest.raises(TypeError):
+        atom_dict.fullytyped.setdefault(2)
+    assert atom_dict.untyped.setdefault('') is None
+    assert atom_dict.fullytyped == {1: 2}
+
+
+def test_update(atom_dict):
+    """Test update validation.
+
+    """
+    atom_dict.fullytyped.update({1: 2})
+    atom_dict.fullytyped.update([(3, 4)])
+    with pytest.raises(TypeError):
+        atom_dict.fullytyped.update({5: 6, 7: ''})
+    with pytest.raises(TypeError):
+        atom_dict.fullytyped.update(a=1)
+    assert atom_dict.fullytyped == {1: 2, 3: 4}
+    atom_dict.untyped.update({1: 2}, a=3)
+    assert atom_dict.untyped == {1: 2, 'a': 3}
+
+
+def test_pickle(atom_dict):
+    """Test pickling the dict alone.
+
+    """
+    atom_dict.fullytyped = {1: 2}
+    data = pickle.loads(pickle.dumps(atom_dict.fullytyped))
+    assert type(data) is dict
+    assert data == {1: 2}
+
+
+class ContainerModel(Atom):
+    """A model with a container dict recording its notifications.
+
+    """
+    typed = ContainerDict(Int(), Int())
+
+    changes = List()
+
+    def _changed(self, change):
+        self.changes.append({k: v for k, v in change.items()
+                             if k not in ('name', 'value', 'object', 'type')})
+
+
+def test_container_notifications():
+    """Test the notifications emitted by a container dict.
+
+    """
+    model = ContainerModel()
+    model.typed = {1: 1}
+    model.observe('typed', model._changed)
+    model.typed[1] = 2
+    model.typed[2] = 3
+    del model.typed[2]
+    model.typed.setdefault(1, 5)
+    model.typed.setdefault(3, 4)
+    model.typed.update({4: 5})
+    model.typed.pop(4)
+    model.typed.pop(4, None)
+    model.typed.pop(3)
+    model.typed.popitem()
+    model.typed.clear()
+    model.typed[1] = 2
+    model.typed.clear()
+    with pytest.raises(TypeError):
+        model.typed[1] = ''
+    with pytest.raises(KeyError):
+        del model.typed[1]
+    assert model.changes == [
+        {'operation': '__setitem__', 'key': 1, 'olditem': 1, 'newitem': 2},
+        {'operation': '__setitem__', 'key': 2, 'newitem': 3},
+        {'operation': '__delitem__', 'key': 2, 'item': 3},
+        {'operation': 'setdefault', 'key': 3, 'item': 4},
+        {'operation': 'update', 'items': {4: 5}},
+        {'operation': 'pop', 'key': 4, 'item': 5},
+        {'operation': 'pop', 'key': 3, 'item': 4},
+        {'operation': 'popitem', 'key': 1, 'item': 2},
+        {'operation': '__setitem__', 'key': 1, 'newitem': 2},
+        {'operation': 'clear', 'items': {1: 2}},
+    ]
+    assert model.typed == {}
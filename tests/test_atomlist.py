@@ -9,13 +9,14 @@ from __future__ import (division, unicode_literals, print_function,
                         absolute_import)
 
 import gc
+from array import array
 from sys import version_info
 from pickle import dumps, loads
 from functools import wraps
 
 import pytest
-from atom.api import (Atom, List, Int, ContainerList, Value, atomlist,
-                      atomclist, atomref)
+from atom.api import (Atom, List, Int, Float, Bool, Range, FloatRange,
+                      ContainerList, Value, atomlist, atomclist, atomref)
 
 
 class StandardModel(Atom):
@@ -424,6 +425,32 @@ class TestStandardList(ListTestBase):
         with pytest.raises(TypeError):
             self.model.typed.extend([1, 2, 3, 'four'])
 
+    def test_typed_bad_extend_rollback(self):
+        self.model.typed = list(range(3))
+        with pytest.raises(TypeError):
+            self.model.typed.extend(i if i < 5 else 'bad' for i in range(10))
+        assert self.model.typed == list(range(3))
+
+    def test_typed_extend_iterable(self):
+        self.model.typed = list(range(3))
+        self.model.typed.extend(i for i in range(3, 10))
+        assert self.model.typed == list(range(10))
+        self.model.typed.extend(iter(range(10, 12)))
+        self.model.typed.extend((12, 13))
+        assert self.model.typed == list(range(14))
+        self.model.typed.extend(self.model.typed)
+        assert self.model.typed == list(range(14)) * 2
+
+    def test_typed_extend_buffer(self):
+        self.model.typed = list(range(3))
+        self.model.typed.extend(array('i', range(3, 6)))
+        assert self.model.typed == list(range(6))
+        self.model.typed[1:3] = array('h', [10, 11])
+        assert self.model.typed == [0, 10, 11, 3, 4, 5]
+        with pytest.raises(TypeError):
+            self.model.typed.extend(array('d', [1.0]))
+        assert self.model.typed == [0, 10, 11, 3, 4, 5]
+
     def test_typed_bad_insert(self):
         self.model.typed = list(range(10))
         with pytest.raises(TypeError):
@@ -448,6 +475,14 @@ class TestStandardList(ListTestBase):
         self.model.typed = list(range(10))
         with pytest.raises(TypeError):
             self.model.typed += [12, 14, 'bad']
+        assert self.model.typed == list(range(10))
+
+    def test_typed_set_slice_iterable(self):
+        self.model.typed = list(range(5))
+        self.model.typed[1:3] = (i for i in range(10, 13))
+        assert self.model.typed == [0, 10, 11, 12, 3, 4]
+        with pytest.raises(TypeError):
+            self.model.typed[1:3] = 1
 
 
 class TestContainerList(TestStandardList):
@@ -523,6 +558,18 @@ def test_container_extend(container_model, kind):
         assert change['items'] == list(range(3))
 
 
+@pytest.mark.parametrize("kind", ('untyped', 'typed'))
+def test_container_extend_iterable(container_model, kind):
+    mlist = getattr(container_model, kind)
+    mlist.extend(i for i in range(3))
+    verify_base_change(container_model, kind)
+    if kind == 'typed':
+        for change in (container_model.change,
+                       container_model.get_static_change(kind)):
+            assert change['operation'] == 'extend'
+            assert change['items'] == list(range(3))
+
+
 @pytest.mark.parametrize("kind", ('untyped', 'typed'))
 def test_container_remove(container_model, kind):
     mlist = getattr(container_model, kind)
@@ -676,3 +723,147 @@ def test_container_repeat(container_model, kind):
                    container_model.get_static_change(kind)):
         assert change['operation'] == '__imul__'
         assert change['count'] == 2
+
+
+@pytest.mark.parametrize("kind", ('untyped', 'typed'))
+def test_container_batch(container_model, kind):
+    mlist = getattr(container_model, kind)
+    counter = Counter()
+    container_model.observe(kind, counter)
+    with mlist.batch() as batched:
+        assert batched is mlist
+        for i in range(100):
+            mlist.append(i)
+        mlist[1] = 42
+        del mlist[3]
+    container_model.unobserve(kind, counter)
+    assert counter.count == 1
+    verify_base_change(container_model, kind)
+    for change in (container_model.change,
+                   container_model.get_static_change(kind)):
+        assert change['operation'] == 'batch'
+        assert change['index'] == 1
+        assert change['removed'] == list(range(1, 10))
+        assert change['inserted'] == [42, 2] + list(range(4, 10)) + list(range(100))
+
+
+@pytest.mark.parametrize("kind", ('untyped', 'typed'))
+def test_container_batch_splice(container_model, kind):
+    """Applying the batched splice to the old content gives the new one.
+
+    """
+    mlist = getattr(container_model, kind)
+    old = list(mlist)
+    with mlist.batch():
+        with mlist.batch():
+            mlist.insert(5, 1)
+            mlist.pop(7)
+        mlist.sort(reverse=True)
+        mlist.sort()
+    change = container_model.change
+    start = change['index']
+    assert old[start:start + len(change['removed'])] == change['removed']
+    old[start:start + len(change['removed'])] = change['inserted']
+    assert old == mlist
+
+
+def test_container_batch_no_change(container_model):
+    container_model.change = None
+    with container_model.typed.batch():
+        container_model.typed.append(1)
+        container_model.typed.pop()
+    assert container_model.change is None
+    with pytest.raises(ValueError):
+        with container_model.typed.batch():
+            container_model.typed.append(1)
+            raise ValueError()
+    assert container_model.change['inserted'] == [1]
+    batch = container_model.typed.batch()
+    with pytest.raises(RuntimeError):
+        batch.__exit__(None, None, None)
+    with batch:
+        with pytest.raises(RuntimeError):
+            batch.__enter__()
+    container_model.typed.append(2)
+    assert container_model.change['operation'] == 'append'
+
+
+class Counter(object):
+    """ An observer counting the notifications it receives.
+
+    """
+    def __init__(self):
+        self.count = 0
+
+    def __call__(self, change):
+        self.count += 1
+
+
+class NumericModel(Atom):
+    """ A model class for testing the validation of numeric buffers.
+
+    """
+    floats = List(Float())
+
+    promoted_floats = List(Float(strict=False))
+
+    ints = List(Int())
+
+    promoted_ints = List(Int(strict=False))
+
+    bools = List(Bool())
+
+    ranged = List(Range(0, 10))
+
+    float_ranged = List(FloatRange(0.0, 1.0))
+
+
+NUMERIC_BUFFERS = [array('d', [0.0, 0.5, 1.0]),
+                   array('f', [0.25, 2.0]),
+                   array('i', [1, 5, -3]),
+                   array('B', [0, 1, 11]),
+                   array('b', [3, 4])]
+if version_info >= (3,):
+    NUMERIC_BUFFERS += [array('Q', [2**64 - 1]),
+                        array('q', [-2**63, 5]),
+                        memoryview(array('d', [0.1, 0.2, 0.3, 0.4]))[::2],
+                        memoryview(b'\x01\x00').cast('?'),
+                        b'\x02\x03']
+
+
+@pytest.mark.parametrize("buffer", NUMERIC_BUFFERS)
+@pytest.mark.parametrize("name", ('floats', 'promoted_floats', 'ints',
+                                  'promoted_ints', 'bools', 'ranged',
+                                  'float_ranged'))
+def test_numeric_buffer_extend(name, buffer):
+    """ Test that buffers are validated exactly like the equivalent list.
+
+    """
+    results = []
+    for data in (buffer, list(buffer)):
+        model = NumericModel()
+        mlist = getattr(model, name)
+        try:
+            mlist.extend(data)
+            result = [(type(item), item) for item in mlist]
+        except TypeError as e:
+            assert mlist == []
+            result = str(e)
+        results.append(result)
+    assert results[0] == results[1]
+
+
+@pytest.mark.skipif(version_info < (3,), reason='buffers are validated on Python 3 only')
+def test_numeric_buffer_boxing_failure():
+    """ Test that a buffer whose items cannot be boxed leaves the list intact.
+
+    """
+    model = NumericModel()
+    model.promoted_ints = [1]
+    data = array('d', [2.0, float('nan')])
+    with pytest.raises(ValueError):
+        model.promoted_ints.extend(data)
+    assert model.promoted_ints == [1]
+    with pytest.raises(ValueError):
+        model.promoted_ints[0:1] = data
+    assert model.promoted_ints == [1]
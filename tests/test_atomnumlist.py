@@ -0,0 +1,250 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2013-2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Test the numeric lists storing their items unboxed.
+
+"""
+from __future__ import (division, unicode_literals, print_function,
+                        absolute_import)
+
+from array import array
+from sys import version_info
+from pickle import dumps, loads
+
+import pytest
+from atom.api import (Atom, Bool, ContainerList, ContainerNumericList, Float,
+                      Int, List, NumericList, Range, Str, Value, atomnumlist,
+                      atomnumclist)
+from atom.catom import PostValidate
+
+
+class NumericModel(Atom):
+    """ A model class for testing atomnumlist behavior.
+
+    """
+    floats = NumericList(Float())
+
+    ints = NumericList(Int())
+
+    bools = NumericList(Bool())
+
+    ranged = NumericList(Range(0, 10))
+
+
+class ContainerModel(Atom):
+    """ A model class for comparing atomnumclist and atomclist notifications.
+
+    """
+    numeric = ContainerNumericList(Int())
+
+    reference = ContainerList(Int())
+
+    changes = Value(factory=dict)
+
+    def _changed(self, change):
+        self.changes.setdefault(change['name'], []).append(
+            {k: v for k, v in change.items()
+             if k not in ('name', 'value', 'object')})
+
+
+def test_list_types():
+    model = NumericModel()
+    assert type(model.floats) is atomnumlist
+    assert type(ContainerModel().numeric) is atomnumclist
+
+
+def test_bad_item_member():
+    with pytest.raises(TypeError):
+        NumericList(Str())
+    with pytest.raises(TypeError):
+        NumericList(List())
+
+
+def test_assign_and_read():
+    model = NumericModel()
+    model.floats = [1.0, 2.5, 3.0]
+    assert model.floats == [1.0, 2.5, 3.0]
+    assert model.floats[1] == 2.5
+    assert model.floats[-1] == 3.0
+    assert model.floats[::-1] == [3.0, 2.5, 1.0]
+    assert len(model.floats) == 3
+    assert list(model.floats) == [1.0, 2.5, 3.0]
+    assert 2.5 in model.floats
+    model.ints = array('i', range(5))
+    assert model.ints == list(range(5))
+    assert all(type(i) is int for i in model.ints)
+    model.bools = [True, False]
+    assert model.bools == [True, False]
+    assert model.bools[0] is True
+
+
+def test_validation():
+    model = NumericModel()
+    with pytest.raises(TypeError):
+        model.ints = [1, 2.0]
+    with pytest.raises(TypeError):
+        model.ints = 1
+    model.ranged = [1, 2]
+    with pytest.raises(TypeError):
+        model.ranged.append(11)
+    with pytest.raises(TypeError):
+        model.ranged.extend(array('i', [1, 11]))
+    with pytest.raises(TypeError):
+        model.ranged[0] = -1
+    assert model.ranged == [1, 2]
+    with pytest.raises(OverflowError):
+        model.ints.append(2**64)
+
+
+def test_setitem_shrinking_validator():
+    """ Test assigning an item while the validator empties the list.
+
+    """
+    item = Float()
+    item.set_post_validate_mode(PostValidate.ObjectMethod_OldNew, '_shrink')
+
+    class ShrinkingModel(Atom):
+        floats = NumericList(item)
+
+        def _shrink(self, old, new):
+            del self.floats[:]
+            return new
+
+    model = ShrinkingModel(floats=[])
+    model.floats.extend(array('d', range(40)))
+    with pytest.raises(IndexError):
+        model.floats[3] = 5.0
+    assert model.floats == []
+
+
+@pytest.mark.parametrize("operation", [
+    lambda l: l.append(3),
+    lambda l: l.insert(-2, 7),
+    lambda l: l.insert(100, 7),
+    lambda l: l.extend((i for i in range(3))),
+    lambda l: l.extend(array('b', [1, 2])),
+    lambda l: l.pop(),
+    lambda l: l.pop(1),
+    lambda l: l.remove(2),
+    lambda l: l.reverse(),
+    lambda l: l.sort(),
+    lambda l: l.sort(reverse=True),
+    lambda l: l.sort(key=lambda i: -i),
+    lambda l: l.__iadd__([8, 9]),
+    lambda l: l.__imul__(3),
+    lambda l: l.__imul__(0),
+    lambda l: l.__setitem__(1, 5),
+    lambda l: l.__setitem__(slice(1, 3), [5, 6, 7]),
+    lambda l: l.__setitem__(slice(None, None, 2), [5, 6, 7]),
+    lambda l: l.__setitem__(slice(None, None, -2), [5, 6, 7]),
+    lambda l: l.__delitem__(-1),
+    lambda l: l.__delitem__(slice(1, 4)),
+    lambda l: l.__delitem__(slice(None, None, 2)),
+    lambda l: l.__delitem__(slice(None, None, -3)),
+])
+def test_operations_match_list(operation):
+    model = NumericModel()
+    reference = [3, 1, 2, 5, 2]
+    model.ints = reference
+    operation(model.ints)
+    operation(reference)
+    assert model.ints == reference
+
+
+def test_query_methods():
+    model = NumericModel()
+    model.ints = [3, 1, 2, 1]
+    assert model.ints.index(1) == 1
+    assert model.ints.index(1, 2) == 3
+    assert model.ints.count(1) == 2
+    with pytest.raises(ValueError) as excinfo:
+        model.ints.index(4)
+    assert '4 is not in list' in str(excinfo.value)
+    with pytest.raises(ValueError):
+        model.ints.remove(4)
+    with pytest.raises(IndexError):
+        model.ints[4]
+    with pytest.raises(IndexError):
+        model.ints.pop(4)
+    with pytest.raises(ValueError):
+        model.ints[::2] = [1]
+
+
+@pytest.mark.skipif(version_info < (3,), reason='memoryview formats are Python 3 only')
+def test_buffer_export():
+    model = NumericModel()
+    model.floats = [1.0, 2.0]
+    view = memoryview(model.floats)
+    assert view.format == 'd'
+    assert view.readonly
+    assert view.tolist() == [1.0, 2.0]
+    model.floats[0] = 5.0
+    assert view[0] == 5.0
+    with pytest.raises(BufferError):
+        model.floats.append(3.0)
+    view.release()
+    model.floats.append(3.0)
+    assert memoryview(model.ints).format == 'q'
+    assert memoryview(model.bools).format == '?'
+
+
+def test_pickle():
+    model = NumericModel()
+    model.floats = [1.0, 2.0]
+    data = loads(dumps(model.floats))
+    assert type(data) is list
+    assert data == [1.0, 2.0]
+
+
+def test_sizeof():
+    model = NumericModel()
+    model.floats = [0.0] * 1000
+    assert model.floats.__sizeof__() < 1000 * 16
+
+
+def test_container_notifications():
+    model = ContainerModel()
+    for name in ('numeric', 'reference'):
+        model.observe(name, model._changed)
+        setattr(model, name, [3, 1, 2, 5])
+        mlist = getattr(model, name)
+        mlist.append(4)
+        mlist.insert(-1, 4)
+        mlist.extend([6, 7])
+        mlist.pop()
+        mlist.pop(0)
+        mlist.remove(4)
+        mlist.reverse()
+        mlist.sort(reverse=True)
+        mlist += [8]
+        mlist *= 2
+        mlist[0] = 9
+        mlist[1:3] = [1, 2]
+        del mlist[0]
+        del mlist[1:2]
+    assert model.numeric == model.reference
+    assert model.changes['numeric'] == model.changes['reference']
+
+
+def test_container_batch():
+    model = ContainerModel()
+    for name in ('numeric', 'reference'):
+        model.observe(name, model._changed)
+        setattr(model, name, [3, 1, 2, 5])
+        mlist = getattr(model, name)
+        with mlist.batch():
+            mlist.append(4)
+            mlist[0] = 3
+            mlist.insert(1, 8)
+            mlist.sort()
+            del mlist[-1]
+        with mlist.batch():
+            mlist.append(1)
+            mlist.pop()
+    assert model.numeric == model.reference
+    assert model.changes['numeric'] == model.changes['reference']
+    assert model.changes['numeric'][-1]['operation'] == 'batch'
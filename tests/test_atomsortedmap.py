@@ -0,0 +1,220 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Test the typed sortedmap.
+
+"""
+import gc
+import pickle
+import pytest
+
+from atom.api import (Atom, ContainerSortedMap, Int, List, SortedMap,
+                      atomcsortedmap, atomsortedmap)
+from atom.datastructures.sortedmap import sortedmap
+
+
+@pytest.fixture
+def atom_map():
+    """Atom with different SortedMap members.
+
+    """
+    class MapAtom(Atom):
+        untyped = SortedMap()
+        keytyped = SortedMap(Int())
+        valuetyped = SortedMap(value=Int())
+        fullytyped = SortedMap(Int(), Int())
+        defaulted = SortedMap(Int(), Int(), default={2: 3, 1: 2})
+
+    return MapAtom()
+
+
+@pytest.mark.parametrize('member',
+                         ['untyped', 'keytyped', 'valuetyped', 'fullytyped'])
+def test_assignment(atom_map, member):
+    """Test assigning a dict or a sortedmap to the member.
+
+    """
+    d = {i: i**2 for i in range(10, 0, -1)}
+    setattr(atom_map, member, d)
+    assert list(getattr(atom_map, member).items()) == sorted(d.items())
+    setattr(atom_map, member, sortedmap(d))
+    assert list(getattr(atom_map, member).items()) == sorted(d.items())
+    with pytest.raises(TypeError):
+        setattr(atom_map, member, [(1, 2)])
+
+
+def test_map_types(atom_map):
+    """Test the type of the stored map and of the maps derived from it.
+
+    """
+    assert type(atom_map.fullytyped) is atomsortedmap
+    assert atom_map.fullytyped is atom_map.fullytyped
+    assert list(atom_map.defaulted.items()) == [(1, 2), (2, 3)]
+    assert type(atom_map.defaulted.copy()) is sortedmap
+    assert type(atom_map.defaulted[1:]) is sortedmap
+    assert type(atom_map.defaulted | {4: 5}) is sortedmap
+    assert type(ContainerModel().typed) is atomcsortedmap
+    with pytest.raises(TypeError):
+        atom_map.fullytyped = {'': 1}
+
+
+def test_key_function(atom_map):
+    """Test that a keyed sortedmap keeps its order once validated.
+
+    """
+    atom_map.fullytyped = sortedmap({1: 1, 2: 2, -3: 3}, key=abs)
+    assert atom_map.fullytyped.key is abs
+    assert list(atom_map.fullytyped) == [1, 2, -3]
+    atom_map.fullytyped[-4] = 4
+    assert list(atom_map.fullytyped) == [1, 2, -3, -4]
+    atom_map.fullytyped = {2: 2, 1: 1}
+    assert atom_map.fullytyped.key is None
+
+    class KeyedDefault(Atom):
+        keyed = SortedMap(Int(), default=sortedmap({2: 0, -1: 0}, key=abs))
+
+    a, b = KeyedDefault(), KeyedDefault()
+    assert list(a.keyed) == [-1, 2]
+    assert a.keyed.key is abs
+    a.keyed[-3] = 0
+    assert list(b.keyed) == [-1, 2]
+
+
+def test_setitem(atom_map):
+    """Test setting items.
+
+    """
+    atom_map.untyped[''] = 1
+
+    atom_map.keytyped[1] = ''
+    with pytest.raises(TypeError):
+        atom_map.keytyped[''] = 1
+
+    atom_map.valuetyped[1] = 1
+    with pytest.raises(TypeError):
+        atom_map.valuetyped[''] = ''
+
+    atom_map.fullytyped[1] = 1
+    with pytest.raises(TypeError):
+        atom_map.fullytyped[''] = 1
+    with pytest.raises(TypeError):
+        atom_map.fullytyped[1] = ''
+    with pytest.raises(TypeError):
+        atom_map.fullytyped[1:] = 1
+    assert list(atom_map.fullytyped.items()) == [(1, 1)]
+
+
+def test_update(atom_map):
+    """Test update validation.
+
+    """
+    atom_map.fullytyped.update({3: 4})
+    atom_map.fullytyped.update([(1, 2)])
+    with pytest.raises(TypeError):
+        atom_map.fullytyped.update({5: 6, 7: ''})
+    with pytest.raises(TypeError):
+        atom_map.fullytyped.update(a=1)
+    assert list(atom_map.fullytyped.items()) == [(1, 2), (3, 4)]
+    atom_map.untyped.update({'b': 2}, a=3)
+    assert list(atom_map.untyped.items()) == [('a', 3), ('b', 2)]
+
+
+def test_merge(atom_map):
+    """Test merge and |= validation, including the values resolved by a
+    callable policy.
+
+    """
+    atom_map.fullytyped = {1: 2}
+    atom_map.fullytyped.merge({1: 3, 2: 4}, lambda k, old, new: old + new)
+    atom_map.fullytyped |= {3: 6}
+    assert list(atom_map.fullytyped.items()) == [(1, 5), (2, 4), (3, 6)]
+    with pytest.raises(TypeError):
+        atom_map.fullytyped.merge({1: 3}, lambda k, old, new: '')
+    with pytest.raises(TypeError):
+        atom_map.fullytyped.merge({'': 3})
+    with pytest.raises(TypeError):
+        atom_map.fullytyped |= {4: ''}
+    with pytest.raises(ValueError):
+        atom_map.fullytyped.merge({4: 4}, 'unknown')
+    assert list(atom_map.fullytyped.items()) == [(1, 5), (2, 4), (3, 6)]
+
+
+def test_pickle(atom_map):
+    """Test pickling the map alone.
+
+    """
+    atom_map.fullytyped = {2: 3, 1: 2}
+    data = pickle.loads(pickle.dumps(atom_map.fullytyped))
+    assert type(data) is sortedmap
+    assert list(data.items()) == [(1, 2), (2, 3)]
+
+
+def test_owner_released():
+    """Test that the map stops validating once its owner is gone.
+
+    """
+    m = ContainerModel().typed
+    gc.collect()
+    m[''] = ''
+    assert list(m.items()) == [('', '')]
+
+
+class ContainerModel(Atom):
+    """A model with a container sortedmap recording its notifications.
+
+    """
+    typed = ContainerSortedMap(Int(), Int())
+
+    changes = List()
+
+    def _changed(self, change):
+        self.changes.append({k: (list(v.items()) if k == 'items' else v)
+                             for k, v in change.items()
+                             if k not in ('name', 'value', 'object', 'type')})
+
+
+def test_container_notifications():
+    """Test the notifications emitted by a container sortedmap.
+
+    """
+    model = ContainerModel()
+    model.typed = {1: 1}
+    model.observe('typed', model._changed)
+    model.typed[1] = 2
+    model.typed[0] = 3
+    del model.typed[0]
+    model.typed.update({4: 5, 3: 4})
+    model.typed.merge({1: 7}, 'keep')
+    model.typed |= {6: 7}
+    model.typed.pop(4)
+    model.typed.pop(4, None)
+    model.typed.popitem(0)
+    model.typed.update({})
+    del model.typed[:4]
+    del model.typed[10:]
+    model.typed.clear()
+    model.typed.clear()
+    with pytest.raises(TypeError):
+        model.typed[1] = ''
+    with pytest.raises(KeyError):
+        del model.typed[1]
+    with pytest.raises(KeyError):
+        model.typed.pop(1)
+    assert model.changes == [
+        {'operation': '__setitem__', 'key': 1, 'olditem': 1, 'newitem': 2,
+         'index': 0},
+        {'operation': '__setitem__', 'key': 0, 'newitem': 3, 'index': 0},
+        {'operation': '__delitem__', 'key': 0, 'item': 3, 'index': 0},
+        {'operation': 'update', 'items': [(3, 4), (4, 5)], 'range': (3, 4)},
+        {'operation': 'merge', 'items': [(1, 7)], 'range': (1, 1)},
+        {'operation': '__ior__', 'items': [(6, 7)], 'range': (6, 6)},
+        {'operation': 'pop', 'key': 4, 'item': 5, 'index': 2},
+        {'operation': 'popitem', 'key': 1, 'item': 2, 'index': 0},
+        {'operation': '__delitem__', 'items': [(3, 4)], 'range': (3, 3)},
+        {'operation': 'clear', 'items': [(6, 7)], 'range': (6, 6)},
+    ]
+    assert len(model.typed) == 0
@@ -0,0 +1,138 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Test the binary change trace.
+
+"""
+import pytest
+
+from atom.api import Atom, ContainerList, Event, Int, Value
+from atom.catom import disable_trace, dump_trace, enable_trace
+from atom.changetrace import dump, load, read
+
+
+class TraceModel(Atom):
+    """Model exercising every kind of recorded change.
+
+    """
+    x = Int()
+
+    v = Value()
+
+    e = Event()
+
+    l = ContainerList()
+
+
+@pytest.fixture
+def tracing():
+    """Disable tracing after a test.
+
+    """
+    yield
+    disable_trace()
+
+
+def test_record_kinds(tracing):
+    """Test that each kind of change is recorded.
+
+    """
+    m = TraceModel()
+    m.observe('l', lambda change: None)
+    enable_trace()
+    m.x = 1
+    m.x = 2
+    m.e = 3
+    del m.x
+    m.v
+    m.l.append(1)
+    disable_trace()
+    m.x = 4
+
+    written, records = load(dump_trace())
+    assert written == len(records)
+    kinds = [(r.kind, r.member) for r in records]
+    assert kinds == [('create', TraceModel.x.index),
+                     ('update', TraceModel.x.index),
+                     ('event', TraceModel.e.index),
+                     ('delete', TraceModel.x.index),
+                     ('create', TraceModel.v.index),
+                     ('create', TraceModel.l.index),
+                     ('container', TraceModel.l.index)]
+    assert all(r.atom == id(m) for r in records)
+    assert all(r.oldhash == r.newhash == 0 for r in records)
+    timestamps = [r.timestamp for r in records]
+    assert timestamps == sorted(timestamps)
+
+
+def test_unchanged_values_are_not_recorded(tracing):
+    """Test that setting the same object does not record anything.
+
+    """
+    m = TraceModel(v=None)
+    enable_trace()
+    m.v = None
+    with m.suppress_notifications():
+        m.v = 1
+    assert load(dump_trace()) == (0, [])
+
+
+def test_hashes(tracing):
+    """Test hashing the old and new values.
+
+    """
+    m = TraceModel()
+    enable_trace(hashes=True)
+    m.v = 'a'
+    m.v = 'b'
+    m.v = []
+    _, records = load(dump_trace())
+    assert [(r.oldhash, r.newhash) for r in records[1:]] == [
+        (hash('a'), hash('b')), (hash('b'), id(m.v))
+    ]
+
+
+def test_ring_buffer(tracing):
+    """Test that the oldest records are overwritten.
+
+    """
+    m = TraceModel()
+    enable_trace(3)
+    for i in range(10):
+        m.x = i + 1
+    written, records = load(dump_trace())
+    assert written == 10
+    assert len(records) == 4
+
+    # Enabling again discards the records.
+    enable_trace(1)
+    assert load(dump_trace()) == (0, [])
+
+
+def test_bad_capacity():
+    """Test that the capacity must be positive.
+
+    """
+    with pytest.raises(ValueError):
+        enable_trace(0)
+
+
+def test_read_and_write(tracing, tmpdir):
+    """Test writing the trace to a file and reading it back.
+
+    """
+    m = TraceModel()
+    enable_trace()
+    m.x = 1
+    path = str(tmpdir.join('trace.bin'))
+    dump(path)
+    assert read(path) == load(dump_trace())
+
+    with pytest.raises(ValueError):
+        load(b'NOTATRACE' + dump_trace()[9:])
+    with pytest.raises(ValueError):
+        load(dump_trace()[:-1])
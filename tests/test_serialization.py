@@ -0,0 +1,196 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Test the binary serialization of atoms.
+
+"""
+from collections import OrderedDict, namedtuple
+
+import pytest
+
+from atom.api import (Atom, Bool, ContainerList, Dict, Float, Int, NumericList,
+                      SortedMap, Str, Typed, Value)
+from atom.catom import deserialize, serialize, set_trusted_unpickling
+from atom.datastructures.api import sortedmap
+
+
+class Point(Atom):
+    """Leaf of the serialized graphs.
+
+    """
+    x = Float()
+
+    y = Int()
+
+    name = Str()
+
+
+class Shape(Atom):
+    """Atom holding every kind of serialized value.
+
+    """
+    points = ContainerList(Typed(Point))
+
+    meta = Dict(Str(), Value())
+
+    numbers = NumericList(Float())
+
+    flags = NumericList(Bool())
+
+    index = SortedMap(Int(), Str())
+
+    parent = Value()
+
+    v = Value()
+
+
+class Renamed(Atom):
+    """Atom standing for Point with a different set of members.
+
+    """
+    name = Str()
+
+    z = Int()
+
+
+class Strict(Atom):
+    """Atom standing for Shape with a stricter member.
+
+    """
+    v = Int()
+
+
+def test_round_trip():
+    """Test serializing and deserializing a graph of atoms.
+
+    """
+    p = Point(x=1.5, y=-3, name='p')
+    s = Shape(points=[p, Point(y=2)], meta={'a': (1, None, True)},
+              numbers=[1.0, 2.5], flags=[True, False], index={2: 'b', 1: 'a'},
+              v=[1 << 80, -(1 << 70), b'raw', u'\xe9', 2.0])
+    s.parent = s
+    s.meta['p'] = p
+
+    loaded = deserialize(serialize(s))
+    assert type(loaded) is Shape
+    assert loaded.parent is loaded
+    assert [(q.x, q.y, q.name) for q in loaded.points] == [(1.5, -3, 'p'),
+                                                          (0.0, 2, '')]
+    assert loaded.meta['p'] is loaded.points[0]
+    assert loaded.meta['a'] == (1, None, True)
+    assert list(loaded.numbers) == [1.0, 2.5]
+    assert list(loaded.flags) == [True, False]
+    assert list(loaded.index.items()) == [(1, 'a'), (2, 'b')]
+    assert loaded.v == [1 << 80, -(1 << 70), b'raw', u'\xe9', 2.0]
+
+    # The containers are validated and bound to the loaded atoms.
+    with pytest.raises(TypeError):
+        loaded.points.append(1)
+
+    # Unset members are not written and stay lazy.
+    point = deserialize(serialize(Point(y=1)))
+    assert point.get_member('x').get_slot(point) is None
+
+    assert deserialize(serialize([1, u'a', None])) == [1, u'a', None]
+    assert type(deserialize(serialize(sortedmap({1: 2})))) is sortedmap
+
+
+class Extra(Atom):
+    """Atom storing attributes outside of its members.
+
+    """
+    __slots__ = ('s', 't', '__dict__')
+
+    i = Int()
+
+
+class Overridden(Extra):
+    """Atom whose Python slot is hidden by a property.
+
+    """
+    s = property(lambda self: 1)
+
+
+def test_python_state():
+    """Test serializing the Python slots and the instance dict of atoms.
+
+    """
+    e = Extra(i=1)
+    e.s = e
+    e.x = [e]
+    loaded = deserialize(serialize(e))
+    assert loaded.i == 1
+    assert loaded.s is loaded
+    assert loaded.x == [loaded]
+    assert not hasattr(loaded, 't')
+
+    with pytest.raises(TypeError):
+        serialize(Overridden())
+
+
+def test_validation():
+    """Test that the members validate the values unless trusted.
+
+    """
+    data = serialize(Shape(v='a'))
+    classes = {Shape.__module__ + '.Shape': Strict}
+    with pytest.raises(TypeError):
+        deserialize(data, classes)
+
+    old = set_trusted_unpickling(True)
+    try:
+        assert deserialize(data, classes).v == 'a'
+    finally:
+        set_trusted_unpickling(old)
+
+
+def test_class_mapping():
+    """Test mapping the classes and skipping the unknown members.
+
+    """
+    data = serialize(Renamed(name='a', z=1))
+    point = deserialize(data, {Renamed.__module__ + '.Renamed': Point})
+    assert type(point) is Point
+    assert point.name == 'a'
+    assert point.get_member('y').get_slot(point) is None
+
+
+def test_errors():
+    """Test the invalid values and data.
+
+    """
+    with pytest.raises(TypeError):
+        serialize(object())
+    with pytest.raises(TypeError):
+        serialize(1j)
+
+    # The subclasses of the builtin types would lose their type.
+    class Number(int):
+        pass
+
+    for subclass in (Number(1), namedtuple('Pair', 'a b')(1, 2),
+                     OrderedDict(a=1), [Number(1)]):
+        with pytest.raises(TypeError):
+            serialize(subclass)
+
+    # The key function of a sortedmap would be lost.
+    with pytest.raises(TypeError):
+        serialize(sortedmap({3: 0, 2: 0, 1: 0}, key=lambda k: -k))
+    with pytest.raises(TypeError):
+        serialize(Shape(index=sortedmap({1: 'a'}, key=abs)))
+    l = []
+    l.append(l)
+    with pytest.raises(RuntimeError):
+        serialize(l)
+
+    data = serialize(Point(x=1.0))
+    for invalid in (b'', b'NOTATOM\x01\x00', data[:7] + b'\x02' + data[8:],
+                    data[:-1], data + b'\x00', data[:8] + b'\x7f'):
+        with pytest.raises(ValueError):
+            deserialize(invalid)
+    with pytest.raises(TypeError):
+        deserialize(data, {Point.__module__ + '.Point': object})
@@ -0,0 +1,149 @@
+#------------------------------------------------------------------------------
+# Copyright (c) 2019, Nucleic Development Team.
+#
+# Distributed under the terms of the Modified BSD License.
+#
+# The full license is in the file COPYING.txt, distributed with this software.
+#------------------------------------------------------------------------------
+"""Test the per member counters.
+
+"""
+import pytest
+
+from atom.api import Atom, Int, List, Value, observe
+from atom.catom import (disable_stats, enable_stats, observer_stats, reset_stats,
+                        set_slow_notification_hook, stats)
+
+
+class StatsModel(Atom):
+    """Model whose observer of x sets y.
+
+    """
+    x = Int()
+
+    y = Value()
+
+    l = List(Int())
+
+    @observe('x')
+    def _observe_x(self, change):
+        self.y = change['value']
+
+
+@pytest.fixture
+def recording():
+    """Reset the counters around a test.
+
+    """
+    reset_stats()
+    yield
+    disable_stats()
+    reset_stats()
+
+
+def counters(cls, name):
+    """The non zero counters of a member.
+
+    """
+    return {k: v for k, v in stats()[(cls, name)].items() if v}
+
+
+def test_counting(recording):
+    """Test counting the operations of each member.
+
+    """
+    model = StatsModel()
+    model.observe('y', lambda change: None)
+    enable_stats()
+    model.x = 1
+    model.x
+    model.l
+    disable_stats()
+    model.x = 2
+    assert counters(StatsModel, 'x') == {'getattr': 1, 'setattr': 1,
+                                         'validate': 1, 'notify': 1,
+                                         'observer_calls': 1}
+    assert counters(StatsModel, 'y') == {'setattr': 1, 'notify': 1,
+                                         'observer_calls': 1}
+    assert counters(StatsModel, 'l') == {'getattr': 1, 'validate': 1,
+                                         'default_value': 1}
+    reset_stats()
+    assert stats() == {}
+
+
+def test_timing(recording):
+    """Test accumulating the duration of the operations.
+
+    """
+    model = StatsModel()
+    enable_stats(timing=True)
+    for i in range(10):
+        model.x = i
+    recorded = stats()[(StatsModel, 'x')]
+    assert recorded['setattr'] == 10
+    assert recorded['setattr_ns'] > 0
+    assert recorded['setattr_ns'] >= recorded['validate_ns']
+    assert recorded['getattr_ns'] == 0
+
+
+def test_dynamic_topics(recording):
+    """Test that the notifications of an arbitrary topic are recorded.
+
+    """
+    model = StatsModel()
+    model.observe('custom', lambda *args: None)
+    enable_stats()
+    model.notify('custom', 1)
+    assert counters(StatsModel, 'custom') == {'notify': 1,
+                                              'observer_calls': 1}
+
+
+def test_observer_histograms(recording):
+    """Test the latency histograms of the observers.
+
+    """
+    def dynamic(change):
+        pass
+
+    model = StatsModel()
+    model.observe('x', dynamic)
+    enable_stats(observers=True)
+    for i in range(1, 11):
+        model.x = i
+    recorded = observer_stats()
+    # Python 2 has no qualified names and reports the bare function names.
+    assert sorted(name.split('.')[-1] for name, _ in recorded) == [
+        '_observe_x', 'dynamic']
+    assert all(name.startswith(__name__) and topic == 'x'
+               for name, topic in recorded)
+    for summary in recorded.values():
+        assert summary['count'] == 10
+        assert 0 < summary['p50_ns'] <= summary['p99_ns'] <= summary['max_ns']
+        assert summary['max_ns'] <= summary['total_ns']
+    reset_stats()
+    assert observer_stats() == {}
+
+
+def test_slow_notification_hook(recording):
+    """Test reporting the notification rounds exceeding a budget.
+
+    """
+    model = StatsModel()
+    rounds = []
+
+    def hook(atom, topic, elapsed, observers):
+        rounds.append((atom, topic, elapsed, observers))
+
+    with pytest.raises(TypeError):
+        set_slow_notification_hook(1)
+    set_slow_notification_hook(hook, 0)
+    try:
+        model.x = 1
+    finally:
+        set_slow_notification_hook(None)
+    model.x = 2
+    assert [r[1] for r in rounds] == ['x']
+    atom, topic, elapsed, observers = rounds[0]
+    assert atom is model
+    assert [name.split('.')[-1] for name, _ in observers] == ['_observe_x']
+    assert elapsed >= observers[0][1] > 0